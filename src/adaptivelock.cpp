@@ -0,0 +1,225 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - AdaptiveLock Class Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#define VLDBUILD
+#include "adaptivelock.h"   // This class' header.
+
+#if defined(_WIN32)
+// WaitOnAddress and WakeByAddressSingle only exist from Windows 8 on, so they
+// are looked up when a lock is first initialized. Without them, parked threads
+// yield their processor until the lock is free.
+typedef BOOL (WINAPI *WaitOnAddress_t)(volatile VOID *address, PVOID compareaddress, SIZE_T size, DWORD milliseconds);
+typedef VOID (WINAPI *WakeByAddressSingle_t)(PVOID address);
+
+static WaitOnAddress_t       s_waitOnAddress = NULL;
+static WakeByAddressSingle_t s_wakeByAddressSingle = NULL;
+#endif
+
+// SpinPause - Tells the processor the calling thread is polling a lock, which
+//   lets the other hardware thread of the core run meanwhile.
+//
+//  Return Value:
+//
+//    None.
+//
+static inline VOID SpinPause ()
+{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// WaitForState - Parks the calling thread as long as a word still holds a
+//   value. The thread may also return spuriously.
+//
+//  - address (IN): The word to wait on.
+//
+//  - value (IN): The value the word held when the thread decided to park.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID WaitForState (std::atomic<UINT32> *address, UINT32 value)
+{
+#if defined(_WIN32)
+    if (s_waitOnAddress != NULL)
+        s_waitOnAddress(address, &value, sizeof(value), INFINITE);
+    else
+        SwitchToThread();
+#elif defined(__linux__)
+    syscall(SYS_futex, (UINT32*)address, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
+
+// WakeOneWaiter - Unparks one of the threads waiting on a word, if any.
+//
+//  - address (IN): The word the threads wait on.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID WakeOneWaiter (std::atomic<UINT32> *address)
+{
+#if defined(_WIN32)
+    if (s_wakeByAddressSingle != NULL)
+        s_wakeByAddressSingle(address);
+#elif defined(__linux__)
+    syscall(SYS_futex, (UINT32*)address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    UNREFERENCED_PARAMETER(address);
+#endif
+}
+
+// Initialize - Readies the lock for use. It is free, and its counters are
+//   zero.
+//
+//  - waitstat (IN): The STATS_* operation the waits are recorded as, or
+//      STATS_NONE.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID AdaptiveLock::Initialize (UINT waitstat)
+{
+    static_assert(sizeof(std::atomic<UINT32>) == sizeof(UINT32), "The lock's state must be waitable as a plain word.");
+
+    UINT32 processors;
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    processors = info.dwNumberOfProcessors;
+    if (s_waitOnAddress == NULL) {
+        HMODULE kernelBase = GetModuleHandleW(L"KernelBase.dll");
+        if (kernelBase != NULL) {
+            s_wakeByAddressSingle = (WakeByAddressSingle_t)GetProcAddress(kernelBase, "WakeByAddressSingle");
+            if (s_wakeByAddressSingle != NULL)
+                s_waitOnAddress = (WaitOnAddress_t)GetProcAddress(kernelBase, "WaitOnAddress");
+        }
+    }
+#else
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    processors = (online > 0) ? (UINT32)online : 1;
+#endif
+
+    m_state.store(LOCK_FREE, std::memory_order_relaxed);
+    m_owner.store(0, std::memory_order_relaxed);
+    m_depth = 0;
+    m_waitStat = waitstat;
+    m_spinMax = (processors > 1) ? LOCK_SPIN_MAX : 0;
+    m_spins.store(0, std::memory_order_relaxed);
+    m_acquisitions.store(0, std::memory_order_relaxed);
+    m_contended.store(0, std::memory_order_relaxed);
+    m_waitCycles.store(0, std::memory_order_relaxed);
+}
+
+// GetStats - Reads the counters of the lock. Acquisitions made meanwhile may
+//   be missed, or only partly counted.
+//
+//  - stats (OUT): Receives the counters.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID AdaptiveLock::GetStats (lockstats_t &stats) const
+{
+    stats.acquisitions = m_acquisitions.load(std::memory_order_relaxed);
+    stats.contended = m_contended.load(std::memory_order_relaxed);
+    stats.waitCycles = m_waitCycles.load(std::memory_order_relaxed);
+}
+
+// enterContended - Acquires the lock once it was found held by another
+//   thread: polls it while the holder is likely to leave soon, then parks
+//   until it is woken by Leave. Counts the wait.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID AdaptiveLock::enterContended ()
+{
+    UINT64 start = __rdtsc();
+
+    // Poll for up to twice the running average, as glibc does, so that the
+    // average can grow when the lock is held for longer.
+    UINT32 average = m_spins.load(std::memory_order_relaxed);
+    UINT32 limit = average * 2 + 10;
+    if (limit > m_spinMax)
+        limit = m_spinMax;
+    UINT32 spins = 0;
+    bool parked = true;
+    for (; spins < limit; spins++) {
+        SpinPause();
+        UINT32 state = m_state.load(std::memory_order_relaxed);
+        if ((state == LOCK_FREE) &&
+            m_state.compare_exchange_weak(state, LOCK_HELD, std::memory_order_acquire, std::memory_order_relaxed)) {
+            parked = false;
+            break;
+        }
+    }
+
+    if (parked) {
+        // Whoever holds the lock now must wake a thread when leaving it. The
+        // state stays contended once this thread acquires it, as other threads
+        // may still be parked.
+        while (m_state.exchange(LOCK_CONTENDED, std::memory_order_acquire) != LOCK_FREE)
+            WaitForState(&m_state, LOCK_CONTENDED);
+    }
+
+    // The lock is held: the counters can be updated without atomic operations.
+    if (m_spinMax != 0)
+        m_spins.store(average + ((LONG)(spins - average) / 8), std::memory_order_relaxed);
+    UINT64 waited = __rdtsc() - start;
+    m_contended.store(m_contended.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_waitCycles.store(m_waitCycles.load(std::memory_order_relaxed) + waited, std::memory_order_relaxed);
+    if (InternalStatsEnabled())
+        RecordStat(m_waitStat, waited);
+}
+
+// wake - Unparks one of the threads waiting for the lock. Called by Leave when
+//   threads may be parked.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID AdaptiveLock::wake ()
+{
+    WakeOneWaiter(&m_state);
+}
@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - AdaptiveLock Class Definition
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <atomic>
+#pragma pop_macro("new")
+#include "criticalsection.h"    // Provides CriticalSectionLocker, which also takes this lock.
+#include "internalstats.h"      // Provides the counters of VLD's own operations.
+#include "platform.h"           // Provides the Win32 types and the time stamp counter.
+
+#define LOCK_SPIN_MAX       100 // Most times a thread polls a held lock before parking.
+
+// States of an AdaptiveLock:
+#define LOCK_FREE           0   // Nobody holds the lock.
+#define LOCK_HELD           1   // A thread holds the lock, and no thread is parked.
+#define LOCK_CONTENDED      2   // A thread holds the lock, and threads may be parked.
+
+// The counters of an AdaptiveLock, as read at one point in time.
+struct lockstats_t
+{
+    UINT64 acquisitions;    // Number of times the lock was acquired, recursive entries left out.
+    UINT64 contended;       // Number of acquisitions which found the lock held by another thread.
+    UINT64 waitCycles;      // Time stamp counter ticks spent waiting in contended acquisitions.
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The AdaptiveLock Class
+//
+//    A recursive lock with the interface of CriticalSection, so that it can be
+//    used with CriticalSectionLocker, or as the lock policy of the Tree based
+//    containers. An uncontended acquisition is a single compare-and-swap. A
+//    thread finding the lock held polls it for a while, then parks in the
+//    system until the holder wakes it: with WaitOnAddress on Windows, and with
+//    a futex on Linux. Like glibc's adaptive mutexes, the number of polls
+//    follows a running average of what the previous acquisitions needed, and
+//    threads never poll on a single processor.
+//
+//    The lock counts its acquisitions, how many of them were contended, and
+//    how long they waited. The counters are only written by the thread holding
+//    the lock, so they don't add any atomic operation.
+//
+class AdaptiveLock
+{
+public:
+    // waitstat is the STATS_* operation the time spent entering the lock is
+    // recorded as, if the internal statistics are enabled.
+    void Initialize (UINT waitstat = STATS_NONE);
+    void Delete ()      { }
+
+    // enter the lock
+    void Enter ()
+    {
+        DWORD threadId = GetCurrentThreadId();
+        if (m_owner.load(std::memory_order_relaxed) == threadId) {
+            m_depth++;
+            return;
+        }
+        UINT32 state = LOCK_FREE;
+        if (m_state.compare_exchange_strong(state, LOCK_HELD, std::memory_order_acquire, std::memory_order_relaxed)) {
+            if (InternalStatsEnabled())
+                RecordStat(m_waitStat, 0);
+        }
+        else {
+            enterContended();
+        }
+        acquired(threadId);
+    }
+
+    bool IsLocked ()
+    {
+        return (m_owner.load(std::memory_order_relaxed) != 0);
+    }
+
+    bool IsLockedByCurrentThread ()
+    {
+        return (m_owner.load(std::memory_order_relaxed) == GetCurrentThreadId());
+    }
+
+    // try enter the lock
+    bool TryEnter ()
+    {
+        DWORD threadId = GetCurrentThreadId();
+        if (m_owner.load(std::memory_order_relaxed) == threadId) {
+            m_depth++;
+            return true;
+        }
+        UINT32 state = LOCK_FREE;
+        if (!m_state.compare_exchange_strong(state, LOCK_HELD, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        acquired(threadId);
+        return true;
+    }
+
+    // leave the lock
+    void Leave ()
+    {
+        if (--m_depth != 0)
+            return;
+        m_owner.store(0, std::memory_order_relaxed);
+        if (m_state.exchange(LOCK_FREE, std::memory_order_release) == LOCK_CONTENDED)
+            wake();
+    }
+
+    void GetStats (lockstats_t &stats) const;
+
+private:
+    // Records the calling thread as the owner, once it acquired the lock.
+    void acquired (DWORD threadId)
+    {
+        m_owner.store(threadId, std::memory_order_relaxed);
+        m_depth = 1;
+        m_acquisitions.store(m_acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void enterContended ();
+    void wake ();
+
+    std::atomic<UINT32> m_state;        // LOCK_FREE, LOCK_HELD or LOCK_CONTENDED. Waited on by parked threads.
+    std::atomic<DWORD>  m_owner;        // Thread holding the lock, or 0.
+    UINT                m_depth;        // Number of times the owner entered the lock.
+    UINT                m_waitStat;     // Operation the waits are recorded as, or STATS_NONE.
+    UINT32              m_spinMax;      // Most polls before parking: 0 on a single processor.
+    std::atomic<UINT32> m_spins;        // Running average of the polls contended acquisitions needed.
+    std::atomic<UINT64> m_acquisitions; // See lockstats_t. Only written while holding the lock.
+    std::atomic<UINT64> m_contended;
+    std::atomic<UINT64> m_waitCycles;
+};
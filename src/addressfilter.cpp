@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Address Filter
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD            // Declares that we are building Visual Leak Detector.
+#include "addressfilter.h"  // Provides the address filter.
+
+namespace {
+
+// Increments a counter, unless it is saturated.
+void increment (std::atomic<std::uint8_t> &counter)
+{
+    std::uint8_t value = counter.load(std::memory_order_relaxed);
+    if (value != ADDRESS_FILTER_SATURATED)
+        counter.store(value + 1, std::memory_order_relaxed);
+}
+
+// Decrements a counter, unless it is saturated.
+void decrement (std::atomic<std::uint8_t> &counter)
+{
+    std::uint8_t value = counter.load(std::memory_order_relaxed);
+    if ((value != 0) && (value != ADDRESS_FILTER_SATURATED))
+        counter.store(value - 1, std::memory_order_relaxed);
+}
+
+} // namespace
+
+// InitAddressFilter - Empties a filter.
+//
+//  - filter (OUT): Filter to initialize.
+//
+//  Return Value:
+//
+//    None.
+//
+void InitAddressFilter (addressfilter_t &filter)
+{
+    for (std::size_t slot = 0; slot < ADDRESS_FILTER_SLOTS; slot++)
+        filter.counters[slot].store(0, std::memory_order_relaxed);
+}
+
+// AddToAddressFilter - Adds an address to a filter. An address may be added
+//   several times, and must then be removed as many times.
+//
+//  - filter (IN/OUT): The filter.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    None.
+//
+void AddToAddressFilter (addressfilter_t &filter, const void *address)
+{
+    increment(filter.counters[AddressFilterSlot(address, ADDRESS_FILTER_HASH1)]);
+    increment(filter.counters[AddressFilterSlot(address, ADDRESS_FILTER_HASH2)]);
+}
+
+// RemoveFromAddressFilter - Removes an address previously added to a filter.
+//
+//  - filter (IN/OUT): The filter.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    None.
+//
+void RemoveFromAddressFilter (addressfilter_t &filter, const void *address)
+{
+    decrement(filter.counters[AddressFilterSlot(address, ADDRESS_FILTER_HASH1)]);
+    decrement(filter.counters[AddressFilterSlot(address, ADDRESS_FILTER_HASH2)]);
+}
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Address Filter Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define ADDRESS_FILTER_BITS     20  // Log2 of the number of counters (1 MB of them).
+#define ADDRESS_FILTER_SLOTS    (1 << ADDRESS_FILTER_BITS)
+#define ADDRESS_FILTER_SATURATED 255 // Counters reaching this value are never decremented again.
+#define ADDRESS_FILTER_HASH1    0x9E3779B97F4A7C15ull // Multiplier of the first hash function.
+#define ADDRESS_FILTER_HASH2    0xC2B2AE3D27D4EB4Full // Multiplier of the second hash function.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The addressfilter_t Structure
+//
+//    A counting Bloom filter of the addresses of the blocks VLD tracks. Each
+//    address is hashed to two byte counters, which are incremented when the
+//    block is tracked and decremented when it is freed. A block whose counters
+//    are not both set is certainly not tracked, which lets frees of blocks VLD
+//    never saw be rejected without taking any lock or looking up any map. The
+//    filter never rejects a tracked block; it only lets some untracked ones
+//    through, more of them as the number of live blocks grows. A counter which
+//    overflows stays saturated.
+//
+//    Adding and removing addresses must be serialized by the caller. Testing
+//    an address is lock-free and can be done by any thread at any time.
+//
+struct addressfilter_t
+{
+    std::atomic<std::uint8_t> counters [ADDRESS_FILTER_SLOTS];
+};
+
+// Address filter functions. See function definitions for details.
+void InitAddressFilter (addressfilter_t &filter);
+void AddToAddressFilter (addressfilter_t &filter, const void *address);
+void RemoveFromAddressFilter (addressfilter_t &filter, const void *address);
+
+// AddressFilterSlot - Finds one of the two counters of an address.
+//
+//  - address (IN): The address.
+//
+//  - multiplier (IN): Odd constant selecting the hash function.
+//
+//  Return Value:
+//
+//    Returns the index of the counter.
+//
+inline std::size_t AddressFilterSlot (const void *address, std::uint64_t multiplier)
+{
+    // Heap blocks are at least 8 byte aligned, so the low bits carry nothing.
+    std::uint64_t key = (std::uint64_t)(std::uintptr_t)address >> 3;
+    return (std::size_t)((key * multiplier) >> (64 - ADDRESS_FILTER_BITS));
+}
+
+// AddressFilterMayContain - Tests whether an address may have been added to
+//   the filter. Lock-free.
+//
+//  - filter (IN): The filter.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    Returns false if the address is certainly not in the filter, or true if
+//    it may be.
+//
+inline bool AddressFilterMayContain (const addressfilter_t &filter, const void *address)
+{
+    return (filter.counters[AddressFilterSlot(address, ADDRESS_FILTER_HASH1)].load(std::memory_order_relaxed) != 0) &&
+        (filter.counters[AddressFilterSlot(address, ADDRESS_FILTER_HASH2)].load(std::memory_order_relaxed) != 0);
+}
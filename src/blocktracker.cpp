@@ -0,0 +1,1200 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - BlockTracker Class Implementations
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD
+#include "blocktracker.h"   // This class' header.
+#include "internalstats.h"  // Provides the counters of VLD's own operations.
+#include "stackhash.h"      // Provides the leak hash.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+#define BLOCK_MAP_RESERVE   64  // This should strike a balance between memory use and a desire to minimize heap hits.
+#define BLOCK_MAP_RESERVE_LIMIT 4096 // Block maps of busy heaps grow in chunks of up to this many blocks.
+#define HEAP_MAP_RESERVE    2   // Usually there won't be more than a few heaps in the process, so this should be small.
+#define SNAPSHOT_BATCH      256 // Most blocks visited by takeSnapshot and classifyLeaks per hold of the lock.
+
+// Constructor - Initializes the tracker's maps and tables, with no heap mapped
+//   yet.
+//
+//  - lock (IN): The lock protecting the tracker. It must outlive the tracker.
+//
+//  - tracklifetimes (IN): If true, the lifetimes of freed blocks are recorded
+//      in lifetime histograms.
+//
+BlockTracker::BlockTracker (CriticalSection &lock, bool tracklifetimes)
+    : m_lock(lock)
+{
+    m_heapMap         = new HeapMap;
+    m_heapMap->reserve(HEAP_MAP_RESERVE);
+    m_blockFilter     = new addressfilter_t;
+    InitAddressFilter(*m_blockFilter);
+    m_stackTable      = new StackTable(tracklifetimes);
+    m_threadReportedSerials = new ThreadSerialMap;
+    m_requestCurr     = 1;
+    m_reportedSerial  = 0;
+    m_totalAlloc      = 0;
+    m_curAlloc        = 0;
+    m_maxAlloc        = 0;
+    m_trackLifetimes  = tracklifetimes;
+    m_scansRunning    = 0;
+}
+
+// Destructor - Frees the records of every heap, along with the call stacks.
+//   The references of the blocks to their call stacks aren't released one by
+//   one, since the whole table is freed anyway.
+//
+BlockTracker::~BlockTracker ()
+{
+    CriticalSectionLocker<> cs(m_lock);
+    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
+        heapinfo_t *heapinfo = (*heapit).second;
+        for (ThreadBlocksMap::Iterator threadit = heapinfo->threadBlocks.begin(); threadit != heapinfo->threadBlocks.end(); ++threadit) {
+            delete (*threadit).second;
+        }
+        delete heapinfo->allocTicks;
+        delete heapinfo;
+    }
+    delete m_heapMap;
+    delete m_blockFilter;
+    delete m_stackTable;
+    delete m_threadReportedSerials;
+}
+
+// mapblock - Tracks memory allocations. Information about allocated blocks is
+//   collected and then the block is mapped to this information. The call
+//   stack is added by the caller, with setStack.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - heap (IN): Handle to the heap from which the block has been allocated.
+//
+//  - mem (IN): Pointer to the memory block being allocated.
+//
+//  - size (IN): Size, in bytes, of the memory block being allocated.
+//
+//  - flags (IN): Initial VLD_BLOCK_* flags of the block.
+//
+//  - threadId (IN): ID of the thread allocating the block.
+//
+//  - pblockInfo (OUT): Receives the block's record.
+//
+//  - oldSize (OUT): If the address was already mapped, receives the size of
+//      the block it was mapped to.
+//
+//  Return Value:
+//
+//    Returns false if a block with this address was already mapped, and was
+//    replaced. Otherwise returns true.
+//
+bool BlockTracker::mapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, UINT32 flags, DWORD threadId,
+    blockinfo_t* &pblockInfo, SIZE_T &oldSize)
+{
+    StatTimer timer(STATS_MAP_BLOCK);
+
+    // Record the block's information. The call stack is added by the caller.
+    blockinfo_t blockinfo;
+    blockinfo.size = size;
+    blockinfo.serialNumber = m_requestCurr++;
+    blockinfo.flags = flags;
+    blockinfo.threadId = threadId;
+    blockinfo.stackId = 0;
+    blockinfo.threadPrev = NULL;
+    blockinfo.threadNext = NULL;
+
+    if (SIZE_MAX - m_totalAlloc > size)
+        m_totalAlloc += size;
+    else
+        m_totalAlloc = SIZE_MAX;
+    return insertBlock(heap, mem, blockinfo, m_trackLifetimes ? __rdtsc() : 0, pblockInfo, oldSize);
+}
+
+// insertblock - Inserts a block's record into the block map of its heap, and
+//   links it to the list of blocks of its thread. The heap is mapped if need
+//   be, and the block is counted in the current allocation totals.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - heap (IN): Handle to the heap the block belongs to.
+//
+//  - mem (IN): Pointer to the memory block.
+//
+//  - blockinfo (IN): The block's record. Its thread links are ignored.
+//
+//  - ticks (IN): Time stamp counter at the block's allocation, recorded if
+//      lifetime histograms are enabled.
+//
+//  - pblockInfo (OUT): Receives the record, as stored in the block map.
+//
+//  - oldSize (OUT): If the address was already mapped, receives the size of
+//      the block it was mapped to.
+//
+//  Return Value:
+//
+//    Returns false if a block with this address was already mapped, and was
+//    replaced. Otherwise returns true.
+//
+bool BlockTracker::insertBlock (HANDLE heap, LPCVOID mem, const blockinfo_t &blockinfo, UINT64 ticks,
+    blockinfo_t* &pblockInfo, SIZE_T &oldSize)
+{
+    m_curAlloc += blockinfo.size;
+    if (m_curAlloc > m_maxAlloc)
+        m_maxAlloc = m_curAlloc;
+
+    // Insert the block's information into the block map.
+    HeapMap::Iterator heapit = m_heapMap->find(heap);
+    if (heapit == m_heapMap->end()) {
+        // We haven't mapped this heap to a block map yet. Do it now.
+        mapHeap(heap);
+        heapit = m_heapMap->find(heap);
+        assert(heapit != m_heapMap->end());
+    }
+    heapinfo_t* heapinfo = (*heapit).second;
+    BlockMap* blockmap = &heapinfo->blockMap;
+    heapinfo->curAlloc += blockinfo.size;
+    bool mapped = true;
+    BlockMap::Iterator blockit = blockmap->insert(mem, blockinfo);
+    if (blockit == blockmap->end()) {
+        // A block with this address has already been allocated. The
+        // previously allocated block must have been freed (probably by some
+        // mechanism unknown to VLD), or the heap wouldn't have allocated it
+        // again. Replace the previously allocated info with the new info. The
+        // address filter already counts the address.
+        blockit = blockmap->find(mem);
+        blockentry_t* entry = &blockmap->entry(blockit);
+        m_curAlloc -= entry->second.size;
+        heapinfo->curAlloc -= entry->second.size;
+        oldSize = entry->second.size;
+        mapped = false;
+        recordFreedRange(mem, 0, oldSize);
+        releaseBlockInfo(heapinfo, entry);
+        blockmap->erase(blockit);
+        blockit = blockmap->insert(mem, blockinfo);
+        if (heapinfo->allocTicks != NULL)
+            heapinfo->allocTicks->erase(mem);
+    }
+    else {
+        AddToAddressFilter(*m_blockFilter, mem);
+    }
+    if (heapinfo->allocTicks != NULL)
+        heapinfo->allocTicks->insert(mem, ticks);
+    blockentry_t* entry = &blockmap->entry(blockit);
+    entry->second.threadPrev = NULL;
+    entry->second.threadNext = NULL;
+    linkThreadBlock(heapinfo, entry);
+    pblockInfo = &entry->second;
+    return mapped;
+}
+
+// mapheap - Tracks heap creation. Creates a block map for tracking individual
+//   allocations from the newly created heap and then maps the heap to this
+//   block map.
+//
+//  - heap (IN): Handle to the newly created heap.
+//
+//  Return Value:
+//
+//    Returns false if the heap was already mapped. Its blocks are then
+//    unmapped. Otherwise returns true.
+//
+bool BlockTracker::mapHeap (HANDLE heap)
+{
+    CriticalSectionLocker<> cs(m_lock);
+
+    // Create a new block map for this heap and insert it into the heap map.
+    heapinfo_t* heapinfo = new heapinfo_t;
+    heapinfo->blockMap.reserve(BLOCK_MAP_RESERVE);
+    heapinfo->blockMap.reservelimit(BLOCK_MAP_RESERVE_LIMIT);
+    heapinfo->allocTicks = m_trackLifetimes ? new TickMap : NULL;
+    heapinfo->curAlloc = 0;
+    heapinfo->flags = 0x0;
+
+    HeapMap::Iterator heapit = m_heapMap->insert(heap, heapinfo);
+    if (heapit == m_heapMap->end()) {
+        // Somehow this heap has been created twice without being destroyed,
+        // or at least it was destroyed without VLD's knowledge. Unmap the heap
+        // from the existing heapinfo, and remap it to the new one.
+        unmapHeap(heap);
+        m_heapMap->insert(heap, heapinfo);
+        return false;
+    }
+    return true;
+}
+
+// remapblock - Tracks reallocations of blocks in-place. The block's record is
+//   updated rather than erased and reinserted. Blocks moved by the
+//   reallocation are unmapped and mapped again by the caller instead.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - heap (IN): Handle to the heap from which the memory is being reallocated.
+//
+//  - mem (IN): Pointer to the memory block being reallocated.
+//
+//  - size (IN): Size, in bytes, of the new memory block.
+//
+//  - flags (IN): Initial VLD_BLOCK_* flags of the block, should it not have
+//      been mapped yet.
+//
+//  - threadId (IN): ID of the thread reallocating the block.
+//
+//  Return Value:
+//
+//    Returns the block's record. Its call stack is released, and must be
+//    replaced by the caller, with setStack.
+//
+blockinfo_t* BlockTracker::remapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, UINT32 flags, DWORD threadId)
+{
+    StatTimer    timer(STATS_REMAP_BLOCK);
+    blockinfo_t* pblockInfo = NULL;
+    SIZE_T       oldSize;
+
+    // Find the existing blockinfo_t entry in the block map and update it with
+    // the new size.
+    HeapMap::Iterator heapit = m_heapMap->find(heap);
+    if (heapit == m_heapMap->end()) {
+        // We haven't mapped this heap to a block map yet. Obviously the
+        // block has also not been mapped to a blockinfo_t entry yet either,
+        // so treat this reallocation as a brand-new allocation (this will
+        // also map the heap to a new block map).
+        mapBlock(heap, mem, size, flags, threadId, pblockInfo, oldSize);
+        return pblockInfo;
+    }
+
+    // Find the block's blockinfo_t structure so that we can update it.
+    heapinfo_t         *heapinfo = (*heapit).second;
+    BlockMap           *blockmap = &heapinfo->blockMap;
+    BlockMap::Iterator  blockit = blockmap->find(mem);
+    if (blockit == blockmap->end()) {
+        // The block hasn't been mapped to a blockinfo_t entry yet.
+        // Treat this reallocation as a new allocation.
+        mapBlock(heap, mem, size, flags, threadId, pblockInfo, oldSize);
+        return pblockInfo;
+    }
+
+    // Found the blockinfo_t entry for this block. Update it with
+    // a new callstack and new size. Snapshots hold their own reference to
+    // the old call stack.
+    blockentry_t* entry = &blockmap->entry(blockit);
+    blockinfo_t* info = &entry->second;
+    if (size < info->size) {
+        // Even an empty block keeps its first byte, as for the scan.
+        SIZE_T kept = (size != 0) ? size : 1;
+        if (kept < info->size)
+            recordFreedRange(mem, kept, info->size - kept);
+    }
+    m_stackTable->removeBlock(info->stackId, info->size);
+    m_stackTable->release(info->stackId);
+    info->stackId = 0;
+
+    if (m_totalAlloc < SIZE_MAX)
+    {
+        m_totalAlloc -= info->size;
+        if (SIZE_MAX - m_totalAlloc > size)
+            m_totalAlloc += size;
+        else
+            m_totalAlloc = SIZE_MAX;
+    }
+
+    m_curAlloc -= info->size;
+    m_curAlloc += size;
+    heapinfo->curAlloc -= info->size;
+    heapinfo->curAlloc += size;
+
+    if (m_curAlloc > m_maxAlloc)
+        m_maxAlloc = m_curAlloc;
+
+    if (info->threadId != threadId) {
+        // The block now belongs to the reallocating thread.
+        unlinkThreadBlock(heapinfo, entry);
+        handOver(*info, threadId);
+        linkThreadBlock(heapinfo, entry);
+    }
+    // Update the block's size.
+    info->size = size;
+    return info;
+}
+
+// setstack - Attaches the call stack of its allocation to a block, after it
+//   has been mapped or remapped. Equal call stacks are stored once.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - info (IN/OUT): The block's record, as returned by mapBlock or remapBlock.
+//
+//  - callstack (IN): The call stack. The tracker takes ownership of it.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::setStack (blockinfo_t* info, CallStack* callstack)
+{
+    info->stackId = m_stackTable->intern(callstack);
+    m_stackTable->addBlock(info->stackId, info->size);
+}
+
+// unmapblock - Tracks memory blocks that are freed. Unmaps the specified block
+//   from the block's information, relinquishing internally allocated resources.
+//
+//  - heap (IN): Handle to the heap to which this block is being freed.
+//
+//  - mem (IN): Pointer to the memory block being freed.
+//
+//  Return Value:
+//
+//    Returns true if the block was mapped from this heap. Otherwise returns
+//    false.
+//
+bool BlockTracker::unmapBlock (HANDLE heap, LPCVOID mem)
+{
+    if (NULL == mem)
+        return false;
+
+    StatTimer timer(STATS_UNMAP_BLOCK);
+
+    // Most frees of blocks VLD never tracked (allocated before VLD was
+    // initialized, from excluded modules, or while leak detection was
+    // disabled) are rejected here, without taking any lock.
+    if (!AddressFilterMayContain(*m_blockFilter, mem))
+        return false;
+
+    // Find this heap's block map.
+    CriticalSectionLocker<> cs(m_lock);
+    HeapMap::Iterator heapit = m_heapMap->find(heap);
+    if (heapit == m_heapMap->end()) {
+        // We don't have a block map for this heap. We must not have monitored
+        // this allocation (probably happened before VLD was initialized).
+        return false;
+    }
+
+    // Find this block in the block map.
+    heapinfo_t         *heapinfo = (*heapit).second;
+    BlockMap           *blockmap = &heapinfo->blockMap;
+    BlockMap::Iterator  blockit = blockmap->find(mem);
+    if (blockit == blockmap->end()) {
+        // This memory block is not in the block map. We must not have
+        // monitored this allocation, or it was allocated from another heap.
+        return false;
+    }
+
+    // Release the block's call stack and erase it from the block map.
+    blockentry_t *entry = &blockmap->entry(blockit);
+    m_curAlloc -= entry->second.size;
+    heapinfo->curAlloc -= entry->second.size;
+    recordFreedRange(mem, 0, entry->second.size);
+    if (heapinfo->allocTicks != NULL) {
+        TickMap::Iterator tickit = heapinfo->allocTicks->find(mem);
+        if (tickit != heapinfo->allocTicks->end()) {
+            m_stackTable->recordLifetime(entry->second.stackId, m_requestCurr - entry->second.serialNumber,
+                __rdtsc() - (*tickit).second);
+            heapinfo->allocTicks->erase(tickit);
+        }
+    }
+    releaseBlockInfo(heapinfo, entry);
+    blockmap->erase(blockit);
+    RemoveFromAddressFilter(*m_blockFilter, mem);
+    return true;
+}
+
+// detachblock - Takes the record of a block about to be reallocated out of
+//   the block maps, before the heap is called. Once the heap has returned,
+//   the record must be attached again, with attachBlock, or released, with
+//   releaseDetached, under the same hold of the lock as any new mapping.
+//
+//  - heap (IN): Handle to the heap the block is reallocated from.
+//
+//  - mem (IN): Pointer to the memory block being reallocated.
+//
+//  - detached (OUT): Receives the block's record. Its address is set to NULL
+//      if the block wasn't mapped.
+//
+//  Return Value:
+//
+//    Returns true if the block was mapped from this heap. Otherwise returns
+//    false.
+//
+bool BlockTracker::detachBlock (HANDLE heap, LPCVOID mem, detachedblock_t &detached)
+{
+    detached.address = NULL;
+    if ((NULL == mem) || !AddressFilterMayContain(*m_blockFilter, mem))
+        return false;
+
+    CriticalSectionLocker<> cs(m_lock);
+    HeapMap::Iterator heapit = m_heapMap->find(heap);
+    if (heapit == m_heapMap->end())
+        return false;
+    heapinfo_t         *heapinfo = (*heapit).second;
+    BlockMap           *blockmap = &heapinfo->blockMap;
+    BlockMap::Iterator  blockit = blockmap->find(mem);
+    if (blockit == blockmap->end())
+        return false;
+
+    // The detached record keeps the reference to the call stack.
+    blockentry_t *entry = &blockmap->entry(blockit);
+    detached.heap = heap;
+    detached.address = mem;
+    detached.info = entry->second;
+    detached.allocTicks = 0;
+    if (heapinfo->allocTicks != NULL) {
+        TickMap::Iterator tickit = heapinfo->allocTicks->find(mem);
+        if (tickit != heapinfo->allocTicks->end()) {
+            detached.allocTicks = (*tickit).second;
+            heapinfo->allocTicks->erase(tickit);
+        }
+    }
+    m_curAlloc -= entry->second.size;
+    heapinfo->curAlloc -= entry->second.size;
+    recordFreedRange(mem, 0, entry->second.size);
+    unlinkThreadBlock(heapinfo, entry);
+    m_stackTable->removeBlock(entry->second.stackId, entry->second.size);
+    blockmap->erase(blockit);
+    RemoveFromAddressFilter(*m_blockFilter, mem);
+    return true;
+}
+
+// attachblock - Maps a record taken out by detachBlock again, at the same
+//   address, once the block was reallocated in-place, or its reallocation
+//   failed. The block keeps its serial number.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - detached (IN/OUT): The detached record. It is left empty.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  - threadId (IN): ID of the thread the block now belongs to.
+//
+//  - keepstack (IN): If true, the block keeps its call stack. Otherwise its
+//      call stack is released, and must be replaced by the caller, with
+//      setStack.
+//
+//  Return Value:
+//
+//    Returns the block's record.
+//
+blockinfo_t* BlockTracker::attachBlock (detachedblock_t &detached, SIZE_T size, DWORD threadId, bool keepstack)
+{
+    blockinfo_t blockinfo = detached.info;
+    blockinfo.size = size;
+    if (blockinfo.threadId != threadId)
+        handOver(blockinfo, threadId);
+    if (m_totalAlloc < SIZE_MAX)
+    {
+        m_totalAlloc -= detached.info.size;
+        if (SIZE_MAX - m_totalAlloc > size)
+            m_totalAlloc += size;
+        else
+            m_totalAlloc = SIZE_MAX;
+    }
+
+    blockinfo_t* info = NULL;
+    SIZE_T oldSize;
+    insertBlock(detached.heap, detached.address, blockinfo, detached.allocTicks, info, oldSize);
+    if (keepstack) {
+        m_stackTable->addBlock(info->stackId, size);
+    }
+    else {
+        m_stackTable->release(info->stackId);
+        info->stackId = 0;
+    }
+    detached.address = NULL;
+    return info;
+}
+
+// releasedetached - Releases a record taken out by detachBlock, once the
+//   block was freed, or moved, by its reallocation, or isn't tracked anymore.
+//   The block's lifetime ends.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - detached (IN/OUT): The detached record, or an empty one. It is left
+//      empty.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::releaseDetached (detachedblock_t &detached)
+{
+    if (detached.address == NULL)
+        return;
+
+    if (m_trackLifetimes) {
+        m_stackTable->recordLifetime(detached.info.stackId, m_requestCurr - detached.info.serialNumber,
+            __rdtsc() - detached.allocTicks);
+    }
+    m_stackTable->release(detached.info.stackId);
+    detached.address = NULL;
+}
+
+// unmapheap - Tracks heap destruction. Unmaps the specified heap from its block
+//   map. The block map is cleared and deleted, relinquishing internally
+//   allocated resources.
+//
+//  - heap (IN): Handle to the heap which is being destroyed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::unmapHeap (HANDLE heap)
+{
+    // Find this heap's block map.
+    CriticalSectionLocker<> cs(m_lock);
+    HeapMap::Iterator heapit = m_heapMap->find(heap);
+    if (heapit == m_heapMap->end()) {
+        // This heap hasn't been mapped. We must not have monitored this heap's
+        // creation (probably happened before VLD was initialized).
+        return;
+    }
+
+    // The block records and the thread lists linking them belong to the heap,
+    // and are freed with it, a chunk of records at a time. Only the
+    // references to the shared call stacks are released one by one.
+    heapinfo_t *heapinfo = (*heapit).second;
+    BlockMap   *blockmap = &heapinfo->blockMap;
+    m_curAlloc -= heapinfo->curAlloc;
+    UINT64 ticks = (heapinfo->allocTicks != NULL) ? __rdtsc() : 0;
+    for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
+        const blockinfo_t& info = (*blockit).second;
+        if (heapinfo->allocTicks != NULL) {
+            TickMap::Iterator tickit = heapinfo->allocTicks->find((*blockit).first);
+            if (tickit != heapinfo->allocTicks->end())
+                m_stackTable->recordLifetime(info.stackId, m_requestCurr - info.serialNumber, ticks - (*tickit).second);
+        }
+        m_stackTable->removeBlock(info.stackId, info.size);
+        m_stackTable->release(info.stackId);
+        RemoveFromAddressFilter(*m_blockFilter, (*blockit).first);
+        recordFreedRange((*blockit).first, 0, info.size);
+    }
+    for (ThreadBlocksMap::Iterator threadit = heapinfo->threadBlocks.begin(); threadit != heapinfo->threadBlocks.end(); ++threadit) {
+        delete (*threadit).second;
+    }
+    delete heapinfo->allocTicks;
+    delete heapinfo;
+
+    // Remove this heap's block map from the heap map.
+    m_heapMap->erase(heapit);
+}
+
+// findblock - Finds the heap a block is mapped from, by searching the block
+//   maps of every heap.
+//
+//  - mem (IN): The address of the block.
+//
+//  - heap (OUT): Receives the heap the block is mapped from, or NULL.
+//
+//  Return Value:
+//
+//    Returns the block's record if the block is mapped, otherwise NULL. The
+//    record may only be used as long as the caller holds the tracker's lock.
+//
+blockinfo_t* BlockTracker::findBlock (LPCVOID mem, HANDLE &heap)
+{
+    heap = NULL;
+    if (!AddressFilterMayContain(*m_blockFilter, mem))
+        return NULL;
+
+    CriticalSectionLocker<> cs(m_lock);
+    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
+        BlockMap& blockmap = (*heapit).second->blockMap;
+        BlockMap::Iterator blockit = blockmap.find(mem);
+        if (blockit != blockmap.end()) {
+            heap = (*heapit).first;
+            return &blockmap.entry(blockit).second;
+        }
+    }
+    return NULL;
+}
+
+// recordfreedrange - Records memory of a block that was freed, or that the
+//   block doesn't span anymore, while a classifyLeaks call may have added the
+//   block to its scan. The scan must not read the memory anymore.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - mem (IN): Address of the block.
+//
+//  - offset (IN): Offset, in bytes, of the memory from the block's address.
+//
+//  - size (IN): Size, in bytes, of the memory. Even an empty block is
+//      recorded.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::recordFreedRange (LPCVOID mem, SIZE_T offset, SIZE_T size)
+{
+    if (m_scansRunning == 0)
+        return;
+
+    scanrange_t range;
+    range.low = (UINT_PTR)mem + offset;
+    range.high = range.low + ((size != 0) ? size : 1);
+    m_freedRanges.push_back(range);
+}
+
+// releaseblockinfo - Releases what a block's record refers to: its place in
+//   the list of blocks of its thread and its reference to its call stack. The
+//   record itself is owned by the block map and must be erased by the caller.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - heapinfo (IN): Information about the heap the block belongs to.
+//
+//  - entry (IN): The block's entry in its block map.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::releaseBlockInfo (heapinfo_t* heapinfo, blockentry_t* entry)
+{
+    unlinkThreadBlock(heapinfo, entry);
+    m_stackTable->removeBlock(entry->second.stackId, entry->second.size);
+    m_stackTable->release(entry->second.stackId);
+    entry->second.stackId = 0;
+}
+
+// isreported - Determines whether a block has been marked as reported, either
+//   individually or by markAllReported or markThreadReported, which mark every
+//   block allocated so far by moving a serial number watermark instead of
+//   visiting each block.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - info (IN): Information about the block.
+//
+//  Return Value:
+//
+//    Returns true if the block shouldn't be reported.
+//
+bool BlockTracker::isReported (const blockinfo_t* info) const
+{
+    if ((info->flags & VLD_BLOCK_REPORTED) || (info->serialNumber < m_reportedSerial))
+        return true;
+
+    if (m_threadReportedSerials->begin() == m_threadReportedSerials->end())
+        return false;
+
+    ThreadSerialMap::Iterator it = m_threadReportedSerials->find(info->threadId);
+    return (it != m_threadReportedSerials->end()) && (info->serialNumber < (*it).second);
+}
+
+// markallreported - Marks every block allocated so far as reported.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::markAllReported ()
+{
+    // Every block allocated so far has a lower serial number than the next
+    // one, so marking them all only takes moving the watermark. The thread
+    // watermarks are now all below it.
+    CriticalSectionLocker<> cs(m_lock);
+    m_reportedSerial = m_requestCurr;
+    if (m_threadReportedSerials->begin() != m_threadReportedSerials->end()) {
+        delete m_threadReportedSerials;
+        m_threadReportedSerials = new ThreadSerialMap;
+    }
+}
+
+// markthreadreported - Marks every block allocated so far by a thread as
+//   reported.
+//
+//  - threadId (IN): ID of the thread.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::markThreadReported (DWORD threadId)
+{
+    // Move the thread's own watermark.
+    CriticalSectionLocker<> cs(m_lock);
+    ThreadSerialMap::Iterator it = m_threadReportedSerials->insert(threadId, m_requestCurr);
+    if (it == m_threadReportedSerials->end()) {
+        // The thread's leaks have been marked before. Replace the watermark.
+        m_threadReportedSerials->erase(threadId);
+        m_threadReportedSerials->insert(threadId, m_requestCurr);
+    }
+}
+
+// handover - Gives a block to another thread, without changing whether it is
+//   reported. A reported block is marked individually, as it no longer falls
+//   under the watermark of the thread that marked it. A block that is not
+//   reported gets a new serial number if it falls under the watermark of its
+//   new thread, like a block moved by a reallocation.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - info (IN/OUT): Information about the block.
+//
+//  - threadId (IN): ID of the thread the block now belongs to.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::handOver (blockinfo_t &info, DWORD threadId)
+{
+    bool reported = isReported(&info);
+    info.threadId = threadId;
+    if (reported)
+        info.flags |= VLD_BLOCK_REPORTED;
+    else if (isReported(&info))
+        info.serialNumber = m_requestCurr++;
+}
+
+// linkthreadblock - Appends a block to the list of blocks of the thread which
+//   allocated it, creating the list if needed.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - heapinfo (IN): Information about the heap the block belongs to.
+//
+//  - entry (IN): The block's entry in its block map. Its threadId selects the
+//      list.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::linkThreadBlock (heapinfo_t* heapinfo, blockentry_t* entry)
+{
+    blockinfo_t* info = &entry->second;
+    threadblocks_t* list;
+    ThreadBlocksMap::Iterator threadit = heapinfo->threadBlocks.find(info->threadId);
+    if (threadit != heapinfo->threadBlocks.end()) {
+        list = (*threadit).second;
+    }
+    else {
+        list = new threadblocks_t;
+        list->threadId = info->threadId;
+        list->head = NULL;
+        list->tail = NULL;
+        list->count = 0;
+        heapinfo->threadBlocks.insert(info->threadId, list);
+    }
+
+    info->threadPrev = list->tail;
+    info->threadNext = NULL;
+    if (list->tail != NULL)
+        list->tail->second.threadNext = entry;
+    else
+        list->head = entry;
+    list->tail = entry;
+    list->count++;
+}
+
+// unlinkthreadblock - Removes a block from the list of blocks of its thread.
+//   The list is freed once it is empty, so that lists don't accumulate for
+//   short-lived threads.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - heapinfo (IN): Information about the heap the block belongs to.
+//
+//  - entry (IN): The block's entry in its block map.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::unlinkThreadBlock (heapinfo_t* heapinfo, blockentry_t* entry)
+{
+    blockinfo_t* info = &entry->second;
+    ThreadBlocksMap::Iterator threadit = heapinfo->threadBlocks.find(info->threadId);
+    if (threadit == heapinfo->threadBlocks.end())
+        return;
+    threadblocks_t* list = (*threadit).second;
+
+    if (info->threadPrev != NULL)
+        info->threadPrev->second.threadNext = info->threadNext;
+    else
+        list->head = info->threadNext;
+    if (info->threadNext != NULL)
+        info->threadNext->second.threadPrev = info->threadPrev;
+    else
+        list->tail = info->threadPrev;
+    info->threadPrev = NULL;
+    info->threadNext = NULL;
+
+    if (--list->count == 0) {
+        heapinfo->threadBlocks.erase(threadit);
+        delete list;
+    }
+}
+
+// takesnapshot - Records the potential leaks currently in the block maps, so
+//   that they can be counted, resolved and reported without keeping the heap
+//   maps locked. The tracker's lock is only held while a batch of blocks is
+//   copied, which doesn't involve the symbol handler, and is released between
+//   batches so that the program can go on allocating meanwhile. Each block
+//   is recorded as it was when its batch was copied: blocks freed before
+//   their batch are left out, blocks allocated behind the walk are missed,
+//   and blocks freed or reallocated after their batch are still reported.
+//   The blocks of a single thread are copied under a single hold of the lock.
+//   Every snapshot must be released with releaseSnapshot.
+//
+//  - snapshot (OUT): Receives the potential leaks, ordered by heap and
+//      address, or by heap and allocation order for a single thread.
+//
+//  - heap (IN): If not NULL, only the blocks allocated from this heap are
+//      recorded.
+//
+//  - threadId (IN): If not (DWORD)-1, only the blocks allocated by this
+//      thread are recorded.
+//
+//  - maxdatadump (IN): Up to this many bytes of each block are copied for the
+//      data dump of the report.
+//
+//  - callback (IN): If not NULL, called for each block before it is added to
+//      the snapshot. See SnapshotCallback.
+//
+//  - context (IN): Passed to the callback.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::takeSnapshot (LeakSnapshot &snapshot, HANDLE heap, DWORD threadId, SIZE_T maxdatadump,
+    SnapshotCallback callback, void *context)
+{
+    if (threadId != ((DWORD)-1)) {
+        CriticalSectionLocker<> cs(m_lock);
+        for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
+            if ((heap != NULL) && ((*heapit).first != heap))
+                continue;
+
+            // Only visit the thread's own blocks, in allocation order.
+            heapinfo_t* heapinfo = (*heapit).second;
+            ThreadBlocksMap::Iterator threadit = heapinfo->threadBlocks.find(threadId);
+            if (threadit == heapinfo->threadBlocks.end())
+                continue;
+
+            for (blockentry_t* entry = (*threadit).second->head; entry != NULL; entry = entry->second.threadNext) {
+                if (!isReported(&entry->second))
+                    snapshotBlock(snapshot, entry, maxdatadump, callback, context);
+            }
+        }
+        return;
+    }
+
+    HANDLE  curheap = heap;     // Heap being walked.
+    LPCVOID curblock = NULL;    // Lowest address of the heap not walked yet.
+    bool    more = true;
+    while (more) {
+        more = false;
+        {
+            CriticalSectionLocker<> cs(m_lock);
+            HeapMap::Iterator heapit = (heap != NULL) ? m_heapMap->find(heap) : m_heapMap->lowerbound(curheap);
+            SIZE_T count = 0;
+            for (; heapit != m_heapMap->end(); ++heapit) {
+                if ((*heapit).first != curheap) {
+                    // Starting on the next heap, or the heap being walked was
+                    // destroyed since the last batch.
+                    curheap = (*heapit).first;
+                    curblock = NULL;
+                }
+
+                BlockMap* blockmap = &(*heapit).second->blockMap;
+                BlockMap::Iterator blockit = blockmap->lowerbound(curblock);
+                for (; (blockit != blockmap->end()) && (count < SNAPSHOT_BATCH); ++blockit, ++count) {
+                    // Found a block which is still in the BlockMap. We've
+                    // identified a potential memory leak.
+                    blockentry_t* entry = &blockmap->entry(blockit);
+                    if (!isReported(&entry->second))
+                        snapshotBlock(snapshot, entry, maxdatadump, callback, context);
+                }
+                if (blockit != blockmap->end()) {
+                    // The rest of the heap is walked by the next batch.
+                    curblock = (*blockit).first;
+                    more = true;
+                    break;
+                }
+                if (heap != NULL)
+                    break;
+            }
+        }
+        if (more) {
+            // Let the threads waiting for the lock have it.
+            SwitchToThread();
+        }
+    }
+}
+
+// snapshotblock - Adds a block to a snapshot, unless the callback leaves it
+//   out. The snapshot holds a reference to the block's call stack.
+//
+//   Caller must hold the tracker's lock.
+//
+//  - snapshot (IN/OUT): The snapshot being taken.
+//
+//  - entry (IN): The block's entry in its block map.
+//
+//  - maxdatadump (IN): Up to this many bytes of the block are copied for the
+//      data dump of the report.
+//
+//  - callback (IN): If not NULL, called before the block is added.
+//
+//  - context (IN): Passed to the callback.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::snapshotBlock (LeakSnapshot &snapshot, blockentry_t* entry, SIZE_T maxdatadump,
+    SnapshotCallback callback, void *context)
+{
+    blockinfo_t* info = &entry->second;
+    leakentry_t leak;
+    leak.stackId = info->stackId;
+    leak.callStack = m_stackTable->get(info->stackId);
+    leak.address = entry->first;
+    leak.size = info->size;
+    leak.serialNumber = (SIZE_T)info->serialNumber;
+    leak.crtRequest = 0;
+    leak.threadId = info->threadId;
+    leak.leakHash = 0;
+    if (leak.callStack)
+        leak.leakHash = CalculateCRC32(info->size, leak.callStack->getHashValue());
+    leak.count = 1;
+    leak.reachability = REACHABILITY_UNKNOWN;
+    leak.data = NULL;
+    leak.dataSize = 0;
+
+    if ((callback != NULL) && !callback(leak, info, context))
+        return;
+
+    // The block may be freed as soon as the lock is released.
+    leak.dataSize = (maxdatadump < leak.size) ? maxdatadump : leak.size;
+    if (leak.dataSize != 0) {
+        leak.data = new BYTE [leak.dataSize];
+        memcpy(leak.data, leak.address, leak.dataSize);
+    }
+
+    m_stackTable->addRef(leak.stackId);
+    snapshot.push_back(leak);
+}
+
+// releasesnapshot - Releases a snapshot taken by takeSnapshot, along with its
+//   references to the call stacks of the leaks. Call stacks of blocks freed or
+//   reallocated in the meantime are freed.
+//
+//  - snapshot (IN/OUT): The snapshot to release. It is left empty.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::releaseSnapshot (LeakSnapshot &snapshot)
+{
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        delete [] leakit->data;
+    }
+
+    CriticalSectionLocker<> cs(m_lock);
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        m_stackTable->release(leakit->stackId);
+    }
+    snapshot.clear();
+}
+
+// classifyleaks - Finds which leaks of a snapshot are still reachable from the
+//   program's data, and which are lost. Every block of every heap is added to
+//   the scan, as the blocks the program still uses may point to leaks, then
+//   the scan is run from the roots the caller added. The blocks are added a
+//   batch at a time, and the worker threads of the scan are started, without
+//   holding the tracker's lock in between. Memory freed meanwhile is left out
+//   of the scan, whose mark is then run with the lock held, as it reads the
+//   blocks. Still reachable leaks are dropped by countLeaks.
+//
+//  - snapshot (IN/OUT): The leaks to classify. The reachability of each leak
+//      is set.
+//
+//  - scan (IN/OUT): A scan with the roots of the program added to it.
+//
+//  - workers (IN): Number of threads to scan with, the calling thread
+//      included.
+//
+//  - callback (IN): If not NULL, called for each block, as by takeSnapshot,
+//      to adjust the range of the block scanned, or to leave the block out.
+//      Only the address and size of the leak are set.
+//
+//  - context (IN): Passed to the callback.
+//
+//  - reachablebytes (OUT): Receives the total size of the still reachable
+//      leaks.
+//
+//  Return Value:
+//
+//    Returns the number of still reachable leaks.
+//
+SIZE_T BlockTracker::classifyLeaks (LeakSnapshot &snapshot, ReachabilityScan &scan, UINT32 workers,
+    SnapshotCallback callback, void *context, SIZE_T &reachablebytes)
+{
+    // Memory freed from now on is recorded, from this index.
+    SIZE_T firstrange;
+    {
+        CriticalSectionLocker<> cs(m_lock);
+        m_scansRunning++;
+        firstrange = m_freedRanges.size();
+    }
+
+    HANDLE  curheap = NULL;     // Heap being walked.
+    LPCVOID curblock = NULL;    // Lowest address of the heap not walked yet.
+    bool    more = true;
+    while (more) {
+        more = false;
+        {
+            CriticalSectionLocker<> cs(m_lock);
+            SIZE_T count = 0;
+            for (HeapMap::Iterator heapit = m_heapMap->lowerbound(curheap); heapit != m_heapMap->end(); ++heapit) {
+                if ((*heapit).first != curheap) {
+                    curheap = (*heapit).first;
+                    curblock = NULL;
+                }
+
+                BlockMap* blockmap = &(*heapit).second->blockMap;
+                BlockMap::Iterator blockit = blockmap->lowerbound(curblock);
+                for (; (blockit != blockmap->end()) && (count < SNAPSHOT_BATCH); ++blockit, ++count) {
+                    blockentry_t* entry = &blockmap->entry(blockit);
+                    leakentry_t block = {};
+                    block.address = entry->first;
+                    block.size = entry->second.size;
+                    if ((callback == NULL) || callback(block, &entry->second, context))
+                        scan.addBlock(block.address, block.size);
+                }
+                if (blockit != blockmap->end()) {
+                    curblock = (*blockit).first;
+                    more = true;
+                    break;
+                }
+            }
+        }
+        if (more)
+            SwitchToThread();
+    }
+
+    scan.start(workers);
+    {
+        CriticalSectionLocker<> cs(m_lock);
+        for (SIZE_T index = firstrange; index < m_freedRanges.size(); index++) {
+            scan.dropRange((LPCVOID)m_freedRanges[index].low, (LPCVOID)m_freedRanges[index].high);
+        }
+        if (--m_scansRunning == 0)
+            m_freedRanges.clear();
+        scan.mark();
+    }
+    scan.finish();
+
+    SIZE_T reachable = 0;
+    reachablebytes = 0;
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        leakit->reachability = scan.classify(leakit->address);
+        if (leakit->reachability == REACHABILITY_REACHABLE) {
+            reachable++;
+            reachablebytes += leakit->size;
+        }
+    }
+    return reachable;
+}
+
+// aggregateduplicates - Folds the leaks of a snapshot that appear to be
+//   duplicates of an earlier leak (same size and same call stack) into that
+//   leak, so that they are reported under a single heading.
+//
+//  - snapshot (IN/OUT): The leaks to aggregate. The count of each leak which
+//      is folded into another one is added to that leak and reset to zero.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID BlockTracker::aggregateDuplicates (LeakSnapshot &snapshot)
+{
+    // Equal call stacks are interned once, so they have the same ID.
+    Map<leakkey_t, leakentry_t*> firstLeaks;
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        leakentry_t *leak = &(*leakit);
+        if ((leak->count == 0) || (leak->stackId == 0))
+            continue;
+
+        leakkey_t key = { leak->size, leak->stackId, leak->reachability };
+        Map<leakkey_t, leakentry_t*>::Iterator it = firstLeaks.insert(key, leak);
+        if (it == firstLeaks.end()) {
+            // Found a leak of the same size with the same call stack.
+            leakentry_t *first = (*firstLeaks.find(key)).second;
+            first->count += leak->count;
+            leak->count = 0;
+        }
+    }
+}
+
+// countleaks - Counts the leaks of a snapshot, dropping those which shouldn't
+//   be reported.
+//
+//   Note: Resolving symbols for the CRT startup check may need the loader lock.
+//
+//  - snapshot (IN/OUT): The leaks to count. On return, the count of each leak
+//      is the number of leaks to report under its heading. Leaks found still
+//      reachable by classifyLeaks are dropped.
+//
+//  - aggregate (IN): If true, duplicate leaks are folded into the first one.
+//
+//  - skipcrtstartup (IN): If true, leaks allocated by the CRT startup code
+//      are dropped.
+//
+//  Return Value:
+//
+//    Returns the number of leaks.
+//
+SIZE_T BlockTracker::countLeaks (LeakSnapshot &snapshot, bool aggregate, bool skipcrtstartup)
+{
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        if (leakit->reachability == REACHABILITY_REACHABLE) {
+            leakit->count = 0;
+        }
+    }
+
+    if (skipcrtstartup) {
+        // Check for crt startup allocations
+        for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+            if (leakit->callStack && leakit->callStack->isCrtStartupAlloc()) {
+                leakit->count = 0;
+            }
+        }
+    }
+
+    if (aggregate) {
+        aggregateDuplicates(snapshot);
+    }
+
+    SIZE_T memoryleaks = 0;
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        memoryleaks += leakit->count;
+    }
+    return memoryleaks;
+}
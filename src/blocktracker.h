@@ -0,0 +1,260 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - BlockTracker Class Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <vector>
+#pragma pop_macro("new")
+#include "addressfilter.h"  // Provides the filter of tracked block addresses.
+#include "platform.h"   // Provides the platform adapters.
+#include "callstack.h"  // Provides a custom class for handling call stacks.
+#include "criticalsection.h"
+#include "map.h"        // Provides a custom STL-like map template.
+#include "reachability.h"   // Provides the reachability scan.
+#include "stacktable.h" // Provides the table of distinct call stacks.
+#include "vldallocator.h"   // Provides internal allocator.
+
+struct blockinfo_t;
+
+// The address of a block, and the information collected about it, as stored
+// in a BlockMap.
+typedef Pair<LPCVOID, blockinfo_t> blockentry_t;
+
+// Data is collected for every block allocated from any heap in the process.
+// The data is stored in this structure and these structures are stored, by
+// value, in a BlockMap which maps each of these structures to its
+// corresponding memory block. There is one for every live block in the
+// process, so it is kept small: the call stack is shared with every other
+// block allocated from the same place (see StackTable), and the flags share
+// a 64-bit word with the serial number. The blocks of each thread are also
+// linked together.
+struct blockinfo_t {
+    SIZE_T        size;             // Size, in bytes, of the block.
+    UINT64        serialNumber : 48; // Serial number of the allocation.
+    UINT64        flags : 16;       // Block flags:
+#define VLD_BLOCK_REPORTED      0x1 //   If set, the block is never reported. Blocks marked as reported by
+                                    //   the API are identified by their serial number instead.
+#define VLD_BLOCK_DEBUGCRTALLOC 0x2 //   If set, the block has a debug CRT header.
+#define VLD_BLOCK_UCRT          0x4 //   If set, the debug CRT header is the UCRT's.
+    DWORD         threadId;         // Thread that allocated (or last reallocated) the block.
+    UINT32        stackId;          // ID of the allocation's call stack in the StackTable, or 0.
+    blockentry_t *threadPrev;       // Previous (older) block in the thread's list.
+    blockentry_t *threadNext;       // Next (newer) block in the thread's list.
+};
+
+// The record of a block taken out of the block maps by
+// BlockTracker::detachBlock while the block is reallocated. The heap may free
+// the block, and give its address to another thread, as soon as the
+// reallocation starts, so the record must not stay in the maps in the
+// meantime. It is then attached again, or released.
+struct detachedblock_t {
+    HANDLE      heap;           // Heap the block was mapped from.
+    LPCVOID     address;        // Address of the block, or NULL if no record is detached.
+    blockinfo_t info;           // The record. It keeps its reference to the call stack.
+    UINT64      allocTicks;     // Time stamp counter at allocation, if lifetime histograms are enabled.
+};
+
+// The blocks mapped from each heap for each thread are linked together, in
+// allocation order, so that the leaks of a single thread can be found without
+// scanning every block map. A block reallocated in-place by another thread
+// moves to that thread's list; a block freed by another thread is unlinked
+// from the list of the thread which allocated it.
+struct threadblocks_t {
+    DWORD         threadId;     // ID of the thread.
+    blockentry_t *head;         // Oldest block of the thread.
+    blockentry_t *tail;         // Newest block of the thread.
+    SIZE_T        count;        // Number of blocks in the list.
+};
+
+// ThreadBlocksMaps map threads (via their IDs) to their lists of blocks in a
+// heap.
+typedef Map<DWORD, threadblocks_t*> ThreadBlocksMap;
+
+// BlockMaps map memory blocks (via their addresses) to blockinfo_t structures.
+typedef Map<LPCVOID, blockinfo_t> BlockMap;
+
+// TickMaps map memory blocks (via their addresses) to the time stamp counter
+// at their allocation. Only kept if lifetime histograms are enabled, so that
+// the records of the blocks don't pay for it otherwise.
+typedef Map<LPCVOID, UINT64> TickMap;
+
+// Information about each heap in the process is kept in this map. Primarily
+// this is used for mapping heaps to all of the blocks allocated from those
+// heaps. Everything VLD records about the blocks of a heap is kept here, so
+// that it is freed at once when the heap is destroyed.
+struct heapinfo_t {
+    BlockMap        blockMap;     // Map of all blocks allocated from this heap.
+    ThreadBlocksMap threadBlocks; // Lists of the blocks of each thread.
+    TickMap        *allocTicks;   // Allocation time stamps of the blocks, or NULL if lifetimes aren't tracked.
+    SIZE_T          curAlloc;     // Total amount currently allocated from this heap.
+    UINT32          flags;        // Heap status flags
+};
+
+// HeapMaps map heaps (via their handles) to BlockMaps.
+typedef Map<HANDLE, heapinfo_t*> HeapMap;
+
+// ThreadSerialMaps map threads (via their IDs) to serial numbers. Used to
+// remember which blocks MarkThreadLeaksAsReported marked as reported.
+typedef Map<DWORD, SIZE_T> ThreadSerialMap;
+
+// A potential leak found in the block maps when a LeakSnapshot was taken. Only
+// the information needed to count, resolve and report the leak is recorded, so
+// that the heap maps don't need to stay locked while that work is done. The
+// call stack is kept alive until the snapshot is released, even if the block
+// is freed or reallocated in the meantime.
+struct leakentry_t {
+    CallStack   *callStack;    // Call stack of the block when the snapshot was taken (may be NULL).
+    UINT32       stackId;      // ID of the call stack, referenced until the snapshot is released.
+    LPCVOID      address;      // Address of the user data (past the CRT header, if any).
+    SIZE_T       size;         // Size, in bytes, of the user data.
+    SIZE_T       serialNumber; // Serial number of the allocation.
+    SIZE_T       crtRequest;   // CRT allocation number, for debug CRT blocks. Otherwise 0.
+    DWORD        threadId;     // Thread that allocated (or last reallocated) the block.
+    DWORD        leakHash;     // The "Leak Hash" printed in the report.
+    SIZE_T       count;        // Number of leaks counted under this entry. 0 if skipped or aggregated.
+    BYTE         reachability; // REACHABILITY_* of the block, as found by classifyLeaks.
+    BYTE        *data;         // Copy of the first bytes of user data to dump, or NULL.
+    SIZE_T       dataSize;     // Size, in bytes, of the copy.
+};
+
+// Leaks with equal keys may be duplicates of each other (see aggregateDuplicates).
+struct leakkey_t {
+    BOOL operator < (const leakkey_t &other) const
+    {
+        if (size != other.size)
+            return (size < other.size);
+        if (stackId != other.stackId)
+            return (stackId < other.stackId);
+        return (reachability < other.reachability);
+    }
+
+    SIZE_T size;                // Size, in bytes, of the user data.
+    UINT32 stackId;             // ID of the call stack.
+    BYTE   reachability;        // Directly and indirectly lost leaks are reported apart.
+};
+
+// LeakSnapshots list potential leaks, ordered by heap and address.
+typedef std::vector<leakentry_t, vldallocator<leakentry_t> > LeakSnapshot;
+
+// Called by BlockTracker::takeSnapshot for each unreported block, once the
+// leak has been filled in from the block's record. The callback may adjust
+// the leak (its address and size, for instance) or return false to leave the
+// block out of the snapshot. The block maps are locked during the call, but
+// may change between two calls.
+typedef bool (*SnapshotCallback)(leakentry_t &leak, blockinfo_t *info, void *context);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The BlockTracker Class
+//
+//    Keeps the records of every live block of every heap: the heap and block
+//    maps, the lists of the blocks of each thread, the filter of tracked
+//    addresses and the table of call stacks, along with the allocation totals
+//    and the serial number watermarks of blocks marked as reported. It knows
+//    nothing of the system's heaps and only uses the platform adapters, so it
+//    builds on every platform (as part of vld_core), and can be driven by
+//    synthetic workloads. VisualLeakDetector feeds it from the heap hooks.
+//
+//    The tracker is protected by a lock owned by the caller (g_heapMapLock in
+//    the DLL), so that the caller can update a block's record and its call
+//    stack atomically. Functions documented as such must be called with the
+//    lock held; the others take it themselves.
+//
+class BlockTracker
+{
+public:
+    BlockTracker (CriticalSection &lock, bool tracklifetimes);
+    ~BlockTracker ();
+
+    blockinfo_t* attachBlock (detachedblock_t &detached, SIZE_T size, DWORD threadId, bool keepstack);
+    bool detachBlock (HANDLE heap, LPCVOID mem, detachedblock_t &detached);
+    VOID releaseDetached (detachedblock_t &detached);
+
+    bool mapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, UINT32 flags, DWORD threadId,
+        blockinfo_t* &pblockInfo, SIZE_T &oldSize);
+    bool mapHeap (HANDLE heap);
+    blockinfo_t* remapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, UINT32 flags, DWORD threadId);
+    VOID setStack (blockinfo_t* info, CallStack* callstack);
+    bool unmapBlock (HANDLE heap, LPCVOID mem);
+    VOID unmapHeap (HANDLE heap);
+    blockinfo_t* findBlock (LPCVOID mem, HANDLE &heap);
+    bool isReported (const blockinfo_t* info) const;
+    VOID markAllReported ();
+    VOID markThreadReported (DWORD threadId);
+    VOID takeSnapshot (LeakSnapshot &snapshot, HANDLE heap, DWORD threadId, SIZE_T maxdatadump,
+        SnapshotCallback callback, void *context);
+    VOID releaseSnapshot (LeakSnapshot &snapshot);
+    SIZE_T classifyLeaks (LeakSnapshot &snapshot, ReachabilityScan &scan, UINT32 workers,
+        SnapshotCallback callback, void *context, SIZE_T &reachablebytes);
+
+    static VOID aggregateDuplicates (LeakSnapshot &snapshot);
+    static SIZE_T countLeaks (LeakSnapshot &snapshot, bool aggregate, bool skipcrtstartup);
+
+    // The maps and the table are protected by the tracker's lock.
+    HeapMap* heapMap () const       { return m_heapMap; }
+    StackTable* stackTable () const { return m_stackTable; }
+
+    // Allocation totals, in bytes, and the serial number of the next block.
+    SIZE_T curAlloc () const        { return m_curAlloc; }
+    SIZE_T maxAlloc () const        { return m_maxAlloc; }
+    SIZE_T totalAlloc () const      { return m_totalAlloc; }
+    SIZE_T requestCurr () const     { return m_requestCurr; }
+
+private:
+    // Disallow certain operations
+    BlockTracker (const BlockTracker&);
+    BlockTracker& operator = (const BlockTracker&);
+
+    bool insertBlock (HANDLE heap, LPCVOID mem, const blockinfo_t &blockinfo, UINT64 ticks,
+        blockinfo_t* &pblockInfo, SIZE_T &oldSize);
+    VOID handOver (blockinfo_t &info, DWORD threadId);
+    VOID linkThreadBlock (heapinfo_t* heapinfo, blockentry_t* entry);
+    VOID recordFreedRange (LPCVOID mem, SIZE_T offset, SIZE_T size);
+    VOID releaseBlockInfo (heapinfo_t* heapinfo, blockentry_t* entry);
+    VOID snapshotBlock (LeakSnapshot &snapshot, blockentry_t* entry, SIZE_T maxdatadump,
+        SnapshotCallback callback, void *context);
+    VOID unlinkThreadBlock (heapinfo_t* heapinfo, blockentry_t* entry);
+
+    CriticalSection     &m_lock;              // Protects everything below, unless noted otherwise.
+    HeapMap             *m_heapMap;           // Map of all active heaps in the process.
+    addressfilter_t     *m_blockFilter;       // Addresses of the blocks in the block maps. Updated under the lock, tested without it.
+    StackTable          *m_stackTable;        // Every distinct call stack of a live block or a leak snapshot.
+    ThreadSerialMap     *m_threadReportedSerials; // Same as m_reportedSerial, for the blocks of a single thread.
+    SIZE_T               m_requestCurr;       // Current request number.
+    SIZE_T               m_reportedSerial;    // Blocks with lower serial numbers are marked as reported.
+    SIZE_T               m_totalAlloc;        // Grand total - sum of all allocations.
+    SIZE_T               m_curAlloc;          // Total amount currently allocated.
+    SIZE_T               m_maxAlloc;          // Largest ever allocated at once.
+    bool                 m_trackLifetimes;    // If true, the lifetimes of freed blocks are recorded.
+    UINT32               m_scansRunning;      // Number of classifyLeaks calls collecting or marking blocks.
+    ScanRangeList        m_freedRanges;       // Memory of blocks freed, or shrunk, since the oldest of them started.
+};
@@ -29,12 +29,47 @@
     Applications should never include this header."
 #endif
 
-#include <windows.h>
+#include "platform.h"
+#include "framepatterns.h"
+#include "vldallocator.h"
+#if defined(_WIN32)
+#include "frametable.h"
 #include "utility.h"
+#else
+struct framedesc_t;
+#endif
 
 #define CALLSTACK_CHUNK_SIZE    32	// Number of frame slots in each CallStack chunk.
 #define MAX_SYMBOL_NAME_LENGTH  256 // Maximum symbol name length that we will allow. Longer names will be truncated.
 #define MAX_SYMBOL_NAME_SIZE    ((MAX_SYMBOL_NAME_LENGTH * sizeof(WCHAR)) - 1)
+#define UNWIND_CACHE_SIZE       256 // Number of entries in each thread's function table cache (must be a power of 2).
+
+// Patterns classifying function and source file names, allocated from VLD's
+// internal heap.
+typedef FramePatterns<vldallocator<patternnode_t> > FramePatternSet;
+
+#if defined(_WIN32) && defined(_M_X64)
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The unwindcache_t Structure
+//
+//    Remembers the function table entries that RtlLookupFunctionEntry returned
+//    for recently seen return addresses, so that the safe stack walk does not
+//    have to search the module's exception directory again for every frame of
+//    every allocation. Each thread owns its own cache, which lets the walk run
+//    without taking any lock. The whole cache is dropped whenever the set of
+//    loaded modules changes (see g_modulesGeneration).
+//
+struct unwindcache_t
+{
+    LONG generation;                    // Value of g_modulesGeneration when the cache was last validated.
+    struct entry_t {
+        DWORD64           pc;           // Return address described by this entry.
+        DWORD64           imageBase;    // Base address of the image containing the function.
+        PRUNTIME_FUNCTION function;     // Function table entry covering the return address.
+    } entries [UNWIND_CACHE_SIZE];
+};
+#endif // _WIN32 && _M_X64
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -70,10 +105,15 @@
 //    done by calling VisualLeakDetector::ResolveCallstacks, which can be called from
 //    external code by the exported VLDResolveCallstacks function.
 //    When this happens, the call stacks are formatted, and then cached for later dumping.
-//    This has performance penalties, as the current implementation saves all info to heap memory,
-//    and it is wasteful, as some of the 'converted' memory is not a true leak, but will get
-//    properly de-allocated at a later time. However there is no other way to work around the
-//    fact that the call stacks can only get formatted when the binary is loaded in the process.
+//    Each distinct frame description is kept only once, in the FrameTable, so the
+//    cost of caching grows with the number of distinct frames rather than with the
+//    number of leaks. However there is no other way to work around the fact that
+//    the call stacks can only get formatted when the binary is loaded in the process.
+//
+//    The storage of the frames is the same on every platform (callstack.cpp).
+//    Capturing the frames and resolving them to symbols is done by each
+//    platform's own implementation: callstack_win.cpp, with the Debug Help
+//    Library, and callstack_posix.cpp.
 //
 class CallStack
 {
@@ -81,6 +121,7 @@ public:
     CallStack ();
     virtual ~CallStack ();
     static CallStack* Create(BOOL safe_stack_walk);
+    static VOID InitFramePatterns(FramePatternSet &crtStartupFunctions, FramePatternSet &internalSourceFiles);
     // Public APIs - see each function definition for details.
     VOID clear ();
     // Prints the call stack to one of either / or the debug output window and or
@@ -90,7 +131,12 @@ public:
     int resolve(BOOL showinternalframes, BOOL skipStartupLeaks);
     // Formats the stack frame into a human readable format, and saves it for later retrieval.
     CONST WCHAR* getResolvedCallstack(BOOL showinternalframes, BOOL skipStartupLeaks);
-    virtual DWORD getHashValue() const = 0;
+    // Returns the hash behind the "Leak Hash" printed in leak reports.
+    DWORD getHashValue() const { return m_hashValue; }
+    // Returns the 64-bit hash of the frames, for fast duplicate detection.
+    UINT64 getStackHash() const { return m_stackHash; }
+    // Returns the number of frames.
+    UINT32 size() const { return m_size; }
     virtual VOID getStackTrace (UINT32 maxdepth, const context_t& context) = 0;
     bool isCrtStartupAlloc();
 
@@ -100,6 +146,8 @@ public:
 
 protected:
     // Protected data.
+    DWORD  m_hashValue;                    // Hash of the stack, as printed in the "Leak Hash" of reports.
+    UINT64 m_stackHash;                    // 64-bit hash of the frames, updated by push_back.
     UINT32 m_status;                       // Status flags:
 #define CALLSTACK_STATUS_INCOMPLETE    0x1 //   If set, the stack trace stored in this CallStack appears to be incomplete.
 #define CALLSTACK_STATUS_STARTUPCRT    0x2 //   If set, the stack trace is startup CRT.
@@ -118,18 +166,32 @@ protected:
     CallStack::chunk_t* m_topChunk; // Pointer to the chunk at the top of the stack
     UINT32              m_topIndex; // Index, within the top chunk, of the top of the stack
 
-    // The string that contains the stack converted into a human readable format.
-    // This is always NULL if the callstack has not been 'converted'.
-    WCHAR*              m_resolved;
-    int                 m_resolvedCapacity;
-    int                 m_resolvedLength;
+    // The stack converted into a human readable format: the interned
+    // description of each frame to print, in order. This is always NULL if the
+    // callstack has not been 'converted'.
+    const framedesc_t** m_resolved;
+    UINT32              m_resolvedCount;  // Number of descriptions in m_resolved.
+    UINT32              m_resolvedLength; // Length of the rendered text, in characters.
+    // The rendered text returned by getResolvedCallstack. Only built on request.
+    WCHAR*              m_rendered;
+
+#if defined(_WIN32)
+    WCHAR* render () const;
 
     bool isInternalModule( const PWSTR filename ) const;
     UINT isCrtStartupFunction( LPCWSTR functionName ) const;
+    UINT classifyFrame(SIZE_T programCounter, frameinfo_t* info, CriticalSectionLocker<DbgHelp>& locker) const;
+    VOID resolveFrame(SIZE_T programCounter, frameinfo_t* info, CriticalSectionLocker<DbgHelp>& locker) const;
+#if defined(_M_X64)
+    static unwindcache_t* getUnwindCache ();
+#endif
     LPCWSTR getFunctionName(SIZE_T programCounter, DWORD64& displacement64,
         SYMBOL_INFO* functionInfo, CriticalSectionLocker<DbgHelp>& locker) const;
     DWORD resolveFunction(SIZE_T programCounter, IMAGEHLP_LINEW64* sourceInfo, DWORD displacement,
         LPCWSTR functionName, LPWSTR stack_line, DWORD stackLineSize) const;
+#else
+    VOID hashFrames ();
+#endif // _WIN32
 
 private:
     // Don't allow this!!
@@ -144,23 +206,13 @@ private:
 //  The FastCallStack Class
 //
 //    This class is a specialization of the CallStack class which provides a
-//    very fast stack tracing function.
+//    very fast stack tracing function. On Linux it follows the chain of frame
+//    pointers, which is broken by functions compiled without them.
 //
 class FastCallStack : public CallStack
 {
 public:
-    FastCallStack()
-        : m_hashValue(0)
-    {
-    }
     virtual VOID getStackTrace (UINT32 maxdepth, const context_t& context);
-    virtual DWORD getHashValue() const
-    {
-        return m_hashValue;
-    }
-
-private:
-    UINT32 m_hashValue;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -168,11 +220,19 @@ private:
 //  The SafeCallStack Class
 //
 //    This class is a specialization of the CallStack class which provides a
-//    more robust, but quite slow, stack tracing function.
+//    more robust, but quite slow, stack tracing function. On x64 the stack is
+//    unwound with the function tables of the loaded images, on x86 with
+//    StackWalk64. On Linux it is unwound with the call frame information
+//    (.eh_frame) of the loaded modules. None of the walks holds the heap map
+//    lock.
 //
 class SafeCallStack : public CallStack
 {
 public:
     virtual VOID getStackTrace (UINT32 maxdepth, const context_t& context);
-    virtual DWORD getHashValue() const;
+
+#if defined(_WIN32)
+private:
+    VOID walkStack (UINT32 maxdepth, const context_t& context);
+#endif // _WIN32
 };
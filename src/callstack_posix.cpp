@@ -0,0 +1,431 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - CallStack Capture and Resolution (POSIX)
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// The CallStack class on platforms other than Windows. Frames are captured by
+// following the frame pointers, or by unwinding with the call frame information
+// of the modules, and resolved by the process-wide Symbolizer, from the symbol
+// and line tables of the modules.
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <cxxabi.h>
+#include <pthread.h>
+#if !defined(__x86_64__)
+#include <execinfo.h>
+#endif
+
+#define VLDBUILD
+#include "callstack.h"  // This class' header.
+#include "ehframe.h"    // Provides the call frame information.
+#include "internalstats.h"  // Provides the counters of VLD's own operations.
+#include "stackhash.h"  // Provides the stack hashing functions.
+#include "symbolizer.h" // Provides the symbols of the frames.
+#include "utility.h"    // Provides the report functions.
+#include "vldheap.h"    // Provides internal new and delete operators.
+
+#define MAX_CAPTURED_FRAMES 62  // Most frames captured at once, like RtlCaptureStackBackTrace.
+#define MAX_INTERNAL_FRAMES 16  // Most frames of VLD's own code unwound before reaching the hook's caller.
+
+CallStack* CallStack::Create(BOOL safe_stack_walk)
+{
+    CallStack* result = NULL;
+    if (safe_stack_walk) {
+        result = new SafeCallStack();
+    }
+    else {
+        result = new FastCallStack();
+    }
+    return result;
+}
+
+// Limits of each thread's stack, found the first time the thread walks it.
+// The initial-exec model keeps accesses to them from allocating.
+static __thread UINT_PTR t_stackLow __attribute__((tls_model("initial-exec")));
+static __thread UINT_PTR t_stackHigh __attribute__((tls_model("initial-exec")));
+
+// GetStackLimits - Obtains the limits of the calling thread's stack. Frames
+//   are only ever read from within them.
+//
+//  - low (OUT): Receives the lowest address of the stack.
+//
+//  - high (OUT): Receives the address just past the stack.
+//
+//  Return Value:
+//
+//    Returns true if the limits are known. Otherwise returns false.
+//
+static bool GetStackLimits (UINT_PTR &low, UINT_PTR &high)
+{
+    if (t_stackHigh == 0) {
+        pthread_attr_t attributes;
+        if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+            return false;
+        void*  address = NULL;
+        size_t size = 0;
+        if (pthread_attr_getstack(&attributes, &address, &size) == 0) {
+            t_stackLow = (UINT_PTR)address;
+            t_stackHigh = (UINT_PTR)address + size;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    low = t_stackLow;
+    high = t_stackHigh;
+    return (high != 0);
+}
+
+// IsOnStack - Determines whether a pointer-sized value lies within the stack.
+//
+//  - address (IN): Address of the value.
+//
+//  - low (IN): The lowest address of the stack.
+//
+//  - high (IN): The address just past the stack.
+//
+//  Return Value:
+//
+//    Returns true if the value can be read. Otherwise returns false.
+//
+static inline bool IsOnStack (UINT_PTR address, UINT_PTR low, UINT_PTR high)
+{
+    return (address >= low) && (address <= high - sizeof(UINT_PTR)) && ((address & (sizeof(UINT_PTR) - 1)) == 0);
+}
+
+// InitFramePatterns - Adds VLD's built-in patterns to the pattern sets used to
+//   classify frames. The built-in patterns describe the Microsoft CRT, so there
+//   are none here. Patterns from vld.ini are added by the caller.
+//
+//  - crtStartupFunctions (IN/OUT): Receives the patterns of CRT startup
+//      functions.
+//
+//  - internalSourceFiles (IN/OUT): Receives the patterns of source files
+//      internal to the heap.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CallStack::InitFramePatterns (FramePatternSet &/*crtStartupFunctions*/, FramePatternSet &/*internalSourceFiles*/)
+{
+}
+
+// isCrtStartupAlloc - Determines whether the memory leak was generated from crt
+//   startup code. There is no such thing here.
+//
+//  Return Value:
+//
+//    Always returns false.
+//
+bool CallStack::isCrtStartupAlloc()
+{
+    m_status |= CALLSTACK_STATUS_NOTSTARTUPCRT;
+    return false;
+}
+
+// dump - Dumps a rendition of the CallStack, including the symbols of the
+//   frames if available, to the report.
+//
+//  - showinternalframes (IN): Ignored, no frame is known to be internal.
+//
+//  Return Value:
+//
+//    None.
+//
+void CallStack::dump(BOOL showInternalFrames, BOOL skipStartupLeaks)
+{
+    if (!m_rendered) {
+        resolve(showInternalFrames, skipStartupLeaks);
+    }
+
+    if (m_rendered) {
+        Print(m_rendered);
+    }
+}
+
+// Resolve - Creates a rendition of the CallStack, one line per frame, with the
+//   source file and line, module, function and displacement of each frame
+//   when the symbolizer finds them, and saves it for later retrieval. Several
+//   threads may resolve the same CallStack concurrently; the first one to
+//   finish publishes its rendition.
+//
+//  - showInternalFrames (IN): Ignored, no frame is known to be internal.
+//
+//  Return Value:
+//
+//    Returns the number of frames whose function couldn't be found.
+//
+int CallStack::resolve(BOOL /*showInternalFrames*/, BOOL /*skipStartupLeaks*/)
+{
+    if (m_rendered)
+    {
+        // already resolved, no need to do it again
+        return 0;
+    }
+
+    StatTimer timer(STATS_SYMBOLS);
+    int unresolvedFunctionsCount = 0;
+    // Room for the function's name and for the source file's path.
+    const size_t lineSize = MAX_SYMBOL_NAME_LENGTH * 2 + 64;
+    WCHAR* text = new WCHAR [m_size * lineSize + 1];
+    size_t length = 0;
+    for (UINT32 frame = 0; frame < m_size; frame++) {
+        UINT_PTR programCounter = (*this)[frame];
+        WCHAR* line = text + length;
+        symbolinfo_t info;
+        if (!Symbolizer::Get()->resolve(programCounter, info) || (info.function == NULL)) {
+            const char* module = (info.module != NULL) ? info.module : "(Module name unavailable)";
+            swprintf(line, lineSize, L"    %s!0x%lx()\n", module, (unsigned long)programCounter);
+            unresolvedFunctionsCount++;
+        }
+        else {
+            int status = -1;
+            char* demangled = abi::__cxa_demangle(info.function, NULL, NULL, &status);
+            const char* function = (status == 0) ? demangled : info.function;
+            // Demangled C++ names already include their parameters.
+            const char* parameters = (status == 0) ? "" : "()";
+            if (info.file != NULL)
+                swprintf(line, lineSize, L"    %s (%u): %s!%.*s%s + 0x%lX bytes\n", info.file, info.line, info.module,
+                    MAX_SYMBOL_NAME_LENGTH, function, parameters, (unsigned long)info.displacement);
+            else if (info.displacement == 0)
+                swprintf(line, lineSize, L"    %s!%.*s%s\n", info.module, MAX_SYMBOL_NAME_LENGTH, function, parameters);
+            else
+                swprintf(line, lineSize, L"    %s!%.*s%s + 0x%lX bytes\n", info.module, MAX_SYMBOL_NAME_LENGTH, function,
+                    parameters, (unsigned long)info.displacement);
+            free(demangled);
+        }
+        // A truncated line still ends the frame.
+        size_t lineLength = wcslen(line);
+        if ((lineLength == lineSize - 1) && (line[lineLength - 1] != L'\n'))
+            line[lineLength - 1] = L'\n';
+        length += lineLength;
+    }
+    text[length] = L'\0';
+
+    if (!__sync_bool_compare_and_swap(&m_rendered, (WCHAR*)NULL, text)) {
+        // Another thread resolved this stack in the meantime.
+        delete [] text;
+        return 0;
+    }
+    m_resolvedLength = (UINT32)length;
+    m_status |= CALLSTACK_STATUS_NOTSTARTUPCRT;
+    return unresolvedFunctionsCount;
+}
+
+// getResolvedCallstack - Obtains the rendition of the CallStack created by
+//   resolve, resolving it first if necessary.
+//
+//  - showInternalFrames (IN): Ignored, no frame is known to be internal.
+//
+//  Return Value:
+//
+//    Returns the rendered call stack, which stays valid as long as the
+//    CallStack.
+//
+const WCHAR* CallStack::getResolvedCallstack( BOOL showinternalframes, BOOL skipStartupLeaks)
+{
+    resolve(showinternalframes, skipStartupLeaks);
+    return m_rendered;
+}
+
+// hashFrames - Computes the hash behind the "Leak Hash" once all frames have
+//   been pushed. Both walks compute it the same way, so a stack has the same
+//   hash whichever captured it.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CallStack::hashFrames ()
+{
+    DWORD hashcode = STACKHASH_SEED;
+    for (UINT32 frame = 0; frame < m_size; frame++) {
+        hashcode = CalculateCRC32((*this)[frame], hashcode);
+    }
+    m_hashValue = hashcode;
+}
+
+// getStackTrace - Traces the stack as far back as possible, or until 'maxdepth'
+//   frames have been traced. Populates the CallStack with one entry for each
+//   stack frame traced, starting at the frame which returns to the hook that
+//   entered VLD's code.
+//
+//   Note: This function follows the chain of frame pointers, starting at the
+//     hook's own frame. Each frame must lie within the thread's stack, above
+//     the previous one, so a frame pointer used for something else by a
+//     function compiled without them ends the walk instead of crashing it.
+//
+//  - maxdepth (IN): Maximum number of frames to trace back.
+//
+//  - context (IN): Frame address and return address of the hook at which to
+//      begin the stack trace.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID FastCallStack::getStackTrace (UINT32 maxdepth, const context_t& context)
+{
+    StatTimer timer(STATS_STACK_CAPTURE);
+    UINT32  count = 0;
+    UINT_PTR function = context.func;
+    if (function != 0)
+    {
+        count++;
+        push_back(function);
+    }
+
+    UINT_PTR low, high;
+    if ((context.bp != 0) && GetStackLimits(low, high)) {
+        // Each frame starts with the caller's frame pointer, followed by the
+        // return address.
+        UINT_PTR framepointer = context.bp;
+        while ((count < maxdepth) && IsOnStack(framepointer + sizeof(UINT_PTR), low, high)) {
+            UINT_PTR* frame = (UINT_PTR*)framepointer;
+            if (frame[1] == 0) {
+                // End of stack.
+                break;
+            }
+            count++;
+            push_back(frame[1]);
+            if (frame[0] <= framepointer) {
+                // The caller's frame must be further up the stack.
+                break;
+            }
+            framepointer = frame[0];
+        }
+    }
+    else {
+        m_status |= CALLSTACK_STATUS_INCOMPLETE;
+    }
+
+    // Compute the hash behind the "Leak Hash" once, now that all frames are
+    // known.
+    hashFrames();
+}
+
+// getStackTrace - Traces the stack as far back as possible, or until 'maxdepth'
+//   frames have been traced. Populates the CallStack with one entry for each
+//   stack frame traced, starting at the frame which returns to the hook that
+//   entered VLD's code.
+//
+//   Note: On x86-64 the stack is unwound with the call frame information
+//     (.eh_frame) of the loaded modules, so frames of functions compiled
+//     without frame pointers are found too. The walk starts in this function,
+//     and VLD's own frames are unwound until the hook's return address is
+//     reached. Elsewhere the stack is unwound by backtrace.
+//
+//  - maxdepth (IN): Maximum number of frames to trace back.
+//
+//  - context (IN): Return address of the hook at which to begin the stack
+//      trace.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID SafeCallStack::getStackTrace (UINT32 maxdepth, const context_t& context)
+{
+    StatTimer timer(STATS_STACK_CAPTURE);
+    UINT32  count = 0;
+    UINT_PTR function = context.func;
+    if (function != 0)
+    {
+        count++;
+        push_back(function);
+    }
+
+#if defined(__x86_64__)
+    UINT_PTR low, high;
+    if (!GetStackLimits(low, high)) {
+        m_status |= CALLSTACK_STATUS_INCOMPLETE;
+        hashFrames();
+        return;
+    }
+
+    // The registers of this frame.
+    UINT_PTR pc, sp, bp;
+    asm volatile ("leaq 0(%%rip), %0\n\t"
+                  "movq %%rsp, %1\n\t"
+                  "movq %%rbp, %2" : "=r" (pc), "=r" (sp), "=r" (bp));
+
+    cfacache_t *cache = GetCfaCache();
+    UINT32 internalframes = 0;
+    bool   reachedhook = false;
+    while (count < maxdepth) {
+        cfarule_t rule;
+        if (!FindCfaRule(cache, pc, rule)) {
+            // The frame can't be unwound. Couldn't trace back through any more
+            // frames.
+            m_status |= CALLSTACK_STATUS_INCOMPLETE;
+            break;
+        }
+        UINT_PTR cfa = ((rule.cfaRegister == CFA_REGISTER_SP) ? sp : bp) + (LONG64)rule.cfaOffset;
+        UINT_PTR returnaddress = cfa + (LONG64)rule.raOffset;
+        UINT_PTR savedbp = cfa + (LONG64)rule.bpOffset;
+        if ((cfa <= sp) || !IsOnStack(returnaddress, low, high) || (rule.bpSaved && !IsOnStack(savedbp, low, high))) {
+            // The stack pointer left the stack.
+            m_status |= CALLSTACK_STATUS_INCOMPLETE;
+            break;
+        }
+        pc = *(UINT_PTR*)returnaddress;
+        sp = cfa;
+        if (rule.bpSaved)
+            bp = *(UINT_PTR*)savedbp;
+        if (pc == 0) {
+            // End of stack.
+            break;
+        }
+
+        if (!reachedhook) {
+            // Skip VLD's own frames.
+            reachedhook = (pc == context.fp);
+            if (!reachedhook) {
+                if (++internalframes == MAX_INTERNAL_FRAMES)
+                    break;
+                continue;
+            }
+        }
+        count++;
+        push_back(pc);
+    }
+#else
+    void* myFrames [MAX_CAPTURED_FRAMES];
+    UINT32 maxframes = (maxdepth + 10 < MAX_CAPTURED_FRAMES) ? maxdepth + 10 : MAX_CAPTURED_FRAMES;
+    maxframes = (UINT32)backtrace(myFrames, (int)maxframes);
+    UINT32  startIndex = 0;
+    for (UINT32 frame = 0; frame < maxframes; frame++) {
+        if ((UINT_PTR)myFrames[frame] == context.fp) {
+            startIndex = frame;
+            break;
+        }
+    }
+
+    for (UINT32 frame = startIndex; (frame < maxframes) && (count < maxdepth); frame++) {
+        count++;
+        push_back((UINT_PTR)myFrames[frame]);
+    }
+#endif
+
+    // Compute the hash behind the "Leak Hash" once, now that all frames are
+    // known.
+    hashFrames();
+}
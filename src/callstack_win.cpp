@@ -0,0 +1,848 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - CallStack Capture and Resolution (Windows)
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#define VLDBUILD
+#include "callstack.h"  // This class' header.
+#include "internalstats.h"  // Provides the counters of VLD's own operations.
+#include "utility.h"    // Provides various utility functions.
+#include "vldheap.h"    // Provides internal new and delete operators.
+#include "vldint.h"     // Provides access to VLD internals.
+#include "cppformat\format.h"
+
+// Imported global variables.
+extern HANDLE             g_currentProcess;
+extern HANDLE             g_currentThread;
+extern CriticalSection    g_heapMapLock;
+extern VisualLeakDetector g_vld;
+extern DbgHelp g_DbgHelp;
+extern volatile LONG      g_modulesGeneration;
+
+// Functions whose allocations are made by the CRT during startup, and are only
+// freed after VLD has reported leaks. Extended by CrtStartupFunctions in vld.ini.
+static LPCWSTR s_crtStartupFunctions [] = {
+    L"_malloc_crt*",
+    L"_calloc_crt*",
+    L"*CRT_INIT",
+    L"*initterm_e",
+    L"_cinit*",
+    L"std::`dynamic initializer for '*",
+    // VS2008 Release
+    L"std::locale::facet::facet_Register",
+    // VS2010 Release
+    L"std::locale::facet::_Facet_Register",
+    // VS2012 Release
+    L"std::locale::_Init()*",
+    L"std::basic_streambuf<*",
+    // VS2015
+    L"common_initialize_environment_nolock<*",
+    L"common_configure_argv<*",
+    L"__acrt_initialize*",
+    L"__acrt_allocate_buffer_for_argv*",
+    L"_register_onexit_function*",
+    // VS2015 Release
+    L"setlocale",
+    L"_wsetlocale",
+    L"_Getctype",
+    L"std::_Facet_Register",
+    L"*>::_Getcat",
+};
+
+// Functions past which there is no reason going further down the stack looking
+// for CRT startup code.
+static LPCWSTR s_crtEntryFunctions [] = {
+    L"*DllMainCRTStartup",
+    L"*mainCRTStartup",
+    L"`dynamic initializer for '*",
+};
+
+// Source files internal to the heap. Extended by InternalSourceFiles in vld.ini.
+static LPCWSTR s_internalSourceFiles [] = {
+    // VS2015
+    L"*\\atlmfc\\include\\atlsimpstr.h",
+    L"*\\atlmfc\\include\\cstringt.h",
+    L"*\\atlmfc\\src\\mfc\\afxmem.cpp",
+    L"*\\atlmfc\\src\\mfc\\strcore.cpp",
+    L"*\\vcstartup\\src\\heap\\new_scalar.cpp",
+    L"*\\vcstartup\\src\\heap\\new_array.cpp",
+    L"*\\vcstartup\\src\\heap\\new_debug.cpp",
+    L"*\\ucrt\\src\\appcrt\\heap\\align.cpp",
+    L"*\\ucrt\\src\\appcrt\\heap\\malloc.cpp",
+    L"*\\ucrt\\src\\appcrt\\heap\\debug_heap.cpp",
+    // VS2013
+    L"f:\\dd\\vctools\\crt\\crtw32\\*",
+    // VS2010
+    L"*\\crt\\src\\afxmem.cpp",
+    L"*\\crt\\src\\dbgheap.c",
+    L"*\\crt\\src\\dbgnew.cpp",
+    L"*\\crt\\src\\dbgmalloc.c",
+    L"*\\crt\\src\\dbgcalloc.c",
+    L"*\\crt\\src\\dbgrealloc.c",
+    L"*\\crt\\src\\dbgdel.cp",
+    L"*\\crt\\src\\new.cpp",
+    L"*\\crt\\src\\newaop.cpp",
+    L"*\\crt\\src\\malloc.c",
+    L"*\\crt\\src\\realloc.c",
+    L"*\\crt\\src\\free.c",
+    L"*\\crt\\src\\strdup.c",
+    L"*\\crt\\src\\wcsdup.c",
+    L"*\\vc\\include\\xmemory0",
+};
+
+CallStack* CallStack::Create(BOOL safe_stack_walk)
+{
+    CallStack* result = NULL;
+    if (safe_stack_walk) {
+        result = new SafeCallStack();
+    }
+    else {
+        result = new FastCallStack();
+    }
+    return result;
+}
+
+LPCWSTR CallStack::getFunctionName(SIZE_T programCounter, DWORD64& displacement64,
+    SYMBOL_INFO* functionInfo, CriticalSectionLocker<DbgHelp>& locker) const
+{
+    // Initialize structures passed to the symbol handler.
+    functionInfo->SizeOfStruct = sizeof(SYMBOL_INFO);
+    functionInfo->MaxNameLen = MAX_SYMBOL_NAME_LENGTH;
+
+    // Try to get the name of the function containing this program
+    // counter address.
+    displacement64 = 0;
+    LPCWSTR functionName;
+    DbgTrace(L"dbghelp32.dll %i: SymFromAddrW\n", GetCurrentThreadId());
+    if (g_DbgHelp.SymFromAddrW(g_currentProcess, programCounter, &displacement64, functionInfo, locker)) {
+        functionName = functionInfo->Name;
+    }
+    else {
+        // GetFormattedMessage( GetLastError() );
+        fmt::WArrayWriter wf(functionInfo->Name, MAX_SYMBOL_NAME_LENGTH);
+        wf.write(L"" ADDRESSCPPFORMAT, programCounter);
+        functionName = wf.c_str();
+        displacement64 = 0;
+    }
+    return functionName;
+}
+
+DWORD CallStack::resolveFunction(SIZE_T programCounter, IMAGEHLP_LINEW64* sourceInfo, DWORD displacement,
+    LPCWSTR functionName, LPWSTR stack_line, DWORD stackLineSize) const
+{
+    WCHAR callingModuleName[260];
+    HMODULE hCallingModule = GetCallingModule(programCounter);
+    LPWSTR moduleName = L"(Module name unavailable)";
+    if (hCallingModule &&
+        GetModuleFileName(hCallingModule, callingModuleName, _countof(callingModuleName)) > 0)
+    {
+        moduleName = wcsrchr(callingModuleName, L'\\');
+        if (moduleName == NULL)
+            moduleName = wcsrchr(callingModuleName, L'/');
+        if (moduleName != NULL)
+            moduleName++;
+        else
+            moduleName = callingModuleName;
+    }
+
+    fmt::WArrayWriter w(stack_line, stackLineSize);
+    // Display the current stack frame's information.
+    if (sourceInfo)
+    {
+        if (displacement == 0)
+        {
+            w.write(L"    {} ({}): {}!{}()\n",
+                sourceInfo->FileName, sourceInfo->LineNumber, moduleName,
+                functionName);
+        }
+        else
+        {
+            w.write(L"    {} ({}): {}!{}() + 0x{:X} bytes\n",
+                sourceInfo->FileName, sourceInfo->LineNumber, moduleName,
+                functionName, displacement);
+        }
+    }
+    else
+    {
+        if (displacement == 0)
+        {
+            w.write(L"    {}!{}()\n",
+                moduleName, functionName);
+        }
+        else
+        {
+            w.write(L"    {}!{}() + 0x{:X} bytes\n",
+                moduleName, functionName, displacement);
+        }
+    }
+    DWORD NumChars = (DWORD)w.size();
+    stack_line[NumChars] = '\0';
+    return NumChars;
+}
+
+
+// isCrtStartupAlloc - Determines whether the memory leak was generated from crt startup code.
+// This is not an actual memory leaks as it is freed by crt after the VLD object has been destroyed.
+//
+//  Return Value:
+//
+//    true if isCrtStartupModule for any callstack frame returns true.
+//
+bool CallStack::isCrtStartupAlloc()
+{
+    if (m_status & CALLSTACK_STATUS_STARTUPCRT) {
+        return true;
+    } else if (m_status & CALLSTACK_STATUS_NOTSTARTUPCRT) {
+        return false;
+    }
+
+    CriticalSectionLocker<DbgHelp> locker(g_DbgHelp);
+    g_vld.loadSymbols(locker);
+
+    // Iterate through each frame in the call stack.
+    for (UINT32 frame = 0; frame < m_size; frame++) {
+        SIZE_T programCounter = (*this)[frame];
+        frameinfo_t* info = g_vld.m_frameTable->getFrameInfo(programCounter, locker);
+        m_status |= classifyFrame(programCounter, info, locker);
+        if (m_status & CALLSTACK_STATUS_STARTUPCRT) {
+            return true;
+        } else if (m_status & CALLSTACK_STATUS_NOTSTARTUPCRT) {
+            return false;
+        }
+    }
+
+    m_status |= CALLSTACK_STATUS_NOTSTARTUPCRT;
+    return false;
+}
+
+
+// dump - Dumps a nicely formatted rendition of the CallStack, including
+//   symbolic information (function names and line numbers) if available.
+//
+//   Note: The symbol handler is initialized on demand, if needed. Callers
+//     must hold the loader lock if they also hold g_heapMapLock.
+//
+//  - showinternalframes (IN): If true, then all frames in the CallStack will be
+//      dumped. Otherwise, frames internal to the heap will not be dumped.
+//
+//  Return Value:
+//
+//    None.
+//
+void CallStack::dump(BOOL showInternalFrames, BOOL skipStartupLeaks)
+{
+    if (!m_resolved) {
+        resolve(showInternalFrames, skipStartupLeaks);
+    }
+
+    // The stack was reoslved already
+    if (m_resolved) {
+        if (m_rendered) {
+            return Print(m_rendered);
+        }
+        WCHAR* text = render();
+        Print(text);
+        delete [] text;
+    }
+}
+
+// Resolve - Creates a nicely formatted rendition of the CallStack, including
+//   symbolic information (function names and line numbers) if available. and
+//   saves it for later retrieval.
+//
+//   Note: The symbol handler is initialized on demand, if needed. Callers
+//     must hold the loader lock if they also hold g_heapMapLock. Several
+//     threads may resolve the same CallStack concurrently; only one of them
+//     does the work.
+//
+//  - showInternalFrames (IN): If true, then all frames in the CallStack will be
+//      dumped. Otherwise, frames internal to the heap will not be dumped.
+//
+//  Return Value:
+//
+//    None.
+//
+int CallStack::resolve(BOOL showInternalFrames, BOOL skipStartupLeaks)
+{
+    if (m_resolved)
+    {
+        // already resolved, no need to do it again
+        // resolving twice may report an incorrect module for the stack frames
+        // if the memory was leaked in a dynamic library that was already unloaded.
+        return 0;
+    }
+
+    if (m_status & CALLSTACK_STATUS_STARTUPCRT) {
+        // there is no need to resolve a leak that will not be reported
+        return 0;
+    }
+
+    if (m_status & CALLSTACK_STATUS_INCOMPLETE) {
+        // This call stack appears to be incomplete. Using StackWalk64 may be
+        // more reliable.
+        Report(L"    HINT: The following call stack may be incomplete. Setting \"StackWalkMethod\"\n"
+            L"      in the vld.ini file to \"safe\" instead of \"fast\" may result in a more\n"
+            L"      complete stack trace.\n");
+    }
+
+    StatTimer timer(STATS_SYMBOLS);
+    int unresolvedFunctionsCount = 0;
+    bool isPrevFrameInternal = false;
+    const framedesc_t* prevDesc = NULL;
+    CriticalSectionLocker<DbgHelp> locker(g_DbgHelp);
+    if (m_resolved) {
+        // Another thread resolved this stack while we were waiting for the lock.
+        return 0;
+    }
+    g_vld.loadSymbols(locker);
+
+    // Every frame adds at most one description: an internal frame is only
+    // added in place of the frame that follows it. The descriptions are only
+    // published in m_resolved once complete, since leak reports read them
+    // without holding the lock.
+    FrameTable* frameTable = g_vld.m_frameTable;
+    const framedesc_t** resolved = new const framedesc_t* [m_size + 1];
+    UINT32 resolvedCount = 0;
+    UINT32 resolvedLength = 0;
+
+    // Iterate through each frame in the call stack.
+    for (UINT32 frame = 0; frame < m_size; frame++)
+    {
+        // Symbolize and classify this program counter address, unless that
+        // was already done for another call stack.
+        SIZE_T programCounter = (*this)[frame];
+        frameinfo_t* info = frameTable->getFrameInfo(programCounter, locker);
+        if (!(info->flags & FRAMEINFO_RESOLVED))
+            resolveFrame(programCounter, info, locker);
+        if (info->flags & FRAMEINFO_VLD)
+            continue;
+
+        if (skipStartupLeaks) {
+            if (!(m_status & (CALLSTACK_STATUS_STARTUPCRT | CALLSTACK_STATUS_NOTSTARTUPCRT))) {
+                m_status |= info->crtStatus;
+            }
+            if (m_status & CALLSTACK_STATUS_STARTUPCRT) {
+                delete[] resolved;
+                return 0;
+            }
+        }
+
+        // Don't show frames in files internal to the heap.
+        bool isFrameInternal = !showInternalFrames && (info->flags & FRAMEINFO_INTERNAL);
+
+        // show one allocation function for context
+        if (prevDesc && !isFrameInternal && isPrevFrameInternal) {
+            resolvedLength += prevDesc->length;
+            resolved[resolvedCount++] = prevDesc;
+        }
+        isPrevFrameInternal = isFrameInternal;
+        prevDesc = info->desc;
+
+        if (prevDesc && !isFrameInternal) {
+            resolvedLength += prevDesc->length;
+            resolved[resolvedCount++] = prevDesc;
+        }
+    } // end for loop
+
+    m_resolvedCount = resolvedCount;
+    m_resolvedLength = resolvedLength;
+    m_resolved = resolved;
+    m_status |= CALLSTACK_STATUS_NOTSTARTUPCRT;
+    return unresolvedFunctionsCount;
+}
+
+// getResolvedCallstack - Obtains the nicely formatted rendition of the
+//   CallStack created by resolve, resolving it first if necessary.
+//
+//  - showInternalFrames (IN): If true, then all frames in the CallStack will be
+//      included. Otherwise, frames internal to the heap will not be included.
+//
+//  Return Value:
+//
+//    Returns the rendered call stack, which stays valid as long as the
+//    CallStack, or NULL if it has not been resolved.
+//
+const WCHAR* CallStack::getResolvedCallstack( BOOL showinternalframes, BOOL skipStartupLeaks)
+{
+    resolve(showinternalframes, skipStartupLeaks);
+    if (m_resolved && !m_rendered) {
+        CriticalSectionLocker<DbgHelp> locker(g_DbgHelp);
+        if (!m_rendered) {
+            m_rendered = render();
+        }
+    }
+    return m_rendered;
+}
+
+// render - Concatenates the descriptions of the resolved frames.
+//
+//  Return Value:
+//
+//    Returns the rendered call stack. The caller is responsible for freeing it
+//    with delete [].
+//
+WCHAR* CallStack::render () const
+{
+    WCHAR* text = new WCHAR [m_resolvedLength + 1];
+    WCHAR* end = text;
+    for (UINT32 index = 0; index < m_resolvedCount; index++) {
+        memcpy(end, m_resolved[index]->text, m_resolved[index]->length * sizeof(WCHAR));
+        end += m_resolved[index]->length;
+    }
+    *end = L'\0';
+    return text;
+}
+
+// InitFramePatterns - Adds VLD's built-in patterns to the pattern sets used to
+//   classify frames. Patterns from vld.ini are added by the caller.
+//
+//  - crtStartupFunctions (IN/OUT): Receives the patterns of CRT startup
+//      functions (CALLSTACK_STATUS_STARTUPCRT) and of the CRT entry points
+//      (CALLSTACK_STATUS_NOTSTARTUPCRT).
+//
+//  - internalSourceFiles (IN/OUT): Receives the patterns of source files
+//      internal to the heap.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CallStack::InitFramePatterns (FramePatternSet &crtStartupFunctions, FramePatternSet &internalSourceFiles)
+{
+    for (size_t i = 0; i < _countof(s_crtStartupFunctions); i++)
+        crtStartupFunctions.add(s_crtStartupFunctions[i], wcslen(s_crtStartupFunctions[i]), CALLSTACK_STATUS_STARTUPCRT);
+    for (size_t i = 0; i < _countof(s_crtEntryFunctions); i++)
+        crtStartupFunctions.add(s_crtEntryFunctions[i], wcslen(s_crtEntryFunctions[i]), CALLSTACK_STATUS_NOTSTARTUPCRT);
+    for (size_t i = 0; i < _countof(s_internalSourceFiles); i++)
+        internalSourceFiles.add(s_internalSourceFiles[i], wcslen(s_internalSourceFiles[i]), 0x1);
+}
+
+// isCrtStartupFunction - Classifies a function name against the CRT startup
+//   patterns.
+//
+//  - functionName (IN): The function name.
+//
+//  Return Value:
+//
+//    Returns CALLSTACK_STATUS_STARTUPCRT if the function is CRT startup code,
+//    CALLSTACK_STATUS_NOTSTARTUPCRT if it is a CRT entry point, past which
+//    there is no startup code, or 0 otherwise.
+//
+UINT CallStack::isCrtStartupFunction( LPCWSTR functionName ) const
+{
+    UINT32 flags = g_vld.m_crtStartupPatterns->match(functionName, wcslen(functionName));
+    if (flags & CALLSTACK_STATUS_STARTUPCRT)
+        return CALLSTACK_STATUS_STARTUPCRT;
+    return flags & CALLSTACK_STATUS_NOTSTARTUPCRT;
+}
+
+// isInternalModule - Determines whether a source file is internal to the heap.
+//
+//  - filename (IN): The source file name.
+//
+//  Return Value:
+//
+//    Returns true if the file matches one of the internal source file
+//    patterns.
+//
+bool CallStack::isInternalModule( const PWSTR filename ) const
+{
+    return g_vld.m_internalFilePatterns->match(filename, wcslen(filename)) != 0;
+}
+
+// classifyFrame - Determines whether a frame is CRT startup code. The function
+//   name is only looked up the first time a program counter is classified.
+//
+//  - programCounter (IN): The program counter of the frame.
+//
+//  - info (IN/OUT): What is known about the program counter.
+//
+//  - locker (IN): Proof that the caller holds the DbgHelp lock.
+//
+//  Return Value:
+//
+//    Returns the CRT startup status of the frame, as isCrtStartupFunction.
+//
+UINT CallStack::classifyFrame(SIZE_T programCounter, frameinfo_t* info, CriticalSectionLocker<DbgHelp>& locker) const
+{
+    if (!(info->flags & FRAMEINFO_CLASSIFIED)) {
+        DWORD64 displacement64;
+        BYTE symbolBuffer[sizeof(SYMBOL_INFO) + MAX_SYMBOL_NAME_SIZE];
+        LPCWSTR functionName = getFunctionName(programCounter, displacement64, (SYMBOL_INFO*)&symbolBuffer, locker);
+        info->crtStatus = isCrtStartupFunction(functionName);
+        info->flags |= FRAMEINFO_CLASSIFIED;
+    }
+    return info->crtStatus;
+}
+
+// resolveFrame - Symbolizes a frame, classifies it, and interns its
+//   description in the frame table.
+//
+//  - programCounter (IN): The program counter of the frame.
+//
+//  - info (IN/OUT): What is known about the program counter. Receives the
+//      description and classification of the frame.
+//
+//  - locker (IN): Proof that the caller holds the DbgHelp lock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CallStack::resolveFrame(SIZE_T programCounter, frameinfo_t* info, CriticalSectionLocker<DbgHelp>& locker) const
+{
+    info->flags |= FRAMEINFO_RESOLVED;
+    if (GetCallingModule(programCounter) == g_vld.m_vldBase) {
+        info->flags |= FRAMEINFO_VLD;
+        return;
+    }
+
+    DWORD64 displacement64;
+    BYTE symbolBuffer[sizeof(SYMBOL_INFO) + MAX_SYMBOL_NAME_SIZE];
+    LPCWSTR functionName = getFunctionName(programCounter, displacement64, (SYMBOL_INFO*)&symbolBuffer, locker);
+    if (!(info->flags & FRAMEINFO_CLASSIFIED)) {
+        info->crtStatus = isCrtStartupFunction(functionName);
+        info->flags |= FRAMEINFO_CLASSIFIED;
+    }
+
+    // It turns out that calls to SymGetLineFromAddrW64 may free the very memory we are scrutinizing here
+    // in this method. If this is the case, m_Resolved will be null after SymGetLineFromAddrW64 returns.
+    // When that happens there is nothing we can do except crash.
+    IMAGEHLP_LINE64  sourceInfo = { 0 };
+    sourceInfo.SizeOfStruct = sizeof(IMAGEHLP_LINE64);
+    DWORD            displacement = 0;
+    DbgTrace(L"dbghelp32.dll %i: SymGetLineFromAddrW64\n", GetCurrentThreadId());
+    BOOL foundline = g_DbgHelp.SymGetLineFromAddrW64(g_currentProcess, programCounter, &displacement, &sourceInfo, locker);
+    if (foundline && isInternalModule(sourceInfo.FileName)) {
+        // Frames in files internal to the heap are only shown on request.
+        info->flags |= FRAMEINFO_INTERNAL;
+    }
+
+    // Use static here to increase performance, and avoid heap allocs.
+    // It's thread safe because of the DbgHelp lock.
+    static WCHAR stack_line[MAXREPORTLENGTH + 1] = L"";
+    if (!foundline)
+        displacement = (DWORD)displacement64;
+    DWORD NumChars = resolveFunction( programCounter, foundline ? &sourceInfo : NULL,
+        displacement, functionName, stack_line, _countof( stack_line ));
+    if (NumChars > 0) {
+        info->desc = g_vld.m_frameTable->intern(stack_line, NumChars);
+    }
+}
+
+// getStackTrace - Traces the stack as far back as possible, or until 'maxdepth'
+//   frames have been traced. Populates the CallStack with one entry for each
+//   stack frame traced.
+//
+//   Note: This function uses a very efficient method to walk the stack from
+//     frame to frame, so it is quite fast. However, unconventional stack frames
+//     (such as those created when frame pointer omission optimization is used)
+//     will not be successfully walked by this function and will cause the
+//     stack trace to terminate prematurely.
+//
+//  - maxdepth (IN): Maximum number of frames to trace back.
+//
+//  - framepointer (IN): Frame (base) pointer at which to begin the stack trace.
+//      If NULL, then the stack trace will begin at this function.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID FastCallStack::getStackTrace (UINT32 maxdepth, const context_t& context)
+{
+    StatTimer timer(STATS_STACK_CAPTURE);
+    UINT32  count = 0;
+    UINT_PTR function = context.func;
+    if (function != NULL)
+    {
+        count++;
+        push_back(function);
+    }
+
+/*#if defined(_M_IX86)
+    UINT_PTR* framePointer = (UINT_PTR*)context.BPREG;
+    while (count < maxdepth) {
+        if (*framePointer < (UINT_PTR)framePointer) {
+            if (*framePointer == NULL) {
+                // Looks like we reached the end of the stack.
+                break;
+            }
+            else {
+                // Invalid frame pointer. Frame pointer addresses should always
+                // increase as we move up the stack.
+                m_status |= CALLSTACK_STATUS_INCOMPLETE;
+                break;
+            }
+        }
+        if (*framePointer & (sizeof(UINT_PTR*) - 1)) {
+            // Invalid frame pointer. Frame pointer addresses should always
+            // be aligned to the size of a pointer. This probably means that
+            // we've encountered a frame that was created by a module built with
+            // frame pointer omission (FPO) optimization turned on.
+            m_status |= CALLSTACK_STATUS_INCOMPLETE;
+            break;
+        }
+        if (IsBadReadPtr((UINT*)*framePointer, sizeof(UINT_PTR*))) {
+            // Bogus frame pointer. Again, this probably means that we've
+            // encountered a frame built with FPO optimization.
+            m_status |= CALLSTACK_STATUS_INCOMPLETE;
+            break;
+        }
+        count++;
+        push_back(*(framePointer + 1));
+        framePointer = (UINT_PTR*)*framePointer;
+    }
+#elif defined(_M_X64)*/
+    UINT32 maxframes = min(62, maxdepth + 10);
+    UINT_PTR* myFrames = new UINT_PTR[maxframes];
+    ZeroMemory(myFrames, sizeof(UINT_PTR) * maxframes);
+    ULONG BackTraceHash;
+    maxframes = RtlCaptureStackBackTrace(0, maxframes, reinterpret_cast<PVOID*>(myFrames), &BackTraceHash);
+    m_hashValue = BackTraceHash;
+    UINT32  startIndex = 0;
+    while (count < maxframes) {
+        if (myFrames[count] == 0)
+            break;
+        if (myFrames[count] == context.fp)
+            startIndex = count;
+        count++;
+    }
+    count = startIndex;
+    while (count < maxframes) {
+        if (myFrames[count] == 0)
+            break;
+        push_back(myFrames[count]);
+        count++;
+    }
+    delete [] myFrames;
+//#endif
+}
+
+#if defined(_M_X64)
+// getUnwindCache - Obtains the calling thread's function table cache. The cache
+//   is allocated the first time a thread walks its stack, and is emptied if
+//   modules have been loaded or unloaded since the thread last used it.
+//
+//  Return Value:
+//
+//    Returns a pointer to the calling thread's cache.
+//
+unwindcache_t* CallStack::getUnwindCache ()
+{
+    tls_t* tls = g_vld.getTls();
+    unwindcache_t* cache = tls->unwindCache;
+    LONG generation = g_modulesGeneration;
+    if (cache == NULL) {
+        cache = new unwindcache_t;
+        tls->unwindCache = cache;
+        cache->generation = generation - 1;
+    }
+    if (cache->generation != generation) {
+        ZeroMemory(cache->entries, sizeof(cache->entries));
+        cache->generation = generation;
+    }
+    return cache;
+}
+
+// lookupFunctionEntry - Finds the function table entry describing how to unwind
+//   the frame of the function containing the specified address. Entries found
+//   in the thread's cache are returned without calling into ntdll.
+//
+//  - cache (IN/OUT): The calling thread's function table cache.
+//
+//  - programcounter (IN): Address for which to look up the function table entry.
+//
+//  - imagebase (OUT): Receives the base address of the image containing the
+//      function.
+//
+//  Return Value:
+//
+//    Returns a pointer to the function table entry, or NULL if the address is
+//    not covered by any function table (i.e. it belongs to a leaf function).
+//
+static PRUNTIME_FUNCTION lookupFunctionEntry (unwindcache_t* cache, DWORD64 programcounter, PDWORD64 imagebase)
+{
+    unwindcache_t::entry_t& entry = cache->entries[(programcounter >> 2) & (UNWIND_CACHE_SIZE - 1)];
+    if (entry.pc == programcounter) {
+        *imagebase = entry.imageBase;
+        return entry.function;
+    }
+
+    PRUNTIME_FUNCTION function = RtlLookupFunctionEntry(programcounter, imagebase, NULL);
+    if (function != NULL) {
+        // Leaf functions are not cached: a miss for them is cheap, and code
+        // generated at runtime may register a function table for them later.
+        entry.pc = programcounter;
+        entry.imageBase = *imagebase;
+        entry.function = function;
+    }
+    return function;
+}
+#endif // _M_X64
+
+// getStackTrace - Traces the stack as far back as possible, or until 'maxdepth'
+//   frames have been traced. Populates the CallStack with one entry for each
+//   stack frame traced.
+//
+//   Note: This function does not rely on frame pointers, so it is able to walk
+//     stack frames that do not follow the conventional stack frame layout. On
+//     x64 each frame is unwound with RtlVirtualUnwind, using the function table
+//     of the image it belongs to. The lookups are cached per thread, and no lock
+//     is held while walking, so threads allocating concurrently do not wait for
+//     each other. On x86 there are no function tables, so the documented
+//     StackWalk64 API is used instead. It is *extremely* slow compared to
+//     walking frames by following frame (base) pointers, and it has to hold the
+//     DbgHelp lock, but it no longer holds the heap map lock: only mapping the
+//     finished call stack to its block is serialized with other threads.
+//
+//  - maxdepth (IN): Maximum number of frames to trace back.
+//
+//  - context (IN): Registers of the frame at which to begin the stack trace.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID SafeCallStack::getStackTrace (UINT32 maxdepth, const context_t& context)
+{
+    StatTimer timer(STATS_STACK_CAPTURE);
+    walkStack(maxdepth, context);
+
+    // Compute the hash behind the "Leak Hash" once, now that all frames are
+    // known.
+    DWORD hashcode = STACKHASH_SEED;
+    for (UINT32 frame = 0; frame < m_size; frame++) {
+        hashcode = CalculateCRC32((*this)[frame], hashcode);
+    }
+    m_hashValue = hashcode;
+}
+
+// walkStack - Does the actual stack walk for getStackTrace.
+//
+//  - maxdepth (IN): Maximum number of frames to trace back.
+//
+//  - context (IN): Registers of the frame at which to begin the stack trace.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID SafeCallStack::walkStack (UINT32 maxdepth, const context_t& context)
+{
+    UINT32 count = 0;
+    UINT_PTR function = context.func;
+    if (function != NULL)
+    {
+        count++;
+        push_back(function);
+    }
+
+    if (context.IPREG == NULL)
+    {
+        return;
+    }
+
+    count++;
+    push_back(context.IPREG);
+
+    CONTEXT currentContext;
+    memset(&currentContext, 0, sizeof(currentContext));
+    currentContext.SPREG = context.SPREG;
+    currentContext.BPREG = context.BPREG;
+    currentContext.IPREG = context.IPREG;
+
+#if defined(_M_X64)
+    // Frames are only ever read from this thread's own stack.
+    NT_TIB* tib = (NT_TIB*)NtCurrentTeb();
+    DWORD64 stacklimit = (DWORD64)tib->StackLimit;
+    DWORD64 stackbase = (DWORD64)tib->StackBase;
+    unwindcache_t* cache = getUnwindCache();
+
+    // Walk the stack.
+    while (count < maxdepth) {
+        count++;
+        if ((currentContext.Rsp < stacklimit) || (currentContext.Rsp >= stackbase) ||
+            (currentContext.Rsp & (sizeof(DWORD64) - 1))) {
+            // The stack pointer left the stack. Couldn't trace back through
+            // any more frames.
+            m_status |= CALLSTACK_STATUS_INCOMPLETE;
+            break;
+        }
+
+        DWORD64 imagebase = 0;
+        PRUNTIME_FUNCTION entry = lookupFunctionEntry(cache, currentContext.Rip, &imagebase);
+        if (entry == NULL) {
+            // Leaf function: the return address is on top of the stack.
+            currentContext.Rip = *(PDWORD64)currentContext.Rsp;
+            currentContext.Rsp += sizeof(DWORD64);
+        }
+        else {
+            PVOID   handlerdata = NULL;
+            DWORD64 establisherframe = 0;
+            RtlVirtualUnwind(UNW_FLAG_NHANDLER, imagebase, currentContext.Rip, entry,
+                &currentContext, &handlerdata, &establisherframe, NULL);
+        }
+        if (currentContext.Rip == 0) {
+            // End of stack.
+            break;
+        }
+
+        // Push this frame's program counter onto the CallStack.
+        push_back((UINT_PTR)currentContext.Rip);
+    }
+#else
+    DWORD   architecture   = X86X64ARCHITECTURE;
+
+    // Initialize the STACKFRAME64 structure to be passed to StackWalk64().
+    // Required fields are AddrPC and AddrFrame.
+    STACKFRAME64 frame;
+    memset(&frame, 0x0, sizeof(frame));
+    frame.AddrPC.Offset       = currentContext.IPREG;
+    frame.AddrPC.Mode         = AddrModeFlat;
+    frame.AddrStack.Offset    = currentContext.SPREG;
+    frame.AddrStack.Mode      = AddrModeFlat;
+    frame.AddrFrame.Offset    = currentContext.BPREG;
+    frame.AddrFrame.Mode      = AddrModeFlat;
+    frame.Virtual             = TRUE;
+
+    CriticalSectionLocker<DbgHelp> locker(g_DbgHelp);
+
+    // Walk the stack.
+    while (count < maxdepth) {
+        count++;
+        DbgTrace(L"dbghelp32.dll %i: StackWalk64\n", GetCurrentThreadId());
+        if (!g_DbgHelp.StackWalk64(architecture, g_currentProcess, g_currentThread, &frame, &currentContext, NULL,
+            SymFunctionTableAccess64, SymGetModuleBase64, NULL, locker)) {
+                // Couldn't trace back through any more frames.
+                break;
+        }
+        if (frame.AddrFrame.Offset == 0) {
+            // End of stack.
+            break;
+        }
+
+        // Push this frame's program counter onto the CallStack.
+        push_back((UINT_PTR)frame.AddrPC.Offset);
+    }
+#endif // _M_X64
+}
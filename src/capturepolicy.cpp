@@ -0,0 +1,530 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - CapturePolicy Class Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD
+#include "capturepolicy.h"  // This class' header.
+#include "vldconfig.h"      // Provides ConfigStrToBool.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+#define CAPTURE_RULE_SEPARATOR  L';'        // Separates the rules of CaptureRules.
+#define CAPTURE_MAX_NAME        260         // Longest module or thread name matched. Must match MAX_PATH.
+#define CAPTURE_MAX_VALUE       100000000   // Largest depth or sampling rate.
+
+// IsBlank - Determines whether a character separates the fields of a rule.
+//
+//  - c (IN): The character.
+//
+//  Return Value:
+//
+//    Returns true if the character is a blank.
+//
+static bool IsBlank (wchar_t c)
+{
+    return (c == L' ') || (c == L'\t');
+}
+
+// KeyIs - Compares the key of a field with a key name, ignoring case.
+//
+//  - first (IN): The first character of the key.
+//
+//  - last (IN): Just past the last character of the key.
+//
+//  - key (IN): The key name, in lower case.
+//
+//  Return Value:
+//
+//    Returns true if the key is the key name.
+//
+static bool KeyIs (const wchar_t *first, const wchar_t *last, const wchar_t *key)
+{
+    for (; first < last; first++, key++) {
+        wchar_t c = ((*first >= L'A') && (*first <= L'Z')) ? (wchar_t)(*first + (L'a' - L'A')) : *first;
+        if (c != *key)
+            return false;
+    }
+    return (*key == L'\0');
+}
+
+// ToLower - Copies a name or a list of patterns, in lower case, so that they
+//   are matched ignoring case.
+//
+//  - first (IN): The first character to copy.
+//
+//  - last (IN): Just past the last character to copy.
+//
+//  - buffer (OUT): Receives the null-terminated copy.
+//
+//  - size (IN): Size of the buffer, in characters.
+//
+//  Return Value:
+//
+//    Returns the length of the copy, truncated to fit in the buffer.
+//
+static size_t ToLower (const wchar_t *first, const wchar_t *last, wchar_t *buffer, size_t size)
+{
+    size_t length = 0;
+    for (; (first < last) && (length < size - 1); first++)
+        buffer[length++] = ((*first >= L'A') && (*first <= L'Z')) ? (wchar_t)(*first + (L'a' - L'A')) : *first;
+    buffer[length] = L'\0';
+    return length;
+}
+
+// ParseNumber - Parses a decimal number, with an optional K, M or G suffix
+//   multiplying it by 2^10, 2^20 or 2^30.
+//
+//  - first (IN): The first character of the number.
+//
+//  - last (IN): Just past the last character of the number.
+//
+//  - suffixes (IN): If false, suffixes are not accepted.
+//
+//  - value (OUT): Receives the number.
+//
+//  Return Value:
+//
+//    Returns false if the text is not a number, or if the number doesn't fit
+//    in a SIZE_T.
+//
+static bool ParseNumber (const wchar_t *first, const wchar_t *last, bool suffixes, SIZE_T &value)
+{
+    const SIZE_T largest = (SIZE_T)-1;
+    SIZE_T number = 0;
+    const wchar_t *digit = first;
+    for (; (digit < last) && (*digit >= L'0') && (*digit <= L'9'); digit++) {
+        if (number > (largest - (*digit - L'0')) / 10)
+            return false;
+        number = number * 10 + (*digit - L'0');
+    }
+    if (digit == first)
+        return false;
+
+    UINT32 shift = 0;
+    if ((digit < last) && suffixes) {
+        switch (*digit++) {
+        case L'k': case L'K': shift = 10; break;
+        case L'm': case L'M': shift = 20; break;
+        case L'g': case L'G': shift = 30; break;
+        default: return false;
+        }
+    }
+    if ((digit != last) || (number > (largest >> shift)))
+        return false;
+    value = number << shift;
+    return true;
+}
+
+// ValidPatterns - Determines whether every pattern of a comma separated list
+//   is valid: not empty, and not made of two wildcards only. Patterns with a
+//   wildcard on both ends match the names containing the text in between.
+//
+//  - first (IN): The first character of the list.
+//
+//  - last (IN): Just past the last character of the list.
+//
+//  Return Value:
+//
+//    Returns true if the list is valid.
+//
+static bool ValidPatterns (const wchar_t *first, const wchar_t *last)
+{
+    while (first <= last) {
+        const wchar_t *end = first;
+        while ((end < last) && (*end != L','))
+            end++;
+        size_t length = end - first;
+        if ((length == 0) || ((length == 2) && (first[0] == FRAMEPATTERN_WILDCARD) && (first[1] == FRAMEPATTERN_WILDCARD)))
+            return false;
+        first = end + 1;
+    }
+    return true;
+}
+
+// AddPatterns - Adds every pattern of a comma separated list, as checked by
+//   ValidPatterns. FramePatterns doesn't match the patterns with a wildcard on
+//   both ends: "*text*" is added as the prefix pattern "text*" to another set,
+//   whose patterns are matched at every position of the names by
+//   MatchPatterns.
+//
+//  - patterns (IN/OUT): The exact, prefix and suffix patterns.
+//
+//  - infixes (IN/OUT): The patterns with a wildcard on both ends.
+//
+//  - list (IN): Null-terminated list of patterns.
+//
+//  - flags (IN): Flags returned by MatchPatterns for names matching the
+//      patterns.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID AddPatterns (CapturePatternSet &patterns, CapturePatternSet &infixes, const wchar_t *list, UINT32 flags)
+{
+    while (*list != L'\0') {
+        const wchar_t *end = list;
+        while ((*end != L'\0') && (*end != L','))
+            end++;
+        size_t length = end - list;
+        if ((length > 2) && (list[0] == FRAMEPATTERN_WILDCARD) && (end[-1] == FRAMEPATTERN_WILDCARD))
+            infixes.add(list + 1, length - 1, flags);
+        else
+            patterns.add(list, length, flags);
+        list = (*end != L'\0') ? end + 1 : end;
+    }
+}
+
+// MatchPatterns - Matches a name against the patterns added by AddPatterns.
+//
+//  - patterns (IN): The exact, prefix and suffix patterns.
+//
+//  - infixes (IN): The patterns with a wildcard on both ends.
+//
+//  - name (IN): The name, in lower case. Need not be null-terminated.
+//
+//  - length (IN): Length of the name, in characters.
+//
+//  Return Value:
+//
+//    Returns the union of the flags of the patterns matching the name.
+//
+static UINT32 MatchPatterns (const CapturePatternSet &patterns, const CapturePatternSet &infixes, const wchar_t *name,
+    size_t length)
+{
+    UINT32 flags = patterns.match(name, length);
+    if (infixes.size() > 0) {
+        for (size_t start = 0; start < length; start++)
+            flags |= infixes.match(name + start, length - start);
+    }
+    return flags;
+}
+
+// Constructor - Initializes the policy without any rule.
+//
+CapturePolicy::CapturePolicy ()
+{
+    size_t invalid;
+    m_generation = 1;
+    compile(L"", invalid);
+}
+
+// compile - Replaces the rules of the policy, and builds the decision table
+//   for the modules no module pattern matches. The rows of the other modules
+//   are built by moduleRow, as they are loaded.
+//
+//   Rules are separated by semicolons. Each rule is made of fields separated
+//   by blanks, in any order, each written key=value without blanks:
+//
+//     module=<patterns>    Modules the rule applies to. Default: all.
+//     thread=<patterns>    Threads the rule applies to, by name. Default: all.
+//     size=<min>-<max>     Sizes the rule applies to. Either bound may be
+//                          left out, and a single size may be given. Sizes
+//                          may end with K, M or G. Default: all.
+//     depth=<frames>       Most frames to capture. Default: MaxTraceFrames.
+//     sample=<n>           Only track one block in n. Default: 1.
+//     track=yes|no         Whether to track the blocks. Default: yes.
+//
+//   Patterns are separated by commas, and have the syntax of FramePatterns,
+//   or have a wildcard on both ends, such as *pool*, to match the names
+//   containing the text. Names are matched ignoring case. For example:
+//
+//     module=*.exe thread=worker* size=4K- depth=8; size=-16 track=no
+//
+//  - text (IN): Null-terminated rules, as the value of CaptureRules.
+//
+//  - invalid (OUT): Receives the number of rules which couldn't be parsed,
+//      or went beyond CAPTURE_MAX_RULES, and were left out.
+//
+//  Return Value:
+//
+//    Returns the number of rules compiled.
+//
+size_t CapturePolicy::compile (const wchar_t *text, size_t &invalid)
+{
+    m_ruleCount = 0;
+    m_anyModule = 0;
+    m_anyThread = 0;
+    m_modulePatterns.clear();
+    m_moduleInfixes.clear();
+    m_threadPatterns.clear();
+    m_threadInfixes.clear();
+    invalid = 0;
+
+    while (*text != L'\0') {
+        const wchar_t *end = text;
+        while ((*end != L'\0') && (*end != CAPTURE_RULE_SEPARATOR))
+            end++;
+        const wchar_t *first = text;
+        const wchar_t *last = end;
+        while ((first < last) && IsBlank(*first))
+            first++;
+        while ((last > first) && IsBlank(*(last - 1)))
+            last--;
+        if (first < last) {
+            if ((m_ruleCount < CAPTURE_MAX_RULES) && parseRule(first, last, m_ruleCount))
+                m_ruleCount++;
+            else
+                invalid++;
+        }
+        text = (*end != L'\0') ? end + 1 : end;
+    }
+
+    // Rules meant to exclude some allocations leave the others tracked, but
+    // rules meant to track some allocations don't.
+    m_trackUnmatched = true;
+    for (UINT32 index = 0; index < m_ruleCount; index++) {
+        if (m_rules[index].track)
+            m_trackUnmatched = false;
+    }
+
+    m_rowMasks[CAPTURE_ROW_ANY] = m_anyModule;
+    compileRow(CAPTURE_ROW_ANY, m_anyModule);
+    m_rowCount = 1;
+
+    // Make every thread match its name against the new thread patterns.
+    m_generation++;
+    return m_ruleCount;
+}
+
+// compileRow - Builds a row of the decision table.
+//
+//  - row (IN): The row.
+//
+//  - modulemask (IN): The rules whose module patterns match the modules of
+//      the row, including the rules without module patterns.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CapturePolicy::compileRow (UINT32 row, UINT32 modulemask)
+{
+    for (UINT32 sizeclass = 0; sizeclass < CAPTURE_SIZE_CLASSES; sizeclass++) {
+        // Sizes of the class: 0, or [2^(class - 1), 2^class - 1].
+        UINT64 low = (sizeclass == 0) ? 0 : ((UINT64)1 << (sizeclass - 1));
+        UINT64 high = (sizeclass == 0) ? 0 : ((sizeclass == 64) ? (UINT64)-1 : ((UINT64)1 << sizeclass) - 1);
+        captureentry_t &entry = m_table[row][sizeclass];
+        entry.rules = 0;
+        entry.partial = 0;
+        for (UINT32 index = 0; index < m_ruleCount; index++) {
+            const capturerule_t &rule = m_rules[index];
+            if (!(modulemask & (1u << index)) || ((UINT64)rule.minSize > high) || ((UINT64)rule.maxSize < low))
+                continue;
+            entry.rules |= 1u << index;
+            if (((UINT64)rule.minSize > low) || ((UINT64)rule.maxSize < high))
+                entry.partial |= 1u << index;
+        }
+    }
+}
+
+// moduleRow - Finds the row of the decision table of a module, building it if
+//   no module with the same rules has been loaded before. Called when the
+//   module is loaded.
+//
+//  - name (IN): The file name of the module. Need not be null-terminated.
+//
+//  - length (IN): Length of the name, in characters.
+//
+//  Return Value:
+//
+//    Returns the row to pass to capture for the allocations made by the
+//    module. Once the table is full, modules needing a new row get
+//    CAPTURE_ROW_ANY, where only the rules without module patterns apply.
+//
+UINT32 CapturePolicy::moduleRow (const wchar_t *name, size_t length)
+{
+    wchar_t lower [CAPTURE_MAX_NAME];
+    length = ToLower(name, name + length, lower, CAPTURE_MAX_NAME);
+    UINT32 modulemask = MatchPatterns(m_modulePatterns, m_moduleInfixes, lower, length) | m_anyModule;
+
+    for (UINT32 row = 0; row < m_rowCount; row++) {
+        if (m_rowMasks[row] == modulemask)
+            return row;
+    }
+    if (m_rowCount == CAPTURE_MAX_ROWS)
+        return CAPTURE_ROW_ANY;
+
+    compileRow(m_rowCount, modulemask);
+    m_rowMasks[m_rowCount] = modulemask;
+    return m_rowCount++;
+}
+
+// parseRule - Parses a rule, and adds its patterns to the policy's. See
+//   compile for the syntax.
+//
+//  - first (IN): The first character of the rule.
+//
+//  - last (IN): Just past the last character of the rule.
+//
+//  - index (IN): The index of the rule.
+//
+//  Return Value:
+//
+//    Returns false if the rule is not valid. Nothing is added then.
+//
+bool CapturePolicy::parseRule (const wchar_t *first, const wchar_t *last, UINT32 index)
+{
+    capturerule_t rule;
+    rule.minSize = 0;
+    rule.maxSize = (SIZE_T)-1;
+    rule.depth = 0;
+    rule.sampleRate = 1;
+    rule.track = true;
+    const wchar_t *modules = NULL, *modulesEnd = NULL;
+    const wchar_t *threads = NULL, *threadsEnd = NULL;
+
+    while (first < last) {
+        const wchar_t *end = first;
+        while ((end < last) && !IsBlank(*end))
+            end++;
+        const wchar_t *equals = first;
+        while ((equals < end) && (*equals != L'='))
+            equals++;
+        if (equals == end)
+            return false;
+        const wchar_t *value = equals + 1;
+
+        SIZE_T number;
+        if (KeyIs(first, equals, L"module")) {
+            if (!ValidPatterns(value, end))
+                return false;
+            modules = value;
+            modulesEnd = end;
+        }
+        else if (KeyIs(first, equals, L"thread")) {
+            if (!ValidPatterns(value, end))
+                return false;
+            threads = value;
+            threadsEnd = end;
+        }
+        else if (KeyIs(first, equals, L"size")) {
+            const wchar_t *dash = value;
+            while ((dash < end) && (*dash != L'-'))
+                dash++;
+            if (dash == end) {
+                if (!ParseNumber(value, end, true, rule.minSize))
+                    return false;
+                rule.maxSize = rule.minSize;
+            }
+            else if (((dash == value) && (dash + 1 == end)) ||
+                ((dash > value) && !ParseNumber(value, dash, true, rule.minSize)) ||
+                ((dash + 1 < end) && !ParseNumber(dash + 1, end, true, rule.maxSize)) ||
+                (rule.minSize > rule.maxSize)) {
+                return false;
+            }
+        }
+        else if (KeyIs(first, equals, L"depth")) {
+            if (!ParseNumber(value, end, false, number) || (number > CAPTURE_MAX_VALUE))
+                return false;
+            rule.depth = (UINT32)number;
+        }
+        else if (KeyIs(first, equals, L"sample")) {
+            if (!ParseNumber(value, end, false, number) || (number == 0) || (number > CAPTURE_MAX_VALUE))
+                return false;
+            rule.sampleRate = (UINT32)number;
+        }
+        else if (KeyIs(first, equals, L"track")) {
+            rule.track = ConfigStrToBool(value, end - value);
+        }
+        else {
+            return false;
+        }
+
+        first = end;
+        while ((first < last) && IsBlank(*first))
+            first++;
+    }
+
+    wchar_t patterns [VLD_CONFIG_MAX_MODULE_LIST];
+    if (modules != NULL) {
+        ToLower(modules, modulesEnd, patterns, VLD_CONFIG_MAX_MODULE_LIST);
+        AddPatterns(m_modulePatterns, m_moduleInfixes, patterns, 1u << index);
+    }
+    else {
+        m_anyModule |= 1u << index;
+    }
+    if (threads != NULL) {
+        ToLower(threads, threadsEnd, patterns, VLD_CONFIG_MAX_MODULE_LIST);
+        AddPatterns(m_threadPatterns, m_threadInfixes, patterns, 1u << index);
+    }
+    else {
+        m_anyThread |= 1u << index;
+    }
+    m_rules[index] = rule;
+    return true;
+}
+
+// setThreadName - Finds the rules whose thread patterns match the name of the
+//   calling thread. Called when threadNameStale asks for it.
+//
+//  - thread (IN/OUT): The state of the policy kept by the calling thread.
+//
+//  - name (IN): The name of the thread, or NULL if it has none. Need not be
+//      null-terminated.
+//
+//  - length (IN): Length of the name, in characters.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CapturePolicy::setThreadName (capturethread_t &thread, const wchar_t *name, size_t length) const
+{
+    wchar_t lower [CAPTURE_MAX_NAME];
+    if (name == NULL)
+        length = 0;
+    length = ToLower(name, name + length, lower, CAPTURE_MAX_NAME);
+    thread.mask = MatchPatterns(m_threadPatterns, m_threadInfixes, lower, length) | m_anyThread;
+    thread.generation = m_generation.load(std::memory_order_acquire);
+    thread.recheck = CAPTURE_THREAD_RECHECK;
+}
+
+// threadNameStale - Determines whether the calling thread must read its name
+//   again, and pass it to setThreadName, before calling capture. This is the
+//   case the first time, after threadNamesChanged, and then every
+//   CAPTURE_THREAD_RECHECK allocations, to catch names set without VLD
+//   knowing.
+//
+//  - thread (IN/OUT): The state of the policy kept by the calling thread.
+//
+//  Return Value:
+//
+//    Returns true if the name must be read again.
+//
+bool CapturePolicy::threadNameStale (capturethread_t &thread) const
+{
+    if (thread.generation != m_generation.load(std::memory_order_relaxed))
+        return true;
+    return usesThreadNames() && (--thread.recheck == 0);
+}
+
+// threadNamesChanged - Makes every thread read its name again before its next
+//   allocation. Called when a thread is renamed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID CapturePolicy::threadNamesChanged ()
+{
+    m_generation++;
+}
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Capture Policy Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <atomic>
+#pragma pop_macro("new")
+#include "framepatterns.h"  // Provides the matcher of module and thread names.
+#include "platform.h"       // Provides the Win32 types.
+#include "vldallocator.h"   // Provides a custom STL-like allocator for VLD's containers.
+
+#define CAPTURE_MAX_RULES       32      // Most capture rules, one bit of each mask per rule.
+#define CAPTURE_MAX_ROWS        64      // Most distinct rows of the decision table.
+#define CAPTURE_SIZE_CLASSES    65      // Size classes: 0, then one per power of two up to 2^63.
+#define CAPTURE_THREAD_RECHECK  4096    // Allocations after which a thread's name is read again.
+#define CAPTURE_ROW_ANY         0       // Row of the modules no module pattern matches.
+
+typedef FramePatterns<vldallocator<patternnode_t> > CapturePatternSet;
+
+// A capture rule, as written in CaptureRules. Which modules and threads it
+// applies to is recorded by the patterns of the CapturePolicy.
+struct capturerule_t
+{
+    SIZE_T minSize;     // Smallest block size the rule applies to.
+    SIZE_T maxSize;     // Largest block size the rule applies to.
+    UINT32 depth;       // Most frames captured for the blocks tracked, or 0 for MaxTraceFrames.
+    UINT32 sampleRate;  // Only one of this many blocks the rule applies to is tracked.
+    bool   track;       // If false, the blocks the rule applies to are not tracked.
+};
+
+// An entry of the decision table, for a row and a size class.
+struct captureentry_t
+{
+    UINT32 rules;       // Rules which may apply to the blocks of the size class.
+    UINT32 partial;     // Among them, rules whose size range only covers part of the size class.
+};
+
+// The state of the policy kept by each thread.
+struct capturethread_t
+{
+    UINT32 mask;        // Rules whose thread patterns match the name of the thread.
+    UINT32 generation;  // Generation of the thread names when the mask was computed.
+    UINT32 recheck;     // Allocations left until the name of the thread is read again.
+    UINT32 samples [CAPTURE_MAX_RULES]; // Blocks each sampled rule applied to.
+};
+
+// CaptureLowestRule - Finds the first rule of a mask.
+//
+//  - mask (IN): A mask of rules. Must not be 0.
+//
+//  Return Value:
+//
+//    Returns the index of the rule.
+//
+inline UINT32 CaptureLowestRule (UINT32 mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (UINT32)index;
+#else
+    return (UINT32)__builtin_ctz(mask);
+#endif
+}
+
+// CaptureSizeClass - Finds the size class of a block size: 0 for empty
+//   blocks, otherwise the number of significant bits of the size.
+//
+//  - size (IN): The size of the block, in bytes.
+//
+//  Return Value:
+//
+//    Returns the size class.
+//
+inline UINT32 CaptureSizeClass (SIZE_T size)
+{
+    UINT32 sizeclass = 0;
+    UINT64 remaining = (UINT64)size;
+    while (remaining >= 0x100) {
+        remaining >>= 8;
+        sizeclass += 8;
+    }
+    while (remaining != 0) {
+        remaining >>= 1;
+        sizeclass++;
+    }
+    return sizeclass;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The CapturePolicy Class
+//
+//    Decides which allocations are tracked, following the rules of the
+//    CaptureRules option. Each rule may name modules, a range of block sizes
+//    and thread names, and sets the depth of the call stacks captured and a
+//    sampling rate. The first rule applying to an allocation decides; when
+//    none does, the allocation is tracked only if no rule tracks anything, so
+//    that a set of rules made of exclusions leaves everything else tracked.
+//
+//    The rules are compiled into a decision table. Modules whose names match
+//    the same rules share a row, computed once when the module is loaded, and
+//    each row has an entry per size class, holding the rules which may apply
+//    to the blocks of that class. A thread masks out the rules whose thread
+//    patterns don't match its name, computed once per thread. Deciding on an
+//    allocation is then a load from the table and a mask: only size classes a
+//    size range splits need comparing the size, and only sampled rules write
+//    anything.
+//
+//    compile and moduleRow must be serialized by the caller. Once a row is
+//    published, capture can be called by any thread without taking any lock.
+//
+class CapturePolicy
+{
+public:
+    CapturePolicy ();
+
+    bool   capture (UINT32 row, SIZE_T size, capturethread_t &thread, UINT32 &depth) const;
+    size_t compile (const wchar_t *text, size_t &invalid);
+    UINT32 moduleRow (const wchar_t *name, size_t length);
+    size_t ruleCount () const { return m_ruleCount; }
+    VOID   setThreadName (capturethread_t &thread, const wchar_t *name, size_t length) const;
+    bool   threadNameStale (capturethread_t &thread) const;
+    VOID   threadNamesChanged ();
+    bool   usesThreadNames () const { return (m_threadPatterns.size() + m_threadInfixes.size() > 0); }
+
+private:
+    // Disallow certain operations
+    CapturePolicy (const CapturePolicy&);
+    CapturePolicy& operator = (const CapturePolicy&);
+
+    VOID   compileRow (UINT32 row, UINT32 modulemask);
+    bool   parseRule (const wchar_t *first, const wchar_t *last, UINT32 index);
+
+    capturerule_t       m_rules [CAPTURE_MAX_RULES];
+    UINT32              m_ruleCount;
+    UINT32              m_anyModule;        // Rules without module patterns.
+    UINT32              m_anyThread;        // Rules without thread patterns.
+    bool                m_trackUnmatched;   // If set, allocations no rule applies to are tracked.
+    CapturePatternSet   m_modulePatterns;   // Module patterns, flagged with the bits of their rules.
+    CapturePatternSet   m_moduleInfixes;    // Module patterns with a wildcard on both ends, without the first one.
+    CapturePatternSet   m_threadPatterns;   // Thread patterns, flagged with the bits of their rules.
+    CapturePatternSet   m_threadInfixes;    // Thread patterns with a wildcard on both ends, without the first one.
+    UINT32              m_rowCount;
+    UINT32              m_rowMasks [CAPTURE_MAX_ROWS];  // Rules whose module patterns match the modules of each row.
+    std::atomic<UINT32> m_generation;       // Incremented when a thread is renamed.
+    captureentry_t      m_table [CAPTURE_MAX_ROWS][CAPTURE_SIZE_CLASSES];
+};
+
+// capture - Decides whether an allocation is tracked. Doesn't take any lock.
+//
+//  - row (IN): The row of the module making the allocation, see moduleRow.
+//
+//  - size (IN): The size of the block, in bytes.
+//
+//  - thread (IN/OUT): The state of the policy kept by the calling thread.
+//      Must be up to date, see threadNameStale.
+//
+//  - depth (OUT): Receives the most frames to capture for the block, or 0 to
+//      capture MaxTraceFrames frames.
+//
+//  Return Value:
+//
+//    Returns true if the allocation is tracked.
+//
+inline bool CapturePolicy::capture (UINT32 row, SIZE_T size, capturethread_t &thread, UINT32 &depth) const
+{
+    const captureentry_t &entry = m_table[row][CaptureSizeClass(size)];
+    UINT32 rules = entry.rules & thread.mask;
+    while (rules != 0) {
+        UINT32 index = CaptureLowestRule(rules);
+        const capturerule_t &rule = m_rules[index];
+        if (!(entry.partial & (1u << index)) || ((size >= rule.minSize) && (size <= rule.maxSize))) {
+            depth = rule.depth;
+            if (!rule.track)
+                return false;
+            return (rule.sampleRate <= 1) || ((thread.samples[index]++ % rule.sampleRate) == 0);
+        }
+        rules &= rules - 1;
+    }
+    depth = 0;
+    return m_trackUnmatched;
+}
@@ -1,16 +1,27 @@
 #pragma once
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <windows.h>
+#else
+#include <atomic>
+#include <pthread.h>
+#include "platform.h"
+#endif
+#include "internalstats.h"
 
 // you should consider CriticalSectionLocker<> whenever possible instead of
 // directly working with CriticalSection class - it is safer
+#if defined(_WIN32)
 class CriticalSection
 {
 public:
-	void Initialize()
+	// waitstat is the STATS_* operation the time spent entering the section is
+	// recorded as, if the internal statistics are enabled.
+	void Initialize(UINT waitstat = STATS_NONE)
 	{
+		m_waitStat = waitstat;
 		m_critRegion.OwningThread = 0;
 		__try {
 			InitializeCriticalSection(&m_critRegion);
@@ -25,6 +36,12 @@ public:
 	{
 		ULONG_PTR ownerThreadId = (ULONG_PTR)m_critRegion.OwningThread;
 		UNREFERENCED_PARAMETER(ownerThreadId);
+		if (InternalStatsEnabled()) {
+			UINT64 start = __rdtsc();
+			EnterCriticalSection(&m_critRegion);
+			RecordStat(m_waitStat, __rdtsc() - start);
+			return;
+		}
 		EnterCriticalSection(&m_critRegion);
 	}
 
@@ -49,7 +66,77 @@ public:
 
 private:
 	CRITICAL_SECTION m_critRegion;
+	UINT             m_waitStat;	// Operation the waits are recorded as, or STATS_NONE.
+};
+#else // POSIX
+// Elsewhere the critical section is a recursive mutex, which also remembers the
+// thread owning it so that it can be asked the same questions.
+class CriticalSection
+{
+public:
+	void Initialize(UINT waitstat = STATS_NONE)
+	{
+		m_waitStat = waitstat;
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&m_mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		m_owner.store(0, std::memory_order_relaxed);
+		m_depth = 0;
+	}
+	void Delete()		{ pthread_mutex_destroy(&m_mutex); }
+
+	// enter the section
+	void Enter()
+	{
+		if (InternalStatsEnabled()) {
+			UINT64 start = __rdtsc();
+			pthread_mutex_lock(&m_mutex);
+			RecordStat(m_waitStat, __rdtsc() - start);
+		}
+		else {
+			pthread_mutex_lock(&m_mutex);
+		}
+		if (m_depth++ == 0)
+			m_owner.store(GetCurrentThreadId(), std::memory_order_relaxed);
+	}
+
+	bool IsLocked()
+	{
+		return (m_owner.load(std::memory_order_relaxed) != 0);
+	}
+
+	bool IsLockedByCurrentThread()
+	{
+		return (m_owner.load(std::memory_order_relaxed) == GetCurrentThreadId());
+	}
+
+	// try enter the section
+	bool TryEnter()
+	{
+		if (pthread_mutex_trylock(&m_mutex) != 0)
+			return false;
+		if (m_depth++ == 0)
+			m_owner.store(GetCurrentThreadId(), std::memory_order_relaxed);
+		return true;
+	}
+
+	// leave the critical section
+	void Leave()
+	{
+		if (--m_depth == 0)
+			m_owner.store(0, std::memory_order_relaxed);
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+private:
+	pthread_mutex_t     m_mutex;
+	std::atomic<DWORD>  m_owner;	// Thread owning the section, or 0.
+	UINT                m_depth;	// Number of times the owner entered the section.
+	UINT                m_waitStat;	// Operation the waits are recorded as, or STATS_NONE.
 };
+#endif // _WIN32
 
 template<typename T = CriticalSection>
 class CriticalSectionLocker
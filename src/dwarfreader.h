@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - DWARF Reader
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include "platform.h"   // Provides the Win32 types.
+
+// Pointer encodings of the call frame information. See the Linux Standard Base
+// Core Specification, section 10.5.
+#define DW_EH_PE_absptr     0x00
+#define DW_EH_PE_uleb128    0x01
+#define DW_EH_PE_udata2     0x02
+#define DW_EH_PE_udata4     0x03
+#define DW_EH_PE_udata8     0x04
+#define DW_EH_PE_sleb128    0x09
+#define DW_EH_PE_sdata2     0x0a
+#define DW_EH_PE_sdata4     0x0b
+#define DW_EH_PE_sdata8     0x0c
+#define DW_EH_PE_pcrel      0x10
+#define DW_EH_PE_datarel    0x30
+#define DW_EH_PE_indirect   0x80
+#define DW_EH_PE_omit       0xff
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The DwarfReader Class
+//
+//    Reads the encoded values of a DWARF section: the line tables read by the
+//    symbolizer, and the call frame information read by the unwinder. Reading
+//    past the end of the data returns zeros and marks the reader as failed, so
+//    that truncated or corrupt data is never a problem.
+//
+class DwarfReader
+{
+public:
+    DwarfReader (const BYTE *data, size_t size) : m_position(data), m_end(data + size), m_failed(false) {}
+
+    bool failed () const             { return m_failed; }
+    const BYTE* position () const    { return m_position; }
+    size_t remaining () const        { return (size_t)(m_end - m_position); }
+
+    const BYTE* skip (size_t size)
+    {
+        const BYTE *start = m_position;
+        if (size > remaining()) {
+            m_failed = true;
+            m_position = m_end;
+            return NULL;
+        }
+        m_position += size;
+        return start;
+    }
+
+    UINT64 fixed (size_t size)
+    {
+        const BYTE *bytes = skip(size);
+        UINT64 value = 0;
+        for (size_t index = 0; (bytes != NULL) && (index < size); index++)
+            value |= (UINT64)bytes[index] << (8 * index);
+        return value;
+    }
+
+    UINT64 uleb ()
+    {
+        UINT64 value = 0;
+        for (UINT32 shift = 0; ; shift += 7) {
+            const BYTE *byte = skip(1);
+            if (byte == NULL)
+                return 0;
+            if (shift < 64)
+                value |= (UINT64)(*byte & 0x7f) << shift;
+            if ((*byte & 0x80) == 0)
+                return value;
+        }
+    }
+
+    LONG64 sleb ()
+    {
+        UINT64 value = 0;
+        UINT32 shift = 0;
+        for (;;) {
+            const BYTE *byte = skip(1);
+            if (byte == NULL)
+                return 0;
+            if (shift < 64)
+                value |= (UINT64)(*byte & 0x7f) << shift;
+            shift += 7;
+            if ((*byte & 0x80) == 0) {
+                if ((shift < 64) && (*byte & 0x40))
+                    value |= ~(UINT64)0 << shift;
+                return (LONG64)value;
+            }
+        }
+    }
+
+    const char* string ()
+    {
+        const BYTE *start = m_position;
+        while ((m_position < m_end) && (*m_position != 0))
+            m_position++;
+        if (m_position == m_end) {
+            m_failed = true;
+            return "";
+        }
+        m_position++;
+        return (const char*)start;
+    }
+
+    // pointer - Reads a pointer encoded as described by the DW_EH_PE_* flags,
+    //   as found in .eh_frame and .eh_frame_hdr. Indirect pointers are not
+    //   supported.
+    //
+    //  - encoding (IN): How the pointer is encoded.
+    //
+    //  - database (IN): The base of data-relative pointers: the address of
+    //      .eh_frame_hdr.
+    //
+    //  Return Value:
+    //
+    //    Returns the pointer, or 0 if its encoding is not supported, in which
+    //    case the reader is marked as failed.
+    //
+    UINT_PTR pointer (BYTE encoding, UINT_PTR database = 0)
+    {
+        if (encoding == DW_EH_PE_omit)
+            return 0;
+        UINT_PTR base = 0;
+        switch (encoding & 0x70) {
+        case DW_EH_PE_absptr:   break;
+        case DW_EH_PE_pcrel:    base = (UINT_PTR)m_position; break;
+        case DW_EH_PE_datarel:  base = database; break;
+        default:                m_failed = true; return 0;
+        }
+        UINT64 value;
+        switch (encoding & 0x0f) {
+        case DW_EH_PE_absptr:   value = fixed(sizeof(UINT_PTR)); break;
+        case DW_EH_PE_uleb128:  value = uleb(); break;
+        case DW_EH_PE_udata2:   value = fixed(2); break;
+        case DW_EH_PE_udata4:   value = fixed(4); break;
+        case DW_EH_PE_udata8:   value = fixed(8); break;
+        case DW_EH_PE_sleb128:  value = (UINT64)sleb(); break;
+        case DW_EH_PE_sdata2:   value = (UINT64)(LONG64)(int16_t)fixed(2); break;
+        case DW_EH_PE_sdata4:   value = (UINT64)(LONG64)(LONG)fixed(4); break;
+        case DW_EH_PE_sdata8:   value = fixed(8); break;
+        default:                m_failed = true; return 0;
+        }
+        if ((encoding & DW_EH_PE_indirect) || m_failed) {
+            m_failed = true;
+            return 0;
+        }
+        return base + (UINT_PTR)value;
+    }
+
+private:
+    const BYTE *m_position;
+    const BYTE *m_end;
+    bool        m_failed;
+};
+
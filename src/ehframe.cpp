@@ -0,0 +1,648 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Call Frame Information Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <link.h>
+#include <pthread.h>
+
+#define VLDBUILD
+#include "dwarfreader.h"    // Provides the decoding of DWARF data.
+#include "ehframe.h"        // This module's header.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+// Call frame instructions. See the DWARF 5 standard, section 6.4.2.
+#define DW_CFA_advance_loc                  0x40
+#define DW_CFA_offset                       0x80
+#define DW_CFA_restore                      0xc0
+#define DW_CFA_nop                          0x00
+#define DW_CFA_set_loc                      0x01
+#define DW_CFA_advance_loc1                 0x02
+#define DW_CFA_advance_loc2                 0x03
+#define DW_CFA_advance_loc4                 0x04
+#define DW_CFA_offset_extended              0x05
+#define DW_CFA_restore_extended             0x06
+#define DW_CFA_undefined                    0x07
+#define DW_CFA_same_value                   0x08
+#define DW_CFA_register                     0x09
+#define DW_CFA_remember_state               0x0a
+#define DW_CFA_restore_state                0x0b
+#define DW_CFA_def_cfa                      0x0c
+#define DW_CFA_def_cfa_register             0x0d
+#define DW_CFA_def_cfa_offset               0x0e
+#define DW_CFA_def_cfa_expression           0x0f
+#define DW_CFA_expression                   0x10
+#define DW_CFA_offset_extended_sf           0x11
+#define DW_CFA_def_cfa_sf                   0x12
+#define DW_CFA_def_cfa_offset_sf            0x13
+#define DW_CFA_val_offset                   0x14
+#define DW_CFA_val_offset_sf                0x15
+#define DW_CFA_val_expression               0x16
+#define DW_CFA_GNU_args_size                0x2e
+#define DW_CFA_GNU_negative_offset_extended 0x2f
+
+// DWARF numbers of the registers the unwinder follows.
+#if defined(__x86_64__)
+#define DWARF_REGISTER_BP   6
+#define DWARF_REGISTER_SP   7
+#elif defined(__aarch64__)
+#define DWARF_REGISTER_BP   29
+#define DWARF_REGISTER_SP   31
+#else
+// Unknown: no frame has a rule.
+#define DWARF_REGISTER_BP   ((UINT64)-1)
+#define DWARF_REGISTER_SP   ((UINT64)-1)
+#endif
+
+#define CFA_CACHE_SIZE      1024    // Number of rules in each thread's cache (must be a power of 2).
+#define CFA_MAX_STATES      8       // Maximum depth of DW_CFA_remember_state.
+
+// The rule of a register, while running the call frame instructions.
+enum regrulekind_e {
+    RULE_SAME,          // The register has the same value in the caller.
+    RULE_UNDEFINED,     // The register's value in the caller is lost.
+    RULE_OFFSET,        // The register is saved at the CFA plus an offset.
+    RULE_UNSUPPORTED    // Any other rule.
+};
+
+struct regrule_t
+{
+    regrulekind_e kind;
+    LONG64        offset;       // Offset from the CFA, for RULE_OFFSET.
+};
+
+// The row of the call frame table being built.
+struct cfastate_t
+{
+    UINT64      cfaRegister;    // DWARF number of the register the CFA is computed from.
+    LONG64      cfaOffset;      // Offset added to the register.
+    bool        cfaExpression;  // If set, the CFA is computed by a DWARF expression.
+    regrule_t   bp;             // The rule of the frame pointer.
+    regrule_t   ra;             // The rule of the return address.
+};
+
+// What a CIE holds that matters to its FDEs.
+struct cieinfo_t
+{
+    UINT64      codeAlignment;  // Factor of the location advances.
+    LONG64      dataAlignment;  // Factor of the register offsets.
+    UINT64      raRegister;     // DWARF number of the return address column.
+    BYTE        fdeEncoding;    // Encoding of the addresses in the FDEs.
+    bool        augmented;      // If set, the FDEs have augmentation data.
+    bool        signalFrame;    // If set, the FDEs describe signal handler frames.
+    const BYTE *instructions;   // The initial instructions.
+    size_t      instructionsSize;
+};
+
+// Each thread's cache of the rules it found, so that the call frame
+// information of a program counter is only read once.
+struct cfacache_t
+{
+    unsigned long long unloads;                 // Number of modules unloaded when the cache was last validated.
+    cfarule_t          rules [CFA_CACHE_SIZE];  // Rules, indexed by a hash of their program counter.
+};
+
+static pthread_once_t   g_cacheKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t    g_cacheKey;
+static __thread cfacache_t *t_cache __attribute__((tls_model("initial-exec")));
+
+// SetRegisterRule - Sets the rule of a register followed by the unwinder. The
+//   rules of the other registers are ignored.
+//
+//  - state (IN/OUT): The row being built.
+//
+//  - cie (IN): The CIE of the frame.
+//
+//  - reg (IN): DWARF number of the register.
+//
+//  - kind (IN): The rule.
+//
+//  - offset (IN): Offset from the CFA, for RULE_OFFSET.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID SetRegisterRule (cfastate_t &state, const cieinfo_t &cie, UINT64 reg, regrulekind_e kind, LONG64 offset)
+{
+    regrule_t *rule = NULL;
+    if (reg == DWARF_REGISTER_BP)
+        rule = &state.bp;
+    else if (reg == cie.raRegister)
+        rule = &state.ra;
+    if (rule != NULL) {
+        rule->kind = kind;
+        rule->offset = offset;
+    }
+}
+
+// RunCfaInstructions - Runs call frame instructions, building the row of a
+//   program counter.
+//
+//  - reader (IN/OUT): Reads the instructions.
+//
+//  - cie (IN): The CIE of the frame.
+//
+//  - location (IN): Address of the first instruction of the frame's function.
+//
+//  - target (IN): The program counter. Instructions describing the rows after
+//      it are not run.
+//
+//  - initial (IN): The row built by the CIE's instructions, restored by
+//      DW_CFA_restore. NULL while running the CIE's instructions.
+//
+//  - state (IN/OUT): The row being built.
+//
+//  Return Value:
+//
+//    Returns false if the instructions could not be decoded.
+//
+static bool RunCfaInstructions (DwarfReader &reader, const cieinfo_t &cie, UINT_PTR location, UINT_PTR target,
+    const cfastate_t *initial, cfastate_t &state)
+{
+    cfastate_t remembered [CFA_MAX_STATES];
+    UINT32     depth = 0;
+    while ((reader.remaining() != 0) && !reader.failed()) {
+        BYTE   opcode = (BYTE)reader.fixed(1);
+        UINT64 reg;
+        switch (opcode & 0xc0) {
+        case DW_CFA_advance_loc:
+            location += (opcode & 0x3f) * cie.codeAlignment;
+            if (location > target)
+                return true;
+            continue;
+        case DW_CFA_offset:
+            SetRegisterRule(state, cie, opcode & 0x3f, RULE_OFFSET, (LONG64)reader.uleb() * cie.dataAlignment);
+            continue;
+        case DW_CFA_restore:
+            reg = opcode & 0x3f;
+            if (initial != NULL) {
+                if (reg == DWARF_REGISTER_BP)
+                    state.bp = initial->bp;
+                else if (reg == cie.raRegister)
+                    state.ra = initial->ra;
+            }
+            continue;
+        }
+
+        switch (opcode) {
+        case DW_CFA_nop:
+            break;
+        case DW_CFA_set_loc:
+            location = reader.pointer(cie.fdeEncoding);
+            if (location > target)
+                return true;
+            break;
+        case DW_CFA_advance_loc1:
+        case DW_CFA_advance_loc2:
+        case DW_CFA_advance_loc4:
+            location += (UINT_PTR)reader.fixed((opcode == DW_CFA_advance_loc4) ? 4 : opcode - 1) * cie.codeAlignment;
+            if (location > target)
+                return true;
+            break;
+        case DW_CFA_offset_extended:
+            reg = reader.uleb();
+            SetRegisterRule(state, cie, reg, RULE_OFFSET, (LONG64)reader.uleb() * cie.dataAlignment);
+            break;
+        case DW_CFA_offset_extended_sf:
+            reg = reader.uleb();
+            SetRegisterRule(state, cie, reg, RULE_OFFSET, reader.sleb() * cie.dataAlignment);
+            break;
+        case DW_CFA_GNU_negative_offset_extended:
+            reg = reader.uleb();
+            SetRegisterRule(state, cie, reg, RULE_OFFSET, -(LONG64)reader.uleb() * cie.dataAlignment);
+            break;
+        case DW_CFA_restore_extended:
+            reg = reader.uleb();
+            if (initial != NULL) {
+                if (reg == DWARF_REGISTER_BP)
+                    state.bp = initial->bp;
+                else if (reg == cie.raRegister)
+                    state.ra = initial->ra;
+            }
+            break;
+        case DW_CFA_undefined:
+            SetRegisterRule(state, cie, reader.uleb(), RULE_UNDEFINED, 0);
+            break;
+        case DW_CFA_same_value:
+            SetRegisterRule(state, cie, reader.uleb(), RULE_SAME, 0);
+            break;
+        case DW_CFA_register:
+            reg = reader.uleb();
+            reader.uleb();
+            SetRegisterRule(state, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_val_offset:
+            reg = reader.uleb();
+            reader.uleb();
+            SetRegisterRule(state, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_val_offset_sf:
+            reg = reader.uleb();
+            reader.sleb();
+            SetRegisterRule(state, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_expression:
+        case DW_CFA_val_expression:
+            reg = reader.uleb();
+            reader.skip((size_t)reader.uleb());
+            SetRegisterRule(state, cie, reg, RULE_UNSUPPORTED, 0);
+            break;
+        case DW_CFA_remember_state:
+            // The CFA is saved along with the registers, as GCC expects.
+            if (depth == CFA_MAX_STATES)
+                return false;
+            remembered[depth++] = state;
+            break;
+        case DW_CFA_restore_state:
+            if (depth == 0)
+                return false;
+            state = remembered[--depth];
+            break;
+        case DW_CFA_def_cfa:
+            state.cfaRegister = reader.uleb();
+            state.cfaOffset = (LONG64)reader.uleb();
+            state.cfaExpression = false;
+            break;
+        case DW_CFA_def_cfa_sf:
+            state.cfaRegister = reader.uleb();
+            state.cfaOffset = reader.sleb() * cie.dataAlignment;
+            state.cfaExpression = false;
+            break;
+        case DW_CFA_def_cfa_register:
+            state.cfaRegister = reader.uleb();
+            break;
+        case DW_CFA_def_cfa_offset:
+            state.cfaOffset = (LONG64)reader.uleb();
+            break;
+        case DW_CFA_def_cfa_offset_sf:
+            state.cfaOffset = reader.sleb() * cie.dataAlignment;
+            break;
+        case DW_CFA_def_cfa_expression:
+            reader.skip((size_t)reader.uleb());
+            state.cfaExpression = true;
+            break;
+        case DW_CFA_GNU_args_size:
+            reader.uleb();
+            break;
+        default:
+            // Unknown instruction: its operands can't be skipped.
+            return false;
+        }
+    }
+    return !reader.failed();
+}
+
+// ReadEntryLength - Reads the length of a CIE or an FDE, and makes a reader of
+//   its contents.
+//
+//  - entry (IN): Address of the CIE or FDE.
+//
+//  - offsetsize (OUT): Receives the size of the offsets in the entry: 4 or 8
+//      bytes.
+//
+//  Return Value:
+//
+//    Returns a reader of the entry's contents, after its length.
+//
+static DwarfReader ReadEntryLength (const BYTE *entry, size_t &offsetsize)
+{
+    DwarfReader length(entry, 12);
+    UINT64 size = length.fixed(4);
+    offsetsize = 4;
+    if (size == 0xffffffff) {
+        size = length.fixed(8);
+        offsetsize = 8;
+    }
+    return DwarfReader(length.position(), (size_t)size);
+}
+
+// ReadCie - Decodes a CIE.
+//
+//  - entry (IN): Address of the CIE.
+//
+//  - cie (OUT): Receives what the CIE holds.
+//
+//  Return Value:
+//
+//    Returns false if the CIE could not be decoded.
+//
+static bool ReadCie (const BYTE *entry, cieinfo_t &cie)
+{
+    size_t offsetsize;
+    DwarfReader reader = ReadEntryLength(entry, offsetsize);
+    if ((reader.fixed(offsetsize) != 0) || reader.failed())
+        return false;
+    BYTE version = (BYTE)reader.fixed(1);
+    if ((version != 1) && (version != 3) && (version != 4))
+        return false;
+    const char *augmentation = reader.string();
+    if (version == 4) {
+        reader.fixed(1); // address_size
+        reader.fixed(1); // segment_selector_size
+    }
+    cie.codeAlignment = reader.uleb();
+    cie.dataAlignment = reader.sleb();
+    cie.raRegister = (version == 1) ? reader.fixed(1) : reader.uleb();
+    cie.fdeEncoding = DW_EH_PE_absptr;
+    cie.augmented = (augmentation[0] == 'z');
+    cie.signalFrame = false;
+    if (cie.augmented) {
+        size_t size = (size_t)reader.uleb();
+        DwarfReader data(reader.skip(size), size);
+        for (const char *letter = augmentation + 1; *letter != '\0'; letter++) {
+            if (*letter == 'R')
+                cie.fdeEncoding = (BYTE)data.fixed(1);
+            else if (*letter == 'P')
+                data.pointer((BYTE)data.fixed(1));
+            else if (*letter == 'L')
+                data.fixed(1);
+            else if (*letter == 'S')
+                cie.signalFrame = true;
+            else if (*letter != 'B')
+                break;
+        }
+    }
+    else if (augmentation[0] != '\0') {
+        // Only the augmentations described by their data can be skipped.
+        return false;
+    }
+    cie.instructions = reader.position();
+    cie.instructionsSize = reader.remaining();
+    return !reader.failed();
+}
+
+// Passed to FindEhFrameHeader by LookupCfaRule.
+struct ehframesearch_t
+{
+    UINT_PTR            programCounter;     // The program counter to find.
+    const BYTE         *header;             // Receives the address of the module's .eh_frame_hdr, if found.
+    size_t              headerSize;         // Receives the size of the module's .eh_frame_hdr.
+    unsigned long long  unloads;            // Receives the number of modules unloaded so far.
+};
+
+// FindEhFrameHeader - dl_iterate_phdr callback finding the .eh_frame_hdr
+//   section of the loaded module holding a program counter.
+//
+//  - info (IN): A loaded module.
+//
+//  - size (IN): The size of the structure.
+//
+//  - context (IN/OUT): The ehframesearch_t describing the search.
+//
+//  Return Value:
+//
+//    Returns 1, ending the search, if the module holds the program counter.
+//    Otherwise returns 0.
+//
+static int FindEhFrameHeader (struct dl_phdr_info *info, size_t size, void *context)
+{
+    ehframesearch_t *search = (ehframesearch_t*)context;
+    if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+        search->unloads = info->dlpi_subs;
+
+    const ElfW(Phdr) *header = NULL;
+    bool found = false;
+    for (int index = 0; index < info->dlpi_phnum; index++) {
+        const ElfW(Phdr) *segment = &info->dlpi_phdr[index];
+        UINT_PTR low = info->dlpi_addr + segment->p_vaddr;
+        if (segment->p_type == PT_GNU_EH_FRAME)
+            header = segment;
+        else if ((segment->p_type == PT_LOAD) && (search->programCounter >= low) &&
+            (search->programCounter < low + segment->p_memsz))
+            found = true;
+    }
+    if (!found)
+        return 0;
+    if (header != NULL) {
+        search->header = (const BYTE*)(info->dlpi_addr + header->p_vaddr);
+        search->headerSize = header->p_memsz;
+    }
+    return 1;
+}
+
+// LookupCfaRule - Finds the rule of a program counter in the call frame
+//   information of its module. The FDE is found with the binary search table
+//   of the module's .eh_frame_hdr.
+//
+//  - programcounter (IN): The program counter, which is a return address.
+//
+//  - rule (OUT): Receives the rule. Its register is CFA_REGISTER_NONE if the
+//      frame can't be unwound.
+//
+//  - unloads (OUT): Receives the number of modules unloaded so far.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID LookupCfaRule (UINT_PTR programcounter, cfarule_t &rule, unsigned long long &unloads)
+{
+    rule.pc = programcounter;
+    rule.cfaRegister = CFA_REGISTER_NONE;
+    rule.cfaOffset = 0;
+    rule.raOffset = 0;
+    rule.bpOffset = 0;
+    rule.bpSaved = 0;
+
+    // The call is the instruction before the return address, and may be the
+    // last one of its function.
+    UINT_PTR target = programcounter - 1;
+    ehframesearch_t search = { target, NULL, 0, 0 };
+    dl_iterate_phdr(FindEhFrameHeader, &search);
+    unloads = search.unloads;
+    if (search.header == NULL)
+        return;
+
+    // Binary search of the table of the FDEs' initial locations.
+    DwarfReader header(search.header, search.headerSize);
+    if (header.fixed(1) != 1)
+        return;
+    BYTE frameencoding = (BYTE)header.fixed(1);
+    BYTE countencoding = (BYTE)header.fixed(1);
+    BYTE tableencoding = (BYTE)header.fixed(1);
+    UINT_PTR database = (UINT_PTR)search.header;
+    header.pointer(frameencoding, database);
+    size_t count = (size_t)header.pointer(countencoding, database);
+    if (header.failed() || (tableencoding != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) ||
+        (count > header.remaining() / 8) || (count == 0))
+        return;
+    const int32_t *table = (const int32_t*)header.position();
+    size_t low = 0, high = count;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (database + (LONG64)table[middle * 2] <= target)
+            low = middle;
+        else
+            high = middle;
+    }
+    const BYTE *entry = (const BYTE*)(database + (LONG64)table[low * 2 + 1]);
+
+    // Decode the FDE and its CIE.
+    size_t offsetsize;
+    DwarfReader fde = ReadEntryLength(entry, offsetsize);
+    const BYTE *ciepointer = fde.position();
+    UINT64 cieoffset = fde.fixed(offsetsize);
+    cieinfo_t cie;
+    if (fde.failed() || (cieoffset == 0) || !ReadCie(ciepointer - cieoffset, cie) || cie.signalFrame)
+        return;
+    UINT_PTR start = fde.pointer(cie.fdeEncoding);
+    UINT_PTR range = fde.pointer(cie.fdeEncoding & 0x0f);
+    if (fde.failed() || (target < start) || (target - start >= range))
+        return;
+    if (cie.augmented)
+        fde.skip((size_t)fde.uleb());
+
+    // Run the instructions of the CIE, then those of the FDE, up to the
+    // program counter.
+    cfastate_t initial = { 0, 0, true, { RULE_SAME, 0 }, { RULE_UNDEFINED, 0 } };
+    DwarfReader instructions(cie.instructions, cie.instructionsSize);
+    if (!RunCfaInstructions(instructions, cie, start, (UINT_PTR)-1, NULL, initial))
+        return;
+    cfastate_t state = initial;
+    if (!RunCfaInstructions(fde, cie, start, target, &initial, state))
+        return;
+
+    if (state.cfaExpression || (state.ra.kind != RULE_OFFSET) ||
+        ((state.bp.kind != RULE_SAME) && (state.bp.kind != RULE_OFFSET) && (state.bp.kind != RULE_UNDEFINED)))
+        return;
+    if (state.cfaRegister == DWARF_REGISTER_SP)
+        rule.cfaRegister = CFA_REGISTER_SP;
+    else if (state.cfaRegister == DWARF_REGISTER_BP)
+        rule.cfaRegister = CFA_REGISTER_BP;
+    else
+        return;
+    rule.cfaOffset = (LONG)state.cfaOffset;
+    rule.raOffset = (LONG)state.ra.offset;
+    rule.bpSaved = (state.bp.kind == RULE_OFFSET) ? 1 : 0;
+    rule.bpOffset = (LONG)state.bp.offset;
+}
+
+// FreeCache - Frees the cache of an exiting thread.
+//
+//  - cache (IN): The thread's cache.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID FreeCache (void *cache)
+{
+    delete (cfacache_t*)cache;
+}
+
+// CreateCacheKey - Creates the key freeing the threads' caches when they exit.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID CreateCacheKey ()
+{
+    pthread_key_create(&g_cacheKey, FreeCache);
+}
+
+// ReadUnloads - dl_iterate_phdr callback reading the dynamic loader's count of
+//   modules unloaded, which is the same for every module.
+//
+//  - info (IN): The first module.
+//
+//  - size (IN): The size of the structure.
+//
+//  - context (OUT): Receives the count.
+//
+//  Return Value:
+//
+//    Always returns 1, to stop at the first module.
+//
+static int ReadUnloads (struct dl_phdr_info *info, size_t size, void *context)
+{
+    if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+        *(unsigned long long*)context = info->dlpi_subs;
+    return 1;
+}
+
+// GetCfaCache - Obtains the calling thread's cache of rules, to be used for
+//   one stack walk. The cache is allocated the first time a thread walks its
+//   stack, and is emptied if modules have been unloaded since the thread last
+//   used it: another module may have been loaded at the addresses of their
+//   rules. Modules unloaded during the walk don't matter, as the frames of the
+//   walk are in modules which can't be unloaded before the walk ends.
+//
+//  Return Value:
+//
+//    Returns a pointer to the calling thread's cache.
+//
+cfacache_t* GetCfaCache ()
+{
+    cfacache_t *cache = t_cache;
+    if (cache == NULL) {
+        pthread_once(&g_cacheKeyOnce, CreateCacheKey);
+        cache = new cfacache_t;
+        memset(cache, 0, sizeof(*cache));
+        pthread_setspecific(g_cacheKey, cache);
+        t_cache = cache;
+    }
+
+    unsigned long long unloads = cache->unloads;
+    dl_iterate_phdr(ReadUnloads, &unloads);
+    if (unloads != cache->unloads) {
+        // The rules of the unloaded modules' addresses are stale.
+        memset(cache->rules, 0, sizeof(cache->rules));
+        cache->unloads = unloads;
+    }
+    return cache;
+}
+
+// FindCfaRule - Finds how to unwind the frame of a program counter, from the
+//   call frame information of its module. The rules are cached by each thread,
+//   so that only the first lookup of a program counter reads the module's call
+//   frame information.
+//
+//  - cache (IN/OUT): The calling thread's cache, as obtained by GetCfaCache for
+//      the current stack walk.
+//
+//  - programcounter (IN): The program counter, which is a return address.
+//
+//  - rule (OUT): Receives the rule.
+//
+//  Return Value:
+//
+//    Returns true if the frame can be unwound. Otherwise returns false.
+//
+bool FindCfaRule (cfacache_t *cache, UINT_PTR programcounter, cfarule_t &rule)
+{
+    cfarule_t &entry = cache->rules[(programcounter ^ (programcounter >> 12)) & (CFA_CACHE_SIZE - 1)];
+    if (entry.pc != programcounter) {
+        unsigned long long unloads;
+        LookupCfaRule(programcounter, rule, unloads);
+        if (unloads != cache->unloads) {
+            // Modules were unloaded since the walk began.
+            memset(cache->rules, 0, sizeof(cache->rules));
+            cache->unloads = unloads;
+        }
+        entry = rule;
+    }
+    else {
+        rule = entry;
+    }
+    return (rule.cfaRegister != CFA_REGISTER_NONE);
+}
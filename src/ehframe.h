@@ -0,0 +1,67 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Call Frame Information Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include "platform.h"   // Provides the Win32 types.
+
+// Registers a frame's CFA may be computed from. See cfarule_t.
+#define CFA_REGISTER_NONE   0   // The frame can't be unwound.
+#define CFA_REGISTER_SP     1   // The stack pointer.
+#define CFA_REGISTER_BP     2   // The frame pointer.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The cfarule_t Structure
+//
+//    How to find the caller of a frame, from the call frame information
+//    (.eh_frame) of the frame's module. The canonical frame address (CFA) is
+//    the value of the stack pointer in the caller, just before the call. Only
+//    the rules needed to unwind the stack pointer, the frame pointer and the
+//    return address are kept, and only the common forms of these rules are
+//    supported: anything else, such as DWARF expressions or signal frames,
+//    leaves the frame without a rule.
+//
+struct cfarule_t
+{
+    UINT_PTR pc;            // Program counter the rule applies to.
+    LONG     cfaOffset;     // The CFA is the value of cfaRegister plus this offset.
+    LONG     raOffset;      // The return address is saved at the CFA plus this offset.
+    LONG     bpOffset;      // The frame pointer is saved at the CFA plus this offset, if bpSaved is set.
+    BYTE     cfaRegister;   // Register the CFA is computed from (CFA_REGISTER_*).
+    BYTE     bpSaved;       // If not set, the frame pointer is the same in the caller.
+};
+
+// Each thread's cache of the rules it found. See GetCfaCache.
+struct cfacache_t;
+
+// Call frame information functions. See function definitions for details.
+cfacache_t* GetCfaCache ();
+bool FindCfaRule (cfacache_t *cache, UINT_PTR programcounter, cfarule_t &rule);
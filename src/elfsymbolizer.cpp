@@ -0,0 +1,877 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - ELF Symbolizer Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma push_macro("new")
+#undef new
+#include <algorithm>
+#pragma pop_macro("new")
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define VLDBUILD
+#include "dwarfreader.h"   // Provides the decoding of DWARF data.
+#include "elfsymbolizer.h"  // This class' header.
+#include "moduletable.h"    // Provides the description of unloaded modules.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+// DWARF line number program opcodes and forms. See the DWARF 5 standard,
+// section 6.2.
+#define DW_LNS_copy                 0x01
+#define DW_LNS_advance_pc           0x02
+#define DW_LNS_advance_line         0x03
+#define DW_LNS_set_file             0x04
+#define DW_LNS_const_add_pc         0x08
+#define DW_LNS_fixed_advance_pc     0x09
+#define DW_LNE_end_sequence         0x01
+#define DW_LNE_set_address          0x02
+#define DW_LNE_define_file          0x03
+#define DW_LNCT_path                0x1
+#define DW_LNCT_directory_index     0x2
+#define DW_FORM_block               0x09
+#define DW_FORM_data1               0x0b
+#define DW_FORM_data2               0x05
+#define DW_FORM_data4               0x06
+#define DW_FORM_data8               0x07
+#define DW_FORM_data16              0x1e
+#define DW_FORM_line_strp           0x1f
+#define DW_FORM_sdata               0x0d
+#define DW_FORM_string              0x08
+#define DW_FORM_strp                0x0e
+#define DW_FORM_udata               0x0f
+
+#define ELF_MAX_FILE_SIZE   0x40000000  // Files larger than this (1 GB) are not mapped.
+#define ELF_MAX_PATH        4096        // Maximum length of the path of the main program, like PATH_MAX.
+
+// A function symbol, relative to the module's load address.
+struct elfsymbol_t
+{
+    BOOL operator < (const elfsymbol_t &other) const { return (address < other.address); }
+
+    UINT_PTR    address;    // Address of the function in the file.
+    UINT_PTR    size;       // Size of the function, in bytes, or 0 if unknown.
+    const char *name;       // Name of the function, in the mapped file.
+};
+
+// A row of the DWARF line table: the instructions from this address up to the
+// next row's belong to the line. Rows ending a sequence cover no instruction.
+struct elfline_t
+{
+    BOOL operator < (const elfline_t &other) const
+    {
+        if (address != other.address)
+            return (address < other.address);
+        // Sequences may start where others end; the start must come last.
+        return (end > other.end);
+    }
+
+    UINT_PTR address;       // Address of the row in the file.
+    UINT32   file;          // Index of the source file in the module's file table.
+    UINT32   line : 31;     // Line number.
+    UINT32   end : 1;       // If set, the row ends a sequence.
+};
+
+typedef std::vector<elfsymbol_t, vldallocator<elfsymbol_t> > ElfSymbolTable;
+typedef std::vector<elfline_t, vldallocator<elfline_t> > ElfLineTable;
+typedef std::vector<UINT32, vldallocator<UINT32> > ElfFileTable;
+typedef std::vector<char, vldallocator<char> > ElfStringBuffer;
+
+// A section of the mapped file. Empty if the file doesn't have it.
+struct elfsection_t
+{
+    const BYTE *data;
+    size_t      size;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The ElfModule Class
+//
+//    The symbols and lines of one loaded module, decoded from its mapped file.
+//    A module whose file can't be read is still known, without any symbol, so
+//    that it is not read again.
+//
+class ElfModule
+{
+public:
+    ElfModule (const char *path, const char *name, UINT_PTR bias);
+    ~ElfModule ();
+
+    bool findFunction (UINT_PTR programcounter, symbolinfo_t &info) const;
+    bool findLine (UINT_PTR programcounter, symbolinfo_t &info) const;
+    const char* name () const { return m_name; }
+
+private:
+    // Disallow certain operations
+    ElfModule (const ElfModule&);
+    ElfModule& operator = (const ElfModule&);
+
+    elfsection_t findSection (const char *name) const;
+    VOID loadLines ();
+    bool loadLineProgram (DwarfReader &reader, const elfsection_t &linestr, const elfsection_t &str);
+    VOID loadSymbols (const char *table, const char *strings);
+    UINT32 addFile (const char *directory, const char *file);
+    bool readEntry (DwarfReader &reader, UINT64 form, size_t offsetsize, const elfsection_t &linestr,
+        const elfsection_t &str, UINT64 &value, const char* &text);
+
+    BYTE           *m_image;        // The mapped file, or NULL.
+    size_t          m_imageSize;    // Size of the mapped file, in bytes.
+    UINT_PTR        m_bias;         // Difference between the addresses in memory and in the file.
+    char           *m_name;         // File name of the module, without its directory.
+    ElfSymbolTable  m_symbols;      // Function symbols, sorted by address.
+    ElfLineTable    m_lines;        // Rows of the line table, sorted by address.
+    ElfFileTable    m_files;        // Offsets of the source file paths in m_fileNames.
+    ElfStringBuffer m_fileNames;    // The source file paths, one after the other.
+};
+
+// Constructor - Maps the module's file, and decodes its symbols and lines.
+//
+//  - path (IN): Path of the module's file.
+//
+//  - name (IN): Name of the module, as shown in reports.
+//
+//  - bias (IN): Difference between the addresses of the module in memory, and
+//      in the file.
+//
+ElfModule::ElfModule (const char *path, const char *name, UINT_PTR bias)
+{
+    m_image = NULL;
+    m_imageSize = 0;
+    m_bias = bias;
+    const char *basename = strrchr(name, '/');
+    basename = (basename != NULL) ? basename + 1 : name;
+    size_t length = strlen(basename);
+    m_name = new char [length + 1];
+    memcpy(m_name, basename, length + 1);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    struct stat status;
+    if ((fstat(fd, &status) == 0) && (status.st_size > (off_t)sizeof(ElfW(Ehdr))) && (status.st_size < ELF_MAX_FILE_SIZE)) {
+        void *image = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED) {
+            m_image = (BYTE*)image;
+            m_imageSize = (size_t)status.st_size;
+        }
+    }
+    close(fd);
+    if (m_image == NULL)
+        return;
+
+    const ElfW(Ehdr) *header = (const ElfW(Ehdr)*)m_image;
+#if defined(__LP64__)
+    const BYTE elfclass = ELFCLASS64;
+#else
+    const BYTE elfclass = ELFCLASS32;
+#endif
+    if ((memcmp(header->e_ident, ELFMAG, SELFMAG) != 0) || (header->e_ident[EI_CLASS] != elfclass) ||
+        (header->e_shentsize != sizeof(ElfW(Shdr))) || (header->e_shoff > m_imageSize) ||
+        ((size_t)header->e_shnum * sizeof(ElfW(Shdr)) > m_imageSize - header->e_shoff) ||
+        (header->e_shstrndx >= header->e_shnum)) {
+        // Not an ELF file of this process' kind.
+        munmap(m_image, m_imageSize);
+        m_image = NULL;
+        return;
+    }
+
+    // Stripped modules only have the dynamic symbols.
+    loadSymbols(".symtab", ".strtab");
+    if (m_symbols.empty())
+        loadSymbols(".dynsym", ".dynstr");
+    loadLines();
+}
+
+// Destructor - Unmaps the module's file.
+//
+ElfModule::~ElfModule ()
+{
+    if (m_image != NULL)
+        munmap(m_image, m_imageSize);
+    delete [] m_name;
+}
+
+// findSection - Finds a section of the mapped file by name. Sections without
+//   data in the file, or whose data is compressed, are not found.
+//
+//  - name (IN): The name of the section.
+//
+//  Return Value:
+//
+//    Returns the section's data, which is empty if it wasn't found.
+//
+elfsection_t ElfModule::findSection (const char *name) const
+{
+    elfsection_t section = { NULL, 0 };
+    const ElfW(Ehdr) *header = (const ElfW(Ehdr)*)m_image;
+    const ElfW(Shdr) *sections = (const ElfW(Shdr)*)(m_image + header->e_shoff);
+    const ElfW(Shdr) *names = &sections[header->e_shstrndx];
+    if ((names->sh_offset > m_imageSize) || (names->sh_size > m_imageSize - names->sh_offset))
+        return section;
+
+    for (UINT32 index = 0; index < header->e_shnum; index++) {
+        const ElfW(Shdr) *candidate = &sections[index];
+        if ((candidate->sh_type == SHT_NOBITS) || (candidate->sh_flags & SHF_COMPRESSED) ||
+            (candidate->sh_name >= names->sh_size) || (candidate->sh_offset > m_imageSize) ||
+            (candidate->sh_size > m_imageSize - candidate->sh_offset))
+            continue;
+        const char *candidatename = (const char*)m_image + names->sh_offset + candidate->sh_name;
+        if (strncmp(candidatename, name, names->sh_size - candidate->sh_name) == 0) {
+            section.data = m_image + candidate->sh_offset;
+            section.size = candidate->sh_size;
+            break;
+        }
+    }
+    return section;
+}
+
+// loadSymbols - Adds the functions of a symbol table to the module's symbols,
+//   sorted by address. When several symbols name the same function, the first
+//   one which is not local is kept.
+//
+//  - table (IN): The name of the symbol table's section.
+//
+//  - strings (IN): The name of the section holding the names of the symbols.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ElfModule::loadSymbols (const char *table, const char *strings)
+{
+    elfsection_t symbols = findSection(table);
+    elfsection_t names = findSection(strings);
+    if ((symbols.data == NULL) || (names.data == NULL))
+        return;
+
+    const ElfW(Sym) *symbol = (const ElfW(Sym)*)symbols.data;
+    size_t count = symbols.size / sizeof(ElfW(Sym));
+    m_symbols.reserve(count);
+    for (size_t index = 0; index < count; index++, symbol++) {
+        UINT32 type = ELF64_ST_TYPE(symbol->st_info);
+        if (((type != STT_FUNC) && (type != STT_GNU_IFUNC)) || (symbol->st_shndx == SHN_UNDEF) ||
+            (symbol->st_value == 0) || (symbol->st_name >= names.size))
+            continue;
+        elfsymbol_t function;
+        function.address = (UINT_PTR)symbol->st_value;
+        function.size = (UINT_PTR)symbol->st_size;
+        function.name = (const char*)names.data + symbol->st_name;
+        if (ELF64_ST_BIND(symbol->st_info) != STB_LOCAL) {
+            // Prefer global names: they are placed before the local aliases.
+            function.size |= (UINT_PTR)1 << (sizeof(UINT_PTR) * 8 - 1);
+        }
+        m_symbols.push_back(function);
+    }
+
+    // Global names first, then the largest symbol, at each address.
+    std::sort(m_symbols.begin(), m_symbols.end(), [] (const elfsymbol_t &first, const elfsymbol_t &second) {
+        if (first.address != second.address)
+            return (first.address < second.address);
+        return (first.size > second.size);
+    });
+    size_t kept = 0;
+    for (size_t index = 0; index < m_symbols.size(); index++) {
+        if ((kept != 0) && (m_symbols[kept - 1].address == m_symbols[index].address))
+            continue;
+        m_symbols[kept] = m_symbols[index];
+        m_symbols[kept].size &= ~((UINT_PTR)1 << (sizeof(UINT_PTR) * 8 - 1));
+        kept++;
+    }
+    m_symbols.resize(kept);
+}
+
+// addFile - Adds a source file to the module's file table.
+//
+//  - directory (IN): The directory of the file, or NULL.
+//
+//  - file (IN): The path of the file, which may be relative to the directory.
+//
+//  Return Value:
+//
+//    Returns the index of the file in the file table.
+//
+UINT32 ElfModule::addFile (const char *directory, const char *file)
+{
+    m_files.push_back((UINT32)m_fileNames.size());
+    if ((directory != NULL) && (directory[0] != '\0') && (file[0] != '/')) {
+        m_fileNames.insert(m_fileNames.end(), directory, directory + strlen(directory));
+        m_fileNames.push_back('/');
+    }
+    m_fileNames.insert(m_fileNames.end(), file, file + strlen(file) + 1);
+    return (UINT32)(m_files.size() - 1);
+}
+
+// readEntry - Reads one field of a DWARF 5 directory or file name entry.
+//
+//  - reader (IN/OUT): Reads the field.
+//
+//  - form (IN): The form of the field.
+//
+//  - offsetsize (IN): The size of section offsets: 4 or 8 bytes.
+//
+//  - linestr (IN): The .debug_line_str section.
+//
+//  - str (IN): The .debug_str section.
+//
+//  - value (OUT): Receives the field's value, if it is a number.
+//
+//  - text (OUT): Receives the field's value, if it is a string.
+//
+//  Return Value:
+//
+//    Returns false if the form is not supported.
+//
+bool ElfModule::readEntry (DwarfReader &reader, UINT64 form, size_t offsetsize, const elfsection_t &linestr,
+    const elfsection_t &str, UINT64 &value, const char* &text)
+{
+    switch (form) {
+    case DW_FORM_string:
+        text = reader.string();
+        return true;
+    case DW_FORM_line_strp:
+    case DW_FORM_strp: {
+        const elfsection_t &strings = (form == DW_FORM_line_strp) ? linestr : str;
+        UINT64 offset = reader.fixed(offsetsize);
+        text = (offset < strings.size) ? (const char*)strings.data + offset : "";
+        if (memchr(text, 0, strings.size - (size_t)((const BYTE*)text - strings.data)) == NULL)
+            text = "";
+        return true;
+    }
+    case DW_FORM_udata:     value = reader.uleb();      return true;
+    case DW_FORM_sdata:     value = reader.sleb();      return true;
+    case DW_FORM_data1:     value = reader.fixed(1);    return true;
+    case DW_FORM_data2:     value = reader.fixed(2);    return true;
+    case DW_FORM_data4:     value = reader.fixed(4);    return true;
+    case DW_FORM_data8:     value = reader.fixed(8);    return true;
+    case DW_FORM_data16:    reader.skip(16);            return true;
+    case DW_FORM_block:     reader.skip((size_t)reader.uleb()); return true;
+    default:
+        return false;
+    }
+}
+
+// loadLineProgram - Runs the line number program of one unit of .debug_line,
+//   adding its rows to the line table, and its files to the file table.
+//   DWARF versions 2 to 5 are supported.
+//
+//  - reader (IN/OUT): Reads the unit, starting with its length. Left at the
+//      start of the next unit.
+//
+//  - linestr (IN): The .debug_line_str section.
+//
+//  - str (IN): The .debug_str section.
+//
+//  Return Value:
+//
+//    Returns false if the unit could not be decoded. Its rows are then
+//    ignored, and so are the units following it.
+//
+bool ElfModule::loadLineProgram (DwarfReader &reader, const elfsection_t &linestr, const elfsection_t &str)
+{
+    size_t offsetsize = 4;
+    UINT64 unitlength = reader.fixed(4);
+    if (unitlength == 0xffffffff) {
+        // 64-bit DWARF.
+        offsetsize = 8;
+        unitlength = reader.fixed(8);
+    }
+    if (reader.failed() || (unitlength > reader.remaining()))
+        return false;
+    DwarfReader unit(reader.skip((size_t)unitlength), (size_t)unitlength);
+
+    UINT32 version = (UINT32)unit.fixed(2);
+    if ((version < 2) || (version > 5))
+        return false;
+    if (version >= 5) {
+        unit.fixed(1); // address_size
+        unit.fixed(1); // segment_selector_size
+    }
+    UINT64 headerlength = unit.fixed(offsetsize);
+    if (headerlength > unit.remaining())
+        return false;
+    DwarfReader program(unit.position() + headerlength, unit.remaining() - (size_t)headerlength);
+    UINT32 mininstlength = (UINT32)unit.fixed(1);
+    if (version >= 4)
+        unit.fixed(1); // maximum_operations_per_instruction, VLIW only.
+    bool defaultisstmt = (unit.fixed(1) != 0);
+    LONG linebase = (signed char)unit.fixed(1);
+    UINT32 linerange = (UINT32)unit.fixed(1);
+    UINT32 opcodebase = (UINT32)unit.fixed(1);
+    const BYTE *opcodelengths = unit.skip((opcodebase > 0) ? opcodebase - 1 : 0);
+    if (unit.failed() || (linerange == 0) || (opcodebase == 0))
+        return false;
+    UNREFERENCED_PARAMETER(defaultisstmt);
+
+    // The unit's file numbers, translated to the module's file table.
+    ElfFileTable files;
+    const char* directories [256];
+    UINT32 directorycount = 0;
+    if (version < 5) {
+        // Directory 0 is the compilation directory, which is not listed.
+        directories[directorycount++] = NULL;
+        for (const char *directory = unit.string(); directory[0] != '\0'; directory = unit.string()) {
+            if (directorycount < 256)
+                directories[directorycount++] = directory;
+        }
+        // File numbers start at 1.
+        files.push_back(0);
+        for (const char *file = unit.string(); file[0] != '\0'; file = unit.string()) {
+            UINT64 directory = unit.uleb();
+            unit.uleb(); // modification time
+            unit.uleb(); // length
+            files.push_back(addFile((directory < directorycount) ? directories[directory] : NULL, file));
+        }
+    }
+    else {
+        for (UINT32 table = 0; table < 2; table++) {
+            UINT64 formats [16][2];
+            UINT32 formatcount = (UINT32)unit.fixed(1);
+            if (formatcount > 16)
+                return false;
+            for (UINT32 index = 0; index < formatcount; index++) {
+                formats[index][0] = unit.uleb();
+                formats[index][1] = unit.uleb();
+            }
+            UINT64 count = unit.uleb();
+            for (UINT64 entry = 0; (entry < count) && !unit.failed(); entry++) {
+                const char *path = "";
+                UINT64 directory = 0;
+                for (UINT32 index = 0; index < formatcount; index++) {
+                    UINT64 value = 0;
+                    const char *text = "";
+                    if (!readEntry(unit, formats[index][1], offsetsize, linestr, str, value, text))
+                        return false;
+                    if (formats[index][0] == DW_LNCT_path)
+                        path = text;
+                    else if (formats[index][0] == DW_LNCT_directory_index)
+                        directory = value;
+                }
+                if (table == 0) {
+                    if (directorycount < 256)
+                        directories[directorycount++] = path;
+                }
+                else {
+                    files.push_back(addFile((directory < directorycount) ? directories[directory] : NULL, path));
+                }
+            }
+        }
+    }
+    if (unit.failed())
+        return false;
+
+    // Run the program. Only the rows' address, file, line and end of sequence
+    // matter here.
+    UINT_PTR address = 0;
+    UINT64   file = 1;
+    LONG64   line = 1;
+    while ((program.remaining() != 0) && !program.failed()) {
+        bool emit = false;
+        bool endsequence = false;
+        UINT32 opcode = (UINT32)program.fixed(1);
+        if (opcode >= opcodebase) {
+            // Special opcode: advances the address and the line, and adds a row.
+            UINT32 adjusted = opcode - opcodebase;
+            address += (adjusted / linerange) * mininstlength;
+            line += linebase + (LONG)(adjusted % linerange);
+            emit = true;
+        }
+        else if (opcode == 0) {
+            // Extended opcode.
+            UINT64 length = program.uleb();
+            if ((length == 0) || (length > program.remaining()))
+                break;
+            DwarfReader extended(program.skip((size_t)length), (size_t)length);
+            UINT32 subopcode = (UINT32)extended.fixed(1);
+            if (subopcode == DW_LNE_end_sequence) {
+                emit = true;
+                endsequence = true;
+            }
+            else if (subopcode == DW_LNE_set_address) {
+                address = (UINT_PTR)extended.fixed((size_t)length - 1);
+            }
+            else if (subopcode == DW_LNE_define_file) {
+                const char *path = extended.string();
+                UINT64 directory = extended.uleb();
+                files.push_back(addFile((directory < directorycount) ? directories[directory] : NULL, path));
+            }
+        }
+        else if (opcode == DW_LNS_copy) {
+            emit = true;
+        }
+        else if (opcode == DW_LNS_advance_pc) {
+            address += (UINT_PTR)program.uleb() * mininstlength;
+        }
+        else if (opcode == DW_LNS_advance_line) {
+            line += program.sleb();
+        }
+        else if (opcode == DW_LNS_set_file) {
+            file = program.uleb();
+        }
+        else if (opcode == DW_LNS_const_add_pc) {
+            address += ((255 - opcodebase) / linerange) * mininstlength;
+        }
+        else if (opcode == DW_LNS_fixed_advance_pc) {
+            address += (UINT_PTR)program.fixed(2);
+        }
+        else {
+            // Any other standard opcode only has operands to skip.
+            for (UINT32 operand = 0; operand < opcodelengths[opcode - 1]; operand++)
+                program.uleb();
+        }
+
+        if (emit) {
+            elfline_t row;
+            row.address = address;
+            row.file = (file < files.size()) ? files[(size_t)file] : (UINT32)-1;
+            row.line = (UINT32)line;
+            row.end = endsequence ? 1 : 0;
+            if (!m_lines.empty() && (m_lines.back().address == address) && !m_lines.back().end) {
+                // Only the last row at an address is used.
+                m_lines.back() = row;
+            }
+            else {
+                m_lines.push_back(row);
+            }
+        }
+        if (endsequence) {
+            address = 0;
+            file = 1;
+            line = 1;
+        }
+    }
+    return !program.failed();
+}
+
+// loadLines - Decodes the DWARF line table of the module, if it has one, into
+//   rows sorted by address.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ElfModule::loadLines ()
+{
+    elfsection_t lines = findSection(".debug_line");
+    if (lines.data == NULL)
+        return;
+    elfsection_t linestr = findSection(".debug_line_str");
+    elfsection_t str = findSection(".debug_str");
+
+    DwarfReader reader(lines.data, lines.size);
+    while ((reader.remaining() != 0) && loadLineProgram(reader, linestr, str)) {
+    }
+    std::stable_sort(m_lines.begin(), m_lines.end());
+}
+
+// findFunction - Finds the function of a program counter.
+//
+//  - programcounter (IN): The program counter.
+//
+//  - info (OUT): Receives the name of the function and the displacement of
+//      the program counter.
+//
+//  Return Value:
+//
+//    Returns true if the function was found. Otherwise returns false.
+//
+bool ElfModule::findFunction (UINT_PTR programcounter, symbolinfo_t &info) const
+{
+    elfsymbol_t key;
+    key.address = programcounter - m_bias;
+    ElfSymbolTable::const_iterator symbol = std::upper_bound(m_symbols.begin(), m_symbols.end(), key);
+    if (symbol == m_symbols.begin())
+        return false;
+    --symbol;
+    // A symbol of unknown size extends to the next one.
+    if ((symbol->size != 0) && (key.address - symbol->address >= symbol->size))
+        return false;
+    info.function = symbol->name;
+    info.displacement = key.address - symbol->address;
+    return true;
+}
+
+// findLine - Finds the source file and line of a program counter.
+//
+//  - programcounter (IN): The program counter.
+//
+//  - info (OUT): Receives the source file and line.
+//
+//  Return Value:
+//
+//    Returns true if the line was found. Otherwise returns false.
+//
+bool ElfModule::findLine (UINT_PTR programcounter, symbolinfo_t &info) const
+{
+    elfline_t key;
+    key.address = programcounter - m_bias;
+    key.end = 0;
+    ElfLineTable::const_iterator row = std::upper_bound(m_lines.begin(), m_lines.end(), key);
+    if (row == m_lines.begin())
+        return false;
+    --row;
+    if (row->end || (row->file >= m_files.size()))
+        return false;
+    info.file = &m_fileNames[m_files[row->file]];
+    info.line = row->line;
+    return true;
+}
+
+// Symbolizer::Get - Obtains the process-wide symbolizer, creating it the first
+//   time.
+//
+//  Return Value:
+//
+//    Returns the symbolizer. It is never destroyed.
+//
+Symbolizer* Symbolizer::Get ()
+{
+    static Symbolizer *symbolizer = NULL;
+    Symbolizer *current = __atomic_load_n(&symbolizer, __ATOMIC_ACQUIRE);
+    if (current != NULL)
+        return current;
+
+    Symbolizer *created = new ElfSymbolizer;
+    if (!__atomic_compare_exchange_n(&symbolizer, &current, created, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Another thread created it first.
+        delete created;
+        return current;
+    }
+    return created;
+}
+
+// Constructor - Initializes the symbolizer, with no module loaded yet.
+//
+ElfSymbolizer::ElfSymbolizer ()
+{
+    m_lock.Initialize();
+}
+
+// Destructor - Unloads the modules.
+//
+ElfSymbolizer::~ElfSymbolizer ()
+{
+    flush();
+    m_lock.Delete();
+}
+
+// addModule - Loads a module which isn't loaded in the process anymore, and
+//   adds the ranges of its executable segments to the range table. Ranges of
+//   modules loaded before are not replaced.
+//
+//  - module (IN): The unloaded module.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ElfSymbolizer::addModule (const loadedmodule_t &module)
+{
+    ElfModule *elfmodule = new ElfModule(module.path, module.name, module.bias);
+    CriticalSectionLocker<> cs(m_lock);
+    m_modules.push_back(elfmodule);
+    for (UINT32 index = 0; index < module.segmentCount; index++) {
+        elfrange_t range;
+        range.low = module.segments[index].low;
+        range.high = module.segments[index].high;
+        range.module = elfmodule;
+        ElfRangeTable::iterator next = std::upper_bound(m_ranges.begin(), m_ranges.end(), range);
+        if (((next != m_ranges.begin()) && ((next - 1)->high > range.low)) ||
+            ((next != m_ranges.end()) && (next->low < range.high))) {
+            // Overlaps a module loaded before.
+            continue;
+        }
+        m_ranges.insert(next, range);
+    }
+}
+
+// flush - Forgets everything known about the modules. The strings returned
+//   by resolve are freed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ElfSymbolizer::flush ()
+{
+    CriticalSectionLocker<> cs(m_lock);
+    for (ElfModuleList::iterator moduleit = m_modules.begin(); moduleit != m_modules.end(); ++moduleit) {
+        delete *moduleit;
+    }
+    m_modules.clear();
+    m_ranges.clear();
+}
+
+// moduleCount - Obtains the number of modules loaded so far.
+//
+//  Return Value:
+//
+//    Returns the number of modules.
+//
+size_t ElfSymbolizer::moduleCount ()
+{
+    CriticalSectionLocker<> cs(m_lock);
+    return m_modules.size();
+}
+
+// findModule - Finds the loaded module of a program counter, loading it if it
+//   wasn't yet.
+//
+//   Caller must hold m_lock.
+//
+//  - programcounter (IN): The program counter.
+//
+//  Return Value:
+//
+//    Returns the module, or NULL if the program counter isn't in any module.
+//
+ElfModule* ElfSymbolizer::findModule (UINT_PTR programcounter)
+{
+    elfrange_t key;
+    key.low = programcounter;
+    ElfRangeTable::iterator range = std::upper_bound(m_ranges.begin(), m_ranges.end(), key);
+    if ((range != m_ranges.begin()) && (programcounter < (range - 1)->high))
+        return (range - 1)->module;
+    return loadModule(programcounter);
+}
+
+// Passed to FindLoadedModule by loadModule.
+struct moduleSearch_t
+{
+    UINT_PTR                 programCounter;   // The program counter to find.
+    const struct dl_phdr_info *found;          // Receives a copy of the module's information, if found.
+    struct dl_phdr_info      info;             // The copy.
+};
+
+// FindLoadedModule - dl_iterate_phdr callback finding the loaded module
+//   holding a program counter.
+//
+//  - info (IN): A loaded module.
+//
+//  - size (IN): The size of the structure.
+//
+//  - context (IN/OUT): The moduleSearch_t describing the search.
+//
+//  Return Value:
+//
+//    Returns 1, ending the search, if the module holds the program counter.
+//    Otherwise returns 0.
+//
+static int FindLoadedModule (struct dl_phdr_info *info, size_t /*size*/, void *context)
+{
+    moduleSearch_t *search = (moduleSearch_t*)context;
+    for (int index = 0; index < info->dlpi_phnum; index++) {
+        const ElfW(Phdr) *segment = &info->dlpi_phdr[index];
+        UINT_PTR low = info->dlpi_addr + segment->p_vaddr;
+        if ((segment->p_type == PT_LOAD) && (search->programCounter >= low) &&
+            (search->programCounter < low + segment->p_memsz)) {
+            search->info = *info;
+            search->found = &search->info;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// loadModule - Loads the module of a program counter, and adds the ranges of
+//   its loadable segments to the range table.
+//
+//   Caller must hold m_lock.
+//
+//  - programcounter (IN): The program counter.
+//
+//  Return Value:
+//
+//    Returns the module, or NULL if the program counter isn't in any loaded
+//    module.
+//
+ElfModule* ElfSymbolizer::loadModule (UINT_PTR programcounter)
+{
+    moduleSearch_t search;
+    search.programCounter = programcounter;
+    search.found = NULL;
+    dl_iterate_phdr(FindLoadedModule, &search);
+    if (search.found == NULL)
+        return NULL;
+
+    // The main program has no name. Its file is read through /proc instead,
+    // and its name is the one of the file the link points to.
+    const char *path = search.info.dlpi_name;
+    const char *name = path;
+    char exepath [ELF_MAX_PATH];
+    if ((path == NULL) || (path[0] == '\0')) {
+        ssize_t length = readlink("/proc/self/exe", exepath, sizeof(exepath) - 1);
+        exepath[(length > 0) ? length : 0] = '\0';
+        path = "/proc/self/exe";
+        name = (length > 0) ? exepath : "(Module name unavailable)";
+    }
+    ElfModule *module = new ElfModule(path, name, search.info.dlpi_addr);
+    m_modules.push_back(module);
+
+    for (int index = 0; index < search.info.dlpi_phnum; index++) {
+        const ElfW(Phdr) *segment = &search.info.dlpi_phdr[index];
+        if (segment->p_type != PT_LOAD)
+            continue;
+        elfrange_t range;
+        range.low = search.info.dlpi_addr + segment->p_vaddr;
+        range.high = range.low + segment->p_memsz;
+        range.module = module;
+        m_ranges.insert(std::upper_bound(m_ranges.begin(), m_ranges.end(), range), range);
+    }
+    return module;
+}
+
+// resolve - Finds what is known about a program counter. See Symbolizer.
+//
+//  - programcounter (IN): The program counter to look up.
+//
+//  - info (OUT): Receives what is known about the program counter.
+//
+//  Return Value:
+//
+//    Returns true if the module of the program counter was found.
+//
+bool ElfSymbolizer::resolve (UINT_PTR programcounter, symbolinfo_t &info)
+{
+    info.module = NULL;
+    info.function = NULL;
+    info.displacement = 0;
+    info.file = NULL;
+    info.line = 0;
+
+    ElfModule *module;
+    {
+        CriticalSectionLocker<> cs(m_lock);
+        module = findModule(programcounter);
+    }
+    if (module == NULL)
+        return false;
+
+    info.module = module->name();
+    bool found = module->findFunction(programcounter, info);
+    // A return address may be just past the last instruction of its line, or
+    // of its function.
+    module->findLine((found && (info.displacement == 0)) ? programcounter : programcounter - 1, info);
+    return true;
+}
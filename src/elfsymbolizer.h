@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - ELF Symbolizer Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <vector>
+#pragma pop_macro("new")
+#include "criticalsection.h"    // Provides the lock protecting the module table.
+#include "symbolizer.h"         // Provides the base class.
+#include "vldallocator.h"       // Provides a custom STL-like allocator for VLD's containers.
+
+class ElfModule;
+
+// The loaded modules, as address ranges sorted by their lowest address. Each
+// module has one range for each of its loadable segments.
+struct elfrange_t
+{
+    BOOL operator < (const elfrange_t &other) const { return (low < other.low); }
+
+    UINT_PTR   low;     // Lowest address of the segment.
+    UINT_PTR   high;    // Address just past the segment.
+    ElfModule *module;  // The module the segment belongs to.
+};
+
+typedef std::vector<elfrange_t, vldallocator<elfrange_t> > ElfRangeTable;
+typedef std::vector<ElfModule*, vldallocator<ElfModule*> > ElfModuleList;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The ElfSymbolizer Class
+//
+//    Symbolizes program counters in-process, from the files of the loaded
+//    modules. The first time a program counter of a module is looked up, the
+//    module's file is mapped into memory, and its function symbols (.symtab,
+//    or .dynsym for stripped modules) and the line number programs of its DWARF
+//    line table (.debug_line) are decoded into tables sorted by address. Every
+//    later lookup is a binary search.
+//
+//    Modules are found with dl_iterate_phdr. Modules which are not loaded
+//    anymore are only known once added with addModule.
+//
+//    The module table is protected by a lock. The tables of a module are never
+//    modified once it is loaded, so they are searched without it.
+//
+class ElfSymbolizer : public Symbolizer
+{
+public:
+    ElfSymbolizer ();
+    virtual ~ElfSymbolizer ();
+
+    virtual VOID addModule (const loadedmodule_t &module);
+    virtual VOID flush ();
+    virtual bool resolve (UINT_PTR programcounter, symbolinfo_t &info);
+
+    size_t moduleCount ();
+
+private:
+    // Disallow certain operations
+    ElfSymbolizer (const ElfSymbolizer&);
+    ElfSymbolizer& operator = (const ElfSymbolizer&);
+
+    ElfModule* findModule (UINT_PTR programcounter);
+    ElfModule* loadModule (UINT_PTR programcounter);
+
+    CriticalSection m_lock;     // Protects the members below.
+    ElfRangeTable   m_ranges;   // Address ranges of the loaded modules, sorted by address.
+    ElfModuleList   m_modules;  // The loaded modules.
+};
@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Frame Pattern Matcher
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+// The matcher is a template over its allocator: VLD instantiates it with its
+// internal allocator, and the tests with the standard one.
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define FRAMEPATTERN_WILDCARD   L'*'    // Matches any run of characters at the start or end of a pattern.
+
+// A node of one of the pattern tries. Children are kept in a singly linked
+// sibling list; index 0 (the root) doubles as "none", since no node can link
+// back to the root.
+struct patternnode_t
+{
+    wchar_t  ch;            // Character leading from the parent to this node.
+    uint32_t child;         // Index of the first child, or 0.
+    uint32_t sibling;       // Index of the next sibling, or 0.
+    uint32_t partialFlags;  // Flags of the prefix (or suffix) patterns ending here.
+    uint32_t exactFlags;    // Flags of the exact patterns ending here.
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The FramePatterns Class
+//
+//    Classifies symbol and file names against a list of patterns in a single
+//    pass over the name, however many patterns there are. A pattern is either
+//    an exact name ("setlocale"), a prefix ("_malloc_crt*") or a suffix
+//    ("*CRT_INIT"). Every pattern carries a set of flags, and matching returns
+//    the union of the flags of all patterns matching the name.
+//
+//    Prefix and exact patterns are stored in a trie walked from the start of
+//    the name, and suffix patterns in a trie of the reversed patterns walked
+//    from the end of the name.
+//
+template <typename Alloc = std::allocator<patternnode_t> >
+class FramePatterns
+{
+public:
+    FramePatterns ()
+    {
+        clear();
+    }
+
+    // clear - Removes every pattern.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    void clear ()
+    {
+        patternnode_t root = { 0, 0, 0, 0, 0 };
+        m_prefixes.assign(1, root);
+        m_suffixes.assign(1, root);
+        m_count = 0;
+    }
+
+    // add - Adds a pattern.
+    //
+    //  - pattern (IN): The pattern. Need not be null-terminated.
+    //
+    //  - length (IN): Length of the pattern, in characters.
+    //
+    //  - flags (IN): Flags returned by match for names matching the pattern.
+    //
+    //  Return Value:
+    //
+    //    Returns false if the pattern is empty or has wildcards on both ends,
+    //    which is not supported. Otherwise returns true.
+    //
+    bool add (const wchar_t *pattern, size_t length, uint32_t flags)
+    {
+        bool prefix = (length > 0) && (pattern[length - 1] == FRAMEPATTERN_WILDCARD);
+        bool suffix = (length > 0) && (pattern[0] == FRAMEPATTERN_WILDCARD);
+        if ((length == 0) || (prefix && suffix && (length > 1)))
+            return false;
+
+        if (suffix) {
+            uint32_t node = 0;
+            for (size_t i = length - 1; i > 0; i--)
+                node = insert(m_suffixes, node, pattern[i]);
+            m_suffixes[node].partialFlags |= flags;
+        }
+        else {
+            if (prefix)
+                length--;
+            uint32_t node = 0;
+            for (size_t i = 0; i < length; i++)
+                node = insert(m_prefixes, node, pattern[i]);
+            if (prefix)
+                m_prefixes[node].partialFlags |= flags;
+            else
+                m_prefixes[node].exactFlags |= flags;
+        }
+        m_count++;
+        return true;
+    }
+
+    // addList - Adds every pattern of a list, such as the value of an option in
+    //   vld.ini. Patterns are separated by commas or semicolons. Whitespace
+    //   around each pattern is ignored.
+    //
+    //  - list (IN): Null-terminated list of patterns.
+    //
+    //  - flags (IN): Flags returned by match for names matching the patterns.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of patterns added.
+    //
+    size_t addList (const wchar_t *list, uint32_t flags)
+    {
+        size_t added = 0;
+        while (*list != L'\0') {
+            const wchar_t *end = list;
+            while ((*end != L'\0') && (*end != L',') && (*end != L';'))
+                end++;
+            const wchar_t *first = list;
+            const wchar_t *last = end;
+            while ((first < last) && isSpace(*first))
+                first++;
+            while ((last > first) && isSpace(*(last - 1)))
+                last--;
+            if ((first < last) && add(first, last - first, flags))
+                added++;
+            list = (*end != L'\0') ? end + 1 : end;
+        }
+        return added;
+    }
+
+    // match - Matches a name against every pattern.
+    //
+    //  - name (IN): The name to match. Need not be null-terminated.
+    //
+    //  - length (IN): Length of the name, in characters.
+    //
+    //  Return Value:
+    //
+    //    Returns the union of the flags of the patterns matching the name, or 0
+    //    if none does.
+    //
+    uint32_t match (const wchar_t *name, size_t length) const
+    {
+        uint32_t flags = m_prefixes[0].partialFlags | m_suffixes[0].partialFlags;
+
+        uint32_t node = 0;
+        size_t i = 0;
+        for (; i < length; i++) {
+            node = find(m_prefixes, node, name[i]);
+            if (node == 0)
+                break;
+            flags |= m_prefixes[node].partialFlags;
+        }
+        if (i == length)
+            flags |= m_prefixes[node].exactFlags;
+
+        node = 0;
+        for (i = length; i > 0; i--) {
+            node = find(m_suffixes, node, name[i - 1]);
+            if (node == 0)
+                break;
+            flags |= m_suffixes[node].partialFlags;
+        }
+        return flags;
+    }
+
+    // size - Obtains the number of patterns added.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of patterns.
+    //
+    size_t size () const
+    {
+        return m_count;
+    }
+
+private:
+    typedef std::vector<patternnode_t, Alloc> trie_t;
+
+    static bool isSpace (wchar_t c)
+    {
+        return (c == L' ') || (c == L'\t');
+    }
+
+    static uint32_t find (const trie_t &trie, uint32_t parent, wchar_t ch)
+    {
+        for (uint32_t node = trie[parent].child; node != 0; node = trie[node].sibling) {
+            if (trie[node].ch == ch)
+                return node;
+        }
+        return 0;
+    }
+
+    static uint32_t insert (trie_t &trie, uint32_t parent, wchar_t ch)
+    {
+        uint32_t node = find(trie, parent, ch);
+        if (node != 0)
+            return node;
+
+        patternnode_t child = { ch, 0, trie[parent].child, 0, 0 };
+        node = (uint32_t)trie.size();
+        trie.push_back(child);
+        trie[parent].child = node;
+        return node;
+    }
+
+    trie_t m_prefixes;  // Trie of the prefix and exact patterns.
+    trie_t m_suffixes;  // Trie of the reversed suffix patterns.
+    size_t m_count;     // Number of patterns added.
+};
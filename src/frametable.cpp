@@ -0,0 +1,188 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Frame Description Table Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#define VLDBUILD
+#include "frametable.h" // This class' header.
+#include "vldheap.h"    // Provides internal new and delete operators.
+
+#define FRAME_TABLE_RESERVE 256 // Even small programs resolve a few hundred distinct frames.
+
+extern volatile LONG g_modulesGeneration;
+
+// Constructor - Initializes an empty table.
+//
+FrameTable::FrameTable ()
+{
+    m_frames.reserve(FRAME_TABLE_RESERVE);
+    m_frameInfo = new FrameInfoMap;
+    m_frameInfo->reserve(FRAME_TABLE_RESERVE);
+    m_generation = g_modulesGeneration;
+    m_count = 0;
+    m_bytes = 0;
+}
+
+// Destructor - Frees every interned description. Call stacks that still
+//   reference any of them must have been freed already.
+//
+FrameTable::~FrameTable ()
+{
+    freeFrameInfo();
+    delete m_frameInfo;
+    for (Set<framekey_t>::Iterator it = m_frames.begin(); it != m_frames.end(); ++it) {
+        delete [] (BYTE*)(*it).desc;
+    }
+}
+
+// operator < - Orders keys by length first, then by text, which is all a
+//   lookup needs and avoids comparing the long common prefixes of lines from
+//   the same source file more often than necessary.
+//
+//  - other (IN): The key to compare against.
+//
+//  Return Value:
+//
+//    Returns TRUE if this key orders before the other key.
+//
+BOOL FrameTable::framekey_t::operator < (const framekey_t &other) const
+{
+    if (length != other.length)
+        return length < other.length;
+    return wmemcmp(text, other.text, length) < 0;
+}
+
+// intern - Finds the description with the specified text, adding it to the
+//   table if it is not there yet.
+//
+//  - text (IN): The description text. Need not be null-terminated.
+//
+//  - length (IN): Length of the text, in characters.
+//
+//  Return Value:
+//
+//    Returns the interned description, which stays valid until the table is
+//    destroyed.
+//
+const framedesc_t* FrameTable::intern (LPCWSTR text, UINT32 length)
+{
+    framekey_t key = { text, length, NULL };
+    Set<framekey_t>::Iterator it = m_frames.find(key);
+    if (it != m_frames.end())
+        return (*it).desc;
+
+    SIZE_T size = sizeof(framedesc_t) + length * sizeof(WCHAR);
+    framedesc_t* desc = (framedesc_t*)new BYTE [size];
+    desc->length = length;
+    memcpy(desc->text, text, length * sizeof(WCHAR));
+    desc->text[length] = L'\0';
+
+    key.text = desc->text;
+    key.desc = desc;
+    it = m_frames.insert(key);
+    if (it == m_frames.end()) {
+        // Another thread interned the same text in the meantime.
+        delete [] (BYTE*)desc;
+        return (*m_frames.find(key)).desc;
+    }
+    InterlockedIncrement(&m_count);
+    InterlockedExchangeAdd64(&m_bytes, (LONG64)size);
+    return desc;
+}
+
+// getFrameInfo - Obtains what is known about the specified program counter.
+//   Program counters seen for the first time get an empty entry (flags of 0)
+//   for the caller to fill in.
+//
+//  - programcounter (IN): The program counter to look up.
+//
+//  - locker (IN): Proof that the caller holds the DbgHelp lock.
+//
+//  Return Value:
+//
+//    Returns the entry for the program counter. It stays valid as long as the
+//    caller holds the DbgHelp lock.
+//
+frameinfo_t* FrameTable::getFrameInfo (UINT_PTR programcounter, CriticalSectionLocker<DbgHelp>& locker)
+{
+    UNREFERENCED_PARAMETER(locker);
+
+    LONG generation = g_modulesGeneration;
+    if (generation != m_generation) {
+        // Modules were loaded or unloaded: the same addresses may now belong to
+        // other functions. Interned descriptions stay, as resolved call stacks
+        // still refer to them.
+        freeFrameInfo();
+        delete m_frameInfo;
+        m_frameInfo = new FrameInfoMap;
+        m_frameInfo->reserve(FRAME_TABLE_RESERVE);
+        m_generation = generation;
+    }
+
+    FrameInfoMap::Iterator it = m_frameInfo->find(programcounter);
+    if (it != m_frameInfo->end())
+        return (*it).second;
+
+    frameinfo_t* info = new frameinfo_t;
+    info->flags = 0x0;
+    info->crtStatus = 0x0;
+    info->desc = NULL;
+    m_frameInfo->insert(programcounter, info);
+    return info;
+}
+
+// freeFrameInfo - Frees every entry of the program counter map.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID FrameTable::freeFrameInfo ()
+{
+    for (FrameInfoMap::Iterator it = m_frameInfo->begin(); it != m_frameInfo->end(); ++it) {
+        delete (*it).second;
+    }
+}
+
+// size - Obtains the number of distinct descriptions in the table.
+//
+//  Return Value:
+//
+//    Returns the number of descriptions.
+//
+size_t FrameTable::size () const
+{
+    return (size_t)m_count;
+}
+
+// bytes - Obtains the amount of memory used by the interned descriptions, not
+//   counting the set indexing them.
+//
+//  Return Value:
+//
+//    Returns the number of bytes.
+//
+SIZE_T FrameTable::bytes () const
+{
+    return (SIZE_T)m_bytes;
+}
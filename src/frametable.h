@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Frame Description Table Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include <windows.h>
+#include "dbghelp.h"    // Provides the DbgHelp lock.
+#include "map.h"        // Provides a custom STL-like map template.
+#include "set.h"        // Provides a custom STL-like set template.
+
+// An interned frame description: one line of a resolved call stack, such as
+// "    file.cpp (42): module.dll!function() + 0x12 bytes\n". Descriptions are
+// immutable and live as long as the FrameTable that interned them, so a
+// pointer to one serves as its ID.
+struct framedesc_t
+{
+    UINT32 length;          // Length of the text, in characters, not counting the terminator.
+    WCHAR  text [1];        // The text itself. The structure is allocated large enough to hold it.
+};
+
+// What is known about one program counter. Symbolizing and classifying a frame
+// is by far the most expensive part of reporting, and the same return addresses
+// show up in the call stacks of many leaks, so each is only done once.
+struct frameinfo_t
+{
+    UINT32             flags;       // Status flags:
+#define FRAMEINFO_CLASSIFIED 0x1    //   If set, crtStatus is valid.
+#define FRAMEINFO_RESOLVED   0x2    //   If set, desc and the flags below are valid.
+#define FRAMEINFO_INTERNAL   0x4    //   If set, the frame is in a source file internal to the heap.
+#define FRAMEINFO_VLD        0x8    //   If set, the frame is in VLD itself.
+    UINT32             crtStatus;   // CALLSTACK_STATUS_STARTUPCRT, CALLSTACK_STATUS_NOTSTARTUPCRT, or 0.
+    const framedesc_t* desc;        // Interned description of the frame, or NULL if there is none.
+};
+
+typedef Map<UINT_PTR, frameinfo_t*> FrameInfoMap;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The FrameTable Class
+//
+//    Resolved call stacks used to be rendered into a private buffer with room
+//    for MAXREPORTLENGTH characters per frame, even though almost every leaked
+//    call stack shares most of its frames with many others. Instead, each
+//    distinct frame description is now stored once in this table, and resolved
+//    call stacks only keep an array of pointers to their descriptions. They are
+//    rendered to text when they are actually printed.
+//
+//    Descriptions are never removed from the table, so they may be read
+//    without holding any lock. Interning is thread safe.
+//
+//    The table also remembers what is known about each program counter (see
+//    frameinfo_t). That information is protected by the DbgHelp lock, and is
+//    forgotten whenever modules are loaded or unloaded, as a program counter
+//    may then belong to a different function.
+//
+class FrameTable
+{
+public:
+    FrameTable ();
+    ~FrameTable ();
+    const framedesc_t* intern (LPCWSTR text, UINT32 length);
+    frameinfo_t* getFrameInfo (UINT_PTR programcounter, CriticalSectionLocker<DbgHelp>& locker);
+    size_t size () const;
+    SIZE_T bytes () const;
+
+private:
+    // Set key ordering descriptions by their text.
+    struct framekey_t {
+        LPCWSTR            text;
+        UINT32             length;
+        const framedesc_t* desc;
+
+        BOOL operator < (const framekey_t &other) const;
+    };
+
+    VOID freeFrameInfo ();
+
+    Set<framekey_t>  m_frames;          // Every interned description, ordered by text.
+    FrameInfoMap    *m_frameInfo;       // What is known about each program counter.
+    LONG             m_generation;      // Value of g_modulesGeneration when m_frameInfo was filled.
+    volatile LONG    m_count;           // Number of interned descriptions.
+    volatile LONG64  m_bytes;           // Memory used by the interned descriptions.
+};
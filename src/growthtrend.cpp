@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Growth Trend Test
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD          // Declares that we are building Visual Leak Detector.
+#include "growthtrend.h"  // Provides the growth trend test.
+
+namespace {
+
+// Counts the samples in which the live bytes grew.
+unsigned countRises (unsigned history)
+{
+    unsigned rises = 0;
+    for (; history != 0; history &= history - 1)
+        rises++;
+    return rises;
+}
+
+} // namespace
+
+// InitGrowthTrend - Resets the trend of a call site which has not been sampled
+//   yet.
+//
+//  - trend (OUT): Trend to initialize.
+//
+//  Return Value:
+//
+//    None.
+//
+void InitGrowthTrend (growthtrend_t &trend)
+{
+    trend.lastBytes     = 0;
+    trend.lowBytes      = (size_t)-1;
+    trend.highBytes     = 0;
+    trend.reportedBytes = 0;
+    trend.history       = 0;
+    trend.samples       = 0;
+}
+
+// SampleGrowthTrend - Adds a sample to the trend of a call site and tests
+//   whether the site should be reported as a suspected leak. Takes constant
+//   time.
+//
+//  - trend (IN/OUT): Trend of the call site.
+//
+//  - livebytes (IN): Bytes of the live blocks allocated from the call site.
+//
+//  Return Value:
+//
+//    Returns true if the site's live bytes keep growing and it should be
+//    reported now. Otherwise returns false.
+//
+bool SampleGrowthTrend (growthtrend_t &trend, size_t livebytes)
+{
+    const unsigned mask = (GROWTH_TREND_WINDOWS < 32) ? ((1u << GROWTH_TREND_WINDOWS) - 1) : ~0u;
+    trend.history = ((trend.history << 1) | ((livebytes > trend.lastBytes) ? 1 : 0)) & mask;
+    trend.lastBytes = livebytes;
+    if (trend.samples < GROWTH_TREND_WINDOWS)
+        trend.samples++;
+    if (livebytes < trend.lowBytes)
+        trend.lowBytes = livebytes;
+    bool newhigh = (livebytes > trend.highBytes);
+    if (newhigh)
+        trend.highBytes = livebytes;
+
+    if ((trend.samples < GROWTH_TREND_WINDOWS) || (countRises(trend.history) < GROWTH_TREND_MIN_RISES) || !newhigh)
+        return false;
+    if (livebytes - trend.lowBytes < GROWTH_TREND_MIN_BYTES)
+        return false;
+    if ((trend.reportedBytes != 0) && (livebytes / 2 < trend.reportedBytes))
+        return false;
+
+    trend.reportedBytes = livebytes;
+    trend.lowBytes = livebytes;
+    trend.highBytes = livebytes;
+    return true;
+}
@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Growth Trend Test Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include <cstddef>
+
+#define GROWTH_TREND_WINDOWS    16      // Number of samples the trend test looks back on (at most 32).
+#define GROWTH_TREND_MIN_RISES  14      // Samples, out of those, in which the live bytes must have grown.
+#define GROWTH_TREND_MIN_BYTES  0x10000 // Growth, in bytes, too small to ever be suspected.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The growthtrend_t Structure
+//
+//    Follows the live bytes allocated from one call site, sampled once per
+//    window of allocations, to tell a site which keeps leaking from one whose
+//    usage merely goes up and down. Only the direction of the last samples is
+//    remembered, one bit each: the site is suspected when its live bytes grew
+//    in nearly every one of the last GROWTH_TREND_WINDOWS samples (a sign test,
+//    which a site whose usage goes up and down at random passes with a
+//    probability of about one in five hundred), reached a new high, and grew by
+//    at least GROWTH_TREND_MIN_BYTES overall. Once reported, a site is only
+//    reported again after its live bytes doubled.
+//
+struct growthtrend_t
+{
+    size_t   lastBytes;     // Live bytes at the previous sample.
+    size_t   lowBytes;      // Lowest live bytes sampled since the site was last reported.
+    size_t   highBytes;     // Highest live bytes sampled since the site was last reported.
+    size_t   reportedBytes; // Live bytes when the site was last reported, or 0.
+    unsigned history;       // One bit per sample, the latest in bit 0: set if the live bytes grew.
+    unsigned samples;       // Number of samples taken, up to GROWTH_TREND_WINDOWS.
+};
+
+// Growth trend functions. See function definitions for details.
+void InitGrowthTrend (growthtrend_t &trend);
+bool SampleGrowthTrend (growthtrend_t &trend, size_t livebytes);
@@ -0,0 +1,275 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Internal Statistics
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD
+#include "internalstats.h"  // This file's header.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+#if defined(_WIN32)
+#define STATS_THREAD_LOCAL __declspec(thread)
+#else
+// The initial-exec model keeps accesses from allocating, as in the heap hooks
+// of libvld_preload.so.
+#define STATS_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#endif
+
+std::atomic<bool> g_internalStatsEnabled (false);
+
+static std::atomic<threadstats_t*> s_threads (NULL);    // Counters of every thread which recorded something.
+static threadstats_t               s_discarded;         // Counters recorded while a thread's own are allocated.
+static STATS_THREAD_LOCAL threadstats_t *t_stats;       // The calling thread's counters, or NULL.
+
+static const LPCWSTR s_statNames [STATS_COUNT] = {
+    L"getTls",
+    L"IsExcludedModule",
+    L"Stack capture",
+    L"mapBlock",
+    L"unmapBlock",
+    L"remapBlock",
+    L"Heap map lock",
+    L"VLD heap lock",
+    L"Modules lock",
+    L"Symbols",
+};
+
+// CreateThreadStats - Allocates the counters of the calling thread, on cache
+//   lines of their own, and adds them to the list of every thread's counters.
+//
+//  Return Value:
+//
+//    Returns the counters, all zero.
+//
+static threadstats_t* CreateThreadStats ()
+{
+    // The allocation may wait for a lock which is itself measured. What it
+    // records goes to counters nobody reads.
+    t_stats = &s_discarded;
+
+    const size_t size = (sizeof(threadstats_t) + STATS_CACHE_LINE - 1) & ~(size_t)(STATS_CACHE_LINE - 1);
+    BYTE *allocation = new BYTE [size + STATS_CACHE_LINE - 1];
+    UINT_PTR aligned = ((UINT_PTR)allocation + STATS_CACHE_LINE - 1) & ~(UINT_PTR)(STATS_CACHE_LINE - 1);
+    threadstats_t *stats = (threadstats_t*)aligned;
+    stats->allocation = allocation;
+    for (UINT stat = 0; stat < STATS_COUNT; stat++) {
+        statcounter_t &counter = stats->counters[stat];
+        counter.calls.store(0, std::memory_order_relaxed);
+        counter.cycles.store(0, std::memory_order_relaxed);
+        counter.maxCycles.store(0, std::memory_order_relaxed);
+        for (unsigned bucket = 0; bucket < STATS_BUCKETS; bucket++)
+            counter.buckets[bucket].store(0, std::memory_order_relaxed);
+    }
+
+    threadstats_t *first = s_threads.load(std::memory_order_relaxed);
+    do {
+        stats->next = first;
+    } while (!s_threads.compare_exchange_weak(first, stats, std::memory_order_release, std::memory_order_relaxed));
+
+    t_stats = stats;
+    return stats;
+}
+
+// EnableInternalStats - Starts or stops recording the statistics. The counts
+//   recorded so far are kept.
+//
+//  - enable (IN): If true, the statistics are recorded from now on.
+//
+//  Return Value:
+//
+//    None.
+//
+void EnableInternalStats (bool enable)
+{
+    g_internalStatsEnabled.store(enable, std::memory_order_relaxed);
+}
+
+// FreeInternalStats - Stops recording the statistics, and frees the counters
+//   of every thread. No other thread may be recording meanwhile, or ever
+//   again, since threads keep a pointer to their counters: call it when VLD
+//   shuts down, or from tests once their threads are finished.
+//
+//  Return Value:
+//
+//    None.
+//
+void FreeInternalStats ()
+{
+    EnableInternalStats(false);
+    threadstats_t *stats = s_threads.exchange(NULL, std::memory_order_acquire);
+    while (stats != NULL) {
+        threadstats_t *next = stats->next;
+        delete [] (BYTE*)stats->allocation;
+        stats = next;
+    }
+    t_stats = NULL;
+}
+
+// ReadInternalStats - Sums the counters of every thread, for each operation.
+//   Calls recorded while the sums are made may be missed, or only partly
+//   counted.
+//
+//  - counts (OUT): Array of STATS_COUNT elements receiving the sums, indexed by
+//      operation.
+//
+//  Return Value:
+//
+//    None.
+//
+void ReadInternalStats (statcounts_t *counts)
+{
+    for (UINT stat = 0; stat < STATS_COUNT; stat++) {
+        counts[stat].calls = 0;
+        counts[stat].cycles = 0;
+        counts[stat].maxCycles = 0;
+        for (unsigned bucket = 0; bucket < STATS_BUCKETS; bucket++)
+            counts[stat].buckets[bucket] = 0;
+    }
+
+    for (threadstats_t *stats = s_threads.load(std::memory_order_acquire); stats != NULL; stats = stats->next) {
+        for (UINT stat = 0; stat < STATS_COUNT; stat++) {
+            const statcounter_t &counter = stats->counters[stat];
+            counts[stat].calls += counter.calls.load(std::memory_order_relaxed);
+            counts[stat].cycles += counter.cycles.load(std::memory_order_relaxed);
+            std::uint64_t longest = counter.maxCycles.load(std::memory_order_relaxed);
+            if (longest > counts[stat].maxCycles)
+                counts[stat].maxCycles = longest;
+            for (unsigned bucket = 0; bucket < STATS_BUCKETS; bucket++)
+                counts[stat].buckets[bucket] += counter.buckets[bucket].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// RecordStat - Counts one call to an operation, in the calling thread's
+//   counters. The first call made by a thread allocates them.
+//
+//  - stat (IN): The operation, one of the STATS_* values. Nothing is recorded
+//      for STATS_NONE.
+//
+//  - cycles (IN): Time stamp counter ticks the call took.
+//
+//  Return Value:
+//
+//    None.
+//
+void RecordStat (UINT stat, std::uint64_t cycles)
+{
+    if (stat >= STATS_COUNT)
+        return;
+
+    threadstats_t *stats = t_stats;
+    if (stats == NULL)
+        stats = CreateThreadStats();
+
+    // Only this thread writes the counters: plain loads and stores suffice.
+    statcounter_t &counter = stats->counters[stat];
+    counter.calls.store(counter.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    counter.cycles.store(counter.cycles.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+    if (cycles > counter.maxCycles.load(std::memory_order_relaxed))
+        counter.maxCycles.store(cycles, std::memory_order_relaxed);
+    std::atomic<std::uint64_t> &bucket = counter.buckets[StatBucket(cycles)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// StatBucket - Finds the bucket of a latency histogram counting a call.
+//
+//  - cycles (IN): Time stamp counter ticks the call took.
+//
+//  Return Value:
+//
+//    Returns the index of the bucket, from 0 to STATS_BUCKETS - 1.
+//
+unsigned StatBucket (std::uint64_t cycles)
+{
+    if (cycles == 0)
+        return 0;
+    if ((cycles >> (STATS_BUCKETS - 2)) != 0)
+        return STATS_BUCKETS - 1;
+
+    // The call fits in 32 bits: the bucket is the number of significant bits.
+#if defined(_MSC_VER)
+    unsigned long highest;
+    _BitScanReverse(&highest, (unsigned long)cycles);
+    return (unsigned)highest + 1;
+#else
+    return 32 - (unsigned)__builtin_clz((unsigned)cycles);
+#endif
+}
+
+// StatBucketLimit - Finds the upper limit of a bucket of a latency histogram.
+//
+//  - bucket (IN): Index of the bucket.
+//
+//  Return Value:
+//
+//    Returns the smallest number of ticks counted by the next bucket, or
+//    UINT64_MAX for the last bucket.
+//
+std::uint64_t StatBucketLimit (unsigned bucket)
+{
+    if (bucket >= STATS_BUCKETS - 1)
+        return UINT64_MAX;
+    return (std::uint64_t)1 << bucket;
+}
+
+// StatName - Obtains the name of an operation, as shown in reports.
+//
+//  - stat (IN): The operation, one of the STATS_* values.
+//
+//  Return Value:
+//
+//    Returns the name of the operation, or an empty string if stat is out of
+//    range.
+//
+LPCWSTR StatName (UINT stat)
+{
+    return (stat < STATS_COUNT) ? s_statNames[stat] : L"";
+}
+
+// StatQuantile - Finds the bucket holding a given percentile of the calls.
+//
+//  - buckets (IN): Counters of a latency histogram, STATS_BUCKETS of them.
+//
+//  - total (IN): Sum of the counters.
+//
+//  - percent (IN): The percentile, from 0 to 100.
+//
+//  Return Value:
+//
+//    Returns the index of the first bucket such that at least percent percent
+//    of the calls fall in it or in the buckets before it, or 0 if the
+//    histogram is empty.
+//
+unsigned StatQuantile (const std::uint64_t *buckets, std::uint64_t total, unsigned percent)
+{
+    if (total == 0)
+        return 0;
+
+    // The number of calls to reach, rounded up without overflowing.
+    std::uint64_t threshold = (total / 100) * percent + ((total % 100) * percent + 99) / 100;
+    std::uint64_t count = 0;
+    for (unsigned bucket = 0; bucket < STATS_BUCKETS - 1; bucket++) {
+        count += buckets[bucket];
+        if ((count >= threshold) && (count != 0))
+            return bucket;
+    }
+    return STATS_BUCKETS - 1;
+}
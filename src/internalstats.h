@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Internal Statistics Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <atomic>
+#include <cstdint>
+#pragma pop_macro("new")
+#include "platform.h"   // Provides the Win32 types and the time stamp counter.
+
+#define STATS_BUCKETS       32  // Number of buckets of each latency histogram. Must match VLD_STAT_BUCKETS.
+#define STATS_CACHE_LINE    64  // The counters of each thread start on a cache line of their own.
+
+// The operations measured. Must match the VLD_STAT_* values of vld_def.h.
+#define STATS_GET_TLS           0   // Finding the thread local storage of a hook (vld.dll only).
+#define STATS_EXCLUDED_MODULE   1   // Finding whether the module calling a hook is excluded.
+#define STATS_STACK_CAPTURE     2   // Capturing the call stack of an allocation.
+#define STATS_MAP_BLOCK         3   // BlockTracker::mapBlock.
+#define STATS_UNMAP_BLOCK       4   // BlockTracker::unmapBlock.
+#define STATS_REMAP_BLOCK       5   // BlockTracker::remapBlock.
+#define STATS_HEAPMAP_LOCK      6   // Waiting for the lock protecting the block maps.
+#define STATS_VLDHEAP_LOCK      7   // Waiting for the locks of VLD's own blocks (vld.dll only).
+#define STATS_MODULES_LOCK      8   // Waiting for the lock protecting the loaded modules.
+#define STATS_SYMBOLS           9   // Resolving the symbols of a call stack.
+#define STATS_COUNT             10  // Number of operations measured.
+#define STATS_NONE              ((UINT)-1)  // Index of no operation: nothing is recorded.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The statcounter_t Structure
+//
+//    Counts the calls made to one operation by one thread, and how many time
+//    stamp counter ticks they took: in total, at most, and in a histogram
+//    whose scale is logarithmic like the one of lifetimehist_t. Bucket 0 counts
+//    calls of 0 ticks, bucket n those from 2^(n-1) up to 2^n - 1, and the last
+//    bucket every longer call too.
+//
+//    Only the thread owning the counters writes them, without atomic
+//    read-modify-write operations, so recording costs no more than plain
+//    stores. They are atomic so that other threads may read them meanwhile.
+//
+struct statcounter_t
+{
+    std::atomic<std::uint64_t> calls;       // Number of calls.
+    std::atomic<std::uint64_t> cycles;      // Ticks spent in all the calls.
+    std::atomic<std::uint64_t> maxCycles;   // Ticks spent in the longest call.
+    std::atomic<std::uint64_t> buckets [STATS_BUCKETS]; // Calls by number of ticks.
+};
+
+// The counters of one thread. They are linked together by pushing them
+// atomically, and are never freed while VLD is running, so that the counts of
+// threads which exited are still there to be read.
+struct threadstats_t
+{
+    threadstats_t *next;                        // Next thread in the list. Never changes once published.
+    void          *allocation;                  // The memory holding the structure, which may start before it.
+    statcounter_t  counters [STATS_COUNT];      // Indexed by STATS_* operation.
+};
+
+// A copy of the counters of one operation, summed over every thread.
+struct statcounts_t
+{
+    std::uint64_t calls;
+    std::uint64_t cycles;
+    std::uint64_t maxCycles;
+    std::uint64_t buckets [STATS_BUCKETS];
+};
+
+// Set while the statistics are being recorded. See InternalStatsEnabled.
+extern std::atomic<bool> g_internalStatsEnabled;
+
+// Internal statistics functions. See function definitions for details.
+void          EnableInternalStats (bool enable);
+void          FreeInternalStats ();
+void          ReadInternalStats (statcounts_t *counts);
+void          RecordStat (UINT stat, std::uint64_t cycles);
+unsigned      StatBucket (std::uint64_t cycles);
+std::uint64_t StatBucketLimit (unsigned bucket);
+LPCWSTR       StatName (UINT stat);
+unsigned      StatQuantile (const std::uint64_t *buckets, std::uint64_t total, unsigned percent);
+
+// InternalStatsEnabled - Tells whether the statistics are being recorded.
+//   While they aren't, this test is all the instrumented code pays for.
+//
+//  Return Value:
+//
+//    Returns true if the statistics are being recorded.
+//
+inline bool InternalStatsEnabled ()
+{
+    return g_internalStatsEnabled.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The StatTimer Class
+//
+//    Measures the scope it is declared in as one call to an operation. The
+//    time stamp counter is only read if the statistics are being recorded when
+//    the timer is constructed.
+//
+class StatTimer
+{
+public:
+    explicit StatTimer (UINT stat)
+        : m_stat(stat), m_start(InternalStatsEnabled() ? __rdtsc() : 0)
+    {
+    }
+    ~StatTimer ()
+    {
+        if (m_start != 0)
+            RecordStat(m_stat, __rdtsc() - m_start);
+    }
+private:
+    // Disallow certain operations
+    StatTimer ();
+    StatTimer (const StatTimer&);
+    StatTimer& operator = (const StatTimer&);
+private:
+    UINT          m_stat;   // The operation measured.
+    std::uint64_t m_start;  // Time stamp counter when the scope was entered, or 0 if not measured.
+};
@@ -0,0 +1,156 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Lifetime Histograms
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD            // Declares that we are building Visual Leak Detector.
+#include "lifetimehist.h"   // Provides the lifetime histograms.
+
+// InitLifetimeHistogram - Resets the histogram of a call site from which no
+//   block has been freed yet.
+//
+//  - hist (OUT): Histogram to initialize.
+//
+//  - site (IN): The call site, which is only handed back to the caller.
+//
+//  - hash (IN): Hash identifying the call site in reports.
+//
+//  Return Value:
+//
+//    None.
+//
+void InitLifetimeHistogram (lifetimehist_t &hist, const void *site, unsigned hash)
+{
+    hist.next = NULL;
+    hist.site = site;
+    hist.hash = hash;
+    for (unsigned bucket = 0; bucket < LIFETIME_BUCKETS; bucket++) {
+        hist.serials[bucket].store(0, std::memory_order_relaxed);
+        hist.ticks[bucket].store(0, std::memory_order_relaxed);
+    }
+}
+
+// LifetimeBucket - Finds the bucket counting a lifetime.
+//
+//  - lifetime (IN): The lifetime, in any unit.
+//
+//  Return Value:
+//
+//    Returns the index of the bucket: the number of significant bits of the
+//    lifetime, capped to the last bucket.
+//
+unsigned LifetimeBucket (std::uint64_t lifetime)
+{
+    unsigned bucket = 0;
+    for (; (lifetime != 0) && (bucket < LIFETIME_BUCKETS - 1); lifetime >>= 1)
+        bucket++;
+    return bucket;
+}
+
+// LifetimeBucketLimit - Obtains the shortest lifetime counted after a bucket.
+//
+//  - bucket (IN): Index of the bucket.
+//
+//  Return Value:
+//
+//    Returns 2^bucket, the exclusive upper bound of the lifetimes counted by
+//    the bucket, or UINT64_MAX for the last bucket.
+//
+std::uint64_t LifetimeBucketLimit (unsigned bucket)
+{
+    if (bucket >= LIFETIME_BUCKETS - 1)
+        return UINT64_MAX;
+    return (std::uint64_t)1 << bucket;
+}
+
+// LifetimeQuantile - Finds the bucket holding a given percentile of the
+//   lifetimes.
+//
+//  - buckets (IN): Counters of a histogram, LIFETIME_BUCKETS of them.
+//
+//  - total (IN): Sum of the counters.
+//
+//  - percent (IN): The percentile, from 0 to 100.
+//
+//  Return Value:
+//
+//    Returns the index of the first bucket such that at least percent percent
+//    of the lifetimes fall in it or in the buckets before it, or 0 if the
+//    histogram is empty.
+//
+unsigned LifetimeQuantile (const std::uint64_t *buckets, std::uint64_t total, unsigned percent)
+{
+    if (total == 0)
+        return 0;
+
+    // The number of lifetimes to reach, rounded up without overflowing.
+    std::uint64_t threshold = (total / 100) * percent + ((total % 100) * percent + 99) / 100;
+    std::uint64_t count = 0;
+    for (unsigned bucket = 0; bucket < LIFETIME_BUCKETS - 1; bucket++) {
+        count += buckets[bucket];
+        if ((count >= threshold) && (count != 0))
+            return bucket;
+    }
+    return LIFETIME_BUCKETS - 1;
+}
+
+// PublishLifetimeHistogram - Adds a histogram to a list, where readers can
+//   find it without taking any lock. Safe to call from several threads at
+//   once.
+//
+//  - head (IN/OUT): Head of the list.
+//
+//  - hist (IN): Initialized histogram to add. It must stay allocated as long as
+//      the list is read.
+//
+//  Return Value:
+//
+//    None.
+//
+void PublishLifetimeHistogram (std::atomic<lifetimehist_t*> &head, lifetimehist_t *hist)
+{
+    lifetimehist_t *first = head.load(std::memory_order_relaxed);
+    do {
+        hist->next = first;
+    } while (!head.compare_exchange_weak(first, hist, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// ReadLifetimeHistogram - Copies the counters of a histogram. Frees recorded
+//   while the copy is made may be missed, or only counted in one of the two
+//   arrays.
+//
+//  - hist (IN): Histogram to read.
+//
+//  - counts (OUT): Receives the counters.
+//
+//  Return Value:
+//
+//    None.
+//
+void ReadLifetimeHistogram (const lifetimehist_t &hist, lifetimecounts_t &counts)
+{
+    counts.frees = 0;
+    for (unsigned bucket = 0; bucket < LIFETIME_BUCKETS; bucket++) {
+        counts.serials[bucket] = hist.serials[bucket].load(std::memory_order_relaxed);
+        counts.ticks[bucket] = hist.ticks[bucket].load(std::memory_order_relaxed);
+        counts.frees += counts.serials[bucket];
+    }
+}
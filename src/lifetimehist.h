@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Lifetime Histogram Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define LIFETIME_BUCKETS 48 // Number of buckets of each histogram. Must match VLD_LIFETIME_BUCKETS.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The lifetimehist_t Structure
+//
+//    Counts the blocks allocated from one call site by how long they lived
+//    before being freed, measured both in allocations made meanwhile (serial
+//    numbers) and in processor cycles (the time stamp counter). The scale is
+//    logarithmic: bucket 0 counts lifetimes of 0, bucket n those from 2^(n-1)
+//    up to 2^n - 1, and the last bucket every longer lifetime too.
+//
+//    Frees update the counters with atomic increments, and the histograms are
+//    linked together by pushing them atomically, so they can be read at any
+//    time without a lock. A histogram is never freed while VLD is running.
+//
+struct lifetimehist_t
+{
+    lifetimehist_t             *next;   // Next histogram in the list. Never changes once published.
+    const void                 *site;   // The call site the histogram belongs to, opaque to this code.
+    unsigned                    hash;   // Hash identifying the call site in reports.
+    std::atomic<std::uint64_t>  serials [LIFETIME_BUCKETS]; // Lifetimes, in allocations.
+    std::atomic<std::uint64_t>  ticks [LIFETIME_BUCKETS];   // Lifetimes, in time stamp counter ticks.
+};
+
+// A copy of the counters of a histogram, as read at one point in time.
+struct lifetimecounts_t
+{
+    std::uint64_t frees;                      // Number of blocks freed: the sum of either array.
+    std::uint64_t serials [LIFETIME_BUCKETS]; // Lifetimes, in allocations.
+    std::uint64_t ticks [LIFETIME_BUCKETS];   // Lifetimes, in time stamp counter ticks.
+};
+
+// Lifetime histogram functions. See function definitions for details.
+void          InitLifetimeHistogram (lifetimehist_t &hist, const void *site, unsigned hash);
+void          PublishLifetimeHistogram (std::atomic<lifetimehist_t*> &head, lifetimehist_t *hist);
+unsigned      LifetimeBucket (std::uint64_t lifetime);
+std::uint64_t LifetimeBucketLimit (unsigned bucket);
+unsigned      LifetimeQuantile (const std::uint64_t *buckets, std::uint64_t total, unsigned percent);
+void          ReadLifetimeHistogram (const lifetimehist_t &hist, lifetimecounts_t &counts);
+
+// RecordLifetime - Counts a freed block in the histogram of its call site.
+//   Lock-free, and safe to call from several threads at once.
+//
+//  - hist (IN/OUT): Histogram of the block's call site.
+//
+//  - serials (IN): Number of allocations made while the block was alive.
+//
+//  - ticks (IN): Time stamp counter ticks elapsed while the block was alive.
+//
+//  Return Value:
+//
+//    None.
+//
+inline void RecordLifetime (lifetimehist_t &hist, std::uint64_t serials, std::uint64_t ticks)
+{
+    hist.serials[LifetimeBucket(serials)].fetch_add(1, std::memory_order_relaxed);
+    hist.ticks[LifetimeBucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+}
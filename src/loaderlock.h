@@ -28,12 +28,18 @@
 class LoaderLock
 {
 public:
-    LoaderLock() : m_uCookie(NULL), m_hThreadId(NULL) {
+    // If tryOnly is true, the lock is only taken if no other thread holds it.
+    // Check IsLocked to find out whether it was.
+    explicit LoaderLock(bool tryOnly = false) : m_uCookie(NULL), m_hThreadId(NULL) {
         ULONG uState = NULL;
-        NTSTATUS ntStatus = LdrLockLoaderLock(LDR_LOCK_LOADER_LOCK_FLAG_DEFAULT, &uState, &m_uCookie);
-        if (ntStatus == STATUS_SUCCESS) {
+        NTSTATUS ntStatus = LdrLockLoaderLock(tryOnly ? LDR_LOCK_LOADER_LOCK_FLAG_TRY_ONLY : LDR_LOCK_LOADER_LOCK_FLAG_DEFAULT,
+            &uState, &m_uCookie);
+        if ((ntStatus == STATUS_SUCCESS) && (!tryOnly || (uState == LDR_LOCK_LOADER_LOCK_STATE_LOCK_ACQUIRED))) {
             m_hThreadId = GetCurrentThreadId();
         }
+        else {
+            m_uCookie = NULL;
+        }
     }
 
     ~LoaderLock() {
@@ -46,6 +52,10 @@ public:
         }
     }
 
+    bool IsLocked() const {
+        return (m_uCookie != NULL);
+    }
+
 private:
     // Disallow certain operations
     LoaderLock(const LoaderLock&);
@@ -94,7 +94,7 @@ public:
 //  nature, this map class has a noticeable performance advantage over some
 //  other standard STL map implementations.
 //
-template <typename Tk, typename Tv>
+template <typename Tk, typename Tv, typename Tl = CriticalSection>
 class Map {
 public:
     class Iterator {
@@ -180,7 +180,7 @@ public:
         // 
         Iterator operator ++ ()
         {
-            typename Tree<Pair<Tk, Tv> >::node_t *cur = m_node;
+            typename Tree<Pair<Tk, Tv>, Tl>::node_t *cur = m_node;
 
             m_node = m_tree->next(m_node);
             return Iterator(m_tree, cur);
@@ -200,7 +200,7 @@ public:
         //
         Iterator operator - (SIZE_T num) const
         {
-            typename Tree<Pair<Tk, Tv> >::node_t *cur = m_node;
+            typename Tree<Pair<Tk, Tv>, Tl>::node_t *cur = m_node;
 
             for (SIZE_T count = 0; count < num; count++)  {
                 cur = m_tree->prev(cur);
@@ -231,17 +231,17 @@ public:
         // Private constructor. Only the Map class itself may use this
         //   constructor. It is used for constructing Iterators which reference
         //   specific nodes in the internal tree's structure.
-        Iterator (const Tree<Pair<Tk, Tv> > *tree, typename Tree<Pair<Tk, Tv> >::node_t *node)
+        Iterator (const Tree<Pair<Tk, Tv>, Tl> *tree, typename Tree<Pair<Tk, Tv>, Tl>::node_t *node)
         {
             m_node = node;
             m_tree = tree;
         }
 
-        typename Tree<Pair<Tk, Tv> >::node_t *m_node; // Pointer to the node referenced by the Map Iterator.
-        const Tree<Pair<Tk, Tv> >            *m_tree; // Pointer to the tree containing the referenced node.
+        typename Tree<Pair<Tk, Tv>, Tl>::node_t *m_node; // Pointer to the node referenced by the Map Iterator.
+        const Tree<Pair<Tk, Tv>, Tl>            *m_tree; // Pointer to the tree containing the referenced node.
 
         // The Map class is a friend of Map Iterators.
-        friend class Map<Tk, Tv>;
+        friend class Map<Tk, Tv, Tl>;
     };
 
     // begin - Obtains an Iterator referencing the beginning of the Map (i.e.
@@ -273,6 +273,24 @@ public:
         return Iterator(&m_tree, NULL);
     }
 
+    // entry - Obtains the key/value pair referenced by an Iterator, so that
+    //   its value can be modified in place. Unlike the key, the value doesn't
+    //   affect the pair's position in the map. The pair stays at the same
+    //   address until it is erased from the map.
+    //
+    //  Note: The key must not be modified.
+    //
+    //  - it (IN): Iterator referencing the key/value pair.
+    //
+    //  Return Value:
+    //
+    //    Returns a reference to the key/value pair referenced by the Iterator.
+    //
+    Pair<Tk, Tv>& entry (const Iterator &it)
+    {
+        return it.m_node->key;
+    }
+
     // erase - Erases a key/value pair from the map.
     //
     //  - it (IN): Iterator referencing the key/value pair to be erased from
@@ -316,6 +334,22 @@ public:
         return Iterator(&m_tree, m_tree.find(Pair<Tk, Tv>(key, Tv())));
     }
 
+    // lowerbound - Finds the key/value pair with the lowest key which is not
+    //   less than the specified key.
+    //
+    //  - key (IN): The key to search for.
+    //
+    //  Return Value:
+    //
+    //    Returns an Iterator referencing the found key/value pair. If every key
+    //    in the map is less than the specified key, then the "NULL" Iterator is
+    //    returned.
+    //
+    Iterator lowerbound (const Tk &key) const
+    {
+        return Iterator(&m_tree, m_tree.lowerbound(Pair<Tk, Tv>(key, Tv())));
+    }
+
     // insert - Inserts a key/value pair into the map.
     //
     //  - key (IN): The key of the key/value pair to be inserted.
@@ -349,7 +383,22 @@ public:
         return m_tree.reserve(count);
     }
 
+    // reservelimit - Lets the map reserve larger chunks of storage as it
+    //   grows, up to the specified number of key/value pairs at once.
+    //
+    //  - limit (IN): The largest number of key/value pairs to reserve space
+    //      for at once.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    VOID reservelimit (size_t limit)
+    {
+        m_tree.reservelimit(limit);
+    }
+
 private:
     // Private data
-    Tree<Pair<Tk, Tv> > m_tree; // The key/value pairs are actually stored in a tree.
+    Tree<Pair<Tk, Tv>, Tl> m_tree; // The key/value pairs are actually stored in a tree.
 };
@@ -0,0 +1,407 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - ModuleTable Class Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma push_macro("new")
+#undef new
+#include <algorithm>
+#pragma pop_macro("new")
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <cwchar>
+#include <link.h>
+
+#define VLDBUILD
+#include "moduletable.h"    // This class' header.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+#define MODULE_MAX_PATH     4096    // Maximum length of the path of the main program, like PATH_MAX.
+
+// Passed to ModuleTable::addModule by refresh.
+struct refresh_t
+{
+    ModuleTable                   *table;
+    const LoadedModuleList        *current;     // The modules of the current snapshot.
+    LoadedModuleList              *modules;     // Receives the modules of the new snapshot.
+    LoadedModuleList              *created;     // Receives the modules seen for the first time.
+    UINT64                         adds;        // Receive the dynamic loader's counts of modules loaded
+    UINT64                         subs;        //   and unloaded, as of the snapshot.
+};
+
+// Passed to ModuleTable::readCounters by changed.
+struct loadcounters_t
+{
+    UINT64 adds;
+    UINT64 subs;
+};
+
+// The counters were added to dl_phdr_info by glibc 2.4. Older loaders pass a
+// smaller structure, and never tell of any change.
+#define MODULE_COUNTERS_SIZE    (offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(((struct dl_phdr_info*)0)->dlpi_subs))
+
+// Constructor - Initializes the table, with an empty snapshot. Call refresh to
+//   take the first snapshot of the loaded modules.
+//
+//  - forcedmodules (IN): The ForceIncludeModules option.
+//
+//  - runtimeaddresses (IN): Addresses within the modules whose allocations
+//      are never tracked: the C library and the dynamic loader.
+//
+//  - runtimecount (IN): Number of addresses in runtimeaddresses. At most 4
+//      are kept.
+//
+//  - policy (IN): If not NULL, the capture rules whose rows are found for
+//      each module.
+//
+ModuleTable::ModuleTable (const wchar_t *forcedmodules, const UINT_PTR *runtimeaddresses, UINT32 runtimecount,
+    CapturePolicy *policy)
+{
+    m_lock.Initialize();
+    m_policy = policy;
+    m_adds.store(0, std::memory_order_relaxed);
+    m_subs.store(0, std::memory_order_relaxed);
+    m_snapshot.store(new snapshot_t(), std::memory_order_relaxed);
+    m_snapshot.load(std::memory_order_relaxed)->previous = NULL;
+
+    // Module names are matched against the list in lower case, like vld.dll
+    // does. A "*" includes every module.
+    m_forcedModules[0] = '\0';
+    if ((forcedmodules != NULL) && (wcscmp(forcedmodules, L"*") != 0)) {
+        size_t length = wcstombs(m_forcedModules, forcedmodules, MODULE_MAX_LIST_LENGTH - 1);
+        if (length == (size_t)-1)
+            length = 0;
+        m_forcedModules[length] = '\0';
+        for (size_t index = 0; index < length; index++)
+            m_forcedModules[index] = (char)tolower((unsigned char)m_forcedModules[index]);
+    }
+    m_includeList = (m_forcedModules[0] != '\0');
+
+    m_runtimeCount = 0;
+    for (UINT32 index = 0; (index < runtimecount) && (m_runtimeCount < sizeof(m_runtime) / sizeof(m_runtime[0])); index++) {
+        if (runtimeaddresses[index] != 0)
+            m_runtime[m_runtimeCount++] = runtimeaddresses[index];
+    }
+}
+
+// Destructor - Frees every snapshot and every module. No other thread may be
+//   searching the table anymore.
+//
+ModuleTable::~ModuleTable ()
+{
+    snapshot_t *snapshot = m_snapshot.load(std::memory_order_acquire);
+    while (snapshot != NULL) {
+        snapshot_t *previous = snapshot->previous;
+        delete snapshot;
+        snapshot = previous;
+    }
+    for (LoadedModuleList::iterator moduleit = m_modules.begin(); moduleit != m_modules.end(); ++moduleit) {
+        delete [] (*moduleit)->path;
+        delete *moduleit;
+    }
+    m_lock.Delete();
+}
+
+// findRange - Finds the executable segment holding an address in the current
+//   snapshot. Doesn't take any lock.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    Returns the segment, or NULL if the address isn't in the code of any
+//    loaded module.
+//
+const modulerange_t* ModuleTable::findRange (UINT_PTR address) const
+{
+    const snapshot_t *snapshot = m_snapshot.load(std::memory_order_acquire);
+    modulerange_t key;
+    key.low = address;
+    ModuleRangeTable::const_iterator range = std::upper_bound(snapshot->ranges.begin(), snapshot->ranges.end(), key);
+    if ((range != snapshot->ranges.begin()) && (address < (range - 1)->high))
+        return &(*(range - 1));
+    return NULL;
+}
+
+// find - Finds the loaded module whose code holds an address. Doesn't take
+//   any lock.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    Returns the module, or NULL if the address isn't in the code of any
+//    loaded module.
+//
+const loadedmodule_t* ModuleTable::find (UINT_PTR address) const
+{
+    const modulerange_t *range = findRange(address);
+    return (range != NULL) ? range->module : NULL;
+}
+
+// flags - Obtains the flags of the loaded module whose code holds an address.
+//   Doesn't take any lock.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    Returns the MODULE_* flags of the module, or 0 if the address isn't in
+//    the code of any loaded module.
+//
+UINT32 ModuleTable::flags (UINT_PTR address) const
+{
+    const modulerange_t *range = findRange(address);
+    return (range != NULL) ? range->module->flags : 0;
+}
+
+// isExcluded - Determines whether allocations made from an address are not
+//   tracked. Code outside of any module, such as code generated at run time,
+//   is tracked. Doesn't take any lock.
+//
+//  - address (IN): The address, typically the return address of a hook.
+//
+//  Return Value:
+//
+//    Returns true if the module holding the address is excluded.
+//
+bool ModuleTable::isExcluded (UINT_PTR address) const
+{
+    return (flags(address) & MODULE_EXCLUDED) != 0;
+}
+
+// moduleCount - Obtains the number of modules in the current snapshot.
+//
+//  Return Value:
+//
+//    Returns the number of loaded modules.
+//
+size_t ModuleTable::moduleCount () const
+{
+    return m_snapshot.load(std::memory_order_acquire)->modules.size();
+}
+
+// flagsOf - Determines the flags of a module seen for the first time, from
+//   its name and its loadable segments.
+//
+//  - module (IN): The module.
+//
+//  - info (IN): The module, as described by the dynamic loader.
+//
+//  Return Value:
+//
+//    Returns the MODULE_* flags of the module.
+//
+UINT32 ModuleTable::flagsOf (const loadedmodule_t &module, const struct dl_phdr_info &info) const
+{
+    UINT32 flags = module.flags;
+    for (int segment = 0; segment < info.dlpi_phnum; segment++) {
+        if (info.dlpi_phdr[segment].p_type != PT_LOAD)
+            continue;
+        UINT_PTR low = info.dlpi_addr + info.dlpi_phdr[segment].p_vaddr;
+        for (UINT32 index = 0; index < m_runtimeCount; index++) {
+            if ((m_runtime[index] >= low) && (m_runtime[index] < low + info.dlpi_phdr[segment].p_memsz))
+                flags |= MODULE_RUNTIME;
+        }
+    }
+    if (flags & MODULE_RUNTIME) {
+        // Their own blocks, such as the buffers of the standard streams or the
+        // thread descriptors, are freed when the process exits, if ever, like
+        // the blocks of the CRT startup code on Windows.
+        return flags | MODULE_EXCLUDED;
+    }
+
+    if (m_includeList && !(flags & MODULE_MAIN)) {
+        char name [MODULE_MAX_LIST_LENGTH];
+        size_t length = 0;
+        for (const char *c = module.name; (*c != '\0') && (length < sizeof(name) - 1); c++)
+            name[length++] = (char)tolower((unsigned char)*c);
+        name[length] = '\0';
+        if ((length == 0) || (strstr(m_forcedModules, name) == NULL))
+            flags |= MODULE_EXCLUDED;
+    }
+    return flags;
+}
+
+// addModule - dl_iterate_phdr callback adding a loaded module to the snapshot
+//   being built. Modules of the current snapshot are reused as they are.
+//
+//  - info (IN): The module.
+//
+//  - size (IN): The size of the structure.
+//
+//  - context (IN/OUT): The refresh_t describing the snapshot being built.
+//
+//  Return Value:
+//
+//    Always returns 0, to visit every module.
+//
+int ModuleTable::addModule (struct dl_phdr_info *info, size_t size, void *context)
+{
+    refresh_t *refresh = (refresh_t*)context;
+    if (size >= MODULE_COUNTERS_SIZE) {
+        refresh->adds = info->dlpi_adds;
+        refresh->subs = info->dlpi_subs;
+    }
+
+    // The main program has no name. Its path is the one /proc/self/exe links
+    // to.
+    bool main = refresh->modules->empty() && ((info->dlpi_name == NULL) || (info->dlpi_name[0] == '\0'));
+    const char *path = (info->dlpi_name != NULL) ? info->dlpi_name : "";
+    char exepath [MODULE_MAX_PATH];
+    if (main) {
+        ssize_t length = readlink("/proc/self/exe", exepath, sizeof(exepath) - 1);
+        exepath[(length > 0) ? length : 0] = '\0';
+        path = (length > 0) ? exepath : "/proc/self/exe";
+    }
+
+    for (LoadedModuleList::const_iterator moduleit = refresh->current->begin(); moduleit != refresh->current->end(); ++moduleit) {
+        if (((*moduleit)->bias == info->dlpi_addr) && (strcmp((*moduleit)->path, path) == 0)) {
+            // Still loaded.
+            refresh->modules->push_back(*moduleit);
+            return 0;
+        }
+    }
+
+    loadedmodule_t *module = new loadedmodule_t;
+    size_t length = strlen(path);
+    module->path = new char [length + 1];
+    memcpy(module->path, path, length + 1);
+    const char *name = strrchr(module->path, '/');
+    module->name = (name != NULL) ? name + 1 : module->path;
+    module->bias = info->dlpi_addr;
+    module->flags = main ? MODULE_MAIN : 0;
+    module->segmentCount = 0;
+    for (int index = 0; (index < info->dlpi_phnum) && (module->segmentCount < MODULE_MAX_SEGMENTS); index++) {
+        const ElfW(Phdr) *segment = &info->dlpi_phdr[index];
+        if ((segment->p_type != PT_LOAD) || !(segment->p_flags & PF_X))
+            continue;
+        module->segments[module->segmentCount].low = info->dlpi_addr + segment->p_vaddr;
+        module->segments[module->segmentCount].high = info->dlpi_addr + segment->p_vaddr + segment->p_memsz;
+        module->segmentCount++;
+    }
+    module->flags = refresh->table->flagsOf(*module, *info);
+    module->policyRow = CAPTURE_ROW_ANY;
+    if (refresh->table->m_policy != NULL) {
+        wchar_t name [MODULE_MAX_LIST_LENGTH];
+        size_t length = mbstowcs(name, module->name, MODULE_MAX_LIST_LENGTH - 1);
+        if (length != (size_t)-1)
+            module->policyRow = refresh->table->m_policy->moduleRow(name, length);
+    }
+    refresh->modules->push_back(module);
+    refresh->created->push_back(module);
+    return 0;
+}
+
+// refresh - Takes a new snapshot of the loaded modules, and publishes it.
+//   Must be called after modules are loaded or unloaded. Threads searching
+//   the table meanwhile keep on using the previous snapshot.
+//
+//  - unloaded (OUT): If not NULL, receives the modules of the previous
+//      snapshot which are not loaded anymore. They stay valid as long as the
+//      table.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ModuleTable::refresh (LoadedModuleList *unloaded)
+{
+    CriticalSectionLocker<> cs(m_lock);
+    snapshot_t *current = m_snapshot.load(std::memory_order_relaxed);
+    snapshot_t *snapshot = new snapshot_t();
+    snapshot->previous = current;
+
+    LoadedModuleList created;
+    refresh_t refresh;
+    refresh.table = this;
+    refresh.current = &current->modules;
+    refresh.modules = &snapshot->modules;
+    refresh.created = &created;
+    refresh.adds = 0;
+    refresh.subs = 0;
+    dl_iterate_phdr(addModule, &refresh);
+    m_adds.store(refresh.adds, std::memory_order_relaxed);
+    m_subs.store(refresh.subs, std::memory_order_relaxed);
+    m_modules.insert(m_modules.end(), created.begin(), created.end());
+
+    for (LoadedModuleList::iterator moduleit = snapshot->modules.begin(); moduleit != snapshot->modules.end(); ++moduleit) {
+        for (UINT32 index = 0; index < (*moduleit)->segmentCount; index++) {
+            modulerange_t range;
+            range.low = (*moduleit)->segments[index].low;
+            range.high = (*moduleit)->segments[index].high;
+            range.module = *moduleit;
+            snapshot->ranges.push_back(range);
+        }
+    }
+    std::sort(snapshot->ranges.begin(), snapshot->ranges.end());
+
+    if (unloaded != NULL) {
+        for (LoadedModuleList::iterator moduleit = current->modules.begin(); moduleit != current->modules.end(); ++moduleit) {
+            if (std::find(snapshot->modules.begin(), snapshot->modules.end(), *moduleit) == snapshot->modules.end())
+                unloaded->push_back(*moduleit);
+        }
+    }
+    m_snapshot.store(snapshot, std::memory_order_release);
+}
+
+// readCounters - dl_iterate_phdr callback reading the dynamic loader's counts
+//   of modules loaded and unloaded, which are the same for every module.
+//
+//  - info (IN): The first module.
+//
+//  - size (IN): The size of the structure.
+//
+//  - context (OUT): The loadcounters_t receiving the counts.
+//
+//  Return Value:
+//
+//    Always returns 1, to stop at the first module.
+//
+int ModuleTable::readCounters (struct dl_phdr_info *info, size_t size, void *context)
+{
+    loadcounters_t *counters = (loadcounters_t*)context;
+    if (size >= MODULE_COUNTERS_SIZE) {
+        counters->adds = info->dlpi_adds;
+        counters->subs = info->dlpi_subs;
+    }
+    return 1;
+}
+
+// changed - Determines whether modules were loaded or unloaded since the last
+//   refresh, from the counts kept by the dynamic loader. Doesn't take the
+//   table's lock, nor allocate: it may be called on every allocation, but
+//   takes the dynamic loader's own lock, and is slower than find.
+//
+//  Return Value:
+//
+//    Returns true if the table must be refreshed.
+//
+bool ModuleTable::changed () const
+{
+    loadcounters_t last;
+    last.adds = m_adds.load(std::memory_order_relaxed);
+    last.subs = m_subs.load(std::memory_order_relaxed);
+    loadcounters_t counters = last;
+    dl_iterate_phdr(readCounters, &counters);
+    return (counters.adds != last.adds) || (counters.subs != last.subs);
+}
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Module Table Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <atomic>
+#include <vector>
+#pragma pop_macro("new")
+#include "capturepolicy.h"      // Provides the rows of the capture rules.
+#include "criticalsection.h"    // Provides the lock serializing refreshes.
+#include "vldallocator.h"       // Provides a custom STL-like allocator for VLD's containers.
+
+#define MODULE_MAX_SEGMENTS     8   // Most executable segments recorded for each module.
+#define MODULE_MAX_LIST_LENGTH  512 // Must match VLD_CONFIG_MAX_MODULE_LIST.
+
+// Module flags:
+#define MODULE_EXCLUDED         0x1 // If set, allocations made by the module's code are not tracked.
+#define MODULE_RUNTIME          0x2 // If set, the module is the C library or the dynamic loader.
+#define MODULE_MAIN             0x4 // If set, the module is the main program.
+
+// An executable segment of a module.
+struct modulesegment_t
+{
+    UINT_PTR low;       // Lowest address of the segment.
+    UINT_PTR high;      // Address just past the segment.
+};
+
+// A loaded module. Once published in a snapshot, it is never modified, and
+// stays valid as long as the table, even after the module is unloaded.
+struct loadedmodule_t
+{
+    char           *path;           // Path of the module's file.
+    const char     *name;           // File name of the module, without its directory, within path.
+    UINT_PTR        bias;           // Difference between the addresses of the module in memory, and in the file.
+    UINT32          flags;          // MODULE_* flags.
+    UINT32          policyRow;      // Row of the module in the decision table of the capture rules.
+    UINT32          segmentCount;   // Number of executable segments.
+    modulesegment_t segments [MODULE_MAX_SEGMENTS];
+};
+
+// The executable segments of the loaded modules, sorted by address.
+struct modulerange_t
+{
+    BOOL operator < (const modulerange_t &other) const { return (low < other.low); }
+
+    UINT_PTR              low;      // Lowest address of the segment.
+    UINT_PTR              high;     // Address just past the segment.
+    const loadedmodule_t *module;   // The module the segment belongs to.
+};
+
+typedef std::vector<loadedmodule_t*, vldallocator<loadedmodule_t*> > LoadedModuleList;
+typedef std::vector<modulerange_t, vldallocator<modulerange_t> > ModuleRangeTable;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The ModuleTable Class
+//
+//    The modules loaded in the process, and whether allocations made by each
+//    of them are tracked: the Linux counterpart of the ModuleSet of vld.dll.
+//    Each refresh takes a snapshot of the loaded modules with dl_iterate_phdr,
+//    and publishes it as a new, immutable table of their executable segments,
+//    sorted by address. Looking up an address is a binary search of the
+//    current snapshot, without any lock, so it can be done on every
+//    allocation. Snapshots replaced by a refresh are kept until the table is
+//    destroyed, as other threads may still be searching them. Whether a
+//    refresh is due is told by the counts of modules loaded and unloaded kept
+//    by the dynamic loader (see changed).
+//
+//    Which modules are tracked follows ForceIncludeModules. The C library and
+//    the dynamic loader are never tracked. Every other module is tracked,
+//    unless the list names modules: then only these, and the main program,
+//    are tracked. The main program plays the part of the modules including
+//    vld.h on Windows. When capture rules are given, the row of each module in
+//    their decision table is found as the module is first seen.
+//
+class ModuleTable
+{
+public:
+    ModuleTable (const wchar_t *forcedmodules, const UINT_PTR *runtimeaddresses, UINT32 runtimecount,
+        CapturePolicy *policy = NULL);
+    ~ModuleTable ();
+
+    const loadedmodule_t* find (UINT_PTR address) const;
+    UINT32 flags (UINT_PTR address) const;
+    bool isExcluded (UINT_PTR address) const;
+    bool isIncludeList () const { return m_includeList; }
+    size_t moduleCount () const;
+    VOID refresh (LoadedModuleList *unloaded);
+    bool changed () const;
+
+private:
+    // Disallow certain operations
+    ModuleTable ();
+    ModuleTable (const ModuleTable&);
+    ModuleTable& operator = (const ModuleTable&);
+
+    // A published snapshot.
+    struct snapshot_t {
+        snapshot_t      *previous;  // The snapshot this one replaced, or NULL.
+        LoadedModuleList modules;   // The loaded modules.
+        ModuleRangeTable ranges;    // Their executable segments, sorted by address.
+    };
+
+    static int addModule (struct dl_phdr_info *info, size_t size, void *context);
+    static int readCounters (struct dl_phdr_info *info, size_t size, void *context);
+    const modulerange_t* findRange (UINT_PTR address) const;
+    UINT32 flagsOf (const loadedmodule_t &module, const struct dl_phdr_info &info) const;
+
+    CriticalSection          m_lock;        // Serializes refreshes, and protects m_modules.
+    std::atomic<snapshot_t*> m_snapshot;    // The current snapshot. Replaced snapshots are chained to it.
+    LoadedModuleList         m_modules;     // Every module ever seen, loaded or not.
+    bool                     m_includeList; // If set, only the listed modules are tracked, with the main program.
+    char                     m_forcedModules [MODULE_MAX_LIST_LENGTH]; // ForceIncludeModules, in lower case.
+    CapturePolicy           *m_policy;      // The capture rules, or NULL. Their rows are built under m_lock.
+    UINT_PTR                 m_runtime [4]; // Addresses within the C library and the dynamic loader.
+    UINT32                   m_runtimeCount;
+    std::atomic<UINT64>      m_adds;        // The dynamic loader's count of modules loaded, as of the last refresh.
+    std::atomic<UINT64>      m_subs;        // The dynamic loader's count of modules unloaded, as of the last refresh.
+};
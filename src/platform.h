@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Platform Adapters
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+// The tracking engine (vld_core: the block maps, the call stack storage and the
+// tables built on them) is written against the subset of the Win32 API
+// declared here. On Windows this is just windows.h. Elsewhere, the types are
+// defined in terms of the standard library, and the few services the engine
+// needs from the system (thread IDs, yielding the processor and a time stamp
+// counter) are provided on top of POSIX. Locks are adapted by criticalsection.h, the internal heap by
+// vldheap.h, and stack capture and symbols by the CallStack implementation of
+// each platform.
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <intrin.h>
+
+#else // POSIX
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define VOID                        void
+#define CONST                       const
+#define TRUE                        1
+#define FALSE                       0
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+
+typedef int                 BOOL;
+typedef uint8_t             BYTE, *PBYTE;
+typedef unsigned int        UINT;
+typedef uint32_t            UINT32, DWORD, ULONG;
+typedef int32_t             LONG;
+typedef uint64_t            UINT64, DWORD64, ULONGLONG;
+typedef int64_t             LONG64;
+typedef size_t              SIZE_T;
+typedef uintptr_t           UINT_PTR, ULONG_PTR;
+typedef void               *LPVOID, *HANDLE;
+typedef const void         *LPCVOID;
+typedef wchar_t             WCHAR, *LPWSTR;
+typedef const wchar_t      *LPCWSTR;
+
+// GetCurrentThreadId - Obtains the ID of the calling thread. Unlike the
+//   pthread_t of the thread, the ID is small, and is the one debuggers show.
+//   The system call is only made the first time a thread asks.
+//
+//  Return Value:
+//
+//    Returns the ID of the calling thread.
+//
+inline DWORD GetCurrentThreadId ()
+{
+    static thread_local DWORD threadId = 0;
+    if (threadId == 0)
+        threadId = (DWORD)syscall(SYS_gettid);
+    return threadId;
+}
+
+// SwitchToThread - Lets another thread ready to run on the processor run
+//   first.
+//
+//  Return Value:
+//
+//    Returns TRUE if the call succeeded.
+//
+inline BOOL SwitchToThread ()
+{
+    return (sched_yield() == 0) ? TRUE : FALSE;
+}
+
+#if !defined(__x86_64__) && !defined(__i386__)
+// __rdtsc - Reads a monotonic time stamp, standing in for the time stamp
+//   counter on processors which don't have one. The unit is nanoseconds
+//   instead of cycles.
+//
+//  Return Value:
+//
+//    Returns the time stamp.
+//
+inline UINT64 __rdtsc ()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000 + (UINT64)now.tv_nsec;
+}
+#endif
+
+// Where a hook entered VLD's code. The stack trace of the allocation starts at
+// the frame returning to this address. See CAPTURE_CONTEXT.
+struct context_t
+{
+    UINT_PTR fp;                    // Return address of the hook.
+    UINT_PTR bp;                    // Frame address of the hook, where the frame pointer walk starts.
+    UINT_PTR func;                  // Address of the hooked function, pushed as the first frame, or 0.
+};
+
+// Capture current context. Taking the frame address makes the compiler give
+// the hook a frame pointer, even where they are otherwise omitted.
+#define CAPTURE_CONTEXT()                                                       \
+    context_t context_;                                                         \
+    context_.fp = (UINT_PTR)__builtin_return_address(0);                        \
+    context_.bp = (UINT_PTR)__builtin_frame_address(0);                         \
+    context_.func = 0;
+#define GET_RETURN_ADDRESS(context)  (context.fp)
+
+#endif // _WIN32
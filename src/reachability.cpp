@@ -0,0 +1,457 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - ReachabilityScan Class Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma push_macro("new")
+#undef new
+#include <algorithm>
+#pragma pop_macro("new")
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#define VLDBUILD
+#include "reachability.h"   // This class' header.
+#include "vldheap.h"        // Provides internal new and delete operators.
+
+#define SCAN_NO_BLOCK       ((SIZE_T)-1)    // Index of no block.
+#define SCAN_BLOCK_BATCH    64              // Number of blocks claimed at once by a worker scanning lost blocks.
+#define SCAN_LANES          4               // Number of words tested at once against the blocks' span.
+
+// The phases of a scan, run in this order by the workers.
+#define SCAN_PHASE_IDLE     0   // The workers wait for the mark.
+#define SCAN_PHASE_ROOTS    1   // Marks the blocks reachable from the roots.
+#define SCAN_PHASE_LOST     2   // Marks the blocks pointed to by lost blocks.
+#define SCAN_PHASE_STOP     3   // The workers exit.
+
+#if defined(__GNUC__)
+// Words tested together. The compiler lowers the operations on the vector to
+// the widest SIMD instructions the target has.
+typedef UINT_PTR scanvector_t __attribute__((vector_size(SCAN_LANES * sizeof(UINT_PTR))));
+#endif
+
+// Constructor - Initializes an empty scan.
+//
+ReachabilityScan::ReachabilityScan ()
+    : m_marks(NULL), m_low(0), m_span(0), m_phase(SCAN_PHASE_IDLE), m_finished(0), m_next(0), m_started(0)
+{
+}
+
+// Destructor - Stops the workers, if the scan wasn't finished, and frees the
+//   marks.
+//
+ReachabilityScan::~ReachabilityScan ()
+{
+    stop();
+    delete [] m_marks;
+}
+
+// addBlock - Adds a tracked block to be classified. Blocks may be added in
+//   any order, but must not overlap.
+//
+//  - address (IN): Address of the block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::addBlock (LPCVOID address, SIZE_T size)
+{
+    scanrange_t block;
+    block.low = (UINT_PTR)address;
+    // Even an empty block can be pointed to.
+    block.high = block.low + ((size != 0) ? size : 1);
+    m_blocks.push_back(block);
+}
+
+// addRoot - Adds a range of memory whose pointers keep blocks reachable. Only
+//   the words aligned on their size are tested.
+//
+//  - address (IN): Address of the range.
+//
+//  - size (IN): Size, in bytes, of the range.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::addRoot (LPCVOID address, SIZE_T size)
+{
+    UINT_PTR low = ((UINT_PTR)address + sizeof(UINT_PTR) - 1) & ~(UINT_PTR)(sizeof(UINT_PTR) - 1);
+    UINT_PTR high = ((UINT_PTR)address + size) & ~(UINT_PTR)(sizeof(UINT_PTR) - 1);
+    while (low < high) {
+        scanrange_t chunk;
+        chunk.low = low;
+        chunk.high = (high - low > SCAN_CHUNK_SIZE) ? low + SCAN_CHUNK_SIZE : high;
+        m_roots.push_back(chunk);
+        low = chunk.high;
+    }
+}
+
+// classify - Obtains the reachability of a block, once the scan was run.
+//
+//  - address (IN): Address of the block, or of any byte within it.
+//
+//  Return Value:
+//
+//    Returns one of the REACHABILITY_* values. REACHABILITY_UNKNOWN is
+//    returned for an address outside of every block, or before the scan was
+//    run.
+//
+BYTE ReachabilityScan::classify (LPCVOID address) const
+{
+    if (m_marks == NULL)
+        return REACHABILITY_UNKNOWN;
+    SIZE_T index = findBlock((UINT_PTR)address);
+    return (index != SCAN_NO_BLOCK) ? m_marks[index].load(std::memory_order_relaxed) : (BYTE)REACHABILITY_UNKNOWN;
+}
+
+// dropRange - Leaves a range of memory freed since the blocks were added out
+//   of the scan. Blocks starting within the range are not scanned, and are
+//   classified as reachable, as they can't be leaks anymore. A block running
+//   into the range is only scanned up to it. Must be called between start and
+//   mark.
+//
+//  - low (IN): Lowest address of the range.
+//
+//  - high (IN): Address just past the range.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::dropRange (LPCVOID low, LPCVOID high)
+{
+    scanrange_t range;
+    range.low = (UINT_PTR)low;
+    range.high = (UINT_PTR)high;
+    ScanRangeList::iterator block = std::lower_bound(m_blocks.begin(), m_blocks.end(), range);
+    if ((block != m_blocks.begin()) && ((block - 1)->high > range.low))
+        (block - 1)->high = range.low;
+    for (; (block != m_blocks.end()) && (block->low < range.high); ++block) {
+        // Less than a word is never read by markRange, but is still found
+        // by classify.
+        block->high = block->low + 1;
+        m_marks[block - m_blocks.begin()].store(REACHABILITY_REACHABLE, std::memory_order_relaxed);
+    }
+}
+
+// findBlock - Finds the block an address points into.
+//
+//  - address (IN): The address.
+//
+//  Return Value:
+//
+//    Returns the index of the block, or SCAN_NO_BLOCK if the address isn't in
+//    any block.
+//
+SIZE_T ReachabilityScan::findBlock (UINT_PTR address) const
+{
+    scanrange_t key;
+    key.low = address;
+    ScanRangeList::const_iterator block = std::upper_bound(m_blocks.begin(), m_blocks.end(), key);
+    if ((block != m_blocks.begin()) && (address < (block - 1)->high))
+        return (SIZE_T)(block - 1 - m_blocks.begin());
+    return SCAN_NO_BLOCK;
+}
+
+// markWord - Marks the block a word points into, unless it is already marked.
+//
+//  - word (IN): The word, which may or may not be a pointer.
+//
+//  - origin (IN): Index of the block holding the word, or SCAN_NO_BLOCK. A
+//      block pointing to itself is not marked.
+//
+//  - mark (IN): The mark: REACHABILITY_REACHABLE or REACHABILITY_INDIRECT.
+//
+//  - work (IN/OUT): Reachable blocks newly marked are added to it, to be
+//      scanned in turn.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::markWord (UINT_PTR word, SIZE_T origin, BYTE mark, ScanWorkList &work)
+{
+    SIZE_T index = findBlock(word);
+    if ((index == SCAN_NO_BLOCK) || (index == origin))
+        return;
+
+    BYTE unmarked = REACHABILITY_UNKNOWN;
+    if (m_marks[index].compare_exchange_strong(unmarked, mark, std::memory_order_relaxed) &&
+        (mark == REACHABILITY_REACHABLE))
+        work.push_back(index);
+}
+
+// markRange - Marks the blocks pointed to by the aligned words of a range of
+//   memory.
+//
+//  - low (IN): Lowest address of the range.
+//
+//  - high (IN): Address just past the range.
+//
+//  - origin (IN): Index of the block being scanned, or SCAN_NO_BLOCK for a
+//      root.
+//
+//  - mark (IN): The mark of the blocks found.
+//
+//  - work (IN/OUT): Receives the reachable blocks newly marked.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::markRange (UINT_PTR low, UINT_PTR high, SIZE_T origin, BYTE mark, ScanWorkList &work)
+{
+    low = (low + sizeof(UINT_PTR) - 1) & ~(UINT_PTR)(sizeof(UINT_PTR) - 1);
+    if (high <= low)
+        return;
+    const UINT_PTR *words = (const UINT_PTR*)low;
+    SIZE_T count = (high - low) / sizeof(UINT_PTR);
+    SIZE_T index = 0;
+
+    // Nearly all words are not pointers into any block: most are rejected by
+    // a single unsigned comparison with the span of the blocks.
+#if defined(__GNUC__)
+    for (; index + SCAN_LANES <= count; index += SCAN_LANES) {
+        scanvector_t lanes;
+        memcpy(&lanes, &words[index], sizeof(lanes));
+        // Each lane of hits is all ones if its word is within the span.
+        scanvector_t hits = (scanvector_t)((lanes - m_low) < m_span);
+        if ((hits[0] | hits[1] | hits[2] | hits[3]) == 0)
+            continue;
+        for (SIZE_T lane = 0; lane < SCAN_LANES; lane++) {
+            if (hits[lane])
+                markWord(words[index + lane], origin, mark, work);
+        }
+    }
+#endif
+    for (; index < count; index++) {
+        if (words[index] - m_low < m_span)
+            markWord(words[index], origin, mark, work);
+    }
+}
+
+// work - Runs a phase of the scan on the calling thread, until the work of
+//   the phase is done.
+//
+//  - phase (IN): The phase, one of the SCAN_PHASE_* values.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::work (UINT32 phase)
+{
+    ScanWorkList work;
+    if (phase == SCAN_PHASE_ROOTS) {
+        // Chunks of the roots are shared, the blocks found from each chunk
+        // are followed by the worker which found them.
+        for (;;) {
+            SIZE_T chunk = m_next.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= m_roots.size())
+                break;
+            markRange(m_roots[chunk].low, m_roots[chunk].high, SCAN_NO_BLOCK, REACHABILITY_REACHABLE, work);
+            while (!work.empty()) {
+                SIZE_T block = work.back();
+                work.pop_back();
+                markRange(m_blocks[block].low, m_blocks[block].high, block, REACHABILITY_REACHABLE, work);
+            }
+        }
+        return;
+    }
+
+    // Every block left unmarked by the first phase is lost. The blocks they
+    // point to are indirectly lost, whatever order they are scanned in.
+    for (;;) {
+        SIZE_T first = m_next.fetch_add(SCAN_BLOCK_BATCH, std::memory_order_relaxed);
+        if (first >= m_blocks.size())
+            break;
+        SIZE_T last = std::min(first + SCAN_BLOCK_BATCH, (SIZE_T)m_blocks.size());
+        for (SIZE_T block = first; block < last; block++) {
+            if (m_marks[block].load(std::memory_order_relaxed) != REACHABILITY_REACHABLE)
+                markRange(m_blocks[block].low, m_blocks[block].high, block, REACHABILITY_INDIRECT, work);
+        }
+    }
+}
+
+// workerThread - Entry point of the worker threads.
+//
+//  - context (IN): The scan.
+//
+//  Return Value:
+//
+//    Always returns 0.
+//
+#if defined(_WIN32)
+DWORD WINAPI ReachabilityScan::workerThread (LPVOID context)
+#else
+LPVOID ReachabilityScan::workerThread (LPVOID context)
+#endif
+{
+    // Each phase is run once, as soon as it is published by runPhase.
+    ReachabilityScan *scan = (ReachabilityScan*)context;
+    UINT32 done = SCAN_PHASE_IDLE;
+    for (;;) {
+        UINT32 phase = scan->m_phase.load(std::memory_order_acquire);
+        if (phase == SCAN_PHASE_STOP)
+            break;
+        if (phase == done) {
+            SwitchToThread();
+            continue;
+        }
+        scan->work(phase);
+        done = phase;
+        scan->m_finished.fetch_add(1, std::memory_order_release);
+    }
+    return 0;
+}
+
+// runPhase - Runs a phase of the scan on the calling thread and on the
+//   worker threads, and waits for all of them to finish.
+//
+//  - phase (IN): The phase, one of the SCAN_PHASE_* values.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::runPhase (UINT32 phase)
+{
+    m_next.store(0, std::memory_order_relaxed);
+    m_finished.store(0, std::memory_order_relaxed);
+    m_phase.store(phase, std::memory_order_release);
+    work(phase);
+    while (m_finished.load(std::memory_order_acquire) < m_started)
+        SwitchToThread();
+}
+
+// start - Gets the scan ready to mark the blocks, and starts the worker
+//   threads, which wait for the mark. Blocks and roots can't be added anymore.
+//   If the workers can't be started, the calling thread does all the work.
+//
+//  - workers (IN): Number of threads to scan with, the calling thread
+//      included. At most SCAN_MAX_WORKERS are used.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::start (UINT32 workers)
+{
+    std::sort(m_blocks.begin(), m_blocks.end());
+    delete [] m_marks;
+    m_marks = new std::atomic<BYTE> [m_blocks.size() + 1];
+    for (SIZE_T index = 0; index < m_blocks.size(); index++)
+        m_marks[index].store(REACHABILITY_UNKNOWN, std::memory_order_relaxed);
+    if (m_blocks.empty())
+        return;
+
+    m_low = m_blocks.front().low;
+    m_span = m_blocks.back().high - m_low;
+    if (workers < 1)
+        workers = 1;
+    if (workers > SCAN_MAX_WORKERS)
+        workers = SCAN_MAX_WORKERS;
+    m_phase.store(SCAN_PHASE_IDLE, std::memory_order_relaxed);
+    for (UINT32 index = 1; index < workers; index++) {
+#if defined(_WIN32)
+        m_threads[m_started] = CreateThread(NULL, 0, workerThread, this, 0, NULL);
+        if (m_threads[m_started] != NULL)
+            m_started++;
+#else
+        if (pthread_create(&m_threads[m_started], NULL, workerThread, this) == 0)
+            m_started++;
+#endif
+    }
+}
+
+// mark - Marks the blocks reachable from the roots, then those pointed to by
+//   lost blocks. The memory of the blocks and of the roots is read, so the
+//   caller must keep it from being freed until mark returns. Must be called
+//   after start.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::mark ()
+{
+    if (m_blocks.empty())
+        return;
+    runPhase(SCAN_PHASE_ROOTS);
+    runPhase(SCAN_PHASE_LOST);
+}
+
+// stop - Stops the worker threads and waits for them to exit.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::stop ()
+{
+    m_phase.store(SCAN_PHASE_STOP, std::memory_order_release);
+    for (UINT32 index = 0; index < m_started; index++) {
+#if defined(_WIN32)
+        WaitForSingleObject(m_threads[index], INFINITE);
+        CloseHandle(m_threads[index]);
+#else
+        pthread_join(m_threads[index], NULL);
+#endif
+    }
+    m_started = 0;
+}
+
+// finish - Stops the worker threads, and classifies the blocks left unmarked
+//   as directly lost. Must be called after mark.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::finish ()
+{
+    stop();
+    for (SIZE_T index = 0; index < m_blocks.size(); index++) {
+        if (m_marks[index].load(std::memory_order_relaxed) == REACHABILITY_UNKNOWN)
+            m_marks[index].store(REACHABILITY_DIRECT, std::memory_order_relaxed);
+    }
+}
+
+// run - Classifies the blocks. Blocks and roots can't be added anymore.
+//
+//  - workers (IN): Number of threads to scan with, the calling thread
+//      included. At most SCAN_MAX_WORKERS are used.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID ReachabilityScan::run (UINT32 workers)
+{
+    start(workers);
+    mark();
+    finish();
+}
@@ -0,0 +1,138 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Reachability Scan Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#pragma push_macro("new")
+#undef new
+#include <atomic>
+#include <vector>
+#pragma pop_macro("new")
+#include "platform.h"       // Provides the Win32 types and the threads.
+#include "vldallocator.h"   // Provides a custom STL-like allocator for VLD's containers.
+
+#define SCAN_MAX_WORKERS    16          // Most threads marking blocks at once, the caller included.
+#define SCAN_CHUNK_SIZE     0x10000     // Roots are split into chunks of this many bytes, shared among the workers.
+
+// Reachability of a block, as found by a ReachabilityScan:
+#define REACHABILITY_UNKNOWN    0   // The block wasn't scanned.
+#define REACHABILITY_DIRECT     1   // Definitely lost: no pointer to the block was found anywhere.
+#define REACHABILITY_INDIRECT   2   // Indirectly lost: only pointed to by lost blocks.
+#define REACHABILITY_REACHABLE  3   // Still reachable: pointed to from a root, or from a reachable block.
+
+// A range of memory holding pointers.
+struct scanrange_t
+{
+    BOOL operator < (const scanrange_t &other) const { return (low < other.low); }
+
+    UINT_PTR low;       // Lowest address of the range.
+    UINT_PTR high;      // Address just past the range.
+};
+
+typedef std::vector<scanrange_t, vldallocator<scanrange_t> > ScanRangeList;
+typedef std::vector<SIZE_T, vldallocator<SIZE_T> > ScanWorkList;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The ReachabilityScan Class
+//
+//    A conservative mark phase, like the one of a garbage collector, telling
+//    the leaks that can't be freed anymore from the blocks still referenced
+//    when the program exits. Every aligned word of the roots (the writable
+//    data of the modules, the stack and the registers of the thread) that
+//    points to the start or into the inside of a tracked block marks the block
+//    reachable, and the block's own words are scanned in turn. The blocks
+//    left are lost: indirectly if another lost block points to them, directly
+//    otherwise. A cycle of lost blocks with no other block pointing into it is
+//    reported as indirectly lost, like LeakSanitizer does.
+//
+//    Words are tested against the range spanned by all the blocks, a few at a
+//    time, before the sorted block index is searched. Chunks of the roots are
+//    shared among worker threads, each following the blocks it marks on its
+//    own.
+//
+//    The memory of the blocks and of the roots must stay valid while they
+//    are marked. The scan doesn't take any lock: the caller must keep the
+//    blocks from being freed. So that the caller only needs to do so during
+//    the mark itself, run can be split up: start sorts the blocks and starts
+//    the workers, dropRange leaves out the memory the caller found freed
+//    since the blocks were added, mark marks the blocks, and finish stops the
+//    workers and settles the blocks left unmarked.
+//
+class ReachabilityScan
+{
+public:
+    ReachabilityScan ();
+    ~ReachabilityScan ();
+
+    VOID addBlock (LPCVOID address, SIZE_T size);
+    VOID addRoot (LPCVOID address, SIZE_T size);
+    BYTE classify (LPCVOID address) const;
+    VOID dropRange (LPCVOID low, LPCVOID high);
+    VOID finish ();
+    VOID mark ();
+    VOID run (UINT32 workers);
+    VOID start (UINT32 workers);
+
+    SIZE_T blockCount () const { return m_blocks.size(); }
+
+private:
+    // Disallow certain operations
+    ReachabilityScan (const ReachabilityScan&);
+    ReachabilityScan& operator = (const ReachabilityScan&);
+
+    SIZE_T findBlock (UINT_PTR address) const;
+    VOID markRange (UINT_PTR low, UINT_PTR high, SIZE_T origin, BYTE mark, ScanWorkList &work);
+    VOID markWord (UINT_PTR word, SIZE_T origin, BYTE mark, ScanWorkList &work);
+    VOID runPhase (UINT32 phase);
+    VOID stop ();
+    VOID work (UINT32 phase);
+
+#if defined(_WIN32)
+    static DWORD WINAPI workerThread (LPVOID context);
+#else
+    static LPVOID workerThread (LPVOID context);
+#endif
+
+    ScanRangeList       m_blocks;   // The blocks, sorted by address.
+    ScanRangeList       m_roots;    // The roots, split into chunks.
+    std::atomic<BYTE>  *m_marks;    // REACHABILITY_* mark of each block, in the order of m_blocks.
+    UINT_PTR            m_low;      // Lowest address of any block.
+    UINT_PTR            m_span;     // Distance from m_low to the end of the highest block.
+    std::atomic<UINT32> m_phase;    // Phase being run by the workers.
+    std::atomic<UINT32> m_finished; // Workers done with the phase being run.
+    std::atomic<SIZE_T> m_next;     // Next root chunk, or block, to be claimed by a worker.
+    UINT32              m_started;  // Worker threads started, the calling thread excluded.
+#if defined(_WIN32)
+    HANDLE              m_threads [SCAN_MAX_WORKERS];
+#else
+    pthread_t           m_threads [SCAN_MAX_WORKERS];
+#endif
+};
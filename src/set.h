@@ -44,7 +44,7 @@ Applications should never include this header."
 //  nature, this set class has a noticeable performance advantage over some
 //  other standard STL set implementations.
 //
-template <typename Tk>
+template <typename Tk, typename Tl = CriticalSection>
 class Set {
 public:
     class Iterator {
@@ -130,7 +130,7 @@ public:
         // 
         Iterator operator ++ ()
         {
-            typename Tree<Tk>::node_t *cur = m_node;
+            typename Tree<Tk, Tl>::node_t *cur = m_node;
 
             m_node = m_tree->next(m_node);
             return Iterator(m_tree, cur);
@@ -150,7 +150,7 @@ public:
         //
         Iterator operator - (SIZE_T num) const
         {
-            typename Tree<Tk>::node_t *cur = m_node;
+            typename Tree<Tk, Tl>::node_t *cur = m_node;
 
             for (SIZE_T count = 0; count < num; count++)  {
                 cur = m_tree->prev(cur);
@@ -181,18 +181,18 @@ public:
         // Private constructor. Only the Set class itself may use this
         //   constructor. It is used for constructing Iterators which reference
         //   specific nodes in the internal tree's structure.
-        Iterator (const Tree<Tk> *tree, typename Tree<Tk>::node_t *node)
+        Iterator (const Tree<Tk, Tl> *tree, typename Tree<Tk, Tl>::node_t *node)
         {
             m_node = node;
             m_tree = tree;
         }
 
     protected:
-        typename Tree<Tk>::node_t *m_node; // Pointer to the node referenced by the Set Iterator.
-        const Tree<Tk>            *m_tree; // Pointer to the tree containing the referenced node.
+        typename Tree<Tk, Tl>::node_t *m_node; // Pointer to the node referenced by the Set Iterator.
+        const Tree<Tk, Tl>            *m_tree; // Pointer to the tree containing the referenced node.
 
         // The Set class is a friend of Set Iterators.
-        friend class Set<Tk>;
+        friend class Set<Tk, Tl>;
     };
 
     // Muterator class - This class provides a mutable Iterator (the regular
@@ -331,5 +331,5 @@ public:
 
 private:
     // Private data
-    Tree<Tk> m_tree; // The keys are actually stored in a tree.
+    Tree<Tk, Tl> m_tree; // The keys are actually stored in a tree.
 };
@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Stack Hashing Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#define STACKHASH_SEED      0xD202EF8D              // Seed of the CRC-32 behind the "Leak Hash".
+#define STACKHASH64_SEED    0x9E3779B97F4A7C15ULL   // Seed of the 64-bit stack hash.
+#define STACKHASH64_PRIME   0xFF51AFD7ED558CCDULL   // Multiplier of the 64-bit stack hash.
+
+uint32_t CalculateCRC32 (uintptr_t p, uint32_t startValue = STACKHASH_SEED);
+
+// HashStackFrame - Folds one frame (program counter) into a running 64-bit
+//   stack hash. A multiply and a xor-shift per whole frame word is much cheaper
+//   than the byte-at-a-time CRC, and is cheap enough to be done as each frame
+//   is captured. Start from STACKHASH64_SEED.
+//
+//  - hash (IN): Hash of the frames folded so far.
+//
+//  - programcounter (IN): Frame to fold into the hash.
+//
+//  Return Value:
+//
+//    Returns the updated hash.
+//
+inline uint64_t HashStackFrame (uint64_t hash, uintptr_t programcounter)
+{
+    hash = (hash ^ (uint64_t)programcounter) * STACKHASH64_PRIME;
+    return hash ^ (hash >> 32);
+}
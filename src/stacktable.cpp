@@ -0,0 +1,368 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Call Stack Table Implementation
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD
+#include "stacktable.h" // This class' header.
+#include "vldheap.h"    // Provides internal new and delete operators.
+
+#define STACK_TABLE_RESERVE 1024 // Initial number of entries.
+
+// Constructor - Initializes an empty table.
+//
+//  - tracklifetimes (IN): If true, the lifetimes of the blocks freed from each
+//      call site are counted.
+//
+StackTable::StackTable (bool tracklifetimes)
+    : m_lifetimes(NULL)
+{
+    m_chains.reserve(STACK_TABLE_RESERVE);
+    m_entries = NULL;
+    m_capacity = 0;
+    m_used = 1; // ID 0 is reserved.
+    m_free = 0;
+    m_count = 0;
+    m_trackLifetimes = tracklifetimes;
+    grow();
+}
+
+// Destructor - Frees every call stack still in the table, and the lifetime
+//   histograms.
+//
+StackTable::~StackTable ()
+{
+    for (UINT32 id = 1; id < m_used; id++) {
+        delete m_entries[id].stack;
+        delete m_entries[id].lifetimes;
+    }
+    delete [] m_entries;
+}
+
+// addref - Adds a reference to a call stack.
+//
+//  - id (IN): ID of the call stack. If 0, nothing is done.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::addRef (UINT32 id)
+{
+    if (id == 0)
+        return;
+
+    assert(m_entries[id].stack != NULL);
+    m_entries[id].refs++;
+}
+
+// addblock - Accounts for a live block allocated from a call site.
+//
+//  - id (IN): ID of the call stack. If 0, nothing is done.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::addBlock (UINT32 id, SIZE_T size)
+{
+    if (id == 0)
+        return;
+
+    assert(m_entries[id].stack != NULL);
+    m_entries[id].liveBytes += size;
+    m_entries[id].liveBlocks++;
+}
+
+// bytes - Obtains the amount of memory used by the table, not counting the
+//   call stacks themselves.
+//
+//  Return Value:
+//
+//    Returns the size, in bytes, of the entries.
+//
+SIZE_T StackTable::bytes () const
+{
+    return m_capacity * sizeof(entry_t);
+}
+
+// grow - Doubles the number of entries.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::grow ()
+{
+    UINT32 capacity = (m_capacity == 0) ? STACK_TABLE_RESERVE : m_capacity * 2;
+    entry_t* entries = new entry_t [capacity];
+    if (m_entries != NULL) {
+        memcpy(entries, m_entries, m_capacity * sizeof(entry_t));
+        delete [] m_entries;
+    }
+    memset(entries + m_capacity, 0, (capacity - m_capacity) * sizeof(entry_t));
+    m_entries = entries;
+    m_capacity = capacity;
+}
+
+// intern - Finds the call stack equal to the specified one, adding it to the
+//   table if there is none yet, and adds a reference to it.
+//
+//  - stack (IN): The call stack. The table takes ownership of it: if an equal
+//      stack is already in the table, it is freed.
+//
+//  Return Value:
+//
+//    Returns the ID of the call stack.
+//
+UINT32 StackTable::intern (CallStack* stack)
+{
+    UINT64 hash = stack->getStackHash();
+    Map<UINT64, UINT32>::Iterator chainit = m_chains.find(hash);
+    UINT32 first = 0;
+    if (chainit != m_chains.end()) {
+        first = (*chainit).second;
+        for (UINT32 id = first; id != 0; id = m_entries[id].next) {
+            if (*(m_entries[id].stack) == *stack) {
+                // Allocated from the same place as another block.
+                delete stack;
+                m_entries[id].refs++;
+                return id;
+            }
+        }
+    }
+
+    // A new call stack. Take a free entry and put it at the head of the chain.
+    UINT32 id = m_free;
+    if (id != 0) {
+        m_free = m_entries[id].next;
+    }
+    else {
+        if (m_used == m_capacity)
+            grow();
+        id = m_used++;
+    }
+    m_entries[id].stack = stack;
+    m_entries[id].refs = 1;
+    m_entries[id].next = first;
+    m_entries[id].retired = false;
+    m_entries[id].liveBytes = 0;
+    m_entries[id].liveBlocks = 0;
+    InitGrowthTrend(m_entries[id].trend);
+    m_entries[id].lifetimes = NULL;
+    if (m_trackLifetimes) {
+        // The histogram keeps its own reference to the call stack.
+        lifetimehist_t* hist = new lifetimehist_t;
+        InitLifetimeHistogram(*hist, stack, stack->getHashValue());
+        PublishLifetimeHistogram(m_lifetimes, hist);
+        m_entries[id].lifetimes = hist;
+        m_entries[id].refs++;
+    }
+    if (chainit != m_chains.end()) {
+        m_chains.entry(chainit).second = id;
+    }
+    else {
+        m_chains.insert(hash, id);
+    }
+    m_count++;
+    return id;
+}
+
+// release - Removes a reference to a call stack. The call stack is freed, and
+//   its ID may be reused, once the last reference is removed.
+//
+//  - id (IN): ID of the call stack. If 0, nothing is done.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::release (UINT32 id)
+{
+    if (id == 0)
+        return;
+
+    entry_t* entry = &m_entries[id];
+    assert((entry->stack != NULL) && (entry->refs > 0));
+    if (--entry->refs != 0)
+        return;
+
+    if (!entry->retired)
+        unlink(id);
+    delete entry->stack;
+    entry->stack = NULL;
+    entry->next = m_free;
+    m_free = id;
+    m_count--;
+}
+
+// recordlifetime - Counts a block freed from a call site in the site's
+//   lifetime histogram. Takes no lock of its own.
+//
+//  - id (IN): ID of the call stack. If 0, or if the site has no histogram,
+//      nothing is done.
+//
+//  - serials (IN): Number of allocations made while the block was alive.
+//
+//  - ticks (IN): Time stamp counter ticks elapsed while the block was alive.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::recordLifetime (UINT32 id, UINT64 serials, UINT64 ticks)
+{
+    if ((id == 0) || (m_entries[id].lifetimes == NULL))
+        return;
+
+    RecordLifetime(*m_entries[id].lifetimes, serials, ticks);
+}
+
+// removeblock - Accounts for a block allocated from a call site being freed.
+//
+//  - id (IN): ID of the call stack. If 0, nothing is done.
+//
+//  - size (IN): Size, in bytes, of the block, as passed to addBlock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::removeBlock (UINT32 id, SIZE_T size)
+{
+    if (id == 0)
+        return;
+
+    assert((m_entries[id].liveBytes >= size) && (m_entries[id].liveBlocks > 0));
+    m_entries[id].liveBytes -= size;
+    m_entries[id].liveBlocks--;
+}
+
+// retire - Removes a call stack from its chain, so that intern never finds it
+//   again. The call stack stays in the table until its last reference is
+//   removed.
+//
+//  - id (IN): ID of the call stack. If 0, or if the call stack is already
+//      retired, nothing is done.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::retire (UINT32 id)
+{
+    if ((id == 0) || m_entries[id].retired)
+        return;
+
+    assert(m_entries[id].stack != NULL);
+    unlink(id);
+    m_entries[id].next = 0;
+    m_entries[id].retired = true;
+}
+
+// sampletrends - Samples the live bytes of every call site, and finds the
+//   sites which should be reported as suspected leaks. Takes time proportional
+//   to the number of sites, not of blocks.
+//
+//  - suspects (OUT): Receives the suspected sites. A reference to each of their
+//      call stacks is added, which the caller must release.
+//
+//  - maxsuspects (IN): Size of the suspects array. Sampling stops once it is
+//      full.
+//
+//  Return Value:
+//
+//    Returns the number of suspected sites.
+//
+UINT32 StackTable::sampleTrends (suspect_t* suspects, UINT32 maxsuspects)
+{
+    UINT32 count = 0;
+    for (UINT32 id = 1; (id < m_used) && (count < maxsuspects); id++) {
+        entry_t* entry = &m_entries[id];
+        if ((entry->stack == NULL) || !SampleGrowthTrend(entry->trend, entry->liveBytes))
+            continue;
+
+        entry->refs++;
+        suspects[count].id = id;
+        suspects[count].liveBytes = entry->liveBytes;
+        suspects[count].liveBlocks = entry->liveBlocks;
+        count++;
+    }
+    return count;
+}
+
+// capacity - Obtains the number of IDs in use. Every ID passed to get must be
+//   below it. Free entries have no call stack.
+//
+//  Return Value:
+//
+//    Returns the number of IDs.
+//
+UINT32 StackTable::capacity () const
+{
+    return m_used;
+}
+
+// size - Obtains the number of distinct call stacks in the table.
+//
+//  Return Value:
+//
+//    Returns the number of call stacks.
+//
+UINT32 StackTable::size () const
+{
+    return m_count;
+}
+
+// unlink - Removes an entry from the chain of its stack hash.
+//
+//  - id (IN): ID of the call stack.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID StackTable::unlink (UINT32 id)
+{
+    entry_t* entry = &m_entries[id];
+    UINT64 hash = entry->stack->getStackHash();
+    Map<UINT64, UINT32>::Iterator chainit = m_chains.find(hash);
+    assert(chainit != m_chains.end());
+    UINT32 first = (*chainit).second;
+    if (first == id) {
+        if (entry->next != 0) {
+            m_chains.entry(chainit).second = entry->next;
+        }
+        else {
+            m_chains.erase(chainit);
+        }
+    }
+    else {
+        UINT32 prev = first;
+        while (m_entries[prev].next != id) {
+            prev = m_entries[prev].next;
+            assert(prev != 0);
+        }
+        m_entries[prev].next = entry->next;
+    }
+}
@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Call Stack Table Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include "growthtrend.h" // Provides the trend test of the leak suspect detector.
+#include "lifetimehist.h" // Provides the lifetime histograms of the call sites.
+#include "platform.h"   // Provides the platform adapters.
+#include "callstack.h"  // Provides the CallStack class.
+#include "map.h"        // Provides a custom STL-like map template.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The StackTable Class
+//
+//    Every live block used to own a private copy of its allocation call stack,
+//    which cost several hundred bytes per block even though most blocks of a
+//    program are allocated from a handful of places. Instead, each distinct
+//    call stack is now stored once in this table, and blocks only keep its
+//    32-bit ID. Stacks are reference counted, and freed with the last block
+//    (or leak snapshot) referring to them.
+//
+//    ID 0 never refers to a stack. IDs of freed stacks are reused. A stack
+//    whose addresses no longer mean what they meant when it was captured, as
+//    its modules were unloaded, is retired: it stays in the table for the
+//    blocks referring to it, but new stacks are no longer found equal to it.
+//
+//    Each stack is also the call site of the blocks allocated from it, so the
+//    table keeps the live bytes of every site, and their trend for the leak
+//    suspect detector. If asked to, it also counts the lifetimes of the blocks
+//    freed from each site. A site with a lifetime histogram stays in the table
+//    once all of its blocks are freed, since the histogram still refers to it.
+//
+//    The table is not thread safe: callers must hold the lock of the
+//    BlockTracker owning it (g_heapMapLock in the DLL). The only exception is
+//    the list of lifetime histograms, which can be read at any time.
+//
+class StackTable
+{
+public:
+    // A call site whose live bytes keep growing.
+    struct suspect_t {
+        UINT32 id;              // ID of the call stack.
+        SIZE_T liveBytes;       // Bytes of the live blocks allocated from the site.
+        SIZE_T liveBlocks;      // Number of live blocks allocated from the site.
+    };
+
+    explicit StackTable (bool tracklifetimes);
+    ~StackTable ();
+    UINT32 intern (CallStack* stack);
+    VOID addRef (UINT32 id);
+    VOID release (UINT32 id);
+    VOID retire (UINT32 id);
+    VOID addBlock (UINT32 id, SIZE_T size);
+    VOID removeBlock (UINT32 id, SIZE_T size);
+    VOID recordLifetime (UINT32 id, UINT64 serials, UINT64 ticks);
+    UINT32 sampleTrends (suspect_t* suspects, UINT32 maxsuspects);
+    UINT32 capacity () const;
+    UINT32 size () const;
+    SIZE_T bytes () const;
+
+    // get - Obtains the call stack with the specified ID.
+    //
+    //  - id (IN): ID of the call stack, as returned by intern.
+    //
+    //  Return Value:
+    //
+    //    Returns the call stack, or NULL if the ID is 0.
+    //
+    CallStack* get (UINT32 id) const
+    {
+        assert(id < m_capacity);
+        return m_entries[id].stack;
+    }
+
+    // lifetimes - Obtains the first lifetime histogram. Each histogram's site
+    //   is its call stack. Neither ever moves nor is freed while the table
+    //   exists, so the list can be walked without holding any lock.
+    //
+    //  Return Value:
+    //
+    //    Returns the first histogram, or NULL if there is none.
+    //
+    lifetimehist_t* lifetimes () const
+    {
+        return m_lifetimes.load(std::memory_order_acquire);
+    }
+
+private:
+    // Each stack is chained, by ID, to the other stacks with the same hash.
+    // Free entries are chained together the same way.
+    struct entry_t {
+        CallStack*    stack;    // The call stack, or NULL if the entry is free.
+        UINT32        refs;     // Number of references to the call stack.
+        UINT32        next;     // ID of the next entry in the same chain, or 0.
+        bool          retired;  // If set, the stack is in no chain.
+        SIZE_T        liveBytes;  // Bytes of the live blocks allocated from the site.
+        SIZE_T        liveBlocks; // Number of live blocks allocated from the site.
+        growthtrend_t trend;    // Trend of liveBytes, sampled by the leak suspect detector.
+        lifetimehist_t* lifetimes; // Lifetimes of the blocks freed from the site, or NULL.
+    };
+
+    VOID grow ();
+    VOID unlink (UINT32 id);
+
+    Map<UINT64, UINT32> m_chains;   // ID of the first stack with each stack hash.
+    entry_t*            m_entries;  // Entries, indexed by ID.
+    UINT32              m_capacity; // Number of entries allocated.
+    UINT32              m_used;     // Number of entries used so far, including free ones.
+    UINT32              m_free;     // ID of the first free entry, or 0.
+    UINT32              m_count;    // Number of distinct stacks in the table.
+    bool                m_trackLifetimes; // If true, each new site gets a lifetime histogram.
+    std::atomic<lifetimehist_t*> m_lifetimes; // Most recently added lifetime histogram.
+};
@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Symbolizer Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+#include "platform.h"   // Provides the Win32 types.
+
+struct loadedmodule_t;
+
+// What a symbolizer knows about a program counter. The strings belong to the
+// symbolizer, and stay valid until it is flushed.
+struct symbolinfo_t
+{
+    const char *module;         // File name of the module, without its directory.
+    const char *function;       // Name of the function, as found in the symbol table (C++ names are mangled), or NULL.
+    UINT_PTR    displacement;   // Distance, in bytes, from the start of the function to the program counter.
+    const char *file;           // Source file of the program counter, or NULL if there is no line information.
+    UINT32      line;           // Line number in the source file, or 0.
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The Symbolizer Class
+//
+//    Translates program counters into module, function, and source file and
+//    line. CallStack::resolve goes through the process-wide symbolizer returned
+//    by Get, which is built on the symbol tables of the platform: the ELF and
+//    DWARF data of the loaded modules on Linux (see elfsymbolizer.h). What it
+//    reads is cached, so that each module is only loaded once.
+//
+//    Symbolizers are thread safe. They may be called while holding any of VLD's
+//    locks, and do not take any of them.
+//
+class Symbolizer
+{
+public:
+    virtual ~Symbolizer () {}
+
+    // addModule - Loads a module which isn't loaded in the process anymore,
+    //   so that the program counters captured while it was can still be
+    //   resolved, until the next flush.
+    //
+    //  - module (IN): The unloaded module. See ModuleTable::refresh.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    virtual VOID addModule (const loadedmodule_t &module) = 0;
+
+    // flush - Forgets everything known about the modules. Must be called when
+    //   a module is unloaded, as its addresses may then be reused by another.
+    virtual VOID flush () = 0;
+
+    // resolve - Finds what is known about a program counter. Program counters
+    //   which are not at the start of a function are taken to be return
+    //   addresses: their line is the line of the call.
+    //
+    //  - programcounter (IN): The program counter to look up.
+    //
+    //  - info (OUT): Receives what is known about the program counter.
+    //
+    //  Return Value:
+    //
+    //    Returns true if the module of the program counter was found, even if
+    //    it has no symbol for it. Otherwise returns false.
+    //
+    virtual bool resolve (UINT_PTR programcounter, symbolinfo_t &info) = 0;
+
+    static Symbolizer* Get ();
+};
@@ -0,0 +1,201 @@
+// adaptive_lock.cpp : Unit tests and a contention benchmark for the adaptive
+// spin-then-park lock. Only ordinary threads are used so the tests can run on
+// any platform.
+//
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The lock is linked into this test straight from the VLD sources.
+#include "adaptivelock.h"
+#include "map.h"
+
+namespace {
+
+// Makes threads increment a counter protected by the lock, and returns the
+// average time of one increment, in nanoseconds.
+template <typename T>
+double Contend (T &lock, int threads, int increments, unsigned long long &counter)
+{
+    std::atomic<bool> go (false);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            while (!go.load())
+                std::this_thread::yield();
+            for (int i = 0; i < increments; i++) {
+                CriticalSectionLocker<T> locker(lock);
+                counter++;
+            }
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (std::thread &worker : workers)
+        worker.join();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return (double)elapsed / ((double)threads * increments);
+}
+
+} // namespace
+
+TEST(AdaptiveLock, EnterAndLeave)
+{
+    AdaptiveLock lock;
+    lock.Initialize();
+    EXPECT_FALSE(lock.IsLocked());
+    lock.Enter();
+    EXPECT_TRUE(lock.IsLocked());
+    EXPECT_TRUE(lock.IsLockedByCurrentThread());
+
+    // The lock is recursive, like CriticalSection.
+    lock.Enter();
+    EXPECT_TRUE(lock.TryEnter());
+    lock.Leave();
+    lock.Leave();
+    EXPECT_TRUE(lock.IsLockedByCurrentThread());
+    lock.Leave();
+    EXPECT_FALSE(lock.IsLocked());
+
+    lockstats_t stats;
+    lock.GetStats(stats);
+    EXPECT_EQ(1u, stats.acquisitions);
+    EXPECT_EQ(0u, stats.contended);
+    EXPECT_EQ(0u, stats.waitCycles);
+    lock.Delete();
+}
+
+TEST(AdaptiveLock, TryEnterFromAnotherThread)
+{
+    AdaptiveLock lock;
+    lock.Initialize();
+    lock.Enter();
+    bool entered = true;
+    bool lockedbyother = true;
+    std::thread other([&]() {
+        entered = lock.TryEnter();
+        lockedbyother = lock.IsLockedByCurrentThread();
+    });
+    other.join();
+    EXPECT_FALSE(entered);
+    EXPECT_FALSE(lockedbyother);
+    lock.Leave();
+
+    std::thread again([&]() {
+        entered = lock.TryEnter();
+        if (entered)
+            lock.Leave();
+    });
+    again.join();
+    EXPECT_TRUE(entered);
+    lock.Delete();
+}
+
+TEST(AdaptiveLock, ParkedThreadIsWoken)
+{
+    AdaptiveLock lock;
+    lock.Initialize();
+    lock.Enter();
+    std::atomic<bool> entered (false);
+    std::thread waiter([&]() {
+        CriticalSectionLocker<AdaptiveLock> locker(lock);
+        entered.store(true);
+    });
+
+    // Long enough for the waiter to give up polling and park.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(entered.load());
+    lock.Leave();
+    waiter.join();
+    EXPECT_TRUE(entered.load());
+
+    lockstats_t stats;
+    lock.GetStats(stats);
+    EXPECT_EQ(2u, stats.acquisitions);
+    EXPECT_EQ(1u, stats.contended);
+    EXPECT_GT(stats.waitCycles, 0u);
+    lock.Delete();
+}
+
+TEST(AdaptiveLock, MutualExclusion)
+{
+    AdaptiveLock lock;
+    lock.Initialize();
+    unsigned long long counter = 0;
+    Contend(lock, 8, 20000, counter);
+    EXPECT_EQ(8u * 20000u, counter);
+
+    lockstats_t stats;
+    lock.GetStats(stats);
+    EXPECT_EQ(8u * 20000u, stats.acquisitions);
+    EXPECT_LE(stats.contended, stats.acquisitions);
+    lock.Delete();
+}
+
+TEST(AdaptiveLock, RecordsInternalStats)
+{
+    FreeInternalStats();
+    AdaptiveLock lock;
+    lock.Initialize(STATS_HEAPMAP_LOCK);
+    lock.Enter();
+    lock.Leave();
+    EnableInternalStats(true);
+    lock.Enter();
+    lock.Enter();
+    lock.Leave();
+    lock.Leave();
+    statcounts_t counts [STATS_COUNT];
+    ReadInternalStats(counts);
+    EXPECT_EQ(1u, counts[STATS_HEAPMAP_LOCK].calls);
+    FreeInternalStats();
+    lock.Delete();
+}
+
+TEST(AdaptiveLock, LockPolicyOfContainers)
+{
+    Map<int, int, AdaptiveLock> map;
+    for (int key = 0; key < 100; key++)
+        map.insert(key, key * 2);
+    Map<int, int, AdaptiveLock>::Iterator it = map.find(42);
+    ASSERT_TRUE(it != map.end());
+    EXPECT_EQ(84, (*it).second);
+}
+
+// Not a correctness test: compares the cost of a short critical section with
+// CriticalSection and with AdaptiveLock, from 1 to 64 threads contending for
+// the same lock.
+TEST(LockBenchmark, Contention)
+{
+    const int total = 400000;
+    printf("Threads  CriticalSection  AdaptiveLock  Contended\n");
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        unsigned long long counter = 0;
+        CriticalSection section;
+        section.Initialize();
+        double sectionns = Contend(section, threads, total / threads, counter);
+        section.Delete();
+
+        AdaptiveLock lock;
+        lock.Initialize();
+        double lockns = Contend(lock, threads, total / threads, counter);
+        lockstats_t stats;
+        lock.GetStats(stats);
+        lock.Delete();
+
+        EXPECT_EQ(2u * (total / threads) * threads, counter);
+        printf("%7d  %12.1f ns  %9.1f ns  %8.1f%%\n", threads, sectionns, lockns,
+            100.0 * stats.contended / stats.acquisitions);
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
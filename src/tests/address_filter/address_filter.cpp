@@ -0,0 +1,155 @@
+// address_filter.cpp : Unit tests for the filter rejecting frees of blocks VLD
+// never tracked. Only the standard library is used so the tests can run on any
+// platform.
+//
+
+#define VLDBUILD        // The filter is compiled into this test straight from the VLD sources.
+#include "addressfilter.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::unique_ptr<addressfilter_t> NewFilter()
+{
+    std::unique_ptr<addressfilter_t> filter(new addressfilter_t);
+    InitAddressFilter(*filter);
+    return filter;
+}
+
+// An address as a heap would return it.
+const void* HeapAddress(std::uintptr_t index)
+{
+    return reinterpret_cast<const void*>(0x10000000 + index * 16);
+}
+
+} // namespace
+
+TEST(AddressFilter, EmptyRejectsEverything)
+{
+    std::unique_ptr<addressfilter_t> filter = NewFilter();
+    for (std::uintptr_t index = 0; index < 100000; index++)
+        EXPECT_FALSE(AddressFilterMayContain(*filter, HeapAddress(index)));
+}
+
+TEST(AddressFilter, NeverRejectsTrackedAddresses)
+{
+    std::unique_ptr<addressfilter_t> filter = NewFilter();
+    std::map<std::uintptr_t, int> tracked;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 1000000; i++) {
+        std::uintptr_t index = rng() % 200000;
+        auto it = tracked.find(index);
+        if ((it == tracked.end()) || (rng() % 2)) {
+            AddToAddressFilter(*filter, HeapAddress(index));
+            tracked[index]++;
+        }
+        else {
+            RemoveFromAddressFilter(*filter, HeapAddress(index));
+            if (--it->second == 0)
+                tracked.erase(it);
+        }
+        if (i % 100000 == 0) {
+            for (const auto &entry : tracked)
+                ASSERT_TRUE(AddressFilterMayContain(*filter, HeapAddress(entry.first)));
+        }
+    }
+
+    // Once everything is removed, the filter is empty again, unless counters
+    // saturated.
+    for (const auto &entry : tracked) {
+        for (int count = 0; count < entry.second; count++)
+            RemoveFromAddressFilter(*filter, HeapAddress(entry.first));
+    }
+    int saturated = 0;
+    for (std::size_t slot = 0; slot < ADDRESS_FILTER_SLOTS; slot++) {
+        std::uint8_t value = filter->counters[slot].load();
+        EXPECT_TRUE((value == 0) || (value == ADDRESS_FILTER_SATURATED));
+        if (value != 0)
+            saturated++;
+    }
+    EXPECT_EQ(0, saturated);
+}
+
+TEST(AddressFilter, FewFalsePositives)
+{
+    std::unique_ptr<addressfilter_t> filter = NewFilter();
+    const std::uintptr_t live = 100000;
+    for (std::uintptr_t index = 0; index < live; index++)
+        AddToAddressFilter(*filter, HeapAddress(index * 3));
+
+    int passed = 0;
+    const int untracked = 1000000;
+    for (int index = 0; index < untracked; index++) {
+        if (AddressFilterMayContain(*filter, HeapAddress(live * 3 + index)))
+            passed++;
+    }
+    // About (1 - e^(-2n/m))^2 of them, 3.4% with these numbers.
+    EXPECT_LT(passed, untracked / 20);
+}
+
+TEST(AddressFilter, SaturatedCountersStaySet)
+{
+    std::unique_ptr<addressfilter_t> filter = NewFilter();
+    const void *address = HeapAddress(42);
+    for (int count = 0; count < ADDRESS_FILTER_SATURATED + 10; count++)
+        AddToAddressFilter(*filter, address);
+    for (int count = 0; count < ADDRESS_FILTER_SATURATED + 10; count++)
+        RemoveFromAddressFilter(*filter, address);
+    EXPECT_TRUE(AddressFilterMayContain(*filter, address));
+}
+
+TEST(AddressFilter, ConcurrentTests)
+{
+    // Addresses which stay tracked are never rejected, while another thread
+    // adds and removes other addresses.
+    std::unique_ptr<addressfilter_t> filter = NewFilter();
+    const std::uintptr_t stable = 1000;
+    for (std::uintptr_t index = 0; index < stable; index++)
+        AddToAddressFilter(*filter, HeapAddress(index));
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        std::mt19937 rng(2);
+        std::vector<std::uintptr_t> live;
+        while (!stop.load()) {
+            if (live.empty() || (rng() % 2)) {
+                live.push_back(stable + rng() % 100000);
+                AddToAddressFilter(*filter, HeapAddress(live.back()));
+            }
+            else {
+                RemoveFromAddressFilter(*filter, HeapAddress(live.back()));
+                live.pop_back();
+            }
+        }
+    });
+
+    std::vector<std::thread> readers;
+    std::atomic<int> rejected(0);
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&]() {
+            for (int round = 0; round < 200; round++) {
+                for (std::uintptr_t index = 0; index < stable; index++) {
+                    if (!AddressFilterMayContain(*filter, HeapAddress(index)))
+                        rejected++;
+                }
+            }
+        });
+    }
+    for (std::thread &reader : readers)
+        reader.join();
+    stop = true;
+    writer.join();
+    EXPECT_EQ(0, rejected.load());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,305 @@
+// capture_policy.cpp : Unit tests and a benchmark for the compiled capture
+// rules. The decisions are made on synthetic allocations, so the tests can run
+// on any platform.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The policy is linked into this test straight from the VLD sources.
+#include "capturepolicy.h"
+
+namespace {
+
+size_t Compile (CapturePolicy &policy, const wchar_t *text)
+{
+    size_t invalid = 0;
+    size_t count = policy.compile(text, invalid);
+    EXPECT_EQ(0u, invalid) << text;
+    return count;
+}
+
+UINT32 Row (CapturePolicy &policy, const wchar_t *module)
+{
+    return policy.moduleRow(module, wcslen(module));
+}
+
+// Makes a thread of the given name ready to call capture.
+capturethread_t Thread (const CapturePolicy &policy, const wchar_t *name)
+{
+    capturethread_t thread;
+    memset(&thread, 0, sizeof(thread));
+    EXPECT_TRUE(policy.threadNameStale(thread));
+    policy.setThreadName(thread, name, (name != NULL) ? wcslen(name) : 0);
+    return thread;
+}
+
+bool Capture (const CapturePolicy &policy, UINT32 row, SIZE_T size, capturethread_t &thread)
+{
+    UINT32 depth;
+    return policy.capture(row, size, thread, depth);
+}
+
+} // namespace
+
+TEST(CapturePolicy, SizeClasses)
+{
+    EXPECT_EQ(0u, CaptureSizeClass(0));
+    EXPECT_EQ(1u, CaptureSizeClass(1));
+    EXPECT_EQ(2u, CaptureSizeClass(2));
+    EXPECT_EQ(2u, CaptureSizeClass(3));
+    EXPECT_EQ(8u, CaptureSizeClass(255));
+    EXPECT_EQ(9u, CaptureSizeClass(256));
+    EXPECT_EQ(13u, CaptureSizeClass(4096));
+    EXPECT_EQ((UINT32)(sizeof(SIZE_T) * 8), CaptureSizeClass((SIZE_T)-1));
+    EXPECT_EQ(0u, CaptureLowestRule(1));
+    EXPECT_EQ(5u, CaptureLowestRule(0x60));
+    EXPECT_EQ(31u, CaptureLowestRule(0x80000000));
+}
+
+TEST(CapturePolicy, NoRulesTracksEverything)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(0u, policy.ruleCount());
+    EXPECT_FALSE(policy.usesThreadNames());
+    capturethread_t thread = Thread(policy, NULL);
+    UINT32 depth = 1;
+    EXPECT_TRUE(policy.capture(CAPTURE_ROW_ANY, 0, thread, depth));
+    EXPECT_EQ(0u, depth);
+    EXPECT_TRUE(Capture(policy, Row(policy, L"app.exe"), 100, thread));
+}
+
+TEST(CapturePolicy, InvalidRulesAreLeftOut)
+{
+    CapturePolicy policy;
+    size_t invalid = 0;
+    EXPECT_EQ(2u, policy.compile(
+        L"size=abc; depth; color=red; size=8-4; sample=0; module=**; size=-; "
+        L" ; size=4K depth=8 ;track=off", invalid));
+    EXPECT_EQ(7u, invalid);
+
+    // Rules beyond CAPTURE_MAX_RULES are left out as well.
+    std::wstring text;
+    for (int i = 0; i < CAPTURE_MAX_RULES + 3; i++)
+        text += L"size=1;";
+    EXPECT_EQ((size_t)CAPTURE_MAX_RULES, policy.compile(text.c_str(), invalid));
+    EXPECT_EQ(3u, invalid);
+}
+
+TEST(CapturePolicy, SizeRanges)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(3u, Compile(policy, L"size=1K-2K depth=4; size=100; SIZE=1m- track=no"));
+    capturethread_t thread = Thread(policy, NULL);
+
+    // Rules which track something leave the rest untracked.
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 0, thread));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 1023, thread));
+    UINT32 depth = 0;
+    EXPECT_TRUE(policy.capture(CAPTURE_ROW_ANY, 1024, thread, depth));
+    EXPECT_EQ(4u, depth);
+    EXPECT_TRUE(Capture(policy, CAPTURE_ROW_ANY, 2048, thread));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 2049, thread));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 99, thread));
+    EXPECT_TRUE(policy.capture(CAPTURE_ROW_ANY, 100, thread, depth));
+    EXPECT_EQ(0u, depth);
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 101, thread));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 1024 * 1024, thread));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, (SIZE_T)-1, thread));
+}
+
+TEST(CapturePolicy, FirstMatchingRuleDecides)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(2u, Compile(policy, L"size=-16 track=no; size=-1K depth=2"));
+    capturethread_t thread = Thread(policy, NULL);
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 16, thread));
+    UINT32 depth = 0;
+    EXPECT_TRUE(policy.capture(CAPTURE_ROW_ANY, 17, thread, depth));
+    EXPECT_EQ(2u, depth);
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 1025, thread));
+}
+
+TEST(CapturePolicy, ExclusionsLeaveTheRestTracked)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(2u, Compile(policy, L"module=*.so track=no; size=-8 track=no"));
+    capturethread_t thread = Thread(policy, NULL);
+    UINT32 app = Row(policy, L"App.exe");
+    UINT32 library = Row(policy, L"libfoo.SO");
+    EXPECT_TRUE(Capture(policy, app, 100, thread));
+    EXPECT_FALSE(Capture(policy, app, 8, thread));
+    EXPECT_FALSE(Capture(policy, library, 100, thread));
+}
+
+TEST(CapturePolicy, PatternsContainingText)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(2u, Compile(policy, L"module=*Pool* depth=3; thread=*net* track=no"));
+    EXPECT_TRUE(policy.usesThreadNames());
+    UINT32 pool = Row(policy, L"libthreadpool.so");
+    EXPECT_NE((UINT32)CAPTURE_ROW_ANY, pool);
+    EXPECT_EQ(pool, Row(policy, L"POOL"));
+    EXPECT_EQ((UINT32)CAPTURE_ROW_ANY, Row(policy, L"libpoo.so"));
+
+    capturethread_t worker = Thread(policy, L"worker");
+    capturethread_t network = Thread(policy, L"Network-IO");
+    UINT32 depth = 0;
+    EXPECT_TRUE(policy.capture(pool, 10, worker, depth));
+    EXPECT_EQ(3u, depth);
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 10, worker));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 10, network));
+}
+
+TEST(CapturePolicy, ModuleRowsAreShared)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(2u, Compile(policy, L"module=libfoo*,*.exe depth=3; module=*.exe size=-64"));
+    UINT32 foo = Row(policy, L"libfoo.so.1");
+    UINT32 app = Row(policy, L"app.exe");
+    EXPECT_NE((UINT32)CAPTURE_ROW_ANY, foo);
+    EXPECT_NE((UINT32)CAPTURE_ROW_ANY, app);
+    EXPECT_NE(foo, app);
+    EXPECT_EQ(foo, Row(policy, L"LIBFOO.so"));
+    EXPECT_EQ(app, Row(policy, L"other.exe"));
+    EXPECT_EQ((UINT32)CAPTURE_ROW_ANY, Row(policy, L"libc.so.6"));
+
+    capturethread_t thread = Thread(policy, NULL);
+    UINT32 depth = 0;
+    EXPECT_TRUE(policy.capture(foo, 1000, thread, depth));
+    EXPECT_EQ(3u, depth);
+    EXPECT_TRUE(policy.capture(app, 1000, thread, depth));
+    EXPECT_EQ(3u, depth);
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 1000, thread));
+
+    // Recompiling forgets the rows of the previous rules.
+    EXPECT_EQ(1u, Compile(policy, L"module=libc* track=no"));
+    EXPECT_EQ((UINT32)CAPTURE_ROW_ANY, Row(policy, L"libfoo.so"));
+    EXPECT_NE((UINT32)CAPTURE_ROW_ANY, Row(policy, L"libc.so.6"));
+}
+
+TEST(CapturePolicy, FullTableFallsBackToAnyModule)
+{
+    // Each module matches a different pair of rules, needing a row of its own.
+    CapturePolicy policy;
+    std::wstring text = L"size=-1 track=no";
+    for (int i = 0; i < 8; i++)
+        text += L"; module=p" + std::to_wstring(i) + L"* depth=" + std::to_wstring(i + 1);
+    for (int j = 0; j < 8; j++)
+        text += L"; module=*s" + std::to_wstring(j) + L" depth=100";
+    EXPECT_EQ(17u, Compile(policy, text.c_str()));
+    capturethread_t thread = Thread(policy, NULL);
+
+    UINT32 rows = 1;
+    for (UINT32 i = 0; i < 8; i++) {
+        for (UINT32 j = 0; j < 8; j++) {
+            std::wstring name = L"p" + std::to_wstring(i) + L"_s" + std::to_wstring(j);
+            UINT32 row = Row(policy, name.c_str());
+            UINT32 depth = 0;
+            if (rows < CAPTURE_MAX_ROWS) {
+                EXPECT_EQ(rows++, row) << name.c_str();
+                EXPECT_TRUE(policy.capture(row, 10, thread, depth));
+                EXPECT_EQ(i + 1, depth);
+            }
+            else {
+                EXPECT_EQ((UINT32)CAPTURE_ROW_ANY, row) << name.c_str();
+                EXPECT_FALSE(policy.capture(row, 10, thread, depth));
+            }
+        }
+    }
+    EXPECT_EQ((UINT32)CAPTURE_MAX_ROWS, rows);
+}
+
+TEST(CapturePolicy, ThreadNames)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(2u, Compile(policy, L"thread=worker*,io depth=5; thread=main track=no"));
+    EXPECT_TRUE(policy.usesThreadNames());
+
+    capturethread_t worker = Thread(policy, L"Worker-3");
+    capturethread_t io = Thread(policy, L"io");
+    capturethread_t main = Thread(policy, L"main");
+    capturethread_t unnamed = Thread(policy, NULL);
+    UINT32 depth = 0;
+    EXPECT_TRUE(policy.capture(CAPTURE_ROW_ANY, 10, worker, depth));
+    EXPECT_EQ(5u, depth);
+    EXPECT_TRUE(Capture(policy, CAPTURE_ROW_ANY, 10, io));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 10, main));
+    EXPECT_FALSE(Capture(policy, CAPTURE_ROW_ANY, 10, unnamed));
+
+    // Renaming a thread makes every thread read its name again.
+    EXPECT_FALSE(policy.threadNameStale(main));
+    policy.threadNamesChanged();
+    EXPECT_TRUE(policy.threadNameStale(main));
+    policy.setThreadName(main, L"worker-9", 8);
+    EXPECT_FALSE(policy.threadNameStale(main));
+    EXPECT_TRUE(Capture(policy, CAPTURE_ROW_ANY, 10, main));
+
+    // Names set without VLD knowing are caught up with eventually.
+    policy.setThreadName(worker, L"worker-3", 8);
+    int checks = 1;
+    while (!policy.threadNameStale(worker))
+        checks++;
+    EXPECT_EQ(CAPTURE_THREAD_RECHECK, checks);
+}
+
+TEST(CapturePolicy, ThreadNamesNotRecheckedWithoutPatterns)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(1u, Compile(policy, L"size=1-"));
+    capturethread_t thread = Thread(policy, NULL);
+    for (int i = 0; i < 2 * CAPTURE_THREAD_RECHECK; i++)
+        ASSERT_FALSE(policy.threadNameStale(thread));
+}
+
+TEST(CapturePolicy, Sampling)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(2u, Compile(policy, L"size=-64 sample=4; size=65- sample=10"));
+    capturethread_t thread = Thread(policy, NULL);
+    capturethread_t other = Thread(policy, NULL);
+    int small = 0, large = 0, others = 0;
+    for (int i = 0; i < 100; i++) {
+        small += Capture(policy, CAPTURE_ROW_ANY, 16, thread) ? 1 : 0;
+        large += Capture(policy, CAPTURE_ROW_ANY, 1000, thread) ? 1 : 0;
+        others += Capture(policy, CAPTURE_ROW_ANY, 16, other) ? 1 : 0;
+    }
+    EXPECT_EQ(25, small);
+    EXPECT_EQ(10, large);
+    EXPECT_EQ(25, others);
+}
+
+// Not a correctness test: measures the cost of deciding on an allocation, paid
+// by every allocation once capture rules are set.
+TEST(CapturePolicyBenchmark, Capture)
+{
+    CapturePolicy policy;
+    EXPECT_EQ(4u, Compile(policy,
+        L"module=libc* track=no; thread=worker* size=4K- depth=8; size=-16 sample=100; "
+        L"module=*.exe size=100-200"));
+    UINT32 rows [] = { Row(policy, L"libc.so.6"), Row(policy, L"app.exe"), Row(policy, L"libfoo.so") };
+    capturethread_t thread = Thread(policy, L"worker-1");
+
+    const int iterations = 10000000;
+    size_t captured = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        UINT32 depth;
+        captured += policy.capture(rows[i % 3], (SIZE_T)(i & 0x3fff), thread, depth) ? 1 : 0;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    EXPECT_GT(captured, 0u);
+    printf("Decided on %d allocations in %.2f ns on average, %.1f%% captured.\n",
+        iterations, (double)elapsed / iterations, 100.0 * captured / iterations);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,123 @@
+// frame_patterns.cpp : Unit tests and a benchmark for the matcher classifying
+// function and source file names. Only the standard library is used so the
+// tests can run on any platform.
+//
+
+#define VLDBUILD        // The matcher is compiled into this test straight from the VLD sources.
+#include "framepatterns.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+
+namespace {
+
+const uint32_t STARTUP = 0x2;
+const uint32_t ENTRY = 0x4;
+
+uint32_t Match(const FramePatterns<> &patterns, const wchar_t *name)
+{
+    return patterns.match(name, wcslen(name));
+}
+
+void AddCrtPatterns(FramePatterns<> &patterns)
+{
+    patterns.addList(L"_malloc_crt*, _calloc_crt*, *CRT_INIT, *initterm_e, _cinit*,"
+        L"std::`dynamic initializer for '*, setlocale, _wsetlocale, *>::_Getcat", STARTUP);
+    patterns.addList(L"*DllMainCRTStartup; *mainCRTStartup; `dynamic initializer for '*", ENTRY);
+}
+
+} // namespace
+
+TEST(FramePatterns, ExactPrefixAndSuffix)
+{
+    FramePatterns<> patterns;
+    AddCrtPatterns(patterns);
+    EXPECT_EQ(12u, patterns.size());
+
+    EXPECT_EQ(STARTUP, Match(patterns, L"setlocale"));
+    EXPECT_EQ(0u, Match(patterns, L"setlocale2"));
+    EXPECT_EQ(0u, Match(patterns, L"_setlocale"));
+    EXPECT_EQ(STARTUP, Match(patterns, L"_malloc_crt"));
+    EXPECT_EQ(STARTUP, Match(patterns, L"_malloc_crt_impl"));
+    EXPECT_EQ(STARTUP, Match(patterns, L"__CRT_INIT"));
+    EXPECT_EQ(STARTUP, Match(patterns, L"std::ctype<char>::_Getcat"));
+    EXPECT_EQ(ENTRY, Match(patterns, L"wmainCRTStartup"));
+    EXPECT_EQ(ENTRY, Match(patterns, L"_DllMainCRTStartup"));
+    EXPECT_EQ(0u, Match(patterns, L"main"));
+    EXPECT_EQ(0u, Match(patterns, L""));
+}
+
+TEST(FramePatterns, FlagsOfAllMatchesAreCombined)
+{
+    FramePatterns<> patterns;
+    AddCrtPatterns(patterns);
+    // Matches both "std::`dynamic initializer for '*" and "*CRT_INIT".
+    EXPECT_EQ(STARTUP, Match(patterns, L"std::`dynamic initializer for 'CRT_INIT"));
+    // Matches both a startup and an entry pattern.
+    EXPECT_EQ(STARTUP | ENTRY, Match(patterns, L"`dynamic initializer for 'x'_cinit*CRT_INIT"));
+}
+
+TEST(FramePatterns, ListParsing)
+{
+    FramePatterns<> patterns;
+    EXPECT_EQ(3u, patterns.addList(L"  alpha ,\tbeta*;;*gamma  , , *bad*", 1));
+    EXPECT_EQ(1u, Match(patterns, L"alpha"));
+    EXPECT_EQ(1u, Match(patterns, L"beta::run"));
+    EXPECT_EQ(1u, Match(patterns, L"omegagamma"));
+    EXPECT_EQ(0u, Match(patterns, L"xbadx"));
+    EXPECT_FALSE(patterns.add(L"", 0, 1));
+
+    patterns.clear();
+    EXPECT_EQ(0u, patterns.size());
+    EXPECT_EQ(0u, Match(patterns, L"alpha"));
+}
+
+TEST(FramePatterns, WildcardAloneMatchesEverything)
+{
+    FramePatterns<> patterns;
+    EXPECT_TRUE(patterns.add(L"*", 1, 8));
+    EXPECT_EQ(8u, Match(patterns, L"anything"));
+    EXPECT_EQ(8u, Match(patterns, L""));
+}
+
+TEST(FramePatterns, SourceFileSuffixes)
+{
+    FramePatterns<> patterns;
+    patterns.addList(L"*\\crt\\src\\dbgheap.c, *\\crt\\src\\new.cpp, f:\\dd\\vctools\\crt\\crtw32\\*", 1);
+    EXPECT_EQ(1u, Match(patterns, L"c:\\vs\\vc\\crt\\src\\dbgheap.c"));
+    EXPECT_EQ(1u, Match(patterns, L"f:\\dd\\vctools\\crt\\crtw32\\misc\\dbgnew.cpp"));
+    EXPECT_EQ(0u, Match(patterns, L"c:\\project\\src\\new.cpp"));
+}
+
+// Not a correctness test: measures how long classifying one name takes, which
+// is paid once per distinct return address found in a leak report.
+TEST(FramePatternsBenchmark, ClassifyNames)
+{
+    FramePatterns<> patterns;
+    AddCrtPatterns(patterns);
+    const wchar_t *names [] = {
+        L"std::basic_string<wchar_t,std::char_traits<wchar_t>,std::allocator<wchar_t> >::_Copy",
+        L"CMyApplication::InitInstance",
+        L"_malloc_crt",
+        L"wmainCRTStartup",
+    };
+    const int iterations = 250000;
+    uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const wchar_t *name : names)
+            sink += Match(patterns, name);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    EXPECT_NE(0u, sink);
+    printf("Classified a name in %.1f ns on average.\n", double(elapsed) / iterations / 4);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
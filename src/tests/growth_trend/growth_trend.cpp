@@ -0,0 +1,89 @@
+// growth_trend.cpp : Unit tests for the trend test behind the leak suspect
+// detector. Only the standard library is used so the tests can run on any
+// platform.
+//
+
+#define VLDBUILD        // The trend test is compiled into this test straight from the VLD sources.
+#include "growthtrend.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+namespace {
+
+// Samples a site whose live bytes follow the given steps, and returns the
+// number of times it was reported.
+int Reports(growthtrend_t &trend, size_t &livebytes, int samples, long step)
+{
+    int reports = 0;
+    for (int i = 0; i < samples; i++) {
+        livebytes += step;
+        if (SampleGrowthTrend(trend, livebytes))
+            reports++;
+    }
+    return reports;
+}
+
+} // namespace
+
+TEST(GrowthTrend, SteadyGrowthIsReported)
+{
+    growthtrend_t trend;
+    InitGrowthTrend(trend);
+    size_t livebytes = 0;
+    EXPECT_EQ(0, Reports(trend, livebytes, GROWTH_TREND_WINDOWS - 1, 0x10000));
+    EXPECT_EQ(1, Reports(trend, livebytes, 1, 0x10000));
+    EXPECT_EQ(livebytes, trend.reportedBytes);
+}
+
+TEST(GrowthTrend, ReportedAgainOnceDoubled)
+{
+    growthtrend_t trend;
+    InitGrowthTrend(trend);
+    size_t livebytes = 0;
+    EXPECT_EQ(1, Reports(trend, livebytes, GROWTH_TREND_WINDOWS, 0x10000));
+    size_t reported = livebytes;
+    EXPECT_EQ(0, Reports(trend, livebytes, GROWTH_TREND_WINDOWS - 1, 0x10000));
+    EXPECT_LT(livebytes, 2 * reported);
+    EXPECT_EQ(1, Reports(trend, livebytes, 1, 0x10000));
+}
+
+TEST(GrowthTrend, SmallGrowthIsIgnored)
+{
+    growthtrend_t trend;
+    InitGrowthTrend(trend);
+    size_t livebytes = 0x100000;
+    SampleGrowthTrend(trend, livebytes);
+    EXPECT_EQ(0, Reports(trend, livebytes, 100, GROWTH_TREND_MIN_BYTES / 200));
+}
+
+TEST(GrowthTrend, StableUsageIsIgnored)
+{
+    // Usage going up and down around the same level, as with a cache.
+    srand(1);
+    growthtrend_t trend;
+    InitGrowthTrend(trend);
+    int reports = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (SampleGrowthTrend(trend, 0x1000000 + (rand() % 0x100000)))
+            reports++;
+    }
+    EXPECT_EQ(0, reports);
+}
+
+TEST(GrowthTrend, DropsResetTheTrend)
+{
+    growthtrend_t trend;
+    InitGrowthTrend(trend);
+    size_t livebytes = 0;
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(0, Reports(trend, livebytes, GROWTH_TREND_WINDOWS - GROWTH_TREND_MIN_RISES + 3, 0x10000));
+        EXPECT_EQ(0, Reports(trend, livebytes, 3, -0x8000));
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
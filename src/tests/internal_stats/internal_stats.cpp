@@ -0,0 +1,190 @@
+// internal_stats.cpp : Unit tests and a benchmark for the statistics VLD keeps
+// about its own operations. The operations are made up, or are ordinary locks,
+// so the tests can run on any platform.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The statistics are linked into this test straight from the VLD sources.
+#include "criticalsection.h"
+#include "internalstats.h"
+
+namespace {
+
+// Starts every test from empty counters, and leaves the statistics disabled.
+class InternalStats : public ::testing::Test
+{
+protected:
+    void SetUp () override    { FreeInternalStats(); }
+    void TearDown () override { FreeInternalStats(); }
+
+    statcounts_t Read (UINT stat)
+    {
+        statcounts_t counts [STATS_COUNT];
+        ReadInternalStats(counts);
+        return counts[stat];
+    }
+};
+
+} // namespace
+
+TEST(InternalStatsBuckets, Buckets)
+{
+    EXPECT_EQ(0u, StatBucket(0));
+    EXPECT_EQ(1u, StatBucket(1));
+    EXPECT_EQ(2u, StatBucket(2));
+    EXPECT_EQ(2u, StatBucket(3));
+    EXPECT_EQ(3u, StatBucket(4));
+    EXPECT_EQ(11u, StatBucket(1024));
+    EXPECT_EQ(unsigned(STATS_BUCKETS - 1), StatBucket(UINT64_MAX));
+    for (unsigned bucket = 0; bucket < STATS_BUCKETS - 1; bucket++) {
+        std::uint64_t limit = StatBucketLimit(bucket);
+        EXPECT_EQ(bucket, StatBucket(limit - 1));
+        EXPECT_EQ(bucket + 1, StatBucket(limit));
+    }
+    EXPECT_EQ(UINT64_MAX, StatBucketLimit(STATS_BUCKETS - 1));
+}
+
+TEST(InternalStatsBuckets, Quantiles)
+{
+    std::uint64_t buckets [STATS_BUCKETS] = {};
+    EXPECT_EQ(0u, StatQuantile(buckets, 0, 50));
+    buckets[3] = 98;
+    buckets[20] = 2;
+    EXPECT_EQ(3u, StatQuantile(buckets, 100, 50));
+    EXPECT_EQ(3u, StatQuantile(buckets, 100, 98));
+    EXPECT_EQ(20u, StatQuantile(buckets, 100, 99));
+    EXPECT_EQ(20u, StatQuantile(buckets, 100, 100));
+}
+
+TEST(InternalStatsBuckets, Names)
+{
+    for (UINT stat = 0; stat < STATS_COUNT; stat++)
+        EXPECT_NE(L'\0', StatName(stat)[0]) << stat;
+    EXPECT_STREQ(L"", StatName(STATS_NONE));
+}
+
+TEST_F(InternalStats, DisabledRecordsNothing)
+{
+    EXPECT_FALSE(InternalStatsEnabled());
+    {
+        StatTimer timer(STATS_MAP_BLOCK);
+    }
+    CriticalSection lock;
+    lock.Initialize(STATS_HEAPMAP_LOCK);
+    lock.Enter();
+    lock.Leave();
+    lock.Delete();
+    EXPECT_EQ(0u, Read(STATS_MAP_BLOCK).calls);
+    EXPECT_EQ(0u, Read(STATS_HEAPMAP_LOCK).calls);
+}
+
+TEST_F(InternalStats, RecordAndRead)
+{
+    EnableInternalStats(true);
+    RecordStat(STATS_UNMAP_BLOCK, 100);
+    RecordStat(STATS_UNMAP_BLOCK, 100);
+    RecordStat(STATS_UNMAP_BLOCK, 100);
+    RecordStat(STATS_UNMAP_BLOCK, 5000);
+    RecordStat(STATS_NONE, 5000);
+
+    statcounts_t counts = Read(STATS_UNMAP_BLOCK);
+    EXPECT_EQ(4u, counts.calls);
+    EXPECT_EQ(5300u, counts.cycles);
+    EXPECT_EQ(5000u, counts.maxCycles);
+    EXPECT_EQ(3u, counts.buckets[StatBucket(100)]);
+    EXPECT_EQ(1u, counts.buckets[StatBucket(5000)]);
+    EXPECT_EQ(0u, Read(STATS_MAP_BLOCK).calls);
+
+    // Disabling keeps the counts.
+    EnableInternalStats(false);
+    EXPECT_EQ(4u, Read(STATS_UNMAP_BLOCK).calls);
+}
+
+TEST_F(InternalStats, TimersAndLocks)
+{
+    EnableInternalStats(true);
+    {
+        StatTimer timer(STATS_SYMBOLS);
+    }
+    CriticalSection measured;
+    CriticalSection unmeasured;
+    measured.Initialize(STATS_MODULES_LOCK);
+    unmeasured.Initialize();
+    for (int i = 0; i < 10; i++) {
+        CriticalSectionLocker<> outer(measured);
+        CriticalSectionLocker<> inner(unmeasured);
+    }
+    measured.Delete();
+    unmeasured.Delete();
+
+    EXPECT_EQ(1u, Read(STATS_SYMBOLS).calls);
+    EXPECT_EQ(10u, Read(STATS_MODULES_LOCK).calls);
+    statcounts_t counts [STATS_COUNT];
+    ReadInternalStats(counts);
+    std::uint64_t total = 0;
+    for (UINT stat = 0; stat < STATS_COUNT; stat++)
+        total += counts[stat].calls;
+    EXPECT_EQ(11u, total);
+}
+
+TEST_F(InternalStats, ThreadsAreSummed)
+{
+    EnableInternalStats(true);
+    const int threads = 4;
+    const int calls = 1000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([t]() {
+            for (int i = 0; i < calls; i++)
+                RecordStat(STATS_MAP_BLOCK, t + 1);
+        });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+
+    // The counters of the threads outlive them.
+    statcounts_t counts = Read(STATS_MAP_BLOCK);
+    EXPECT_EQ(std::uint64_t(threads * calls), counts.calls);
+    EXPECT_EQ(std::uint64_t((1 + 2 + 3 + 4) * calls), counts.cycles);
+    EXPECT_EQ(4u, counts.maxCycles);
+    EXPECT_EQ(std::uint64_t(calls), counts.buckets[1]);
+    EXPECT_EQ(std::uint64_t(2 * calls), counts.buckets[2]);
+    EXPECT_EQ(std::uint64_t(calls), counts.buckets[3]);
+}
+
+// Not a correctness test: measures what the instrumentation adds to taking an
+// uncontended lock, the most frequent of the measured operations, with the
+// statistics disabled and enabled.
+TEST_F(InternalStats, Benchmark)
+{
+    CriticalSection lock;
+    lock.Initialize(STATS_HEAPMAP_LOCK);
+    const int iterations = 2000000;
+    double nanoseconds [2];
+    for (int enabled = 0; enabled < 2; enabled++) {
+        EnableInternalStats(enabled != 0);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            lock.Enter();
+            lock.Leave();
+        }
+        nanoseconds[enabled] = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+    lock.Delete();
+    EXPECT_EQ(std::uint64_t(iterations), Read(STATS_HEAPMAP_LOCK).calls);
+    printf("Lock taken in %.1f ns with the statistics disabled, %.1f ns enabled.\n",
+        nanoseconds[0], nanoseconds[1]);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
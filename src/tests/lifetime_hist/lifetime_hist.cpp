@@ -0,0 +1,111 @@
+// lifetime_hist.cpp : Unit tests for the lifetime histograms kept for each
+// call site. Only the standard library is used so the tests can run on any
+// platform.
+//
+
+#define VLDBUILD        // The histograms are compiled into this test straight from the VLD sources.
+#include "lifetimehist.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(LifetimeHist, Buckets)
+{
+    EXPECT_EQ(0u, LifetimeBucket(0));
+    EXPECT_EQ(1u, LifetimeBucket(1));
+    EXPECT_EQ(2u, LifetimeBucket(2));
+    EXPECT_EQ(2u, LifetimeBucket(3));
+    EXPECT_EQ(3u, LifetimeBucket(4));
+    EXPECT_EQ(11u, LifetimeBucket(1024));
+    EXPECT_EQ(unsigned(LIFETIME_BUCKETS - 1), LifetimeBucket(UINT64_MAX));
+    for (unsigned bucket = 0; bucket < LIFETIME_BUCKETS - 1; bucket++) {
+        std::uint64_t limit = LifetimeBucketLimit(bucket);
+        EXPECT_EQ(bucket, LifetimeBucket(limit - 1));
+        EXPECT_EQ(bucket + 1, LifetimeBucket(limit));
+    }
+    EXPECT_EQ(UINT64_MAX, LifetimeBucketLimit(LIFETIME_BUCKETS - 1));
+}
+
+TEST(LifetimeHist, RecordAndRead)
+{
+    lifetimehist_t hist;
+    int site = 0;
+    InitLifetimeHistogram(hist, &site, 0x1234);
+    EXPECT_EQ(&site, hist.site);
+    EXPECT_EQ(0x1234u, hist.hash);
+
+    RecordLifetime(hist, 1, 100);
+    RecordLifetime(hist, 1, 100);
+    RecordLifetime(hist, 1000, 1000000);
+    lifetimecounts_t counts;
+    ReadLifetimeHistogram(hist, counts);
+    EXPECT_EQ(3u, counts.frees);
+    EXPECT_EQ(2u, counts.serials[1]);
+    EXPECT_EQ(1u, counts.serials[10]);
+    EXPECT_EQ(2u, counts.ticks[7]);
+    EXPECT_EQ(1u, counts.ticks[20]);
+}
+
+TEST(LifetimeHist, Quantiles)
+{
+    std::uint64_t buckets [LIFETIME_BUCKETS] = {};
+    EXPECT_EQ(0u, LifetimeQuantile(buckets, 0, 50));
+
+    buckets[2] = 90;
+    buckets[30] = 10;
+    EXPECT_EQ(2u, LifetimeQuantile(buckets, 100, 0));
+    EXPECT_EQ(2u, LifetimeQuantile(buckets, 100, 50));
+    EXPECT_EQ(2u, LifetimeQuantile(buckets, 100, 90));
+    EXPECT_EQ(30u, LifetimeQuantile(buckets, 100, 91));
+    EXPECT_EQ(30u, LifetimeQuantile(buckets, 100, 100));
+
+    buckets[2] = 1;
+    buckets[30] = 2;
+    EXPECT_EQ(30u, LifetimeQuantile(buckets, 3, 50));
+}
+
+TEST(LifetimeHist, ConcurrentFreesAndPublishing)
+{
+    const int threads = 4;
+    const int histograms = 64;
+    const int frees = 10000;
+    std::vector<std::unique_ptr<lifetimehist_t> > storage;
+    for (int i = 0; i < threads * histograms; i++) {
+        storage.emplace_back(new lifetimehist_t);
+        InitLifetimeHistogram(*storage.back(), NULL, i);
+    }
+
+    // Every thread publishes its own histograms, and counts frees in all the
+    // histograms published so far.
+    std::atomic<lifetimehist_t*> head(NULL);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < histograms; i++)
+                PublishLifetimeHistogram(head, storage[t * histograms + i].get());
+            for (int i = 0; i < frees; i++)
+                RecordLifetime(*storage[i % storage.size()], i, i * 100);
+        });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+
+    int published = 0;
+    std::uint64_t total = 0;
+    for (lifetimehist_t *hist = head.load(); hist != NULL; hist = hist->next) {
+        lifetimecounts_t counts;
+        ReadLifetimeHistogram(*hist, counts);
+        total += counts.frees;
+        published++;
+    }
+    EXPECT_EQ(threads * histograms, published);
+    EXPECT_EQ(std::uint64_t(threads) * frees, total);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,220 @@
+// module_table.cpp : Unit tests and a benchmark for the table of the loaded
+// modules, which the preload library searches on every allocation.
+//
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <thread>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The table is linked into this test straight from the VLD sources.
+#include "moduletable.h"
+#include "symbolizer.h"
+
+namespace {
+
+__attribute__((noinline)) int LocalFunction(int value)
+{
+    return value * 3 + 1;
+}
+
+// The runtime modules, as the preload library sees them.
+ModuleTable* CreateTable(const wchar_t *forcedmodules)
+{
+    UINT_PTR runtime [] = { (UINT_PTR)&malloc };
+    ModuleTable *table = new ModuleTable(forcedmodules, runtime, 1);
+    table->refresh(NULL);
+    return table;
+}
+
+} // namespace
+
+TEST(ModuleTable, FindsTheMainProgramAndTheRuntime)
+{
+    ModuleTable *table = CreateTable(L"");
+    EXPECT_GT(table->moduleCount(), 2u);
+    EXPECT_FALSE(table->isIncludeList());
+
+    const loadedmodule_t *module = table->find((UINT_PTR)&LocalFunction);
+    ASSERT_NE(nullptr, module);
+    EXPECT_STREQ("module_table_test", module->name);
+    EXPECT_EQ((UINT32)MODULE_MAIN, module->flags);
+    EXPECT_FALSE(table->isExcluded((UINT_PTR)&LocalFunction));
+
+    EXPECT_EQ((UINT32)(MODULE_RUNTIME | MODULE_EXCLUDED), table->flags((UINT_PTR)&malloc));
+    EXPECT_TRUE(table->isExcluded((UINT_PTR)&malloc));
+
+    // Data isn't code.
+    static int data = 0;
+    EXPECT_EQ(nullptr, table->find((UINT_PTR)&data));
+    EXPECT_FALSE(table->isExcluded((UINT_PTR)&data));
+    delete table;
+}
+
+TEST(ModuleTable, TracksLoadedAndUnloadedModules)
+{
+    ModuleTable *table = CreateTable(L"");
+    size_t count = table->moduleCount();
+
+    void *plugin = dlopen(MODULE_TABLE_PLUGIN, RTLD_NOW);
+    ASSERT_NE(nullptr, plugin);
+    UINT_PTR function = (UINT_PTR)dlsym(plugin, "PluginFunction");
+    EXPECT_EQ(nullptr, table->find(function));
+
+    LoadedModuleList unloaded;
+    table->refresh(&unloaded);
+    EXPECT_TRUE(unloaded.empty());
+    EXPECT_EQ(count + 1, table->moduleCount());
+    const loadedmodule_t *module = table->find(function);
+    ASSERT_NE(nullptr, module);
+    EXPECT_STREQ("libmodule_table_plugin.so", module->name);
+    EXPECT_EQ(0u, module->flags);
+
+    // Modules still loaded are the same from one snapshot to the next.
+    table->refresh(&unloaded);
+    EXPECT_EQ(module, table->find(function));
+
+    dlclose(plugin);
+    table->refresh(&unloaded);
+    EXPECT_EQ(count, table->moduleCount());
+    EXPECT_EQ(nullptr, table->find(function));
+    ASSERT_EQ(1u, unloaded.size());
+    EXPECT_EQ(module, unloaded[0]);
+    EXPECT_STREQ("libmodule_table_plugin.so", unloaded[0]->name);
+    delete table;
+}
+
+TEST(ModuleTable, DetectsLoadedAndUnloadedModules)
+{
+    ModuleTable *table = CreateTable(L"");
+    EXPECT_FALSE(table->changed());
+
+    void *plugin = dlopen(MODULE_TABLE_PLUGIN, RTLD_NOW);
+    ASSERT_NE(nullptr, plugin);
+    EXPECT_TRUE(table->changed());
+    table->refresh(NULL);
+    EXPECT_FALSE(table->changed());
+
+    dlclose(plugin);
+    EXPECT_TRUE(table->changed());
+    table->refresh(NULL);
+    EXPECT_FALSE(table->changed());
+    delete table;
+}
+
+TEST(ModuleTable, ForceIncludeModules)
+{
+    void *plugin = dlopen(MODULE_TABLE_PLUGIN, RTLD_NOW);
+    ASSERT_NE(nullptr, plugin);
+    UINT_PTR function = (UINT_PTR)dlsym(plugin, "PluginFunction");
+
+    // Like vld.dll, names are matched in lower case, anywhere in the list.
+    const wchar_t *included [] = { L"", L"*", L"LibModule_Table_Plugin.so", L"libc.so.6, libmodule_table_plugin.so" };
+    for (const wchar_t *list : included) {
+        ModuleTable *table = CreateTable(list);
+        EXPECT_FALSE(table->isExcluded(function)) << list;
+        EXPECT_FALSE(table->isExcluded((UINT_PTR)&LocalFunction)) << list;
+        EXPECT_TRUE(table->isExcluded((UINT_PTR)&malloc)) << list;
+        delete table;
+    }
+
+    // The main program is always included, the runtime never.
+    ModuleTable *table = CreateTable(L"libother.so libc.so.6");
+    EXPECT_TRUE(table->isIncludeList());
+    EXPECT_TRUE(table->isExcluded(function));
+    EXPECT_FALSE(table->isExcluded((UINT_PTR)&LocalFunction));
+    EXPECT_TRUE(table->isExcluded((UINT_PTR)&malloc));
+    delete table;
+    dlclose(plugin);
+}
+
+TEST(ModuleTable, UnloadedModulesCanBeSymbolized)
+{
+    ModuleTable *table = CreateTable(L"");
+    void *plugin = dlopen(MODULE_TABLE_PLUGIN, RTLD_NOW);
+    ASSERT_NE(nullptr, plugin);
+    UINT_PTR function = (UINT_PTR)dlsym(plugin, "PluginFunction");
+    table->refresh(NULL);
+    dlclose(plugin);
+    LoadedModuleList unloaded;
+    table->refresh(&unloaded);
+    ASSERT_EQ(1u, unloaded.size());
+
+    Symbolizer *symbolizer = Symbolizer::Get();
+    symbolizer->flush();
+    symbolinfo_t info;
+    EXPECT_FALSE(symbolizer->resolve(function + 1, info));
+
+    symbolizer->addModule(*unloaded[0]);
+    ASSERT_TRUE(symbolizer->resolve(function + 1, info));
+    EXPECT_STREQ("libmodule_table_plugin.so", info.module);
+    ASSERT_NE(nullptr, info.function);
+    EXPECT_STREQ("PluginFunction", info.function);
+    EXPECT_EQ(1u, info.displacement);
+    ASSERT_NE(nullptr, info.file);
+    EXPECT_NE(nullptr, strstr(info.file, "module_table_plugin.cpp"));
+
+    symbolizer->flush();
+    EXPECT_FALSE(symbolizer->resolve(function + 1, info));
+    delete table;
+}
+
+TEST(ModuleTable, LookupsDuringRefreshes)
+{
+    ModuleTable *table = CreateTable(L"");
+    std::atomic<bool> done(false);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int index = 0; index < 4; index++) {
+        threads.emplace_back([&] {
+            while (!done.load()) {
+                if ((table->flags((UINT_PTR)&LocalFunction) != MODULE_MAIN) || !table->isExcluded((UINT_PTR)&malloc))
+                    failures++;
+            }
+        });
+    }
+    for (int count = 0; count < 100; count++) {
+        void *plugin = dlopen(MODULE_TABLE_PLUGIN, RTLD_NOW);
+        table->refresh(NULL);
+        dlclose(plugin);
+        table->refresh(NULL);
+    }
+    done = true;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(0, failures.load());
+    delete table;
+}
+
+// Not a correctness test: measures the cost of the lookup made by the preload
+// library for every allocation.
+TEST(ModuleTableBenchmark, IsExcluded)
+{
+    ModuleTable *table = CreateTable(L"");
+    const int iterations = 1000000;
+    UINT_PTR addresses [] = { (UINT_PTR)&LocalFunction, (UINT_PTR)&malloc, (UINT_PTR)&printf, (UINT_PTR)&strlen };
+    int excluded = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        excluded += table->isExcluded(addresses[i & 3]);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    EXPECT_EQ(iterations / 4 * 3, excluded);
+    printf("Looked up an address among %zu modules in %.1f ns on average.\n", table->moduleCount(),
+        (double)elapsed / iterations);
+    delete table;
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,8 @@
+// module_table_plugin.cpp : A module loaded and unloaded by the module table
+// tests.
+//
+
+extern "C" int PluginFunction(int value)
+{
+    return value * 5 + 2;
+}
@@ -0,0 +1,247 @@
+// reachability.cpp : Unit tests and a benchmark for the conservative
+// reachability scan. The blocks are carved out of an ordinary array, and are
+// made to point to each other the way the program's data would, so the tests
+// can run on any platform.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The scan is linked into this test straight from the VLD sources.
+#include "reachability.h"
+
+namespace {
+
+// A made-up heap: blocks of the same size with a gap between each, so that a
+// pointer just past a block doesn't point into the next one.
+class Heap
+{
+public:
+    explicit Heap (size_t count, size_t words = 4)
+        : m_words(words), m_arena(count * (words + 1) + 1, 0)
+    {
+    }
+
+    UINT_PTR *block (size_t index) { return &m_arena[index * (m_words + 1)]; }
+    size_t size () const { return m_words * sizeof(UINT_PTR); }
+    size_t count () const { return (m_arena.size() - 1) / (m_words + 1); }
+
+    VOID add (ReachabilityScan &scan)
+    {
+        for (size_t index = 0; index < count(); index++)
+            scan.addBlock(block(index), size());
+    }
+
+    VOID link (size_t from, size_t word, size_t to, size_t offset = 0)
+    {
+        block(from)[word] = (UINT_PTR)block(to) + offset;
+    }
+
+private:
+    size_t                m_words;
+    std::vector<UINT_PTR> m_arena;
+};
+
+} // namespace
+
+TEST(Reachability, UnreferencedBlocksAreDirectlyLost)
+{
+    Heap heap(3);
+    ReachabilityScan scan;
+    heap.add(scan);
+    EXPECT_EQ(3u, scan.blockCount());
+    EXPECT_EQ(REACHABILITY_UNKNOWN, scan.classify(heap.block(0)));
+    scan.run(1);
+    for (size_t index = 0; index < heap.count(); index++)
+        EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(index)));
+}
+
+TEST(Reachability, RootsKeepChainsReachable)
+{
+    Heap heap(4);
+    heap.link(0, 1, 1);
+    heap.link(1, 3, 2, 5);      // Interior pointers count.
+    UINT_PTR roots [] = { 42, (UINT_PTR)heap.block(0) + 8, 0 };
+
+    ReachabilityScan scan;
+    heap.add(scan);
+    scan.addRoot(roots, sizeof(roots));
+    scan.run(1);
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify(heap.block(0)));
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify(heap.block(1)));
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify(heap.block(2)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(3)));
+    // Any address within a block classifies the block.
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify((BYTE*)heap.block(2) + 3));
+    EXPECT_EQ(REACHABILITY_UNKNOWN, scan.classify(roots));
+}
+
+TEST(Reachability, BlocksOfLostBlocksAreIndirectlyLost)
+{
+    Heap heap(5);
+    heap.link(0, 0, 1);
+    heap.link(1, 2, 2);
+    heap.link(3, 0, 3);         // Pointing to itself doesn't count.
+    heap.link(4, 1, 4, 16);
+
+    ReachabilityScan scan;
+    heap.add(scan);
+    scan.run(1);
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(0)));
+    EXPECT_EQ(REACHABILITY_INDIRECT, scan.classify(heap.block(1)));
+    EXPECT_EQ(REACHABILITY_INDIRECT, scan.classify(heap.block(2)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(3)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(4)));
+}
+
+TEST(Reachability, LostCyclesAreIndirectlyLost)
+{
+    Heap heap(3);
+    heap.link(0, 0, 1);
+    heap.link(1, 0, 2);
+    heap.link(2, 0, 0);
+
+    ReachabilityScan scan;
+    heap.add(scan);
+    scan.run(4);
+    for (size_t index = 0; index < heap.count(); index++)
+        EXPECT_EQ(REACHABILITY_INDIRECT, scan.classify(heap.block(index)));
+}
+
+TEST(Reachability, PointersPastTheEndDontCount)
+{
+    Heap heap(2);
+    UINT_PTR roots [] = { (UINT_PTR)heap.block(0) + heap.size(), (UINT_PTR)heap.block(1) - 1 };
+
+    ReachabilityScan scan;
+    heap.add(scan);
+    scan.addRoot(roots, sizeof(roots));
+    scan.run(1);
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(0)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(1)));
+}
+
+TEST(Reachability, OnlyAlignedWordsOfRootsAreScanned)
+{
+    Heap heap(2);
+    BYTE roots [4 * sizeof(UINT_PTR)] = {};
+    UINT_PTR aligned = (UINT_PTR)heap.block(0);
+    UINT_PTR unaligned = (UINT_PTR)heap.block(1);
+    memcpy(roots + sizeof(UINT_PTR), &aligned, sizeof(aligned));
+    memcpy(roots + 2 * sizeof(UINT_PTR) + 1, &unaligned, sizeof(unaligned));
+
+    ReachabilityScan scan;
+    heap.add(scan);
+    // The range starts in the middle of a word, which is skipped.
+    scan.addRoot(roots + 1, sizeof(roots) - 1);
+    scan.run(1);
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify(heap.block(0)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(1)));
+}
+
+TEST(Reachability, FreedRangesAreDropped)
+{
+    Heap heap(4);
+    heap.link(0, 0, 1);
+    heap.link(0, 3, 3);
+    heap.link(1, 0, 2);
+    UINT_PTR roots [] = { (UINT_PTR)heap.block(0) };
+
+    ReachabilityScan scan;
+    heap.add(scan);
+    scan.addRoot(roots, sizeof(roots));
+    scan.start(2);
+    // Block 1 was freed, and block 0 shrunk to half its size, after they were
+    // added.
+    scan.dropRange(heap.block(1), (BYTE*)heap.block(1) + heap.size());
+    scan.dropRange(heap.block(0) + 2, (BYTE*)heap.block(0) + heap.size());
+    scan.mark();
+    scan.finish();
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify(heap.block(0)));
+    EXPECT_EQ(REACHABILITY_UNKNOWN, scan.classify(heap.block(0) + 3));
+    EXPECT_EQ(REACHABILITY_REACHABLE, scan.classify(heap.block(1)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(2)));
+    EXPECT_EQ(REACHABILITY_DIRECT, scan.classify(heap.block(3)));
+}
+
+TEST(Reachability, WorkersAgreeWithSingleThread)
+{
+    // Random lists, some of them hanging from roots large enough to be split
+    // into many chunks.
+    const size_t blocks = 20000;
+    Heap heap(blocks, 8);
+    std::vector<UINT_PTR> roots(SCAN_CHUNK_SIZE, 7);
+    std::mt19937 random(1234);
+    for (size_t index = 0; index < blocks; index++) {
+        if (random() % 4 != 0)
+            heap.link(index, random() % 8, random() % blocks, random() % heap.size());
+    }
+    for (size_t index = 0; index < 200; index++)
+        roots[random() % roots.size()] = (UINT_PTR)heap.block(random() % blocks);
+
+    ReachabilityScan single;
+    heap.add(single);
+    single.addRoot(&roots[0], roots.size() * sizeof(UINT_PTR));
+    single.run(1);
+
+    ReachabilityScan parallel;
+    heap.add(parallel);
+    parallel.addRoot(&roots[0], roots.size() * sizeof(UINT_PTR));
+    parallel.run(8);
+
+    size_t counts [4] = {};
+    for (size_t index = 0; index < blocks; index++) {
+        BYTE reachability = single.classify(heap.block(index));
+        ASSERT_EQ(reachability, parallel.classify(heap.block(index))) << index;
+        counts[reachability]++;
+    }
+    EXPECT_EQ(0u, counts[REACHABILITY_UNKNOWN]);
+    EXPECT_LT(0u, counts[REACHABILITY_DIRECT]);
+    EXPECT_LT(0u, counts[REACHABILITY_INDIRECT]);
+    EXPECT_LT(0u, counts[REACHABILITY_REACHABLE]);
+}
+
+// Not a correctness test: measures a scan of 100,000 blocks from 64 MB of
+// roots, most of which don't point into any block, with one thread and with
+// one per processor.
+TEST(ReachabilityBenchmark, Scan)
+{
+    const size_t blocks = 100000;
+    Heap heap(blocks, 8);
+    std::vector<UINT_PTR> roots(64 * 1024 * 1024 / sizeof(UINT_PTR));
+    std::mt19937_64 random(42);
+    for (size_t index = 0; index < roots.size(); index++)
+        roots[index] = random();
+    for (size_t index = 0; index < blocks; index++)
+        heap.link(index, 0, random() % blocks);
+    for (size_t index = 0; index < 1000; index++)
+        roots[random() % roots.size()] = (UINT_PTR)heap.block(random() % blocks);
+
+    std::vector<UINT32> workers(1, 1);
+    UINT32 processors = std::min(std::thread::hardware_concurrency(), (UINT32)SCAN_MAX_WORKERS);
+    if (processors > 1)
+        workers.push_back(processors);
+    for (UINT32 count : workers) {
+        ReachabilityScan scan;
+        heap.add(scan);
+        scan.addRoot(&roots[0], roots.size() * sizeof(UINT_PTR));
+        auto start = std::chrono::steady_clock::now();
+        scan.run(count);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        EXPECT_NE(REACHABILITY_UNKNOWN, scan.classify(heap.block(0)));
+        printf("Scanned %u blocks from %u MB of roots with %u threads in %.2f ms.\n",
+            (unsigned)blocks, (unsigned)(roots.size() * sizeof(UINT_PTR) >> 20), count, elapsed / 1000.0);
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
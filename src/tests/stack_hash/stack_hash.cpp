@@ -0,0 +1,109 @@
+// stack_hash.cpp : Unit tests and a throughput benchmark for the call stack
+// hashes. Only the standard library is used so the tests can run on any
+// platform.
+//
+
+#define VLDBUILD        // The hashes are compiled into this test straight from the VLD sources.
+#include "stackhash.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <vector>
+
+namespace {
+
+const uintptr_t s_frames [] = { 0x00401000, 0x00401234, 0x7C801D7B };
+
+uint32_t LeakHash(const uintptr_t *frames, size_t count)
+{
+    uint32_t hash = STACKHASH_SEED;
+    for (size_t i = 0; i < count; i++)
+        hash = CalculateCRC32(frames[i], hash);
+    return hash;
+}
+
+uint64_t StackHash(const uintptr_t *frames, size_t count)
+{
+    uint64_t hash = STACKHASH64_SEED;
+    for (size_t i = 0; i < count; i++)
+        hash = HashStackFrame(hash, frames[i]);
+    return hash;
+}
+
+} // namespace
+
+#ifndef WIN64
+// The "Leak Hash" printed in reports must stay the same across VLD versions.
+// The expected values were computed with an independent bitwise CRC-32.
+TEST(StackHash, LeakHashIsStable)
+{
+    uint32_t hash = LeakHash(s_frames, 3);
+    EXPECT_EQ(0x70832B68u, hash);
+    EXPECT_EQ(0x11359464u, CalculateCRC32(64, hash));
+}
+#endif
+
+TEST(StackHash, DependsOnEveryFrameAndOrder)
+{
+    const uintptr_t swapped [] = { 0x00401234, 0x00401000, 0x7C801D7B };
+    uint64_t hash = StackHash(s_frames, 3);
+    EXPECT_EQ(hash, StackHash(s_frames, 3));
+    EXPECT_NE(hash, StackHash(swapped, 3));
+    EXPECT_NE(hash, StackHash(s_frames, 2));
+    EXPECT_NE(STACKHASH64_SEED, StackHash(s_frames, 1));
+}
+
+TEST(StackHash, NoCollisionsOnSimilarStacks)
+{
+    // Stacks differing only in the return address inside one caller are the
+    // common case for duplicate detection.
+    std::set<uint64_t> hashes;
+    std::vector<uintptr_t> frames(s_frames, s_frames + 3);
+    for (uintptr_t offset = 0; offset < 100000; offset++) {
+        frames[0] = 0x00401000 + offset;
+        hashes.insert(StackHash(frames.data(), frames.size()));
+    }
+    EXPECT_EQ(100000u, hashes.size());
+}
+
+// Not a correctness test: compares the throughput of the byte-at-a-time CRC
+// that used to be recomputed for every report with the 64-bit hash that is now
+// computed once as the frames are captured.
+TEST(StackHashBenchmark, Throughput)
+{
+    const size_t depth = 32;
+    const int iterations = 200000;
+    std::vector<uintptr_t> frames(depth);
+    for (size_t i = 0; i < depth; i++)
+        frames[i] = 0x00401000 + i * 0x1234;
+
+    uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        frames[0] = i;
+        sink += LeakHash(frames.data(), depth);
+    }
+    auto crc = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        frames[0] = i;
+        sink += StackHash(frames.data(), depth);
+    }
+    auto mix = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_NE(0u, sink);
+    double frames_total = double(depth) * iterations;
+    printf("CRC-32 (Leak Hash): %.2f ns/frame, 64-bit stack hash: %.2f ns/frame\n",
+        crc / frames_total, mix / frames_total);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
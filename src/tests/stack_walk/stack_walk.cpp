@@ -0,0 +1,239 @@
+// stack_walk.cpp : Unit tests and a benchmark for the Linux stack walks: the
+// frame pointer walk of FastCallStack and the .eh_frame unwinder of
+// SafeCallStack. Stacks are captured from a chain of the test's own functions,
+// the way the heap hooks capture them.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The walks are linked into this test straight from the VLD sources.
+#include "callstack.h"
+#include "ehframe.h"
+#include "symbolizer.h"
+
+namespace {
+
+// Stands in for a heap hook: the stack is captured from the frame returning
+// to it.
+__attribute__((noinline)) void Capture(CallStack *callstack, UINT32 maxdepth)
+{
+    CAPTURE_CONTEXT();
+    callstack->getStackTrace(maxdepth, context_);
+    asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) void Level3(CallStack *callstack, UINT32 maxdepth)
+{
+    Capture(callstack, maxdepth);
+    asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) void Level2(CallStack *callstack, UINT32 maxdepth)
+{
+    Level3(callstack, maxdepth);
+    asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) void Level1(CallStack *callstack, UINT32 maxdepth)
+{
+    Level2(callstack, maxdepth);
+    asm volatile("" ::: "memory");
+}
+
+// Captures a stack through the given number of recursive calls.
+__attribute__((noinline)) void Recurse(CallStack *callstack, UINT32 depth, UINT32 maxdepth)
+{
+    if (depth == 0)
+        Capture(callstack, maxdepth);
+    else
+        Recurse(callstack, depth - 1, maxdepth);
+    asm volatile("" ::: "memory");
+}
+
+// The same, with backtrace.
+__attribute__((noinline)) int RecurseAndBacktrace(void **addresses, UINT32 depth, UINT32 maxdepth)
+{
+    int count;
+    if (depth == 0)
+        count = backtrace(addresses, (int)maxdepth);
+    else
+        count = RecurseAndBacktrace(addresses, depth - 1, maxdepth);
+    asm volatile("" ::: "memory");
+    return count;
+}
+
+// Captures a stack from a comparison function called by the C library, which
+// is compiled without frame pointers.
+CallStack *g_sortStack = NULL;
+
+int CompareAndCapture(const void *first, const void *second)
+{
+    if (g_sortStack->getHashValue() == 0)
+        Capture(g_sortStack, 64);
+    return *(const int*)first - *(const int*)second;
+}
+
+__attribute__((noinline)) void SortAndCapture(CallStack *callstack)
+{
+    int values [] = { 5, 3, 9, 1, 7, 2, 8 };
+    g_sortStack = callstack;
+    qsort(values, sizeof(values) / sizeof(values[0]), sizeof(values[0]), CompareAndCapture);
+    asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) std::unique_ptr<CallStack> Walk(BOOL safe, UINT32 maxdepth = 64)
+{
+    std::unique_ptr<CallStack> callstack(CallStack::Create(safe));
+    Level1(callstack.get(), maxdepth);
+    return callstack;
+}
+
+std::string FunctionOf(UINT_PTR frame)
+{
+    symbolinfo_t info;
+    if (!Symbolizer::Get()->resolve(frame, info) || (info.function == NULL))
+        return "";
+    return info.function;
+}
+
+std::vector<UINT_PTR> Frames(const CallStack &callstack, UINT32 count)
+{
+    std::vector<UINT_PTR> frames;
+    for (UINT32 frame = 0; frame < count; frame++)
+        frames.push_back(callstack[frame]);
+    return frames;
+}
+
+} // namespace
+
+TEST(StackWalk, FramePointersStartAtTheHooksCaller)
+{
+    std::unique_ptr<CallStack> callstack = Walk(FALSE);
+    EXPECT_NE(std::string::npos, FunctionOf((*callstack)[0]).find("Level3"));
+    EXPECT_NE(std::string::npos, FunctionOf((*callstack)[1]).find("Level2"));
+    EXPECT_NE(std::string::npos, FunctionOf((*callstack)[2]).find("Level1"));
+    EXPECT_NE(0u, callstack->getHashValue());
+}
+
+TEST(StackWalk, UnwinderStartsAtTheHooksCaller)
+{
+    std::unique_ptr<CallStack> callstack = Walk(TRUE);
+    EXPECT_NE(std::string::npos, FunctionOf((*callstack)[0]).find("Level3"));
+    EXPECT_NE(std::string::npos, FunctionOf((*callstack)[1]).find("Level2"));
+    EXPECT_NE(std::string::npos, FunctionOf((*callstack)[2]).find("Level1"));
+    EXPECT_NE(0u, callstack->getHashValue());
+}
+
+TEST(StackWalk, WalksAgreeOnFramesAndHash)
+{
+    // Down to Walk, every function keeps a frame pointer: both walks find the
+    // same frames, and hash them the same way.
+    std::unique_ptr<CallStack> fast = Walk(FALSE, 4);
+    std::unique_ptr<CallStack> safe = Walk(TRUE, 4);
+    EXPECT_EQ(Frames(*fast, 4), Frames(*safe, 4));
+    EXPECT_TRUE(*fast == *safe);
+    EXPECT_EQ(fast->getHashValue(), safe->getHashValue());
+    EXPECT_EQ(fast->getStackHash(), safe->getStackHash());
+}
+
+TEST(StackWalk, HonorsMaxDepth)
+{
+    for (BOOL safe = FALSE; safe <= TRUE; safe++) {
+        std::unique_ptr<CallStack> callstack(CallStack::Create(safe));
+        Recurse(callstack.get(), 50, 10);
+        for (UINT32 frame = 0; frame < 10; frame++)
+            EXPECT_NE(0u, (*callstack)[frame]);
+        std::unique_ptr<CallStack> deeper(CallStack::Create(safe));
+        Recurse(deeper.get(), 50, 40);
+        EXPECT_EQ(Frames(*callstack, 10), Frames(*deeper, 10));
+    }
+}
+
+TEST(StackWalk, UnwinderFollowsFunctionsWithoutFramePointers)
+{
+    std::unique_ptr<CallStack> callstack(CallStack::Create(TRUE));
+    SortAndCapture(callstack.get());
+    bool found = false;
+    for (UINT32 frame = 0; (frame < 32) && !found; frame++)
+        found = (FunctionOf((*callstack)[frame]).find("SortAndCapture") != std::string::npos);
+    EXPECT_TRUE(found);
+}
+
+TEST(StackWalk, UnwinderReachesTheEndOfTheStack)
+{
+    std::unique_ptr<CallStack> callstack = Walk(TRUE);
+    bool found = false;
+    for (UINT32 frame = 0; (frame < 64) && !found; frame++)
+        found = (FunctionOf((*callstack)[frame]) == "main");
+    EXPECT_TRUE(found);
+}
+
+TEST(StackWalk, UnwinderForgetsTheRulesOfUnloadedModules)
+{
+    typedef int (*pluginfunction_t)(int (*)(int), int);
+    void *plugin = dlopen(STACK_WALK_PLUGIN, RTLD_NOW);
+    ASSERT_NE((void*)NULL, plugin);
+    pluginfunction_t function = (pluginfunction_t)dlsym(plugin, "PluginFunction");
+    ASSERT_NE((void*)NULL, (void*)function);
+    UINT_PTR programcounter = (UINT_PTR)function + 1;
+    cfarule_t rule;
+    EXPECT_TRUE(FindCfaRule(GetCfaCache(), programcounter, rule));
+    dlclose(plugin);
+
+    // The same code, without its rules, is mapped where the plugin was.
+    plugin = dlopen(STACK_WALK_PLUGIN_NOCFI, RTLD_NOW);
+    ASSERT_NE((void*)NULL, plugin);
+    function = (pluginfunction_t)dlsym(plugin, "PluginFunction");
+    if ((UINT_PTR)function + 1 != programcounter) {
+        dlclose(plugin);
+        GTEST_SKIP() << "The plugin was reloaded at another address.";
+    }
+    EXPECT_FALSE(FindCfaRule(GetCfaCache(), programcounter, rule));
+    dlclose(plugin);
+}
+
+// Not a correctness test: measures the cost of each walk, and of backtrace,
+// per frame captured. The stack is deeper than the frames captured.
+TEST(StackWalkBenchmark, NanosecondsPerFrame)
+{
+    const int iterations = 20000;
+    const UINT32 depth = 32;
+    double results [3];
+    for (int walk = 0; walk < 3; walk++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            if (walk < 2) {
+                FastCallStack fast;
+                SafeCallStack safe;
+                CallStack &callstack = (walk == 0) ? (CallStack&)fast : (CallStack&)safe;
+                Recurse(&callstack, 40, depth);
+                ASSERT_NE(0u, callstack[depth - 1]);
+            }
+            else {
+                void *addresses [depth];
+                ASSERT_EQ((int)depth, RecurseAndBacktrace(addresses, 40, depth));
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        results[walk] = (double)elapsed / iterations / depth;
+    }
+    printf("Captured a frame in %.1f ns with frame pointers, %.1f ns with .eh_frame, %.1f ns with backtrace.\n",
+        results[0], results[1], results[2]);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,10 @@
+// stack_walk_plugin.cpp : A module loaded and unloaded by the stack walk
+// tests. It is built twice, with and without call frame information, so that
+// its two builds have the same code at the same addresses, but not the same
+// rules.
+//
+
+extern "C" int PluginFunction(int (*callback)(int), int value)
+{
+    return callback(value * 5) + 2;
+}
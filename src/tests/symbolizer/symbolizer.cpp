@@ -0,0 +1,165 @@
+// symbolizer.cpp : Unit tests and a benchmark for the ELF symbolizer. The test
+// looks up its own functions and lines, and functions of the C library, the
+// way CallStack::resolve looks up the frames of a leak.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The symbolizer is linked into this test straight from the VLD sources.
+#include "elfsymbolizer.h"
+
+namespace {
+
+// Not exported, so only found in .symtab.
+__attribute__((noinline)) int LocalFunction(int value)
+{
+    return value * 3 + 1;
+}
+
+// Returns the address its caller resumes at: a return address, like the
+// frames of a captured call stack.
+__attribute__((noinline)) UINT_PTR CaptureReturnAddress()
+{
+    UINT_PTR address = (UINT_PTR)__builtin_return_address(0);
+    asm volatile("" ::: "memory");
+    return address;
+}
+
+bool EndsWith(const char *text, const char *suffix)
+{
+    size_t length = strlen(text), suffixlength = strlen(suffix);
+    return (length >= suffixlength) && (strcmp(text + length - suffixlength, suffix) == 0);
+}
+
+} // namespace
+
+TEST(Symbolizer, FindsLocalFunctions)
+{
+    symbolinfo_t info;
+    UINT_PTR address = (UINT_PTR)&LocalFunction;
+    ASSERT_TRUE(Symbolizer::Get()->resolve(address, info));
+    ASSERT_NE(nullptr, info.function);
+    EXPECT_NE(nullptr, strstr(info.function, "LocalFunction"));
+    EXPECT_EQ(0u, info.displacement);
+    EXPECT_STREQ("symbolizer_test", info.module);
+
+    ASSERT_TRUE(Symbolizer::Get()->resolve(address + 4, info));
+    ASSERT_NE(nullptr, info.function);
+    EXPECT_NE(nullptr, strstr(info.function, "LocalFunction"));
+    EXPECT_EQ(4u, info.displacement);
+}
+
+TEST(Symbolizer, FindsLinesOfReturnAddresses)
+{
+    UINT_PTR address = CaptureReturnAddress(); const UINT32 line = __LINE__;
+    symbolinfo_t info;
+    ASSERT_TRUE(Symbolizer::Get()->resolve(address, info));
+    ASSERT_NE(nullptr, info.file);
+    EXPECT_TRUE(EndsWith(info.file, "symbolizer.cpp")) << info.file;
+    EXPECT_EQ(line, info.line);
+    ASSERT_NE(nullptr, info.function);
+    EXPECT_NE(nullptr, strstr(info.function, "FindsLinesOfReturnAddresses"));
+}
+
+TEST(Symbolizer, FindsSharedLibraryFunctions)
+{
+    symbolinfo_t info;
+    ASSERT_TRUE(Symbolizer::Get()->resolve((UINT_PTR)&qsort + 1, info));
+    EXPECT_TRUE(EndsWith(info.module, ".so.6") || EndsWith(info.module, ".so")) << info.module;
+    ASSERT_NE(nullptr, info.function);
+    EXPECT_NE(nullptr, strstr(info.function, "qsort"));
+    EXPECT_EQ(1u, info.displacement);
+}
+
+TEST(Symbolizer, RejectsUnmappedAddresses)
+{
+    symbolinfo_t info;
+    EXPECT_FALSE(Symbolizer::Get()->resolve(16, info));
+    EXPECT_EQ(nullptr, info.module);
+    EXPECT_EQ(nullptr, info.function);
+}
+
+TEST(Symbolizer, LoadsEachModuleOnce)
+{
+    ElfSymbolizer symbolizer;
+    symbolinfo_t info;
+    EXPECT_EQ(0u, symbolizer.moduleCount());
+    ASSERT_TRUE(symbolizer.resolve((UINT_PTR)&LocalFunction, info));
+    ASSERT_TRUE(symbolizer.resolve((UINT_PTR)&qsort, info));
+    size_t count = symbolizer.moduleCount();
+    EXPECT_EQ(2u, count);
+    for (int i = 0; i < 100; i++) {
+        symbolizer.resolve((UINT_PTR)&LocalFunction + i, info);
+        symbolizer.resolve((UINT_PTR)&qsort + i, info);
+    }
+    EXPECT_EQ(count, symbolizer.moduleCount());
+
+    symbolizer.flush();
+    EXPECT_EQ(0u, symbolizer.moduleCount());
+    ASSERT_TRUE(symbolizer.resolve((UINT_PTR)&LocalFunction, info));
+    EXPECT_NE(nullptr, strstr(info.function, "LocalFunction"));
+}
+
+TEST(Symbolizer, ConcurrentLookupsAgree)
+{
+    ElfSymbolizer symbolizer;
+    const UINT_PTR addresses [] = { (UINT_PTR)&LocalFunction, (UINT_PTR)&qsort, (UINT_PTR)&printf,
+        (UINT_PTR)&CaptureReturnAddress };
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+    for (int thread = 0; thread < 4; thread++) {
+        threads.emplace_back([&, thread] {
+            for (int i = 0; i < 1000; i++) {
+                symbolinfo_t info;
+                UINT_PTR address = addresses[(thread + i) % 4];
+                if (!symbolizer.resolve(address, info) || (info.function == NULL) || (info.displacement != 0))
+                    failures[thread]++;
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    for (int thread = 0; thread < 4; thread++)
+        EXPECT_EQ(0, failures[thread]);
+}
+
+// Not a correctness test: measures the cost of resolving a frame once its
+// module is loaded, against dladdr, which only finds exported functions.
+TEST(SymbolizerBenchmark, Resolve)
+{
+    const int iterations = 100000;
+    UINT_PTR address = (UINT_PTR)&qsort + 8;
+    symbolinfo_t info;
+    ASSERT_TRUE(Symbolizer::Get()->resolve(address, info));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        Symbolizer::Get()->resolve(address + (i & 7), info);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    Dl_info dlinfo;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        dladdr((void*)(address + (i & 7)), &dlinfo);
+    auto dlelapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    printf("Resolved an address in %.1f ns on average (%.1f ns with dladdr).\n",
+        (double)elapsed / iterations, (double)dlelapsed / iterations);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,642 @@
+// vld_bench.cpp : Allocation benchmarks measuring the overhead VLD adds to
+// every heap call, and how it scales with threads. Each workload runs at 1, 2,
+// 4... up to N threads, and the results are printed as a table and, for
+// regression tracking, as JSON.
+//
+// In engine mode (the default), the workloads drive the tracking engine
+// directly, the way the heap hooks do, with synthetic blocks and call stacks,
+// so they run on every platform. In system mode, they call the real heap, so
+// they measure whatever is hooking it: run the benchmark with
+// LD_PRELOAD=libvld_preload.so, or without it for the baseline.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The engine is linked into this benchmark straight from the VLD sources.
+#include "blocktracker.h"
+
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+namespace {
+
+const size_t   LIVE_WINDOW     = 64;        // Blocks each thread keeps alive while churning.
+const size_t   RING_SIZE       = 1024;      // Blocks in flight between a producer and its consumer.
+const size_t   MAX_GROWTH      = 4096;      // Size, in bytes, at which a growing block is freed.
+const UINT32   DEFAULT_DEPTH   = 8;         // Frames of the call stacks of most workloads.
+const UINT32   DEEP_DEPTH      = 128;       // Frames of the call stacks of deep_stacks.
+const UINT32   SITE_DEPTH      = 16;        // Frames telling apart the call sites of many_sites.
+const UINT_PTR MANY_SITES      = 65536;     // Distinct call sites of many_sites (2 ^ SITE_DEPTH).
+const size_t   DEFAULT_OPS     = 100000;    // Heap calls per thread.
+const size_t   QUICK_OPS       = 5000;      // Heap calls per thread with --quick.
+
+enum benchmode_t { MODE_ENGINE, MODE_SYSTEM };
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Heaps
+//
+//    The workloads allocate through BenchHeap, so that the same workload can
+//    either feed the tracking engine or call the real heap.
+//
+
+class BenchHeap
+{
+public:
+    virtual ~BenchHeap () {}
+    virtual void*  allocate (HANDLE heap, size_t size, UINT_PTR site, UINT32 depth) = 0;
+    virtual void*  reallocate (void *mem, size_t size, UINT_PTR site, UINT32 depth) = 0;
+    virtual void   free (void *mem) = 0;
+    virtual HANDLE createHeap () = 0;
+    virtual void   destroyHeap (HANDLE heap) = 0;
+    virtual bool   hasHeaps () const = 0;
+};
+
+// A call stack made of made-up frames, standing in for a captured one.
+class SyntheticStack : public CallStack
+{
+public:
+    SyntheticStack (UINT_PTR site, UINT32 depth)
+    {
+        for (UINT32 frame = 0; frame < depth; frame++)
+            push_back(0x400000 + site * 0x100 + frame);
+        m_hashValue = (DWORD)site;
+    }
+
+    virtual VOID getStackTrace (UINT32, const context_t&) {}
+};
+
+// Feeds the tracking engine with what the heap hooks would see, without
+// allocating anything: the addresses are made up, and unique to the thread.
+class EngineHeap : public BenchHeap
+{
+public:
+    EngineHeap (BlockTracker &tracker, CriticalSection &lock, UINT_PTR thread)
+        : m_tracker(tracker), m_lock(lock), m_thread(thread), m_serial(0), m_heapSerial(0),
+          m_moves(0), m_threadId((DWORD)(thread + 1)) {}
+
+    virtual void* allocate (HANDLE heap, size_t size, UINT_PTR site, UINT32 depth)
+    {
+        if (heap == NULL)
+            heap = DefaultHeap();
+        void *mem = nextAddress();
+        // Like the hooks, capture the call stack before taking the lock.
+        CallStack *callstack = new SyntheticStack(site, depth);
+        CriticalSectionLocker<> cs(m_lock);
+        blockinfo_t *info = NULL;
+        SIZE_T oldsize;
+        m_tracker.mapBlock(heap, mem, size, 0, m_threadId, info, oldsize);
+        m_tracker.setStack(info, callstack);
+        return mem;
+    }
+
+    // Every other reallocation moves the block, the others grow it in place.
+    virtual void* reallocate (void *mem, size_t size, UINT_PTR site, UINT32 depth)
+    {
+        CallStack *callstack = new SyntheticStack(site, depth);
+        CriticalSectionLocker<> cs(m_lock);
+        blockinfo_t *info = NULL;
+        if (m_moves++ & 1) {
+            void *newmem = nextAddress();
+            SIZE_T oldsize;
+            m_tracker.unmapBlock(DefaultHeap(), mem);
+            m_tracker.mapBlock(DefaultHeap(), newmem, size, 0, m_threadId, info, oldsize);
+            mem = newmem;
+        }
+        else {
+            info = m_tracker.remapBlock(DefaultHeap(), mem, size, 0, m_threadId);
+        }
+        m_tracker.setStack(info, callstack);
+        return mem;
+    }
+
+    virtual void free (void *mem)
+    {
+        m_tracker.unmapBlock(DefaultHeap(), mem);
+    }
+
+    virtual HANDLE createHeap ()
+    {
+        HANDLE heap = (HANDLE)(((m_thread + 1) << 20) + ((m_heapSerial++ & 0xFFFF) << 4));
+        m_tracker.mapHeap(heap);
+        return heap;
+    }
+
+    // Like HeapDestroy, frees the blocks left in the heap.
+    virtual void destroyHeap (HANDLE heap)
+    {
+        m_tracker.unmapHeap(heap);
+    }
+
+    virtual bool hasHeaps () const { return true; }
+
+private:
+    static HANDLE DefaultHeap () { return (HANDLE)1; }
+
+    // Addresses are recycled after 2^20 allocations, long after any workload
+    // freed them.
+    void* nextAddress ()
+    {
+        return (void*)(0x10000000 + (m_thread << 24) + (m_serial++ & 0xFFFFF) * 16);
+    }
+
+    BlockTracker    &m_tracker;
+    CriticalSection &m_lock;
+    UINT_PTR         m_thread;
+    UINT_PTR         m_serial;
+    UINT_PTR         m_heapSerial;
+    UINT_PTR         m_moves;
+    DWORD            m_threadId;
+};
+
+// What to do at the top of a synthetic call stack in system mode.
+struct request_t
+{
+    enum { ALLOCATE, REALLOCATE } kind;
+    HANDLE  heap;
+    void   *mem;
+    size_t  size;
+};
+
+void* CallFrom (UINT_PTR site, UINT32 depth, const request_t &request);
+
+// Two functions calling each other build a distinct call stack for each call
+// site: the bits of the site choose which one calls at each frame. Storing the
+// result through a volatile keeps the compiler from turning the calls into
+// jumps, and the side stored keeps the linker from folding the functions.
+NOINLINE void* CallLeft (UINT_PTR site, UINT32 depth, const request_t &request)
+{
+    volatile int side = 0;
+    void * volatile result = CallFrom(site, depth, request);
+    return (side == 0) ? result : NULL;
+}
+
+NOINLINE void* CallRight (UINT_PTR site, UINT32 depth, const request_t &request)
+{
+    volatile int side = 1;
+    void * volatile result = CallFrom(site, depth, request);
+    return (side == 1) ? result : NULL;
+}
+
+void* CallFrom (UINT_PTR site, UINT32 depth, const request_t &request)
+{
+    if (depth > 0)
+        return (site & 1) ? CallRight(site >> 1, depth - 1, request) : CallLeft(site >> 1, depth - 1, request);
+    if (request.kind == request_t::REALLOCATE)
+        return realloc(request.mem, request.size);
+#if defined(_WIN32)
+    if (request.heap != NULL)
+        return HeapAlloc(request.heap, 0, request.size);
+#endif
+    return malloc(request.size);
+}
+
+// Calls the real heap, from as many call sites and as deep as asked.
+class SystemHeap : public BenchHeap
+{
+public:
+    virtual void* allocate (HANDLE heap, size_t size, UINT_PTR site, UINT32 depth)
+    {
+        request_t request = { request_t::ALLOCATE, heap, NULL, size };
+        return CallFrom(site, depth, request);
+    }
+
+    virtual void* reallocate (void *mem, size_t size, UINT_PTR site, UINT32 depth)
+    {
+        request_t request = { request_t::REALLOCATE, NULL, mem, size };
+        return CallFrom(site, depth, request);
+    }
+
+    virtual void free (void *mem)
+    {
+        ::free(mem);
+    }
+
+#if defined(_WIN32)
+    virtual HANDLE createHeap () { return HeapCreate(0, 0, 0); }
+    virtual void   destroyHeap (HANDLE heap) { HeapDestroy(heap); }
+    virtual bool   hasHeaps () const { return true; }
+#else
+    // There are no private heaps to create elsewhere than on Windows.
+    virtual HANDLE createHeap () { return NULL; }
+    virtual void   destroyHeap (HANDLE) {}
+    virtual bool   hasHeaps () const { return false; }
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Workloads
+//
+//    Each thread of a run makes at least run_t::ops heap calls, and leaves the
+//    blocks it holds alive in worker_t::live, so that the memory VLD uses for
+//    them can be measured. They are freed afterwards, outside of the timing.
+//
+
+// A single-producer, single-consumer queue handing blocks to another thread.
+struct ring_t
+{
+    void                *blocks [RING_SIZE];
+    std::atomic<size_t>  head;      // Next slot the producer fills.
+    std::atomic<size_t>  tail;      // Next slot the consumer frees.
+};
+
+struct worker_t
+{
+    UINT_PTR            thread;
+    BenchHeap          *heap;
+    std::vector<void*>  live;       // Blocks held at the end of the workload.
+    std::vector<size_t> sizes;      // Sizes of the live blocks, for realloc_growth.
+    size_t              ops;        // Heap calls made.
+};
+
+struct run_t
+{
+    benchmode_t         mode;
+    unsigned            threads;
+    size_t              ops;        // Heap calls each thread makes, at least.
+    std::vector<ring_t> rings;      // Blocks sent by thread i to thread i + 1, for cross_thread_free.
+};
+
+// Allocates and frees small blocks, keeping a window of them alive.
+void Churn (worker_t &worker, size_t ops, UINT_PTR sites, UINT32 depth, bool sharedsites)
+{
+    worker.live.assign(LIVE_WINDOW, NULL);
+    for (size_t i = 0; worker.ops < ops; i++) {
+        void *&block = worker.live[i % LIVE_WINDOW];
+        if (block != NULL) {
+            worker.heap->free(block);
+            worker.ops++;
+        }
+        UINT_PTR site = sharedsites ? (i % sites) : (i * 7 + worker.thread) % sites;
+        block = worker.heap->allocate(NULL, 16 + (i * 37) % 241, site, depth);
+        worker.ops++;
+    }
+}
+
+void SmallChurn (run_t &run, worker_t &worker)
+{
+    Churn(worker, run.ops, 16, DEFAULT_DEPTH, false);
+}
+
+void DeepStacks (run_t &run, worker_t &worker)
+{
+    Churn(worker, run.ops, 16, DEEP_DEPTH, false);
+}
+
+// All threads allocate from the same sites, as threads running the same code do.
+void ManySites (run_t &run, worker_t &worker)
+{
+    Churn(worker, run.ops, MANY_SITES, SITE_DEPTH, true);
+}
+
+// Grows blocks by doubling them, up to MAX_GROWTH bytes, then starts over.
+void ReallocGrowth (run_t &run, worker_t &worker)
+{
+    worker.live.assign(LIVE_WINDOW, NULL);
+    std::vector<size_t> &sizes = worker.sizes;
+    sizes.assign(LIVE_WINDOW, 0);
+    for (size_t i = 0; worker.ops < run.ops; i++) {
+        size_t slot = i % LIVE_WINDOW;
+        void *&block = worker.live[slot];
+        if (block == NULL) {
+            sizes[slot] = 16;
+            block = worker.heap->allocate(NULL, sizes[slot], slot % 16, DEFAULT_DEPTH);
+        }
+        else if (sizes[slot] >= MAX_GROWTH) {
+            worker.heap->free(block);
+            block = NULL;
+        }
+        else {
+            sizes[slot] *= 2;
+            block = worker.heap->reallocate(block, sizes[slot], 16 + slot % 16, DEFAULT_DEPTH);
+        }
+        worker.ops++;
+    }
+}
+
+// Each thread allocates blocks for the next thread to free, and frees the
+// blocks of the previous one. A single thread frees its own blocks, a ring
+// later.
+void CrossThreadFree (run_t &run, worker_t &worker)
+{
+    ring_t &out = run.rings[worker.thread];
+    ring_t &in = run.rings[(worker.thread + run.threads - 1) % run.threads];
+    size_t blocks = run.ops / 2;
+    size_t produced = 0;
+    size_t consumed = 0;
+    while ((produced < blocks) || (consumed < blocks)) {
+        bool progress = false;
+        size_t head = out.head.load(std::memory_order_relaxed);
+        while ((produced < blocks) && (head - out.tail.load(std::memory_order_acquire) < RING_SIZE)) {
+            out.blocks[head % RING_SIZE] = worker.heap->allocate(NULL, 16 + (produced * 37) % 241,
+                produced % 16, DEFAULT_DEPTH);
+            out.head.store(++head, std::memory_order_release);
+            produced++;
+            progress = true;
+        }
+        size_t tail = in.tail.load(std::memory_order_relaxed);
+        while ((consumed < blocks) && (tail != in.head.load(std::memory_order_acquire))) {
+            // The slot is only handed back once the block is freed, so that
+            // the producer can't reuse its address while it is still mapped.
+            worker.heap->free(in.blocks[tail % RING_SIZE]);
+            in.tail.store(++tail, std::memory_order_release);
+            consumed++;
+            progress = true;
+        }
+        if (!progress)
+            std::this_thread::yield();
+    }
+    worker.ops += produced + consumed;
+}
+
+// Creates a heap, allocates from it, and destroys it with its blocks.
+void HeapCycles (run_t &run, worker_t &worker)
+{
+    for (size_t cycle = 0; worker.ops < run.ops; cycle++) {
+        HANDLE heap = worker.heap->createHeap();
+        size_t blocks = 16 + cycle % 17;
+        for (size_t i = 0; i < blocks; i++)
+            worker.heap->allocate(heap, 16 + (i * 37) % 241, i % 16, DEFAULT_DEPTH);
+        worker.heap->destroyHeap(heap);
+        worker.ops += blocks + 2;
+    }
+}
+
+struct workload_t
+{
+    const char *name;
+    void      (*run) (run_t &run, worker_t &worker);
+    bool        needsHeaps;     // Creates private heaps.
+};
+
+const workload_t s_workloads [] = {
+    { "small_churn",       SmallChurn,      false },
+    { "realloc_growth",    ReallocGrowth,   false },
+    { "cross_thread_free", CrossThreadFree, false },
+    { "deep_stacks",       DeepStacks,      false },
+    { "many_sites",        ManySites,       false },
+    { "heap_cycles",       HeapCycles,      true  },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Running and reporting
+//
+
+struct result_t
+{
+    const char *workload;
+    unsigned    threads;
+    size_t      ops;
+    double      seconds;
+    size_t      liveBlocks;
+    double      metadataPerBlock;   // Negative if it couldn't be measured.
+};
+
+// Bytes currently allocated from the C runtime's heap, which is VLD's internal
+// heap outside of Windows. Returns 0 where it can't be queried.
+size_t HeapInUse ()
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// Waits until the counter reaches the count.
+void WaitFor (const std::atomic<unsigned> &counter, unsigned count)
+{
+    while (counter.load() < count)
+        std::this_thread::yield();
+}
+
+result_t Run (const workload_t &workload, benchmode_t mode, unsigned threads, size_t ops)
+{
+    run_t run;
+    run.mode = mode;
+    run.threads = threads;
+    run.ops = ops;
+    run.rings = std::vector<ring_t>(threads);
+    for (ring_t &ring : run.rings) {
+        ring.head.store(0);
+        ring.tail.store(0);
+    }
+
+    CriticalSection lock;
+    lock.Initialize();
+    BlockTracker *tracker = (mode == MODE_ENGINE) ? new BlockTracker(lock, false) : NULL;
+
+    std::vector<worker_t> workers (threads);
+    for (unsigned t = 0; t < threads; t++) {
+        workers[t].thread = t;
+        workers[t].ops = 0;
+        if (mode == MODE_ENGINE)
+            workers[t].heap = new EngineHeap(*tracker, lock, t);
+        else
+            workers[t].heap = new SystemHeap;
+        // Reserved up front, so that the heap only grows by VLD's records
+        // while the workload runs.
+        workers[t].live.reserve(LIVE_WINDOW);
+        workers[t].sizes.reserve(LIVE_WINDOW);
+    }
+
+    // The threads start together once they all exist, and hold on to their
+    // blocks until the memory has been measured.
+    std::atomic<unsigned> ready (0), done (0), release (0);
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++) {
+        pool.push_back(std::thread([&, t] () {
+            worker_t &worker = workers[t];
+            ready++;
+            WaitFor(release, 1);
+            workload.run(run, worker);
+            done++;
+            WaitFor(release, 2);
+            for (void *block : worker.live) {
+                if (block != NULL)
+                    worker.heap->free(block);
+            }
+        }));
+    }
+    WaitFor(ready, threads);
+    size_t baseline = HeapInUse();
+    auto start = std::chrono::steady_clock::now();
+    release.store(1);
+    WaitFor(done, threads);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    size_t inuse = HeapInUse();
+    release.store(2);
+    for (std::thread &thread : pool)
+        thread.join();
+
+    result_t result;
+    result.workload = workload.name;
+    result.threads = threads;
+    result.ops = 0;
+    result.liveBlocks = 0;
+    for (worker_t &worker : workers) {
+        result.ops += worker.ops;
+        for (void *block : worker.live)
+            result.liveBlocks += (block != NULL) ? 1 : 0;
+        delete worker.heap;
+    }
+    result.seconds = std::chrono::duration<double>(elapsed).count();
+    // The engine allocates nothing but its own records, so everything the
+    // heap gained while the blocks were alive is VLD's metadata.
+    result.metadataPerBlock = -1;
+    if ((mode == MODE_ENGINE) && (result.liveBlocks > 0) && (baseline > 0) && (inuse >= baseline))
+        result.metadataPerBlock = (double)(inuse - baseline) / result.liveBlocks;
+
+    delete tracker;
+    lock.Delete();
+    return result;
+}
+
+void PrintTable (FILE *out, benchmode_t mode, const std::vector<result_t> &results)
+{
+    fprintf(out, "vld_bench (%s mode)\n\n", (mode == MODE_ENGINE) ? "engine" : "system");
+    fprintf(out, "  %-18s %7s %14s %10s %15s\n", "Workload", "Threads", "ops/s", "ns/op", "Metadata/block");
+    for (const result_t &result : results) {
+        char metadata [32] = "-";
+        if (result.metadataPerBlock >= 0)
+            snprintf(metadata, sizeof(metadata), "%.1f B", result.metadataPerBlock);
+        fprintf(out, "  %-18s %7u %14.0f %10.1f %15s\n", result.workload, result.threads,
+            result.ops / result.seconds, result.seconds * 1e9 * result.threads / result.ops, metadata);
+    }
+}
+
+// Writes the results as JSON. ns_per_op is the time a thread spends per heap
+// call, which stays flat when a workload scales perfectly.
+void PrintJson (FILE *out, benchmode_t mode, const std::vector<result_t> &results)
+{
+    fprintf(out, "{\n  \"benchmark\": \"vld_bench\",\n  \"mode\": \"%s\",\n  \"results\": [",
+        (mode == MODE_ENGINE) ? "engine" : "system");
+    for (size_t i = 0; i < results.size(); i++) {
+        const result_t &result = results[i];
+        fprintf(out, "%s\n    {\"workload\": \"%s\", \"threads\": %u, \"ops\": %zu, \"seconds\": %.6f, "
+            "\"ops_per_sec\": %.0f, \"ns_per_op\": %.2f, \"live_blocks\": %zu, \"metadata_bytes_per_block\": ",
+            (i > 0) ? "," : "", result.workload, result.threads, result.ops, result.seconds,
+            result.ops / result.seconds, result.seconds * 1e9 * result.threads / result.ops, result.liveBlocks);
+        if (result.metadataPerBlock >= 0)
+            fprintf(out, "%.1f}", result.metadataPerBlock);
+        else
+            fprintf(out, "null}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int Usage ()
+{
+    fprintf(stderr,
+        "Usage: vld_bench [options]\n"
+        "  --mode engine|system  Drive VLD's engine directly (default), or call the real heap.\n"
+        "  --threads N           Run at 1, 2, 4... up to N threads (default: one per processor).\n"
+        "  --ops N               Heap calls per thread (default: %zu).\n"
+        "  --workload NAME       Only run this workload. May be repeated.\n"
+        "  --json FILE           Also write the results as JSON to FILE, or to stdout for -.\n"
+        "  --quick               Run %zu heap calls per thread, for smoke tests.\n"
+        "Workloads:", DEFAULT_OPS, QUICK_OPS);
+    for (const workload_t &workload : s_workloads)
+        fprintf(stderr, " %s", workload.name);
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+} // namespace
+
+int main (int argc, char **argv)
+{
+    benchmode_t mode = MODE_ENGINE;
+    unsigned maxthreads = std::thread::hardware_concurrency();
+    size_t ops = DEFAULT_OPS;
+    const char *json = NULL;
+    std::vector<std::string> selected;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasvalue = (i + 1 < argc);
+        if ((arg == "--mode") && hasvalue) {
+            std::string value = argv[++i];
+            if (value == "engine")
+                mode = MODE_ENGINE;
+            else if (value == "system")
+                mode = MODE_SYSTEM;
+            else
+                return Usage();
+        }
+        else if ((arg == "--threads") && hasvalue)
+            maxthreads = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if ((arg == "--ops") && hasvalue)
+            ops = (size_t)strtoull(argv[++i], NULL, 10);
+        else if ((arg == "--workload") && hasvalue)
+            selected.push_back(argv[++i]);
+        else if ((arg == "--json") && hasvalue)
+            json = argv[++i];
+        else if (arg == "--quick")
+            ops = QUICK_OPS;
+        else
+            return Usage();
+    }
+    if (maxthreads == 0)
+        maxthreads = 1;
+    if (ops == 0)
+        return Usage();
+    for (const std::string &name : selected) {
+        bool known = false;
+        for (const workload_t &workload : s_workloads)
+            known = known || (name == workload.name);
+        if (!known)
+            return Usage();
+    }
+
+    SystemHeap systemheap;
+    std::vector<result_t> results;
+    for (const workload_t &workload : s_workloads) {
+        bool wanted = selected.empty();
+        for (const std::string &name : selected)
+            wanted = wanted || (name == workload.name);
+        if (!wanted)
+            continue;
+        if (workload.needsHeaps && (mode == MODE_SYSTEM) && !systemheap.hasHeaps()) {
+            fprintf(stderr, "Skipping %s: this system has no private heaps.\n", workload.name);
+            continue;
+        }
+        for (unsigned threads = 1; ; threads *= 2) {
+            if (threads > maxthreads)
+                threads = maxthreads;
+            results.push_back(Run(workload, mode, threads, ops));
+            if (threads == maxthreads)
+                break;
+        }
+    }
+
+    bool jsonstdout = (json != NULL) && (strcmp(json, "-") == 0);
+    PrintTable(jsonstdout ? stderr : stdout, mode, results);
+    if (json != NULL) {
+        FILE *out = jsonstdout ? stdout : fopen(json, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Can't write %s.\n", json);
+            return 1;
+        }
+        PrintJson(out, mode, results);
+        if (!jsonstdout)
+            fclose(out);
+    }
+    return 0;
+}
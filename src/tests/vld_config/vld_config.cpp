@@ -0,0 +1,191 @@
+// vld_config.cpp : Unit tests and a startup benchmark for the single-pass
+// configuration loader. Only the standard library is used so the tests can run
+// on any platform.
+//
+
+#define VLDBUILD        // The parser is compiled into this test straight from the VLD sources.
+#include "vldconfig.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+vldconfig_t DefaultConfig()
+{
+    vldconfig_t config;
+    InitConfig(config, 256, 64);
+    return config;
+}
+
+size_t Apply(vldconfig_t &config, const std::wstring &text)
+{
+    return ApplyConfigText(config, text.c_str(), text.length());
+}
+
+std::wstring ReadShippedIni()
+{
+    std::ifstream file(VLD_INI_PATH, std::ios::binary);
+    std::stringstream bytes;
+    bytes << file.rdbuf();
+    std::string ascii = bytes.str();
+    return std::wstring(ascii.begin(), ascii.end());
+}
+
+} // namespace
+
+TEST(Config, Defaults)
+{
+    vldconfig_t config = DefaultConfig();
+    EXPECT_TRUE(config.vld);
+    EXPECT_FALSE(config.aggregateDuplicates);
+    EXPECT_TRUE(config.skipCrtStartupLeaks);
+    EXPECT_EQ(256u, config.maxDataDump);
+    EXPECT_EQ(64u, config.maxTraceFrames);
+    EXPECT_EQ(0u, config.leakSuspectWindow);
+    EXPECT_FALSE(config.lifetimeHistograms);
+    EXPECT_FALSE(config.reachabilityScan);
+    EXPECT_FALSE(config.internalStats);
+    EXPECT_STREQ(L"", config.reportFile);
+    EXPECT_STREQ(L"", config.overrideFile);
+    EXPECT_STREQ(L"", config.captureRules);
+}
+
+TEST(Config, ParsesOptionsSection)
+{
+    vldconfig_t config = DefaultConfig();
+    size_t count = Apply(config,
+        L"; comment = ignored\r\n"
+        L"[Other]\r\n"
+        L"SelfTest = yes\r\n"
+        L"  [ options ]  \r\n"
+        L"aggregateduplicates=YES\r\n"
+        L"\tMaxDataDump =  16 \r\n"
+        L"ReportFile = \"C:\\leaks report.txt\"\r\n"
+        L"ReportTo=both\n"
+        L"NoEqualsSign\n"
+        L"; SkipCrtStartupLeaks = no\n"
+        L"StackWalkMethod = safe");
+    EXPECT_EQ(5u, count);
+    EXPECT_TRUE(config.aggregateDuplicates);
+    EXPECT_FALSE(config.selfTest);
+    EXPECT_TRUE(config.skipCrtStartupLeaks);
+    EXPECT_EQ(16u, config.maxDataDump);
+    EXPECT_STREQ(L"C:\\leaks report.txt", config.reportFile);
+    EXPECT_STREQ(L"both", config.reportTo);
+    EXPECT_STREQ(L"safe", config.stackWalkMethod);
+}
+
+TEST(Config, EmptyNumericValueKeepsDefault)
+{
+    vldconfig_t config = DefaultConfig();
+    Apply(config, L"[Options]\nMaxDataDump = \nMaxTraceFrames = abc\n");
+    EXPECT_EQ(256u, config.maxDataDump);
+    EXPECT_EQ(0u, config.maxTraceFrames);
+}
+
+TEST(Config, BooleanValues)
+{
+    const wchar_t *truevalues [] = { L"yes", L"On", L"TRUE", L"1" };
+    const wchar_t *falsevalues [] = { L"no", L"off", L"false", L"0", L"", L"2" };
+    for (const wchar_t *value : truevalues)
+        EXPECT_TRUE(ConfigStrToBool(value, wcslen(value))) << value;
+    for (const wchar_t *value : falsevalues)
+        EXPECT_FALSE(ConfigStrToBool(value, wcslen(value))) << value;
+}
+
+TEST(Config, StringsAreTruncated)
+{
+    vldconfig_t config = DefaultConfig();
+    std::wstring longvalue(VLD_CONFIG_MAX_VALUE * 2, L'x');
+    Apply(config, L"[Options]\nReportTo = " + longvalue + L"\n");
+    EXPECT_EQ(size_t(VLD_CONFIG_MAX_VALUE - 1), wcslen(config.reportTo));
+}
+
+TEST(Config, LayersOverridePreviousValues)
+{
+    vldconfig_t config = DefaultConfig();
+    Apply(config, L"[Options]\nSelfTest = yes\nMaxTraceFrames = 10\nOverrideFile = local.ini\n");
+    EXPECT_STREQ(L"local.ini", config.overrideFile);
+
+    config.overrideFile[0] = L'\0';
+    Apply(config, L"[Options]\nMaxTraceFrames = 20\n");
+    EXPECT_TRUE(config.selfTest);
+    EXPECT_EQ(20u, config.maxTraceFrames);
+    EXPECT_STREQ(L"", config.overrideFile);
+}
+
+TEST(Config, EnvironmentBlock)
+{
+    vldconfig_t config = DefaultConfig();
+    const wchar_t environment [] =
+        L"=C:=C:\\work\0"
+        L"PATH=C:\\Windows\0"
+        L"VLD=off\0"
+        L"vldMaxDataDump=8\0"
+        L"VldReportTo=\0"
+        L"VldUnknownOption=1\0"
+        L"VldSkipCrtStartupLeaks=no\0";
+    EXPECT_EQ(3u, ApplyConfigEnvironment(config, environment));
+    EXPECT_FALSE(config.vld);
+    EXPECT_EQ(8u, config.maxDataDump);
+    EXPECT_STREQ(L"", config.reportTo);
+    EXPECT_FALSE(config.skipCrtStartupLeaks);
+}
+
+TEST(Config, ShippedIniMatchesDefaults)
+{
+    std::wstring text = ReadShippedIni();
+    ASSERT_FALSE(text.empty());
+
+    vldconfig_t config = DefaultConfig();
+    EXPECT_EQ(22u, Apply(config, text));
+    EXPECT_TRUE(config.vld);
+    EXPECT_FALSE(config.aggregateDuplicates);
+    EXPECT_FALSE(config.selfTest);
+    EXPECT_TRUE(config.skipCrtStartupLeaks);
+    EXPECT_EQ(256u, config.maxDataDump);
+    EXPECT_EQ(64u, config.maxTraceFrames);
+    EXPECT_EQ(0u, config.leakSuspectWindow);
+    EXPECT_FALSE(config.lifetimeHistograms);
+    EXPECT_FALSE(config.reachabilityScan);
+    EXPECT_FALSE(config.internalStats);
+    EXPECT_STREQ(L"debugger", config.reportTo);
+    EXPECT_STREQ(L"ascii", config.reportEncoding);
+    EXPECT_STREQ(L"fast", config.stackWalkMethod);
+    EXPECT_STREQ(L"", config.crtStartupFunctions);
+    EXPECT_STREQ(L"", config.internalSourceFiles);
+    EXPECT_STREQ(L"", config.captureRules);
+}
+
+// Not a correctness test: measures the cost of loading the shipped vld.ini,
+// which every process using VLD pays while blocked in DLL initialization.
+TEST(ConfigBenchmark, ParseShippedIni)
+{
+    std::wstring text = ReadShippedIni();
+    ASSERT_FALSE(text.empty());
+
+    const int iterations = 10000;
+    vldconfig_t config;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        InitConfig(config, 256, 64);
+        Apply(config, text);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    EXPECT_EQ(64u, config.maxTraceFrames);
+    printf("Parsed vld.ini (%u characters) in %.2f us on average.\n",
+        (unsigned)text.length(), elapsed / 1000.0 / iterations);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,528 @@
+// vld_core.cpp : Unit tests and a benchmark for the tracking engine. The
+// engine is driven with synthetic heaps, blocks and call stacks from several
+// threads at once, the way the heap hooks drive it, so the tests can run on
+// any platform.
+//
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Included last: the VLD headers redefine operator new for VLD's own code.
+#define VLDBUILD        // The engine is linked into this test straight from the VLD sources.
+#include "blocktracker.h"
+
+namespace {
+
+// A call stack made of made-up frames, standing in for a captured one.
+class SyntheticStack : public CallStack
+{
+public:
+    explicit SyntheticStack (UINT_PTR site, UINT32 depth = 8)
+    {
+        for (UINT32 frame = 0; frame < depth; frame++)
+            push_back(0x400000 + site * 0x100 + frame);
+        m_hashValue = (DWORD)site;
+    }
+
+    virtual VOID getStackTrace (UINT32, const context_t&) {}
+};
+
+// A heap handle and addresses as a heap would return them.
+HANDLE Heap(UINT_PTR index)
+{
+    return reinterpret_cast<HANDLE>(0x1000 + index * 0x10);
+}
+
+LPCVOID Address(UINT_PTR thread, UINT_PTR index)
+{
+    return reinterpret_cast<LPCVOID>(0x10000000 + (thread << 24) + index * 16);
+}
+
+// Allocates a block from a site, the way CaptureContext does.
+blockinfo_t* Allocate(BlockTracker &tracker, CriticalSection &lock, HANDLE heap, LPCVOID mem, SIZE_T size,
+    UINT_PTR site, DWORD threadId = 1)
+{
+    CriticalSectionLocker<> cs(lock);
+    blockinfo_t* info = NULL;
+    SIZE_T oldsize;
+    tracker.mapBlock(heap, mem, size, 0, threadId, info, oldsize);
+    tracker.setStack(info, new SyntheticStack(site));
+    return info;
+}
+
+SIZE_T CountLeaks(BlockTracker &tracker, HANDLE heap = NULL, DWORD threadId = (DWORD)-1, bool aggregate = false)
+{
+    LeakSnapshot snapshot;
+    tracker.takeSnapshot(snapshot, heap, threadId, 0, NULL, NULL);
+    SIZE_T count = BlockTracker::countLeaks(snapshot, aggregate, false);
+    tracker.releaseSnapshot(snapshot);
+    return count;
+}
+
+struct Fixture : public ::testing::Test
+{
+    Fixture () { lock.Initialize(); tracker = new BlockTracker(lock, false); }
+    ~Fixture () { delete tracker; lock.Delete(); }
+
+    CriticalSection lock;
+    BlockTracker   *tracker;
+};
+
+typedef Fixture Tracker;
+typedef Fixture TrackerBenchmark;
+
+} // namespace
+
+TEST_F(Tracker, MapAndUnmap)
+{
+    Allocate(*tracker, lock, Heap(0), Address(0, 0), 100, 1);
+    Allocate(*tracker, lock, Heap(0), Address(0, 1), 50, 2);
+    Allocate(*tracker, lock, Heap(1), Address(0, 2), 10, 1);
+    EXPECT_EQ(160u, tracker->curAlloc());
+    EXPECT_EQ(4u, tracker->requestCurr());
+    EXPECT_EQ(2u, tracker->stackTable()->size());
+    EXPECT_EQ(3u, CountLeaks(*tracker));
+    EXPECT_EQ(2u, CountLeaks(*tracker, Heap(0)));
+
+    EXPECT_FALSE(tracker->unmapBlock(Heap(1), Address(0, 0)));  // Wrong heap.
+    EXPECT_FALSE(tracker->unmapBlock(Heap(0), Address(1, 0)));  // Never mapped.
+    EXPECT_TRUE(tracker->unmapBlock(Heap(0), Address(0, 0)));
+    EXPECT_FALSE(tracker->unmapBlock(Heap(0), Address(0, 0)));
+    EXPECT_EQ(60u, tracker->curAlloc());
+    EXPECT_EQ(160u, tracker->maxAlloc());
+    EXPECT_EQ(160u, tracker->totalAlloc());
+
+    HANDLE heap;
+    EXPECT_EQ(NULL, tracker->findBlock(Address(0, 0), heap));
+    EXPECT_NE((blockinfo_t*)NULL, tracker->findBlock(Address(0, 2), heap));
+    EXPECT_EQ(Heap(1), heap);
+
+    tracker->unmapHeap(Heap(1));
+    EXPECT_EQ(50u, tracker->curAlloc());
+    EXPECT_EQ(1u, CountLeaks(*tracker));
+    EXPECT_EQ(1u, tracker->stackTable()->size());
+}
+
+TEST_F(Tracker, RetiredStacksAreNotShared)
+{
+    blockinfo_t* info = Allocate(*tracker, lock, Heap(0), Address(0, 0), 100, 1);
+    {
+        CriticalSectionLocker<> cs(lock);
+        tracker->stackTable()->retire(info->stackId);
+    }
+    Allocate(*tracker, lock, Heap(0), Address(0, 1), 100, 1);
+    Allocate(*tracker, lock, Heap(0), Address(0, 2), 100, 1);
+    EXPECT_EQ(2u, tracker->stackTable()->size());
+
+    tracker->unmapBlock(Heap(0), Address(0, 0));
+    EXPECT_EQ(1u, tracker->stackTable()->size());
+    tracker->unmapBlock(Heap(0), Address(0, 1));
+    tracker->unmapBlock(Heap(0), Address(0, 2));
+    EXPECT_EQ(0u, tracker->stackTable()->size());
+}
+
+TEST_F(Tracker, DuplicatesAreReplaced)
+{
+    Allocate(*tracker, lock, Heap(0), Address(0, 0), 100, 1);
+
+    CriticalSectionLocker<> cs(lock);
+    blockinfo_t* info;
+    SIZE_T oldsize = 0;
+    EXPECT_FALSE(tracker->mapBlock(Heap(0), Address(0, 0), 30, 0, 1, info, oldsize));
+    EXPECT_EQ(100u, oldsize);
+    tracker->setStack(info, new SyntheticStack(1));
+    EXPECT_EQ(30u, tracker->curAlloc());
+
+    EXPECT_TRUE(tracker->mapHeap(Heap(1)));
+    EXPECT_FALSE(tracker->mapHeap(Heap(0)));
+    EXPECT_EQ(0u, tracker->curAlloc());
+    EXPECT_EQ(0u, CountLeaks(*tracker));
+}
+
+TEST_F(Tracker, RemapInPlaceMovesToThread)
+{
+    Allocate(*tracker, lock, Heap(0), Address(0, 0), 100, 1, 1);
+    Allocate(*tracker, lock, Heap(0), Address(0, 1), 100, 1, 1);
+    {
+        CriticalSectionLocker<> cs(lock);
+        blockinfo_t* info = tracker->remapBlock(Heap(0), Address(0, 0), 300, 0, 2);
+        ASSERT_NE((blockinfo_t*)NULL, info);
+        EXPECT_EQ(0u, info->stackId);
+        tracker->setStack(info, new SyntheticStack(3));
+        EXPECT_EQ(400u, tracker->curAlloc());
+
+        // Remapping a block that was never mapped maps it.
+        info = tracker->remapBlock(Heap(2), Address(0, 2), 10, 0, 2);
+        tracker->setStack(info, new SyntheticStack(3));
+    }
+    EXPECT_EQ(1u, CountLeaks(*tracker, NULL, 1));
+    EXPECT_EQ(2u, CountLeaks(*tracker, NULL, 2));
+    EXPECT_EQ(0u, CountLeaks(*tracker, NULL, 3));
+}
+
+TEST_F(Tracker, DetachedBlocksAreAttachedOrReleased)
+{
+    Allocate(*tracker, lock, Heap(0), Address(0, 0), 100, 1, 1);
+    Allocate(*tracker, lock, Heap(0), Address(0, 1), 100, 2, 1);
+
+    // While detached, the address can be mapped by another thread.
+    detachedblock_t detached;
+    EXPECT_FALSE(tracker->detachBlock(Heap(1), Address(0, 0), detached));
+    EXPECT_EQ(NULL, detached.address);
+    ASSERT_TRUE(tracker->detachBlock(Heap(0), Address(0, 0), detached));
+    HANDLE heap;
+    EXPECT_EQ(NULL, tracker->findBlock(Address(0, 0), heap));
+    EXPECT_EQ(100u, tracker->curAlloc());
+    EXPECT_EQ(1u, CountLeaks(*tracker));
+
+    // A failed reallocation leaves the block as it was.
+    {
+        CriticalSectionLocker<> cs(lock);
+        blockinfo_t* info = tracker->attachBlock(detached, detached.info.size, detached.info.threadId, true);
+        EXPECT_EQ(1u, (SIZE_T)info->serialNumber);
+        EXPECT_NE(0u, info->stackId);
+    }
+    EXPECT_EQ(NULL, detached.address);
+    EXPECT_EQ(200u, tracker->curAlloc());
+    EXPECT_EQ(2u, tracker->stackTable()->size());
+
+    // An in-place reallocation by another thread keeps the serial number.
+    ASSERT_TRUE(tracker->detachBlock(Heap(0), Address(0, 0), detached));
+    {
+        CriticalSectionLocker<> cs(lock);
+        blockinfo_t* info = tracker->attachBlock(detached, 300, 2, false);
+        EXPECT_EQ(1u, (SIZE_T)info->serialNumber);
+        EXPECT_EQ(0u, info->stackId);
+        tracker->setStack(info, new SyntheticStack(3));
+    }
+    EXPECT_EQ(400u, tracker->curAlloc());
+    EXPECT_EQ(1u, CountLeaks(*tracker, NULL, 2));
+    EXPECT_EQ(2u, tracker->stackTable()->size());
+
+    // A moved block's record is released, along with its call stack.
+    ASSERT_TRUE(tracker->detachBlock(Heap(0), Address(0, 0), detached));
+    {
+        CriticalSectionLocker<> cs(lock);
+        tracker->releaseDetached(detached);
+    }
+    EXPECT_EQ(100u, tracker->curAlloc());
+    EXPECT_EQ(1u, CountLeaks(*tracker));
+    EXPECT_EQ(1u, tracker->stackTable()->size());
+}
+
+TEST_F(Tracker, MarkedBlocksAreNotReported)
+{
+    Allocate(*tracker, lock, Heap(0), Address(0, 0), 8, 1, 1);
+    Allocate(*tracker, lock, Heap(0), Address(0, 1), 8, 1, 2);
+    tracker->markThreadReported(1);
+    EXPECT_EQ(1u, CountLeaks(*tracker));
+    Allocate(*tracker, lock, Heap(0), Address(0, 2), 8, 1, 1);
+    EXPECT_EQ(2u, CountLeaks(*tracker));
+
+    // A block marked by its thread stays marked when another thread takes it.
+    {
+        CriticalSectionLocker<> cs(lock);
+        blockinfo_t* info = tracker->remapBlock(Heap(0), Address(0, 0), 16, 0, 2);
+        tracker->setStack(info, new SyntheticStack(1));
+    }
+    EXPECT_EQ(2u, CountLeaks(*tracker));
+
+    // A block its thread didn't mark stays unmarked when a thread which has
+    // marked its own blocks since takes it, in place or after detaching it.
+    Allocate(*tracker, lock, Heap(0), Address(0, 4), 8, 1, 3);
+    Allocate(*tracker, lock, Heap(0), Address(0, 5), 8, 1, 3);
+    tracker->markThreadReported(2);
+    EXPECT_EQ(3u, CountLeaks(*tracker));
+    {
+        CriticalSectionLocker<> cs(lock);
+        blockinfo_t* info = tracker->remapBlock(Heap(0), Address(0, 4), 16, 0, 2);
+        tracker->setStack(info, new SyntheticStack(1));
+    }
+    EXPECT_EQ(3u, CountLeaks(*tracker));
+    detachedblock_t detached;
+    ASSERT_TRUE(tracker->detachBlock(Heap(0), Address(0, 5), detached));
+    {
+        CriticalSectionLocker<> cs(lock);
+        tracker->attachBlock(detached, 16, 2, true);
+    }
+    EXPECT_EQ(3u, CountLeaks(*tracker));
+
+    tracker->markAllReported();
+    EXPECT_EQ(0u, CountLeaks(*tracker));
+    Allocate(*tracker, lock, Heap(0), Address(0, 3), 8, 1, 1);
+    EXPECT_EQ(1u, CountLeaks(*tracker));
+}
+
+TEST_F(Tracker, SnapshotCallbackAndAggregation)
+{
+    static BYTE data [4][32];
+    for (UINT_PTR index = 0; index < 4; index++) {
+        memset(data[index], (int)index, sizeof(data[index]));
+        Allocate(*tracker, lock, Heap(0), data[index], sizeof(data[index]), (index < 3) ? 1 : 2);
+    }
+
+    struct Skip {
+        static bool First (leakentry_t &leak, blockinfo_t*, void *context)
+        {
+            if (leak.address == context)
+                return false;
+            leak.size -= 8;
+            return true;
+        }
+    };
+
+    LeakSnapshot snapshot;
+    tracker->takeSnapshot(snapshot, NULL, (DWORD)-1, 16, Skip::First, data[0]);
+    ASSERT_EQ(3u, snapshot.size());
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        EXPECT_EQ(24u, leakit->size);
+        ASSERT_EQ(16u, leakit->dataSize);
+        EXPECT_EQ(0, memcmp(leakit->data, leakit->address, 16));
+        EXPECT_NE(0u, leakit->leakHash);
+    }
+
+    // Blocks freed after the snapshot was taken are still reported.
+    for (UINT_PTR index = 0; index < 4; index++)
+        tracker->unmapBlock(Heap(0), data[index]);
+    EXPECT_EQ(2u, tracker->stackTable()->size());
+    EXPECT_EQ(3u, BlockTracker::countLeaks(snapshot, true, false));
+    EXPECT_EQ(2u, snapshot[0].count + snapshot[1].count);   // Two leaks from site 1...
+    EXPECT_EQ(1u, snapshot[2].count);                       // ...and one from site 2.
+    tracker->releaseSnapshot(snapshot);
+    EXPECT_TRUE(snapshot.empty());
+    EXPECT_EQ(0u, tracker->stackTable()->size());
+}
+
+TEST_F(Tracker, SnapshotsSpanSeveralBatches)
+{
+    const UINT_PTR blocks = 1000;
+    for (UINT_PTR index = 0; index < blocks; index++)
+        Allocate(*tracker, lock, Heap(index % 2), Address(0, blocks - index), 8, 1);
+
+    // Ordered by heap, then by address.
+    LeakSnapshot snapshot;
+    tracker->takeSnapshot(snapshot, NULL, (DWORD)-1, 0, NULL, NULL);
+    ASSERT_EQ(blocks, snapshot.size());
+    for (UINT_PTR index = 1; index < blocks; index++) {
+        if (index != blocks / 2) {
+            EXPECT_LT(snapshot[index - 1].address, snapshot[index].address) << index;
+        }
+    }
+    tracker->releaseSnapshot(snapshot);
+    EXPECT_EQ(blocks / 2, CountLeaks(*tracker, Heap(1)));
+}
+
+TEST_F(Tracker, SnapshotsLetOtherThreadsAllocate)
+{
+    const UINT_PTR blocks = 200000;
+    for (UINT_PTR index = 0; index < blocks; index++)
+        Allocate(*tracker, lock, Heap(0), Address(0, index), 8, 1);
+
+    // The lock is released between batches, so a thread keeps allocating
+    // while a large snapshot is taken: the allocations counted when the first
+    // and the last blocks are copied differ. The snapshot is retried, should
+    // the thread not be scheduled in time.
+    struct Progress {
+        static bool Count (leakentry_t &leak, blockinfo_t*, void *context)
+        {
+            Progress *progress = (Progress*)context;
+            if (leak.address == Address(0, 0))
+                progress->first = progress->allocated;
+            progress->last = progress->allocated;
+            return true;
+        }
+
+        std::atomic<UINT_PTR> allocated;
+        UINT_PTR first;
+        UINT_PTR last;
+    };
+
+    bool progressed = false;
+    for (int attempt = 0; (attempt < 5) && !progressed; attempt++) {
+        Progress progress;
+        progress.allocated = 0;
+        std::atomic<bool> stop(false);
+        std::thread allocator([&] () {
+            while (!stop) {
+                Allocate(*tracker, lock, Heap(1), Address(1, 0), 8, 2);
+                tracker->unmapBlock(Heap(1), Address(1, 0));
+                progress.allocated++;
+            }
+        });
+
+        LeakSnapshot snapshot;
+        tracker->takeSnapshot(snapshot, Heap(0), (DWORD)-1, 0, Progress::Count, &progress);
+        progressed = (progress.last != progress.first);
+        stop = true;
+        allocator.join();
+        EXPECT_EQ(blocks, snapshot.size());
+        tracker->releaseSnapshot(snapshot);
+    }
+    EXPECT_TRUE(progressed);
+}
+
+TEST_F(Tracker, ClassifyLeaks)
+{
+    // Each block starts with a header, like debug CRT blocks, pointing to the
+    // previous block. Only the data past it is scanned.
+    static UINT_PTR blocks [5][4];
+    for (UINT_PTR index = 0; index < 5; index++) {
+        blocks[index][0] = (index > 0) ? (UINT_PTR)&blocks[index - 1][1] : 0;
+        Allocate(*tracker, lock, Heap(index % 2), blocks[index], sizeof(blocks[index]), 1);
+    }
+    blocks[0][1] = (UINT_PTR)&blocks[1][2];     // Reachable from the root.
+    blocks[2][3] = (UINT_PTR)&blocks[3][1];     // Lost, and so is block 3.
+
+    struct Header {
+        static bool Skip (leakentry_t &leak, blockinfo_t*, void*)
+        {
+            leak.address = (const UINT_PTR*)leak.address + 1;
+            leak.size -= sizeof(UINT_PTR);
+            return true;
+        }
+    };
+
+    UINT_PTR roots [] = { 0, (UINT_PTR)&blocks[0][1] };
+    ReachabilityScan scan;
+    scan.addRoot(roots, sizeof(roots));
+    LeakSnapshot snapshot;
+    tracker->takeSnapshot(snapshot, NULL, (DWORD)-1, 0, Header::Skip, NULL);
+    SIZE_T reachablebytes = 0;
+    EXPECT_EQ(2u, tracker->classifyLeaks(snapshot, scan, 2, Header::Skip, NULL, reachablebytes));
+    EXPECT_EQ(2 * 3 * sizeof(UINT_PTR), reachablebytes);
+    EXPECT_EQ(5u, scan.blockCount());
+
+    BYTE expected [] = { REACHABILITY_REACHABLE, REACHABILITY_REACHABLE, REACHABILITY_DIRECT,
+        REACHABILITY_INDIRECT, REACHABILITY_DIRECT };
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        UINT_PTR index = ((const UINT_PTR*)leakit->address - &blocks[0][0]) / 4;
+        EXPECT_EQ(expected[index], leakit->reachability) << index;
+    }
+
+    // Lost leaks are only aggregated with leaks lost the same way.
+    EXPECT_EQ(3u, BlockTracker::countLeaks(snapshot, true, false));
+    SIZE_T headings = 0;
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        if (leakit->count != 0)
+            headings++;
+        if (leakit->reachability == REACHABILITY_REACHABLE) {
+            EXPECT_EQ(0u, leakit->count);
+        }
+    }
+    EXPECT_EQ(2u, headings);
+    tracker->releaseSnapshot(snapshot);
+}
+
+TEST_F(Tracker, LifetimesAreRecorded)
+{
+    BlockTracker lifetimes(lock, true);
+    Allocate(lifetimes, lock, Heap(0), Address(0, 0), 8, 1);
+    Allocate(lifetimes, lock, Heap(0), Address(0, 1), 8, 1);
+    Allocate(lifetimes, lock, Heap(0), Address(0, 2), 8, 2);
+    EXPECT_TRUE(lifetimes.unmapBlock(Heap(0), Address(0, 0)));
+    lifetimes.unmapHeap(Heap(0));
+
+    // The sites stay in the table, since their histograms refer to them.
+    EXPECT_EQ(2u, lifetimes.stackTable()->size());
+    UINT64 frees = 0;
+    for (lifetimehist_t* hist = lifetimes.stackTable()->lifetimes(); hist != NULL; hist = hist->next) {
+        lifetimecounts_t counts;
+        ReadLifetimeHistogram(*hist, counts);
+        frees += counts.frees;
+    }
+    EXPECT_EQ(3u, frees);
+}
+
+TEST_F(Tracker, CapturesCallStacks)
+{
+    CAPTURE_CONTEXT();
+    CallStack* callstack = CallStack::Create(FALSE);
+    callstack->getStackTrace(32, context_);
+    EXPECT_NE(0u, callstack->getHashValue());
+
+    CriticalSectionLocker<> cs(lock);
+    blockinfo_t* info;
+    SIZE_T oldsize;
+    tracker->mapBlock(Heap(0), Address(0, 0), 8, 0, GetCurrentThreadId(), info, oldsize);
+    tracker->setStack(info, callstack);
+    CallStack* stored = tracker->stackTable()->get(info->stackId);
+    ASSERT_EQ(callstack, stored);
+    stored->resolve(FALSE, FALSE);
+    ASSERT_NE((const WCHAR*)NULL, stored->getResolvedCallstack(FALSE, FALSE));
+    EXPECT_NE(0u, wcslen(stored->getResolvedCallstack(FALSE, FALSE)));
+}
+
+TEST_F(Tracker, ConcurrentWorkload)
+{
+    // Each thread allocates, reallocates and frees its own blocks, from a
+    // heap shared by all threads, while leaking one block in ten.
+    const UINT_PTR threads = 4;
+    const UINT_PTR blocks = 20000;
+    std::vector<std::thread> workers;
+    for (UINT_PTR thread = 0; thread < threads; thread++) {
+        workers.push_back(std::thread([&, thread] () {
+            DWORD threadId = (DWORD)(thread + 1);
+            for (UINT_PTR index = 0; index < blocks; index++) {
+                LPCVOID mem = Address(thread, index);
+                Allocate(*tracker, lock, Heap(0), mem, 16, index % 7, threadId);
+                if (index % 2 == 0) {
+                    CriticalSectionLocker<> cs(lock);
+                    blockinfo_t* info = tracker->remapBlock(Heap(0), mem, 32, 0, threadId);
+                    tracker->setStack(info, new SyntheticStack(index % 5));
+                }
+                if (index % 10 != 0) {
+                    EXPECT_TRUE(tracker->unmapBlock(Heap(0), mem));
+                }
+            }
+        }));
+    }
+    for (size_t index = 0; index < workers.size(); index++)
+        workers[index].join();
+
+    SIZE_T leaks = threads * blocks / 10;
+    EXPECT_EQ(leaks, CountLeaks(*tracker));
+    EXPECT_EQ(blocks / 10, CountLeaks(*tracker, NULL, 2));
+    EXPECT_EQ(threads * blocks + 1, tracker->requestCurr());
+    // Every leaked block was reallocated, from site 0, since its index is even.
+    EXPECT_EQ(leaks * 32, tracker->curAlloc());
+    EXPECT_EQ(1u, tracker->stackTable()->size());
+}
+
+// Not a correctness test: measures the cost of tracking an allocation and its
+// free, which every allocation of the process pays while VLD is loaded.
+TEST_F(TrackerBenchmark, MapAndUnmap)
+{
+    const UINT_PTR blocks = 200000;
+    const unsigned counts [] = { 1, 4 };
+    for (unsigned threads : counts) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (UINT_PTR thread = 0; thread < threads; thread++) {
+            workers.push_back(std::thread([&, thread] () {
+                DWORD threadId = (DWORD)(thread + 1);
+                for (UINT_PTR index = 0; index < blocks; index++) {
+                    LPCVOID mem = Address(thread, index % 1024);
+                    Allocate(*tracker, lock, Heap(thread), mem, 64, index % 16, threadId);
+                    tracker->unmapBlock(Heap(thread), mem);
+                }
+            }));
+        }
+        for (size_t index = 0; index < workers.size(); index++)
+            workers[index].join();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(0u, tracker->curAlloc());
+        printf("Tracked an allocation and its free in %.1f ns on average (%u threads).\n",
+            (double)elapsed / (blocks * threads), threads);
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
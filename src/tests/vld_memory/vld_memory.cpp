@@ -0,0 +1,81 @@
+// vld_memory.cpp : Measures how much memory VLD spends tracking each live
+// block. Not a correctness test as such: the figure is printed so that changes
+// to the block records can be compared.
+//
+
+#include <Windows.h>
+#include <psapi.h>
+#include <stdio.h>
+
+// This hooks vld into this app
+#include "vld.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kBlocks = 100000;
+const HANDLE kNoHeap = NULL;
+
+SIZE_T PrivateUsage()
+{
+    PROCESS_MEMORY_COUNTERS_EX counters = { sizeof(counters) };
+    GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters));
+    return counters.PrivateUsage;
+}
+
+// Allocates kBlocks small blocks from a private heap, all from the same call
+// site, and returns how much the private usage of the process grew.
+SIZE_T AllocateBlocks(HANDLE heap, void **blocks)
+{
+    SIZE_T before = PrivateUsage();
+    for (int i = 0; i < kBlocks; i++) {
+        blocks[i] = HeapAlloc(heap, 0, 16);
+    }
+    return PrivateUsage() - before;
+}
+
+void FreeBlocks(HANDLE heap, void **blocks)
+{
+    for (int i = 0; i < kBlocks; i++) {
+        HeapFree(heap, 0, blocks[i]);
+    }
+}
+
+} // namespace
+
+TEST(Memory, BytesPerTrackedBlock)
+{
+    void **blocks = new void* [kBlocks];
+    HANDLE heap = HeapCreate(0, 0, 0);
+    ASSERT_NE(kNoHeap, heap);
+
+    // Warm up the heap so that both runs start from the same committed size.
+    VLDDisable();
+    AllocateBlocks(heap, blocks);
+    FreeBlocks(heap, blocks);
+    SIZE_T untracked = AllocateBlocks(heap, blocks);
+    FreeBlocks(heap, blocks);
+    VLDEnable();
+
+    VLDMarkAllLeaksAsReported();
+    UINT leaks = VLDGetLeaksCount();
+    SIZE_T tracked = AllocateBlocks(heap, blocks);
+    EXPECT_EQ(leaks + kBlocks, VLDGetLeaksCount());
+    FreeBlocks(heap, blocks);
+    EXPECT_EQ(leaks, VLDGetLeaksCount());
+
+    HeapDestroy(heap);
+    delete [] blocks;
+
+    SIZE_T overhead = (tracked > untracked) ? tracked - untracked : 0;
+    printf("Tracked %d blocks with %.1f bytes of metadata per block.\n",
+        kBlocks, (double)overhead / kBlocks);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    int res = RUN_ALL_TESTS();
+    VLDMarkAllLeaksAsReported();
+    return res;
+}
@@ -0,0 +1,280 @@
+// vld_preload.cpp : Runs a program with libvld_preload.so preloaded, and
+// checks the leak report it prints when it exits.
+//
+
+#include <gtest/gtest.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+// Runs vld_preload_leaks with the scenario and the environment variables, and
+// returns everything it printed, the report included.
+std::string RunLeaks(const std::string &scenario, const std::string &environment = "", bool preload = true)
+{
+    std::string command = environment;
+    if (preload)
+        command += " LD_PRELOAD=" VLD_PRELOAD_LIBRARY;
+    command += " " VLD_PRELOAD_LEAKS " " + scenario + " 2>&1";
+
+    std::string output;
+    FILE* pipe = popen(command.c_str(), "r");
+    if (pipe == NULL)
+        return output;
+    char buffer [4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), pipe)) != 0)
+        output.append(buffer, count);
+    pclose(pipe);
+    return output;
+}
+
+// Reads the average printed by the benchmark scenario, after VLD's banner.
+double ReadBenchmark(const std::string &output)
+{
+    for (size_t position = 0; position < output.length(); position = output.find('\n', position) + 1) {
+        if (isdigit((unsigned char)output[position]))
+            return atof(output.c_str() + position);
+        if (output.find('\n', position) == std::string::npos)
+            break;
+    }
+    return 0.0;
+}
+
+size_t Count(const std::string &text, const std::string &pattern)
+{
+    size_t count = 0;
+    for (size_t position = text.find(pattern); position != std::string::npos; position = text.find(pattern, position + 1))
+        count++;
+    return count;
+}
+
+// Returns the number of frames of the longest call stack of the report.
+size_t MaxFrames(const std::string &report)
+{
+    size_t most = 0;
+    for (size_t position = report.find("  Call Stack"); position != std::string::npos;
+        position = report.find("  Call Stack", position + 1)) {
+        size_t frames = 0;
+        for (size_t line = report.find('\n', position) + 1; report.compare(line, 4, "    ") == 0;
+            line = report.find('\n', line) + 1)
+            frames++;
+        if (frames > most)
+            most = frames;
+    }
+    return most;
+}
+
+} // namespace
+
+TEST(Preload, NoLeaks)
+{
+    std::string report = RunLeaks("none");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector Version 2.5.2 installed.")) << report;
+    EXPECT_NE(std::string::npos, report.find("No memory leaks detected.")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector is now exiting.")) << report;
+}
+
+TEST(Preload, ReportsEachFunction)
+{
+    std::string report = RunLeaks("leaks");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 9 memory leaks (246 bytes).")) << report;
+    EXPECT_EQ(9u, Count(report, "  Call Stack (TID "));
+
+    const char* functions [] = { "malloc()", "calloc()", "realloc()", "strdup()", "memalign()", "aligned_alloc()",
+        "posix_memalign()", "operator new(unsigned long)", "operator new[](unsigned long)" };
+    for (const char* function : functions)
+        EXPECT_NE(std::string::npos, report.find(std::string("    libvld_preload.so!") + function)) << function;
+
+    EXPECT_EQ(9u, Count(report, "    vld_preload_leaks!Leak() + "));
+    EXPECT_NE(std::string::npos, report.find("70 72 65 6C    6F 61 64 20    6C 65 61 6B    00")) << report;
+}
+
+TEST(Preload, Reallocations)
+{
+    // The block whose reallocation failed keeps its size and call stack.
+    std::string report = RunLeaks("realloc");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 3 memory leaks (1048616 bytes).")) << report;
+    EXPECT_EQ(2u, Count(report, "    libvld_preload.so!realloc()"));
+    EXPECT_EQ(1u, Count(report, "    libvld_preload.so!malloc()"));
+}
+
+TEST(Preload, AggregatesDuplicates)
+{
+    std::string report = RunLeaks("threads", "VldAggregateDuplicates=yes VldMaxDataDump=0");
+    EXPECT_NE(std::string::npos, report.find("    Aggregating duplicate leaks.")) << report;
+    EXPECT_NE(std::string::npos, report.find("    Suppressing data dumps.")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 4 memory leaks (406 bytes).")) << report;
+    EXPECT_EQ(0u, Count(report, "  Data:"));
+}
+
+TEST(Preload, ThreadsLeakTheirOwnBlocks)
+{
+    std::string report = RunLeaks("threads");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 4 memory leaks (406 bytes).")) << report;
+
+    std::set<std::string> threads;
+    for (size_t position = report.find("  Call Stack (TID "); position != std::string::npos;
+        position = report.find("  Call Stack (TID ", position + 1)) {
+        threads.insert(report.substr(position, report.find('\n', position) - position));
+    }
+    EXPECT_EQ(4u, threads.size()) << report;
+}
+
+TEST(Preload, Fork)
+{
+    std::string report = RunLeaks("fork");
+    EXPECT_NE(std::string::npos, report.find("No memory leaks detected.")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 1 memory leak (21 bytes).")) << report;
+}
+
+TEST(Preload, TurnedOff)
+{
+    std::string report = RunLeaks("leaks", "VLD=off");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector is turned off.")) << report;
+    EXPECT_EQ(std::string::npos, report.find("memory leak")) << report;
+}
+
+TEST(Preload, ReportFile)
+{
+    char path [] = "/tmp/vld_preload_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    std::string output = RunLeaks("leaks", std::string("VldReportTo=file VldReportFile=") + path);
+    EXPECT_EQ(std::string::npos, output.find("memory leak")) << output;
+
+    std::string report;
+    FILE* file = fopen(path, "r");
+    ASSERT_NE((FILE*)NULL, file);
+    char buffer [4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) != 0)
+        report.append(buffer, count);
+    fclose(file);
+    remove(path);
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 9 memory leaks (246 bytes).")) << report;
+}
+
+TEST(Preload, ResolvesUnloadedModules)
+{
+    std::string report = RunLeaks("plugin");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 2 memory leaks (60 bytes).")) << report;
+    EXPECT_NE(std::string::npos, report.find("    libvld_preload_plugin.so!PluginLeak() + ")) << report;
+    EXPECT_EQ(std::string::npos, report.find("libvld_preload_plugin.so!0x")) << report;
+}
+
+TEST(Preload, TellsModulesLoadedAtTheSameAddresses)
+{
+    std::string report = RunLeaks("replugin");
+    if (report.find("Loaded at another address.") != std::string::npos)
+        GTEST_SKIP() << "The other plugin wasn't loaded where the plugin was.";
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 2 memory leaks (78 bytes).")) << report;
+    EXPECT_NE(std::string::npos, report.find("    libvld_preload_plugin.so!PluginLeak() + ")) << report;
+    EXPECT_NE(std::string::npos, report.find("    libvld_preload_other_plugin.so!OtherPluginLeak() + ")) << report;
+
+    report = RunLeaks("replugin", "VldForceIncludeModules=libvld_preload_plugin.so");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 1 memory leak (37 bytes).")) << report;
+}
+
+TEST(Preload, ForceIncludeModules)
+{
+    std::string report = RunLeaks("plugin", "VldForceIncludeModules=libother.so");
+    EXPECT_NE(std::string::npos, report.find("    Forcing inclusion of these modules in leak detection: libother.so"))
+        << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 1 memory leak (23 bytes).")) << report;
+
+    report = RunLeaks("plugin", "VldForceIncludeModules=\"libother.so LIBVLD_PRELOAD_PLUGIN.so\"");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 2 memory leaks (60 bytes).")) << report;
+
+    report = RunLeaks("plugin", "VldForceIncludeModules=*");
+    EXPECT_EQ(std::string::npos, report.find("Forcing inclusion")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 2 memory leaks (60 bytes).")) << report;
+}
+
+TEST(Preload, ReachabilityScan)
+{
+    std::string report = RunLeaks("reachable", "VldReachabilityScan=yes");
+    EXPECT_NE(std::string::npos, report.find("    Leaving leaks still reachable from the program's data out of the report."))
+        << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 5 memory leaks (287 bytes).")) << report;
+    EXPECT_NE(std::string::npos, report.find("Reachability: 2 leaks definitely lost, 3 indirectly lost, "
+        "3 blocks still reachable (115 bytes, not reported).")) << report;
+    EXPECT_EQ(2u, Count(report, "  Reachability: definitely lost\n"));
+    EXPECT_EQ(3u, Count(report, "  Reachability: indirectly lost"));
+    EXPECT_EQ(std::string::npos, report.find(": 31 bytes -")) << report;
+
+    // Without the scan, every block is reported.
+    report = RunLeaks("reachable");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 8 memory leaks (402 bytes).")) << report;
+    EXPECT_EQ(std::string::npos, report.find("Reachability:")) << report;
+}
+
+TEST(Preload, InternalStats)
+{
+    std::string report = RunLeaks("threads", "VldInternalStats=yes");
+    EXPECT_NE(std::string::npos, report.find("    Measuring Visual Leak Detector's own operations.")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 4 memory leaks (406 bytes).")) << report;
+    size_t table = report.find("Visual Leak Detector internal statistics, in cycles:\n");
+    ASSERT_NE(std::string::npos, table) << report;
+    EXPECT_LT(table, report.find("Visual Leak Detector is now exiting."));
+    const char* operations [] = { "  IsExcludedModule ", "  Stack capture ", "  mapBlock ", "  unmapBlock ",
+        "  Heap map lock ", "  Symbols " };
+    for (const char* operation : operations)
+        EXPECT_NE(std::string::npos, report.find(operation, table)) << operation;
+
+    // Without the option, nothing is measured.
+    report = RunLeaks("threads");
+    EXPECT_EQ(std::string::npos, report.find("internal statistics")) << report;
+}
+
+TEST(Preload, CaptureRules)
+{
+    // Only the large blocks of the worker threads, with short call stacks. The
+    // stacks are unwound, so that they are longer than that even when the
+    // program is built without frame pointers.
+    std::string report = RunLeaks("named",
+        "VldStackWalkMethod=safe VldCaptureRules=\"thread=worker* size=4K- depth=4\"");
+    EXPECT_NE(std::string::npos, report.find("    Tracking allocations following 1 capture rule(s): "
+        "thread=worker* size=4K- depth=4")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 2 memory leaks (10001 bytes).")) << report;
+    EXPECT_EQ(2u, Count(report, "  Call Stack (TID "));
+    EXPECT_LE(MaxFrames(report), 4u) << report;
+    EXPECT_GT(MaxFrames(RunLeaks("named", "VldStackWalkMethod=safe")), 4u);
+
+    // Rules which only exclude blocks leave the others tracked.
+    report = RunLeaks("named", "VldCaptureRules=\"size=-4K track=no\"");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 3 memory leaks (15003 bytes).")) << report;
+
+    report = RunLeaks("plugin", "VldCaptureRules=\"module=LIBVLD_PRELOAD_PLUGIN.so track=no\"");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 1 memory leak (23 bytes).")) << report;
+    report = RunLeaks("plugin", "VldCaptureRules=\"module=*preload_plugin* track=no\"");
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 1 memory leak (23 bytes).")) << report;
+
+    // Invalid rules are left out, here all of them.
+    report = RunLeaks("named", "VldCaptureRules=\"size=abc; module=**; sample=0\"");
+    EXPECT_NE(std::string::npos, report.find("VLD: Ignoring 3 capture rule(s) which could not be parsed")) << report;
+    EXPECT_EQ(std::string::npos, report.find("    Tracking allocations following")) << report;
+    EXPECT_NE(std::string::npos, report.find("Visual Leak Detector detected 6 memory leaks (15306 bytes).")) << report;
+}
+
+// Not a correctness test: compares the cost of malloc and free with and
+// without the library preloaded.
+TEST(PreloadBenchmark, MallocAndFree)
+{
+    double plain = ReadBenchmark(RunLeaks("benchmark", "", false));
+    double preloaded = ReadBenchmark(RunLeaks("benchmark"));
+    EXPECT_GT(preloaded, 0.0);
+    printf("Allocated and freed a block in %.1f ns on average (%.1f ns without VLD).\n", preloaded, plain);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,251 @@
+// vld_preload_leaks.cpp : Allocates and leaks memory with every function
+// replaced by libvld_preload.so. The tests run it with the library preloaded,
+// and check the report. The scenario is selected by the first argument.
+//
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Keeps the compiler from removing the allocations.
+void* volatile g_sink;
+
+// Blocks the program still points to when it exits.
+void* volatile g_kept;
+void** volatile g_list;
+
+} // namespace
+
+// The functions are exported, so that they can be found in the report.
+
+// Allocates a block with each function, and frees it with the matching one.
+void AllocateAndFree()
+{
+    free(malloc(10));
+    free(calloc(2, 8));
+    void* block = realloc(NULL, 4);
+    block = realloc(block, 4096);
+    free(block);
+    free(strdup("freed"));
+    free(memalign(64, 10));
+    free(aligned_alloc(64, 64));
+    if (posix_memalign(&block, 32, 10) == 0)
+        free(block);
+    delete new int(1);
+    delete [] new char [10];
+    delete new (std::nothrow) int(2);
+    std::string text(100, 'x');
+    g_sink = (void*)text.data();
+}
+
+void Leak()
+{
+    g_sink = malloc(11);
+    g_sink = calloc(3, 4);
+    void* block = malloc(5);
+    g_sink = realloc(block, 33);
+    g_sink = strdup("preload leak");
+    g_sink = memalign(64, 13);
+    g_sink = aligned_alloc(128, 128);
+    if (posix_memalign(&block, 32, 15) == 0)
+        g_sink = block;
+    g_sink = new int(0x2A);
+    g_sink = new char [17];
+}
+
+// Leaks a block reallocated in-place, one moved by its reallocation, and one
+// whose reallocation failed.
+void Reallocate()
+{
+    void* block = malloc(64);
+    g_sink = realloc(block, 16);
+    block = malloc(8);
+    g_sink = realloc(block, 1 << 20);
+    // Too large to be allocated, but not known to the compiler.
+    volatile size_t huge = SIZE_MAX / 2;
+    block = malloc(24);
+    if (realloc(block, huge) == NULL)
+        g_sink = block;
+}
+
+// Each thread allocates and frees a lot, and leaks a single block.
+void Threads()
+{
+    std::vector<std::thread> threads;
+    for (int index = 0; index < 4; index++) {
+        threads.emplace_back([index] {
+            for (int count = 0; count < 10000; count++) {
+                AllocateAndFree();
+            }
+            g_sink = malloc(100 + index);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// The child leaks nothing of its own, the parent leaks one block after the fork.
+void Fork()
+{
+    pid_t child = fork();
+    if (child == 0) {
+        AllocateAndFree();
+        exit(0);
+    }
+    g_sink = malloc(21);
+    int status;
+    waitpid(child, &status, 0);
+}
+
+// Leaks a block from a plugin, which is unloaded before the program exits, and
+// one from the program.
+void Plugin()
+{
+    void* plugin = dlopen(VLD_PRELOAD_PLUGIN, RTLD_NOW);
+    if (plugin == NULL) {
+        printf("%s\n", dlerror());
+        return;
+    }
+    void (*pluginLeak)() = (void (*)())dlsym(plugin, "PluginLeak");
+    pluginLeak();
+    dlclose(plugin);
+    g_sink = malloc(23);
+}
+
+// Leaks a block from a plugin, which is unloaded, and one from another plugin
+// loaded at the same addresses, and left loaded.
+void Replugin()
+{
+    void* plugin = dlopen(VLD_PRELOAD_PLUGIN, RTLD_NOW);
+    if (plugin == NULL) {
+        printf("%s\n", dlerror());
+        return;
+    }
+    void (*pluginLeak)() = (void (*)())dlsym(plugin, "PluginLeak");
+    Dl_info unloaded;
+    dladdr((void*)pluginLeak, &unloaded);
+    pluginLeak();
+    dlclose(plugin);
+
+    plugin = dlopen(VLD_PRELOAD_OTHER_PLUGIN, RTLD_NOW);
+    if (plugin == NULL) {
+        printf("%s\n", dlerror());
+        return;
+    }
+    void (*otherPluginLeak)() = (void (*)())dlsym(plugin, "OtherPluginLeak");
+    Dl_info loaded;
+    dladdr((void*)otherPluginLeak, &loaded);
+    if (loaded.dli_fbase != unloaded.dli_fbase)
+        printf("Loaded at another address.\n");
+    otherPluginLeak();
+}
+
+// Keeps three blocks reachable from the program's data, and loses five: two
+// directly, with one of them pointing to a third block, and a cycle of two.
+// The blocks are allocated by another thread, so that no stale copy of their
+// addresses is left on the stack or in the registers of the thread exiting.
+void Reachable()
+{
+    std::thread thread([] {
+        g_kept = malloc(31);
+        void** list = (void**)calloc(1, 41);
+        list[0] = calloc(1, 43);
+        g_list = list;
+
+        // The lost blocks go through the sink, which is cleared afterwards,
+        // so that the compiler doesn't remove them.
+        void** lost = (void**)calloc(1, 47);
+        lost[0] = calloc(1, 53);
+        g_sink = lost;
+        void** cycle = (void**)calloc(1, 59);
+        cycle[0] = calloc(1, 61);
+        ((void**)cycle[0])[0] = cycle;
+        g_sink = cycle;
+        void* last = malloc(67);
+        memset(last, 0, 67);
+        g_sink = last;
+        g_sink = NULL;
+    });
+    thread.join();
+}
+
+// Two threads named worker-0 and worker-1, and one named io, each leak a small
+// block and a large one. The threads name themselves before allocating.
+void NamedThreads()
+{
+    std::vector<std::thread> threads;
+    const char* names [] = { "worker-0", "worker-1", "io" };
+    for (int index = 0; index < 3; index++) {
+        const char* name = names[index];
+        threads.emplace_back([index, name] {
+            pthread_setname_np(pthread_self(), name);
+            g_sink = malloc(100 + index);
+            g_sink = malloc(5000 + index);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Prints the average time taken by malloc and free, while other blocks are
+// allocated.
+void Benchmark()
+{
+    const int blocks = 1000;
+    const int iterations = 200;
+    std::vector<void*> live(blocks);
+    auto start = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        for (int index = 0; index < blocks; index++) {
+            live[index] = malloc(16 + index % 128);
+        }
+        for (int index = 0; index < blocks; index++) {
+            free(live[index]);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    printf("%.1f\n", (double)elapsed / (blocks * iterations));
+}
+
+int main(int argc, char **argv)
+{
+    const char* scenario = (argc > 1) ? argv[1] : "none";
+    AllocateAndFree();
+    if (strcmp(scenario, "leaks") == 0)
+        Leak();
+    else if (strcmp(scenario, "realloc") == 0)
+        Reallocate();
+    else if (strcmp(scenario, "threads") == 0)
+        Threads();
+    else if (strcmp(scenario, "fork") == 0)
+        Fork();
+    else if (strcmp(scenario, "plugin") == 0)
+        Plugin();
+    else if (strcmp(scenario, "replugin") == 0)
+        Replugin();
+    else if (strcmp(scenario, "benchmark") == 0)
+        Benchmark();
+    else if (strcmp(scenario, "reachable") == 0)
+        Reachable();
+    else if (strcmp(scenario, "named") == 0)
+        NamedThreads();
+    fflush(stdout);
+    // Like many programs, close the standard streams before exiting.
+    fclose(stderr);
+    return 0;
+}
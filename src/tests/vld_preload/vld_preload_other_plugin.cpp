@@ -0,0 +1,13 @@
+// vld_preload_other_plugin.cpp : A module loaded by vld_preload_leaks once
+// vld_preload_plugin is unloaded, at the same addresses, leaking a block.
+//
+
+#include <cstdlib>
+
+// Keeps the compiler from removing the allocation.
+void* volatile g_otherPluginSink;
+
+extern "C" void OtherPluginLeak()
+{
+    g_otherPluginSink = malloc(41);
+}
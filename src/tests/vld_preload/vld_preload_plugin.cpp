@@ -0,0 +1,13 @@
+// vld_preload_plugin.cpp : A module loaded and unloaded by vld_preload_leaks
+// with dlopen and dlclose, leaking a block in between.
+//
+
+#include <cstdlib>
+
+// Keeps the compiler from removing the allocation.
+void* volatile g_pluginSink;
+
+extern "C" void PluginLeak()
+{
+    g_pluginSink = malloc(37);
+}
@@ -51,7 +51,14 @@ Applications should never include this header."
 //    an STL-like interface so that it can be used as the backend for STL-like
 //    container classes.
 //
-template <typename T>
+//    A key never moves once inserted: it stays in the same node, at the same
+//    address, until it is erased. Containers may therefore hand out pointers
+//    to the keys they store.
+//
+//    The lock protecting the tree is a policy: any class with the interface of
+//    CriticalSection, such as AdaptiveLock, can be given as Tl.
+//
+template <typename T, typename Tl = CriticalSection>
 class Tree
 {
 public:
@@ -91,6 +98,7 @@ public:
         m_nil.parent = &m_nil;
         m_nil.right  = &m_nil;
         m_reserve    = TREE_DEFAULT_RESERVE;
+        m_limit      = 0;
         m_root       = &m_nil;
         m_store      = NULL;
         m_storetail  = NULL;
@@ -98,7 +106,7 @@ public:
 
     // Copy constructor - The sole purpose of this constructor's existence is
     //   to ensure that trees are not being inadvertently copied.
-    Tree<T> (const Tree<T>& source)
+    Tree (const Tree& source)
     {
         assert(FALSE); // Do not make copies of trees!
     }
@@ -128,7 +136,7 @@ public:
     //   should be performed). The sole purpose of this assignment operator is
     //   to ensure that no copying is being done inadvertently.
     //
-    Tree<T>& operator = (const Tree<T> &other)
+    Tree& operator = (const Tree &other)
     {
         // Don't make copies of Trees!
         assert(FALSE);
@@ -146,7 +154,7 @@ public:
     {
         node_t *cur;
 
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
         if (m_root == &m_nil) {
             return NULL;
         }
@@ -177,7 +185,7 @@ public:
         node_t *erasure;
         node_t *sibling;
 
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
 
         if ((node->left == &m_nil) || (node->right == &m_nil)) {
             // The node to be erased has less than two children. It can be directly
@@ -186,9 +194,8 @@ public:
         }
         else {
             // The node to be erased has two children. It can only be removed
-            // indirectly. The actual node will stay where it is, but it's contents
-            // will be replaced by it's in-order successor's contents. The successor
-            // node will then be erased. Find the successor.
+            // indirectly: its in-order successor is unlinked from the tree
+            // instead, and then takes the place of the node. Find the successor.
             erasure = node->right;
             while (erasure->left != &m_nil) {
                 erasure = erasure->left;
@@ -218,13 +225,6 @@ public:
             }
         }
 
-        if (erasure != node) {
-            // The node being erased from the tree is the successor of the actual
-            // node to be erased. Replace the contents of the node to be erased
-            // with the successor's contents.
-            node->key  = erasure->key;
-        }
-
         if (erasure->color == black) {
             // The node being erased from the tree is black. Restructuring of the
             // tree may be needed so that black-height is maintained.
@@ -294,6 +294,31 @@ public:
             cur->color = black;
         }
 
+        if (erasure != node) {
+            // The successor has been unlinked from the tree. Move it, rather
+            // than its key, into the position of the node to be erased.
+            erasure->color  = node->color;
+            erasure->parent = node->parent;
+            erasure->left   = node->left;
+            erasure->right  = node->right;
+            if (node->parent == &m_nil) {
+                m_root = erasure;
+            }
+            else if (node == node->parent->left) {
+                node->parent->left = erasure;
+            }
+            else {
+                node->parent->right = erasure;
+            }
+            if (erasure->left != &m_nil) {
+                erasure->left->parent = erasure;
+            }
+            if (erasure->right != &m_nil) {
+                erasure->right->parent = erasure;
+            }
+            erasure = node;
+        }
+
         // Put the erased node onto the free list.
         erasure->next = m_freelist;
         m_freelist = erasure;
@@ -317,7 +342,7 @@ public:
         node_t *node;
 
         // Find the node to erase.
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
         node = m_root;
         while (node != &m_nil) {
             if (node->key < key) {
@@ -353,7 +378,7 @@ public:
     {
         node_t *cur;
 
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
         cur = m_root;
         while (cur != &m_nil) {
             if (cur->key < key) {
@@ -374,6 +399,38 @@ public:
         return NULL;
     }
 
+    // lowerbound - Obtains a pointer to the node of the lowest key which is
+    //   not less than the specified key. Lets a walk through the tree resume
+    //   after the tree was modified.
+    //
+    //  - key (IN): The value to search for in the tree.
+    //
+    //  Return Value:
+    //
+    //    Returns a pointer to the node found. If every key in the tree is less
+    //    than the specified key, then "lowerbound" returns NULL.
+    //
+    typename Tree::node_t* lowerbound (const T &key) const
+    {
+        node_t *cur;
+        node_t *found = NULL;
+
+        CriticalSectionLocker<Tl> cs(m_lock);
+        cur = m_root;
+        while (cur != &m_nil) {
+            if (cur->key < key) {
+                // Go right.
+                cur = cur->right;
+            }
+            else {
+                // This key may be the one; look for a lower one on the left.
+                found = cur;
+                cur = cur->left;
+            }
+        }
+        return found;
+    }
+
     // insert - Inserts a new key into the tree.
     //
     //  - key (IN): The key to insert into the tree. This value is treated as
@@ -388,7 +445,7 @@ public:
     //
     typename Tree::node_t* insert (const T &key)
     {
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
 
         // Find the location where the new node should be inserted..
         node_t  *cur = m_root;
@@ -413,6 +470,10 @@ public:
         if (m_freelist == NULL) {
             // Allocate additional storage.
             reserve(m_reserve);
+            if (m_reserve < m_limit) {
+                // Make the next chunk larger.
+                m_reserve = (m_reserve < m_limit / 2) ? m_reserve * 2 : m_limit;
+            }
         }
         node_t  *node = m_freelist;
         m_freelist = m_freelist->next;
@@ -508,7 +569,7 @@ public:
         if (node == NULL)
             return NULL;
 
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
         node_t* cur;
         if (node->right != &m_nil) {
             // 'node' has a right child. Successor is the far left node in
@@ -567,7 +628,7 @@ public:
             return NULL;
         }
 
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
         node_t* cur;
         if (node->left != &m_nil) {
             // 'node' has left child. Predecessor is the far right node in the
@@ -642,7 +703,7 @@ public:
             }
         }
 
-        CriticalSectionLocker<> cs(m_lock);
+        CriticalSectionLocker<Tl> cs(m_lock);
         if (m_freelist == NULL) {
             // Allocate additional storage.
             // Link a new chunk into the chunk list.
@@ -668,6 +729,23 @@ public:
         return oldreserve;
     }
 
+    // reservelimit - Lets the reserve grow as the tree grows. Each time the
+    //   tree runs out of storage, the reserve doubles until it reaches the
+    //   limit, so that large trees are made of few chunks and are quickly
+    //   freed.
+    //
+    //  - limit (IN): The largest number of nodes to reserve at once. If not
+    //      larger than the reserve, the reserve stays fixed.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    VOID reservelimit (size_t limit)
+    {
+        m_limit = limit;
+    }
+
 private:
     // _rotateleft: Rotates a pair of nodes counter-clockwise so that the parent
     //   node becomes the left child and the right child becomes the parent.
@@ -747,9 +825,10 @@ private:
 
     // Private data members.
     node_t                   *m_freelist;  // Pointer to the list of free nodes (reserve storage).
-    mutable CriticalSection   m_lock;      // Protects the tree's integrity against concurrent accesses.
+    mutable Tl                m_lock;      // Protects the tree's integrity against concurrent accesses.
     node_t                    m_nil;       // The tree's nil node. All leaf nodes point to this.
     size_t                    m_reserve;   // The size (in nodes) of the chunks of reserve storage.
+    size_t                    m_limit;     // The size up to which m_reserve grows (see reservelimit).
     node_t                   *m_root;      // Pointer to the tree's root node.
     chunk_t                  *m_store;     // Pointer to the start of the chunk list.
     chunk_t                  *m_storetail; // Pointer to the end of the chunk list.
@@ -29,9 +29,35 @@
 Applications should never include this header."
 #endif
 
+#if !defined(_WIN32)
+
+// Elsewhere, only the report functions are available, for the preload library
+// (vld_preload.cpp) and the portable tracking engine. See utility_posix.cpp.
+#include <cstdio>
+#include "platform.h"
+#include "vldconfig.h"  // Provides the configuration structure.
+
+#if defined(__LP64__)
+#define ADDRESSFORMAT       L"0x%.16lX"  // Format string for 64-bit addresses. Addresses are passed as UINT_PTR.
+#else
+#define ADDRESSFORMAT       L"0x%.8X"    // Format string for 32-bit addresses. Addresses are passed as UINT_PTR.
+#endif
+#define MAXREPORTLENGTH     511          // Maximum length, in characters, of "report" messages.
+
+// Utility functions. See function definitions for details.
+VOID DumpMemoryA (LPCVOID address, SIZE_T length);
+VOID LoadConfigEnvironment (vldconfig_t &config);
+VOID Print (LPWSTR message);
+VOID Report (LPCWSTR format, ...);
+VOID SetReportFile (FILE *file, BOOL copydebugger, BOOL copytostdout);
+
+#else // _WIN32
+
 #include <cstdio>
 #include <windows.h>
 #include <intrin.h>
+#include "stackhash.h"  // Provides the stack hashing functions.
+#include "vldconfig.h"  // Provides the configuration structure.
 
 #ifdef _WIN64
 #define ADDRESSFORMAT       L"0x%.16X"   // Format string for 64-bit addresses
@@ -155,12 +181,13 @@ DWORD _GetProcessIdOfThread (HANDLE thread);
 #define GetProcessIdOfThread _GetProcessIdOfThread
 #endif
 void ConvertModulePathToAscii( LPCWSTR modulename, LPSTR * modulenamea );
-DWORD CalculateCRC32(UINT_PTR p, UINT startValue = 0xD202EF8D);
 // Formats a message string using the specified message and variable
 // list of arguments.
 void GetFormattedMessage(DWORD last_error);
 HMODULE GetCallingModule(UINT_PTR pCaller);
 DWORD FilterFunction(long);
-BOOL LoadBoolOption(LPCWSTR optionname, LPCWSTR defaultvalue, LPCWSTR inipath);
-UINT LoadIntOption(LPCWSTR optionname, UINT defaultvalue, LPCWSTR inipath);
-VOID LoadStringOption(LPCWSTR optionname, LPWSTR outputbuffer, UINT buffersize, LPCWSTR inipath);
\ No newline at end of file
+ULONGLONG ElapsedMicroseconds (const LARGE_INTEGER &start);
+BOOL LoadConfigFile (vldconfig_t &config, LPCWSTR inipath);
+VOID LoadConfigEnvironment (vldconfig_t &config);
+
+#endif // _WIN32
@@ -0,0 +1,252 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Utility Functions (POSIX)
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// The few utility functions needed by vld_core and the preload library on
+// platforms other than Windows. Reports go to the standard error stream, which
+// stands in for the debugger, and/or to a file.
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cwchar>
+#include <fcntl.h>
+#include <strings.h>
+
+#define VLDBUILD
+#include "utility.h"    // Provides the declarations of these functions.
+#include "vldheap.h"    // Provides internal new and delete operators.
+
+extern char **environ;
+
+#define BYTEFORMATBUFFERLENGTH  4
+#define HEXDUMPLINELENGTH       58
+
+// Global variables.
+static FILE *s_reportFile = NULL;       // Send reports to this file, if it is not NULL.
+static BOOL  s_reportToDebugger = TRUE; // If TRUE, a copy of the reports is sent to the standard error stream.
+static BOOL  s_reportToStdOut = FALSE;  // If TRUE, a copy of the reports is sent to the standard output stream.
+
+// DumpMemoryA - Dumps a nicely formatted rendition of a region of memory.
+//   Includes both the hex value of each byte and its ASCII equivalent (if
+//   printable).
+//
+//  - address (IN): Pointer to the beginning of the memory region to dump.
+//
+//  - size (IN): The size, in bytes, of the region to dump.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID DumpMemoryA (LPCVOID address, SIZE_T size)
+{
+    // Each line of output is 16 bytes.
+    SIZE_T dumpLen;
+    if ((size % 16) == 0) {
+        // No padding needed.
+        dumpLen = size;
+    }
+    else {
+        // We'll need to pad the last line out to 16 bytes.
+        dumpLen = size + (16 - (size % 16));
+    }
+
+    // For each byte of data, get both the ASCII equivalent (if it is a
+    // printable character) and the hex representation.
+    SIZE_T bytesDone = 0;
+    WCHAR  hexDump [HEXDUMPLINELENGTH] = {0};
+    WCHAR  ascDump [18] = {0};
+    WCHAR  formatBuf [BYTEFORMATBUFFERLENGTH];
+    for (SIZE_T byteIndex = 0; byteIndex < dumpLen; byteIndex++) {
+        SIZE_T wordIndex = byteIndex % 16;
+        SIZE_T hexIndex = 3 * (wordIndex + (wordIndex / 4)); // 3 characters per byte, plus a 3-character space after every 4 bytes.
+        SIZE_T ascIndex = wordIndex + wordIndex / 8;         // 1 character per byte, plus a 1-character space after every 8 bytes.
+        if (byteIndex < size) {
+            BYTE byte = ((PBYTE)address)[byteIndex];
+            swprintf(formatBuf, BYTEFORMATBUFFERLENGTH, L"%.2X ", byte);
+            formatBuf[3] = '\0';
+            wcsncpy(hexDump + hexIndex, formatBuf, 4);
+            if (isgraph(byte)) {
+                ascDump[ascIndex] = (WCHAR)byte;
+            }
+            else {
+                ascDump[ascIndex] = L'.';
+            }
+        }
+        else {
+            // Add padding to fill out the last line to 16 bytes.
+            wcsncpy(hexDump + hexIndex, L"   ", 4);
+            ascDump[ascIndex] = L'.';
+        }
+        bytesDone++;
+        if ((bytesDone % 16) == 0) {
+            // Print one line of data for every 16 bytes. Include the
+            // ASCII dump and the hex dump side-by-side.
+            Report(L"    %ls    %ls\n", hexDump, ascDump);
+        }
+        else {
+            if ((bytesDone % 8) == 0) {
+                // Add a spacer in the ASCII dump after every 8 bytes.
+                ascDump[ascIndex + 1] = L' ';
+            }
+            if ((bytesDone % 4) == 0) {
+                // Add a spacer in the hex dump after every 4 bytes.
+                wcsncpy(hexDump + hexIndex + 3, L"   ", 4);
+            }
+        }
+    }
+}
+
+// LoadConfigEnvironment - Applies the options set by Vld<Option> environment
+//   variables. The variables are copied into a block laid out like the
+//   environment block of Windows, as expected by ApplyConfigEnvironment.
+//
+//  - config (IN/OUT): The configuration the options are applied to.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID LoadConfigEnvironment (vldconfig_t &config)
+{
+    // Only the variables which may be options are copied, so the block is
+    // usually tiny.
+    size_t length = 1;
+    for (char **variable = environ; (variable != NULL) && (*variable != NULL); variable++) {
+        if (strncasecmp(*variable, "vld", 3) == 0)
+            length += strlen(*variable) + 1;
+    }
+    WCHAR *environment = new WCHAR [length];
+    WCHAR *entry = environment;
+    for (char **variable = environ; (variable != NULL) && (*variable != NULL); variable++) {
+        if (strncasecmp(*variable, "vld", 3) != 0)
+            continue;
+        for (const char *c = *variable; *c != '\0'; c++)
+            *entry++ = (WCHAR)(unsigned char)*c;
+        *entry++ = L'\0';
+    }
+    *entry = L'\0';
+
+    ApplyConfigEnvironment(config, environment);
+    delete [] environment;
+}
+
+// Print - Sends a message to the standard error stream and/or to the report
+//   file. Reports are always encoded as ASCII: characters which aren't are
+//   replaced with question marks, so that no locale is needed to convert them.
+//
+//  - message (IN): The message to send.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Print (LPWSTR messagew)
+{
+    if (NULL == messagew)
+        return;
+
+    const size_t MAXMESSAGELENGTH = 5119;
+    size_t  count = 0;
+    char    messagea [MAXMESSAGELENGTH + 1];
+    for (; (messagew[count] != L'\0') && (count < MAXMESSAGELENGTH); count++) {
+        messagea[count] = ((UINT)messagew[count] < 0x80) ? (char)messagew[count] : '?';
+    }
+    messagea[count] = '\0';
+
+    if (s_reportFile != NULL) {
+        // Send the report to the previously specified file.
+        fwrite(messagea, sizeof(char), count, s_reportFile);
+    }
+
+    if (s_reportToStdOut)
+        fputs(messagea, stdout);
+
+    if (s_reportToDebugger) {
+        // Programs often close the standard error stream before they exit, and
+        // the leaks are only reported after that. A copy of the stream's file
+        // descriptor, taken by the first report, is written to instead.
+        static int debuggerfd = -1;
+        if (debuggerfd == -1)
+            debuggerfd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+        if (debuggerfd != -1) {
+            ssize_t written = write(debuggerfd, messagea, count);
+            UNREFERENCED_PARAMETER(written);
+        }
+    }
+}
+
+// Report - Sends a printf-style formatted message to the standard error stream
+//   and/or to a file.
+//
+//   Note: A message longer than MAXREPORTLENGTH characters will be truncated
+//     to MAXREPORTLENGTH. Strings must be formatted with %ls.
+//
+//  - format (IN): Specifies a printf-compliant format string containing the
+//      message to be sent.
+//
+//  - ... (IN): Arguments to be formatted using the specified format string.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Report (LPCWSTR format, ...)
+{
+    va_list args;
+    WCHAR   messagew [MAXREPORTLENGTH + 1];
+
+    va_start(args, format);
+    int result = vswprintf(messagew, MAXREPORTLENGTH + 1, format, args);
+    va_end(args);
+    messagew[MAXREPORTLENGTH] = L'\0';
+
+    // Unlike _vsnwprintf_s, vswprintf fails on truncation, leaving the
+    // contents of the buffer unspecified.
+    if (result >= 0)
+        Print(messagew);
+}
+
+// SetReportFile - Sets a destination file to which all report messages should
+//   be sent. If this function is not called to set a destination file, then
+//   report messages will be sent to the standard error stream instead.
+//
+//  - file (IN): Pointer to an open file, to which future report messages should
+//      be sent.
+//
+//  - copydebugger (IN): If true, in addition to sending report messages to
+//      the specified file, a copy of each message will also be sent to the
+//      standard error stream.
+//
+//  - tostdout (IN): If true, a copy of each message will also be sent to the
+//      standard output stream.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID SetReportFile (FILE *file, BOOL copydebugger, BOOL tostdout)
+{
+    s_reportFile = file;
+    s_reportToDebugger = copydebugger;
+    s_reportToStdOut = tostdout;
+}
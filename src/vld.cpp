@@ -30,6 +30,7 @@
 #define VLDBUILD         // Declares that we are building Visual Leak Detector.
 #include "callstack.h"   // Provides a class for handling call stacks.
 #include "crtmfcpatch.h" // Provides CRT and MFC patch functions.
+#include "internalstats.h"  // Provides the counters of VLD's own operations.
 #include "map.h"         // Provides a lightweight STL-like map template.
 #include "ntapi.h"       // Provides access to NT APIs.
 #include "set.h"         // Provides a lightweight STL-like set template.
@@ -38,16 +39,20 @@
 #include "loaderlock.h"
 #include "tchar.h"
 
-#define BLOCK_MAP_RESERVE   64  // This should strike a balance between memory use and a desire to minimize heap hits.
-#define HEAP_MAP_RESERVE    2   // Usually there won't be more than a few heaps in the process, so this should be small.
 #define MODULE_SET_RESERVE  16  // There are likely to be several modules loaded in the process.
+#define SUSPECT_POLL_TIME   1000 // Milliseconds between two checks of the leak suspect detector.
+#define SUSPECT_RETRY_TIME  100 // Milliseconds the leak suspect detector waits for the loader lock before trying again.
+#define MAX_SUSPECTS        16  // Maximum number of suspected leaks reported at once.
+#define MAX_LIFETIME_SITES  32  // Maximum number of call sites listed in lifetime reports.
 
 #define PRESERVE_WSAERROR       // if defined preserves status of WSAGetLastError
 
 // Imported global variables.
-extern vldblockheader_t *g_vldBlockList;
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+extern vldblocklist_t    g_vldBlockLists [VLD_BLOCK_LISTS];
+#endif
+extern volatile LONG     g_vldBlockCount;
 extern HANDLE            g_vldHeap;
-extern CriticalSection   g_vldHeapLock;
 
 // Global variables.
 HANDLE           g_currentProcess; // Pseudo-handle for the current process.
@@ -55,6 +60,8 @@ HANDLE           g_currentThread;  // Pseudo-handle for the current thread.
 HANDLE           g_processHeap;    // Handle to the process's heap (COM allocations come from here).
 CriticalSection  g_heapMapLock;    // Serializes access to the heap and block maps.
 ReportHookSet*   g_pReportHooks;
+volatile LONG    g_modulesGeneration; // Incremented whenever the set of loaded modules changes.
+GetThreadDescription_t g_GetThreadDescription; // Reads the names of threads, or NULL before Windows 10.
 DbgHelp g_DbgHelp;
 ImageDirectoryEntries g_Ide;
 LoadedModules g_LoadedModules;
@@ -83,7 +90,7 @@ moduleentry_t ntdllPatch [] = {
 // to properly capture all _CRT_INIT memory allocations which include internal CRT startup memory allocations and all
 // global and static initializers.
 //
-// In getLeaksCount(), reportLeaks() and resolveStacks(), we take extra measures to identify and exclude debug and release
+// In takeSnapshot(), we take extra measures to identify and exclude debug and release
 // internal CRT allocations from reporting as real memory leaks.
 //
 // Global and static initializers *might* be reported as memory leaks based on the order being unintialised by _CRT_INIT.
@@ -342,12 +349,25 @@ bool IsWindows8OrGreater()
 //
 VisualLeakDetector::VisualLeakDetector ()
 {
+    LARGE_INTEGER startupstart;
+    QueryPerformanceCounter(&startupstart);
+    ZeroMemory(&m_startupProfile, sizeof(m_startupProfile));
+
     _set_error_mode(_OUT_TO_STDERR);
 
     // Initialize configuration options and related private data.
     _wcsnset_s(m_forcedModuleList, MAXMODULELISTLENGTH, '\0', _TRUNCATE);
+    m_crtStartupFunctions[0] = '\0';
+    m_internalSourceFiles[0] = '\0';
+    m_captureRules[0] = '\0';
+    m_capturePolicy  = NULL;
     m_maxDataDump    = 0xffffffff;
     m_maxTraceFrames = 0xffffffff;
+    m_suspectWindow  = 0;
+    m_suspectSampled = 0;
+    m_reachableBytes = 0;
+    m_suspectThread  = NULL;
+    m_suspectStop    = NULL;
     m_options        = 0x0;
     m_reportFile     = NULL;
     wcsncpy_s(m_reportFilePath, MAX_PATH, VLD_DEFAULT_REPORT_FILE_NAME, _TRUNCATE);
@@ -377,7 +397,10 @@ VisualLeakDetector::VisualLeakDetector ()
     }
 
     // Load configuration options.
+    LARGE_INTEGER phasestart;
+    QueryPerformanceCounter(&phasestart);
     configure();
+    m_startupProfile.configure = ElapsedMicroseconds(phasestart);
     if (m_options & VLD_OPT_VLDOFF) {
         Report(L"Visual Leak Detector is turned off.\n");
         return;
@@ -401,6 +424,8 @@ VisualLeakDetector::VisualLeakDetector ()
         assert(m_patchTable[0].patchTable == m_kernelbasePatch);
         m_patchTable[0].exportModuleName = "kernelbase.dll";
     }
+    if (kernelBase)
+        g_GetThreadDescription = (GetThreadDescription_t)GetProcAddress(kernelBase, "GetThreadDescription");
 
     // Initialize global variables.
     g_currentProcess    = GetCurrentProcess();
@@ -409,27 +434,52 @@ VisualLeakDetector::VisualLeakDetector ()
 
     LoaderLock ll;
 
-    g_heapMapLock.Initialize();
+    g_heapMapLock.Initialize(STATS_HEAPMAP_LOCK);
     g_vldHeap         = HeapCreate(0x0, 0, 0);
-    g_vldHeapLock.Initialize();
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+    for (UINT index = 0; index < VLD_BLOCK_LISTS; index++) {
+        g_vldBlockLists[index].lock.Initialize(STATS_VLDHEAP_LOCK);
+        g_vldBlockLists[index].head = NULL;
+    }
+#endif
     g_pReportHooks    = new ReportHookSet;
 
     // Initialize remaining private data.
-    m_heapMap         = new HeapMap;
-    m_heapMap->reserve(HEAP_MAP_RESERVE);
+    m_tracker         = new BlockTracker(g_heapMapLock, (m_options & VLD_OPT_LIFETIME_HISTOGRAMS) != 0);
+    m_reportLock.Initialize();
     m_iMalloc         = NULL;
-    m_requestCurr     = 1;
-    m_totalAlloc      = 0;
-    m_curAlloc        = 0;
-    m_maxAlloc        = 0;
     m_loadedModules   = new ModuleSet();
-    m_modulesLock.Initialize();
+    m_modulesLock.Initialize(STATS_MODULES_LOCK);
+    m_symbolModules   = new SymbolModuleMap;
+    m_symbolModules->reserve(MODULE_SET_RESERVE);
+    m_symbolsPending  = false;
+    m_symbolsInitialized = false;
+    m_frameTable      = new FrameTable;
+    m_crtStartupPatterns   = new FramePatternSet;
+    m_internalFilePatterns = new FramePatternSet;
+    CallStack::InitFramePatterns(*m_crtStartupPatterns, *m_internalFilePatterns);
+    m_crtStartupPatterns->addList(m_crtStartupFunctions, CALLSTACK_STATUS_STARTUPCRT);
+    m_internalFilePatterns->addList(m_internalSourceFiles, 0x1);
+    if (m_captureRules[0] != '\0') {
+        // Compiled before the modules are enumerated, which finds the row of
+        // each module in the decision table.
+        size_t invalid;
+        m_capturePolicy = new CapturePolicy;
+        if (m_capturePolicy->compile(m_captureRules, invalid) == 0) {
+            delete m_capturePolicy;
+            m_capturePolicy = NULL;
+        }
+        if (invalid > 0) {
+            Report(L"VLD: Ignoring %Iu capture rule(s) which could not be parsed: %s\n", invalid, m_captureRules);
+        }
+    }
     m_selfTestFile    = __FILE__;
     m_selfTestLine    = 0;
     m_tlsIndex        = TlsAlloc();
     m_tlsLock.Initialize();
     m_tlsMap          = new TlsMap;
 
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
     if (m_options & VLD_OPT_SELF_TEST) {
         // Self-test mode has been enabled. Intentionally leak a small amount of
         // memory so that memory leak self-checking can be verified.
@@ -442,10 +492,14 @@ VisualLeakDetector::VisualLeakDetector ()
             m_selfTestLine = __LINE__ - 1;
         }
     }
+#endif // VLD_TRACK_INTERNAL_BLOCKS
     if (m_options & VLD_OPT_START_DISABLED) {
         // Memory leak detection will initially be disabled.
         m_status |= VLD_STATUS_NEVER_ENABLED;
     }
+    if (m_options & VLD_OPT_INTERNAL_STATS) {
+        EnableInternalStats(true);
+    }
     if (m_options & VLD_OPT_REPORT_TO_FILE) {
         setupReporting();
     }
@@ -464,30 +518,12 @@ VisualLeakDetector::VisualLeakDetector ()
         return;
     }
 
-    // Initialize the symbol handler. We use it for obtaining source file/line
-    // number information and function names for the memory leak report.
-    LPWSTR symbolpath = buildSymbolSearchPath();
-#ifdef NOISY_DBGHELP_DIAGOSTICS
-    // From MSDN docs about SYMOPT_DEBUG:
-    /* To view all attempts to load symbols, call SymSetOptions with SYMOPT_DEBUG.
-    This causes DbgHelp to call the OutputDebugString function with detailed
-    information on symbol searches, such as the directories it is searching and and error messages.
-    In other words, this will really pollute the debug output window with extra messages.
-    To enable this debug output to be displayed to the console without changing your source code,
-    set the DBGHELP_DBGOUT environment variable to a non-NULL value before calling the SymInitialize function.
-    To log the information to a file, set the DBGHELP_LOG environment variable to the name of the log file to be used.
-    */
-    g_DbgHelp.SymSetOptions(SYMOPT_DEBUG | SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
-#else
-    g_DbgHelp.SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
-#endif
-    DbgTrace(L"dbghelp32.dll %i: SymInitializeW\n", GetCurrentThreadId());
-    if (!g_DbgHelp.SymInitializeW(g_currentProcess, symbolpath, FALSE)) {
-        Report(L"WARNING: Visual Leak Detector: The symbol handler failed to initialize (error=%lu).\n"
-            L"    File and function names will probably not be available in call stacks.\n", GetLastError());
-    }
-    delete [] symbolpath;
+    // The symbol handler, used for obtaining source file/line number
+    // information and function names for the memory leak report, is only
+    // initialized once a call stack needs to be resolved (see loadSymbols).
+    // Until then, only the identity of each loaded module is recorded.
 
+    QueryPerformanceCounter(&phasestart);
     ntdllPatch[0].moduleBase = (UINT_PTR)ntdll;
     PatchImport(kernel32, ntdllPatch);
     if (kernelBase != NULL)
@@ -502,12 +538,31 @@ VisualLeakDetector::VisualLeakDetector ()
     ModuleSet* oldmodules = m_loadedModules;
     m_loadedModules = newmodules;
     delete oldmodules;
+    m_startupProfile.attach = ElapsedMicroseconds(phasestart);
+
+    if (m_options & VLD_OPT_SAFE_STACK_WALK) {
+        // StackWalk64 relies on the symbol handler to unwind through each
+        // module, so it is needed right away.
+        QueryPerformanceCounter(&phasestart);
+        loadSymbols();
+        m_startupProfile.symbols = ElapsedMicroseconds(phasestart);
+    }
     m_status |= VLD_STATUS_INSTALLED;
 
     m_dbghlpBase = GetModuleHandleW(L"dbghelp.dll");
     if (m_dbghlpBase)
         ChangeModuleState(m_dbghlpBase, false);
 
+    if (m_suspectWindow != 0) {
+        // Start looking for call sites that keep leaking while the program
+        // runs. The thread only starts once the loader lock is released.
+        m_suspectStop = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (m_suspectStop != NULL)
+            m_suspectThread = CreateThread(NULL, 0, suspectThreadProc, this, 0, NULL);
+        if (m_suspectThread != NULL)
+            SetThreadPriority(m_suspectThread, THREAD_PRIORITY_LOWEST);
+    }
+
     Report(L"Visual Leak Detector Version " VLDVERSION L" installed.\n");
     if (m_status & VLD_STATUS_FORCE_REPORT_TO_FILE) {
         // The report is being forced to a file. Let the human know why.
@@ -517,6 +572,11 @@ VisualLeakDetector::VisualLeakDetector ()
             L"  been specified, the default file name is \"" VLD_DEFAULT_REPORT_FILE_NAME L"\".\n");
     }
     reportConfig();
+
+    m_startupProfile.total = ElapsedMicroseconds(startupstart);
+    DbgReport(L"Visual Leak Detector startup took %I64u us (configuration %I64u us, symbol handler %I64u us,"
+        L" attaching to modules %I64u us).\n", m_startupProfile.total, m_startupProfile.configure,
+        m_startupProfile.symbols, m_startupProfile.attach);
 }
 
 bool VisualLeakDetector::waitForAllVLDThreads()
@@ -568,36 +628,36 @@ bool VisualLeakDetector::waitForAllVLDThreads()
 
 void VisualLeakDetector::checkInternalMemoryLeaks()
 {
-    const char* leakfile = NULL;
-    size_t count;
-    WCHAR leakfilew [MAX_PATH];
-    int leakline = 0;
-
     // Do a memory leak self-check.
     SIZE_T  internalleaks = 0;
-    vldblockheader_t *header = g_vldBlockList;
-    while (header) {
-        // Doh! VLD still has an internally allocated block!
-        // This won't ever actually happen, right guys?... guys?
-        internalleaks++;
-        leakfile = header->file;
-        leakline = header->line;
-        mbstowcs_s(&count, leakfilew, MAX_PATH, leakfile, _TRUNCATE);
-        Report(L"ERROR: Visual Leak Detector: Detected a memory leak internal to Visual Leak Detector!!\n");
-        Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", header->serialNumber, VLDBLOCKDATA(header), header->size);
-        Report(L"  Call Stack:\n");
-        Report(L"    %s (%d): Full call stack not available.\n", leakfilew, leakline);
-        if (m_maxDataDump != 0) {
-            Report(L"  Data:\n");
-            if (m_options & VLD_OPT_UNICODE_REPORT) {
-                DumpMemoryW(VLDBLOCKDATA(header), (m_maxDataDump < header->size) ? m_maxDataDump : header->size);
-            }
-            else {
-                DumpMemoryA(VLDBLOCKDATA(header), (m_maxDataDump < header->size) ? m_maxDataDump : header->size);
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+    const char* leakfile = NULL;
+    int leakline = 0;
+    for (UINT index = 0; index < VLD_BLOCK_LISTS; index++) {
+        for (vldblockheader_t *header = g_vldBlockLists[index].head; header != NULL; header = header->next) {
+            // Doh! VLD still has an internally allocated block!
+            // This won't ever actually happen, right guys?... guys?
+            internalleaks++;
+            leakfile = header->file;
+            leakline = header->line;
+            size_t count;
+            WCHAR leakfilew [MAX_PATH];
+            mbstowcs_s(&count, leakfilew, MAX_PATH, leakfile, _TRUNCATE);
+            Report(L"ERROR: Visual Leak Detector: Detected a memory leak internal to Visual Leak Detector!!\n");
+            Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", header->serialNumber, VLDBLOCKDATA(header), header->size);
+            Report(L"  Call Stack:\n");
+            Report(L"    %s (%d): Full call stack not available.\n", leakfilew, leakline);
+            if (m_maxDataDump != 0) {
+                Report(L"  Data:\n");
+                if (m_options & VLD_OPT_UNICODE_REPORT) {
+                    DumpMemoryW(VLDBLOCKDATA(header), (m_maxDataDump < header->size) ? m_maxDataDump : header->size);
+                }
+                else {
+                    DumpMemoryA(VLDBLOCKDATA(header), (m_maxDataDump < header->size) ? m_maxDataDump : header->size);
+                }
             }
+            Report(L"\n");
         }
-        Report(L"\n");
-        header = header->next;
     }
     if (m_options & VLD_OPT_SELF_TEST) {
         if ((internalleaks == 1) && (strcmp(leakfile, m_selfTestFile) == 0) && (leakline == m_selfTestLine)) {
@@ -607,6 +667,20 @@ void VisualLeakDetector::checkInternalMemoryLeaks()
             Report(L"ERROR: Visual Leak Detector: Failed the memory leak self-test.\n");
         }
     }
+#else
+    // Internal blocks are only counted: there is no telling where they were
+    // allocated.
+    internalleaks = (SIZE_T)g_vldBlockCount;
+    if (internalleaks != 0) {
+        Report(L"ERROR: Visual Leak Detector: Detected %Iu memory leaks internal to Visual Leak Detector!!\n", internalleaks);
+        Report(L"  Build Visual Leak Detector in debug mode for details.\n\n");
+    }
+    if (m_options & VLD_OPT_SELF_TEST) {
+        // Without the file and line of each block, there is no telling the
+        // self-test leak from any other: the self-test isn't run.
+        Report(L"Visual Leak Detector: The memory leak self-test needs a debug build of Visual Leak Detector.\n");
+    }
+#endif // VLD_TRACK_INTERNAL_BLOCKS
 }
 
 // Destructor - Detaches Visual Leak Detector from all modules loaded in the
@@ -622,6 +696,19 @@ VisualLeakDetector::~VisualLeakDetector ()
         return;
     }
 
+    if (m_suspectThread != NULL) {
+        // Stop the leak suspect detector. It never waits for the loader lock,
+        // so it can't be waiting for this thread.
+        SetEvent(m_suspectStop);
+        WaitForSingleObject(m_suspectThread, INFINITE);
+        CloseHandle(m_suspectThread);
+        m_suspectThread = NULL;
+    }
+    if (m_suspectStop != NULL) {
+        CloseHandle(m_suspectStop);
+        m_suspectStop = NULL;
+    }
+
     if (m_status & VLD_STATUS_INSTALLED) {
         // Detach Visual Leak Detector from all previously attached modules.
         DbgTrace(L"dbghelp32.dll %i: EnumerateLoadedModulesW64\n", GetCurrentThreadId());
@@ -650,37 +737,46 @@ VisualLeakDetector::~VisualLeakDetector ()
             }
             else {
                 Report(L"Visual Leak Detector detected %Iu memory leak", leaks_count);
-                Report((leaks_count > 1) ? L"s (%Iu bytes).\n" : L" (%Iu bytes).\n", m_curAlloc);
-                Report(L"Largest number used: %Iu bytes.\n", m_maxAlloc);
-                Report(L"Total allocations: %Iu bytes.\n", m_totalAlloc);
+                Report((leaks_count > 1) ? L"s (%Iu bytes).\n" : L" (%Iu bytes).\n", m_tracker->curAlloc() - m_reachableBytes);
+                Report(L"Largest number used: %Iu bytes.\n", m_tracker->maxAlloc());
+                Report(L"Total allocations: %Iu bytes.\n", m_tracker->totalAlloc());
             }
+            ReportLifetimeHistograms();
         }
-
-        // Free resources used by the symbol handler.
-        DbgTrace(L"dbghelp32.dll %i: SymCleanup\n", GetCurrentThreadId());
-        if (!g_DbgHelp.SymCleanup(g_currentProcess)) {
-            Report(L"WARNING: Visual Leak Detector: The symbol handler failed to deallocate resources (error=%lu).\n",
-                GetLastError());
-        }
+        ReportInternalStats();
 
         {
-            // Free internally allocated resources used by the heapmap and blockmap.
-            CriticalSectionLocker<> cs(g_heapMapLock);
-            for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-                BlockMap *blockmap = &(*heapit).second->blockMap;
-                for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-                    delete (*blockit).second;
+            // Free resources used by the symbol handler.
+            CriticalSectionLocker<DbgHelp> locker(g_DbgHelp);
+            if (m_symbolsInitialized) {
+                DbgTrace(L"dbghelp32.dll %i: SymCleanup\n", GetCurrentThreadId());
+                if (!g_DbgHelp.SymCleanup(g_currentProcess, locker)) {
+                    Report(L"WARNING: Visual Leak Detector: The symbol handler failed to deallocate resources (error=%lu).\n",
+                        GetLastError());
                 }
-                delete blockmap;
             }
-            delete m_heapMap;
+            for (SymbolModuleMap::Iterator symit = m_symbolModules->begin(); symit != m_symbolModules->end(); ++symit) {
+                delete (*symit).second;
+            }
+            delete m_symbolModules;
         }
+
+        // Free internally allocated resources used by the heapmap and blockmap.
+        delete m_tracker;
+        // Only free the frame descriptions once no call stack refers to them.
+        delete m_frameTable;
+        delete m_crtStartupPatterns;
+        delete m_internalFilePatterns;
+        delete m_capturePolicy;
         delete m_loadedModules;
 
         {
             // Free internally allocated resources used for thread local storage.
             CriticalSectionLocker<> cs(m_tlsLock);
             for (TlsMap::Iterator tlsit = m_tlsMap->begin(); tlsit != m_tlsMap->end(); ++tlsit) {
+#if defined(_M_X64)
+                delete (*tlsit).second->unwindCache;
+#endif
                 delete (*tlsit).second;
             }
             delete m_tlsMap;
@@ -694,11 +790,19 @@ VisualLeakDetector::~VisualLeakDetector ()
         delete g_pReportHooks;
         g_pReportHooks = NULL;
 
+        // The counters are VLD's own blocks. No other thread is left to
+        // record in them.
+        FreeInternalStats();
         checkInternalMemoryLeaks();
     }
     else {
         // VLD failed to load properly.
-        delete m_heapMap;
+        delete m_tracker;
+        delete m_symbolModules;
+        delete m_frameTable;
+        delete m_crtStartupPatterns;
+        delete m_internalFilePatterns;
+        delete m_capturePolicy;
         delete m_tlsMap;
         delete g_pReportHooks;
         g_pReportHooks = NULL;
@@ -707,9 +811,14 @@ VisualLeakDetector::~VisualLeakDetector ()
 
     m_optionsLock.Delete();
     m_modulesLock.Delete();
+    m_reportLock.Delete();
     m_tlsLock.Delete();
     g_heapMapLock.Delete();
-    g_vldHeapLock.Delete();
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+    for (UINT index = 0; index < VLD_BLOCK_LISTS; index++) {
+        g_vldBlockLists[index].lock.Delete();
+    }
+#endif
 
     if (m_tlsIndex != TLS_OUT_OF_INDEXES) {
         TlsFree(m_tlsIndex);
@@ -801,38 +910,11 @@ VOID VisualLeakDetector::attachToLoadedModules (ModuleSet *newmodules)
 
         DWORD64 modulebase = (DWORD64) (*newit).addrLow;
         LPCWSTR modulename = (*newit).name.c_str();
-        LPCWSTR modulepath = (*newit).path.c_str();
-        DWORD modulesize   = (DWORD)((*newit).addrHigh - (*newit).addrLow) + 1;
-
-        if ((state == 3) && (moduleFlags & VLD_MODULE_SYMBOLSLOADED)) {
-            // Discard the previously loaded symbols, so we can refresh them.
-            DbgTrace(L"dbghelp32.dll %i: SymUnloadModule64\n", GetCurrentThreadId());
-            if (g_DbgHelp.SymUnloadModule64(g_currentProcess, modulebase, locker) == false) {
-                Report(L"WARNING: Visual Leak Detector: Failed to unload the symbols for %s. Function names and line"
-                    L" numbers shown in the memory leak report for %s may be inaccurate.\n", modulename, modulename);
-            }
-        }
-
-        // Try to load the module's symbols. This ensures that we have loaded
-        // the symbols for every module that has ever been loaded into the
-        // process, guaranteeing the symbols' availability when generating the
-        // leak report.
-        IMAGEHLP_MODULE64     moduleimageinfo;
-        moduleimageinfo.SizeOfStruct = sizeof(IMAGEHLP_MODULE64);
-        BOOL SymbolsLoaded = g_DbgHelp.SymGetModuleInfoW64(g_currentProcess, modulebase, &moduleimageinfo, locker);
 
-        if (!SymbolsLoaded || moduleimageinfo.BaseOfImage != modulebase)
-        {
-            DbgTrace(L"dbghelp32.dll %i: SymLoadModuleEx\n", GetCurrentThreadId());
-            DWORD64 module = g_DbgHelp.SymLoadModuleExW(g_currentProcess, NULL, modulepath, NULL, modulebase, modulesize, NULL, 0, locker);
-            if (module == modulebase)
-            {
-                DbgTrace(L"dbghelp32.dll %i: SymGetModuleInfoW64\n", GetCurrentThreadId());
-                SymbolsLoaded = g_DbgHelp.SymGetModuleInfoW64(g_currentProcess, modulebase, &moduleimageinfo, locker);
-            }
-        }
-        if (SymbolsLoaded)
-            moduleFlags |= VLD_MODULE_SYMBOLSLOADED;
+        // Remember where the module came from, so that its symbols can be
+        // loaded if and when a leak report needs them, even if the module has
+        // been unloaded by then.
+        symbolmodule_t *symbols = recordSymbolModule(*newit, locker);
 
         if (_wcsicmp(TEXT(VLDDLL), modulename) == 0) {
             // What happens when a module goes through it's own portal? Bad things.
@@ -884,16 +966,7 @@ VOID VisualLeakDetector::attachToLoadedModules (ModuleSet *newmodules)
                 }
             }
         }
-        if ((moduleFlags & VLD_MODULE_EXCLUDED) == 0 &&
-            !(moduleFlags & VLD_MODULE_SYMBOLSLOADED) || (moduleimageinfo.SymType == SymExport)) {
-            // This module is going to be included in leak detection, but complete
-            // symbols for this module couldn't be loaded. This means that any stack
-            // traces through this module may lack information, like line numbers
-            // and function names.
-            Report(L"WARNING: Visual Leak Detector: A module, %s, included in memory leak detection\n"
-                L"  does not have any debugging symbols available, or they could not be located.\n"
-                L"  Function names and/or line numbers for this module may not be available.\n", modulename);
-        }
+        symbols->excluded = (moduleFlags & VLD_MODULE_EXCLUDED) != 0;
 
         // Update the module's flags in the "new modules" set.
         ModuleSet::Muterator  updateit;
@@ -907,6 +980,197 @@ VOID VisualLeakDetector::attachToLoadedModules (ModuleSet *newmodules)
     }
 }
 
+// recordSymbolModule - Records the identity of a loaded module, so that its
+//   symbols can be loaded later on by loadSymbols. If a different module was
+//   previously recorded at the same base address, it is replaced.
+//
+//   Note: The caller must hold the DbgHelp lock and the loader lock, and the
+//     module must still be loaded.
+//
+//  - moduleinfo (IN): Information about the loaded module.
+//
+//  - locker (IN): Proof that the DbgHelp lock is held.
+//
+//  Return Value:
+//
+//    Returns the recorded module identity.
+//
+symbolmodule_t* VisualLeakDetector::recordSymbolModule (const moduleinfo_t &moduleinfo,
+    CriticalSectionLocker<DbgHelp>& locker)
+{
+    UNREFERENCED_PARAMETER(locker);
+
+    // The link time stamp tells apart a module later reloaded at the same
+    // address, and lets loadSymbols detect a module file changed on disk.
+    DWORD timestamp = 0;
+    PIMAGE_DOS_HEADER dosheader = (PIMAGE_DOS_HEADER)moduleinfo.addrLow;
+    if (dosheader->e_magic == IMAGE_DOS_SIGNATURE) {
+        PIMAGE_NT_HEADERS ntheaders = (PIMAGE_NT_HEADERS)R2VA(dosheader, dosheader->e_lfanew);
+        if (ntheaders->Signature == IMAGE_NT_SIGNATURE)
+            timestamp = ntheaders->FileHeader.TimeDateStamp;
+    }
+
+    SymbolModuleMap::Iterator symit = m_symbolModules->find(moduleinfo.addrLow);
+    symbolmodule_t *module;
+    if (symit != m_symbolModules->end()) {
+        module = (*symit).second;
+        if ((module->timestamp == timestamp) && (_wcsicmp(module->path.c_str(), moduleinfo.path.c_str()) == 0)) {
+            // The same module, reloaded at the same address. Its symbols, if
+            // already loaded, are still valid.
+            module->size = (DWORD)(moduleinfo.addrHigh - moduleinfo.addrLow) + 1;
+            return module;
+        }
+    }
+    else {
+        module = new symbolmodule_t;
+        m_symbolModules->insert(moduleinfo.addrLow, module);
+    }
+
+    module->path      = moduleinfo.path;
+    module->base      = (DWORD64)moduleinfo.addrLow;
+    module->size      = (DWORD)(moduleinfo.addrHigh - moduleinfo.addrLow) + 1;
+    module->timestamp = timestamp;
+    module->excluded  = true;
+    module->pending   = true;
+    m_symbolsPending  = true;
+    return module;
+}
+
+// loadSymbols - Initializes the symbol handler, if it hasn't been yet, and
+//   loads the symbols of every module recorded since the last call. This is
+//   deferred until a call stack actually needs to be resolved, so that runs
+//   without any leaks never pay for loading symbols.
+//
+//   Note: Acquires the loader lock and the DbgHelp lock, so it must not be
+//     called while holding g_heapMapLock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::loadSymbols ()
+{
+    if (m_options & VLD_OPT_VLDOFF)
+        return;
+
+    LoaderLock ll;
+    CriticalSectionLocker<DbgHelp> locker(g_DbgHelp);
+    loadSymbols(locker);
+}
+
+// loadSymbols - Initializes the symbol handler, if it hasn't been yet, and
+//   loads the symbols of every module recorded since the last call.
+//
+//  - locker (IN): Proof that the DbgHelp lock is held.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::loadSymbols (CriticalSectionLocker<DbgHelp>& locker)
+{
+    if (!m_symbolsInitialized) {
+        m_symbolsInitialized = true;
+
+        LPWSTR symbolpath = buildSymbolSearchPath();
+#ifdef NOISY_DBGHELP_DIAGOSTICS
+        // From MSDN docs about SYMOPT_DEBUG:
+        /* To view all attempts to load symbols, call SymSetOptions with SYMOPT_DEBUG.
+        This causes DbgHelp to call the OutputDebugString function with detailed
+        information on symbol searches, such as the directories it is searching and and error messages.
+        In other words, this will really pollute the debug output window with extra messages.
+        To enable this debug output to be displayed to the console without changing your source code,
+        set the DBGHELP_DBGOUT environment variable to a non-NULL value before calling the SymInitialize function.
+        To log the information to a file, set the DBGHELP_LOG environment variable to the name of the log file to be used.
+        */
+        g_DbgHelp.SymSetOptions(SYMOPT_DEBUG | SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES, locker);
+#else
+        g_DbgHelp.SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES, locker);
+#endif
+        DbgTrace(L"dbghelp32.dll %i: SymInitializeW\n", GetCurrentThreadId());
+        if (!g_DbgHelp.SymInitializeW(g_currentProcess, symbolpath, FALSE, locker)) {
+            Report(L"WARNING: Visual Leak Detector: The symbol handler failed to initialize (error=%lu).\n"
+                L"    File and function names will probably not be available in call stacks.\n", GetLastError());
+        }
+        delete [] symbolpath;
+    }
+
+    if (!m_symbolsPending)
+        return;
+    m_symbolsPending = false;
+
+    for (SymbolModuleMap::Iterator symit = m_symbolModules->begin(); symit != m_symbolModules->end(); ++symit) {
+        symbolmodule_t *module = (*symit).second;
+        if (module->pending) {
+            module->pending = false;
+            loadModuleSymbols(*module, locker);
+        }
+    }
+}
+
+// loadModuleSymbols - Loads the symbols of a single module into the symbol
+//   handler, replacing the symbols of any other module previously loaded at
+//   the same address. The module need not be loaded in the process anymore:
+//   the symbols are located from the module's file.
+//
+//  - module (IN): Identity of the module whose symbols are to be loaded.
+//
+//  - locker (IN): Proof that the DbgHelp lock is held.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::loadModuleSymbols (const symbolmodule_t &module, CriticalSectionLocker<DbgHelp>& locker)
+{
+    LPCWSTR modulepath = module.path.c_str();
+    LPCWSTR modulename = wcsrchr(modulepath, L'\\');
+    modulename = (modulename != NULL) ? modulename + 1 : modulepath;
+
+    IMAGEHLP_MODULE64     moduleimageinfo;
+    moduleimageinfo.SizeOfStruct = sizeof(IMAGEHLP_MODULE64);
+    BOOL SymbolsLoaded = g_DbgHelp.SymGetModuleInfoW64(g_currentProcess, module.base, &moduleimageinfo, locker);
+    if (SymbolsLoaded && ((moduleimageinfo.BaseOfImage != module.base) || (moduleimageinfo.TimeDateStamp != module.timestamp))) {
+        // Discard the symbols of the module previously loaded at this address,
+        // so we can refresh them.
+        DbgTrace(L"dbghelp32.dll %i: SymUnloadModule64\n", GetCurrentThreadId());
+        if (g_DbgHelp.SymUnloadModule64(g_currentProcess, moduleimageinfo.BaseOfImage, locker) == false) {
+            Report(L"WARNING: Visual Leak Detector: Failed to unload the symbols for %s. Function names and line"
+                L" numbers shown in the memory leak report for %s may be inaccurate.\n", modulename, modulename);
+        }
+        SymbolsLoaded = FALSE;
+    }
+
+    if (!SymbolsLoaded)
+    {
+        DbgTrace(L"dbghelp32.dll %i: SymLoadModuleEx\n", GetCurrentThreadId());
+        DWORD64 base = g_DbgHelp.SymLoadModuleExW(g_currentProcess, NULL, modulepath, NULL, module.base, module.size, NULL, 0, locker);
+        if (base == module.base)
+        {
+            DbgTrace(L"dbghelp32.dll %i: SymGetModuleInfoW64\n", GetCurrentThreadId());
+            SymbolsLoaded = g_DbgHelp.SymGetModuleInfoW64(g_currentProcess, module.base, &moduleimageinfo, locker);
+        }
+    }
+
+    if (module.excluded)
+        return;
+
+    if (!SymbolsLoaded || (moduleimageinfo.SymType == SymExport)) {
+        // This module is included in leak detection, but complete symbols for
+        // this module couldn't be loaded. This means that any stack traces
+        // through this module may lack information, like line numbers and
+        // function names.
+        Report(L"WARNING: Visual Leak Detector: A module, %s, included in memory leak detection\n"
+            L"  does not have any debugging symbols available, or they could not be located.\n"
+            L"  Function names and/or line numbers for this module may not be available.\n", modulename);
+    }
+    else if (moduleimageinfo.TimeDateStamp != module.timestamp) {
+        // The module has been unloaded, and its file replaced since.
+        Report(L"WARNING: Visual Leak Detector: The file of a module, %s, changed after the module was\n"
+            L"  unloaded. Function names and line numbers shown for this module may be inaccurate.\n", modulename);
+    }
+}
+
 // buildsymbolsearchpath - Builds the symbol search path for the symbol handler.
 //   This helps the symbol handler find the symbols for the application being
 //   debugged.
@@ -1093,7 +1357,9 @@ BOOL VisualLeakDetector::GetIniFilePath(LPTSTR lpPath, SIZE_T cchPath)
     return FALSE;
 }
 
-// configure - Configures VLD using values read from the vld.ini file.
+// configure - Configures VLD using values read from the vld.ini file, any
+//   override files it names, and the Vld<Option> environment variables. Each
+//   file and the environment block are read exactly once.
 //
 //  Return Value:
 //
@@ -1106,79 +1372,141 @@ VOID VisualLeakDetector::configure ()
 
     Report(L"Visual Leak Detector read settings from: %s\n", found ? inipath : L"(default settings)");
 
-    // Read the boolean options.
-    const UINT buffersize = 64;
-    WCHAR buffer[buffersize] = { 0 };
-
-    if (!GetEnvironmentVariable(L"VLD", buffer, buffersize)) {
-        GetPrivateProfileString(L"Options", L"VLD", L"on", buffer, buffersize, inipath);
+    // Build the configuration in layers: defaults, vld.ini, then any chain of
+    // override files, and finally the environment, which always has the final
+    // say. The VldOverrideFile variable takes the place of the OverrideFile of
+    // vld.ini; the files further down the chain are named by the file above.
+    vldconfig_t config;
+    InitConfig(config, VLD_DEFAULT_MAX_DATA_DUMP, VLD_DEFAULT_MAX_TRACE_FRAMES);
+    if (found) {
+        LoadConfigFile(config, inipath);
+    }
+    WCHAR envoverride [VLD_CONFIG_MAX_PATH];
+    DWORD envlength = GetEnvironmentVariableW(VLD_CONFIG_ENV_PREFIX L"OverrideFile", envoverride, VLD_CONFIG_MAX_PATH);
+    if ((envlength > 0) && (envlength < VLD_CONFIG_MAX_PATH))
+        wcsncpy_s(config.overrideFile, VLD_CONFIG_MAX_PATH, envoverride, _TRUNCATE);
+
+    // Each override path is resolved once, relative to the directory of the
+    // file naming it, and each file is read at most once, which breaks cycles.
+    WCHAR visited [VLD_CONFIG_MAX_LAYERS + 1][MAX_PATH];
+    UINT visitedcount = 0;
+    if (_wfullpath(visited[0], inipath, MAX_PATH) == NULL)
+        wcsncpy_s(visited[0], MAX_PATH, inipath, _TRUNCATE);
+    visitedcount++;
+    while ((config.overrideFile[0] != '\0') && (visitedcount <= VLD_CONFIG_MAX_LAYERS)) {
+        LPCWSTR namingpath = visited[visitedcount - 1];
+        WCHAR relativepath [MAX_PATH] = {0};
+        LPCWSTR separator = wcsrchr(namingpath, L'\\');
+        if ((config.overrideFile[0] != L'\\') && (config.overrideFile[1] != L':') && (separator != NULL)) {
+            wcsncpy_s(relativepath, MAX_PATH, namingpath, separator - namingpath + 1);
+        }
+        wcsncat_s(relativepath, MAX_PATH, config.overrideFile, _TRUNCATE);
+        config.overrideFile[0] = '\0';
+
+        LPWSTR overridepath = visited[visitedcount];
+        if (_wfullpath(overridepath, relativepath, MAX_PATH) == NULL)
+            wcsncpy_s(overridepath, MAX_PATH, relativepath, _TRUNCATE);
+        bool seen = false;
+        for (UINT index = 0; index < visitedcount; index++) {
+            if (_wcsicmp(overridepath, visited[index]) == 0)
+                seen = true;
+        }
+        if (seen) {
+            Report(L"WARNING: Visual Leak Detector: Ignoring override settings already read from: %s\n", overridepath);
+            break;
+        }
+        if (!LoadConfigFile(config, overridepath)) {
+            Report(L"WARNING: Visual Leak Detector: Unable to read override settings from: %s\n", overridepath);
+            break;
+        }
+        Report(L"Visual Leak Detector read override settings from: %s\n", overridepath);
+        visitedcount++;
     }
+    LoadConfigEnvironment(config);
 
-    if (StrToBool(buffer) == FALSE) {
+    if (!config.vld) {
         m_options |= VLD_OPT_VLDOFF;
         return;
     }
 
-    if (LoadBoolOption(L"AggregateDuplicates", L"", inipath)) {
+    if (config.aggregateDuplicates) {
         m_options |= VLD_OPT_AGGREGATE_DUPLICATES;
     }
 
-    if (LoadBoolOption(L"SelfTest", L"", inipath)) {
+    if (config.selfTest) {
         m_options |= VLD_OPT_SELF_TEST;
     }
 
-    if (LoadBoolOption(L"SlowDebuggerDump", L"", inipath)) {
+    if (config.slowDebuggerDump) {
         m_options |= VLD_OPT_SLOW_DEBUGGER_DUMP;
     }
 
-    if (LoadBoolOption(L"StartDisabled", L"", inipath)) {
+    if (config.startDisabled) {
         m_options |= VLD_OPT_START_DISABLED;
     }
 
-    if (LoadBoolOption(L"TraceInternalFrames", L"", inipath)) {
+    if (config.traceInternalFrames) {
         m_options |= VLD_OPT_TRACE_INTERNAL_FRAMES;
     }
 
-    if (LoadBoolOption(L"SkipHeapFreeLeaks", L"", inipath)) {
+    if (config.skipHeapFreeLeaks) {
         m_options |= VLD_OPT_SKIP_HEAPFREE_LEAKS;
     }
 
-    if (LoadBoolOption(L"SkipCrtStartupLeaks", L"yes", inipath)) {
+    if (config.skipCrtStartupLeaks) {
         m_options |= VLD_OPT_SKIP_CRTSTARTUP_LEAKS;
     }
 
+    if (config.lifetimeHistograms) {
+        m_options |= VLD_OPT_LIFETIME_HISTOGRAMS;
+    }
+
+    if (config.reachabilityScan) {
+        m_options |= VLD_OPT_REACHABILITY_SCAN;
+    }
+
+    if (config.internalStats) {
+        m_options |= VLD_OPT_INTERNAL_STATS;
+    }
+
     // Read the integer configuration options.
-    m_maxDataDump = LoadIntOption(L"MaxDataDump", VLD_DEFAULT_MAX_DATA_DUMP, inipath);
-    m_maxTraceFrames = LoadIntOption(L"MaxTraceFrames", VLD_DEFAULT_MAX_TRACE_FRAMES, inipath);
+    m_maxDataDump = config.maxDataDump;
+    m_maxTraceFrames = config.maxTraceFrames;
     if (m_maxTraceFrames < 1) {
         m_maxTraceFrames = VLD_DEFAULT_MAX_TRACE_FRAMES;
     }
+    m_suspectWindow = config.leakSuspectWindow;
 
     // Read the force-include module list.
-    LoadStringOption(L"ForceIncludeModules", m_forcedModuleList, MAXMODULELISTLENGTH, inipath);
+    wcsncpy_s(m_forcedModuleList, MAXMODULELISTLENGTH, config.forceIncludeModules, _TRUNCATE);
     _wcslwr_s(m_forcedModuleList, MAXMODULELISTLENGTH);
     if (wcscmp(m_forcedModuleList, L"*") == 0)
         m_forcedModuleList[0] = '\0';
     else
         m_options |= VLD_OPT_MODULE_LIST_INCLUDE;
 
+    // Read the frame classification patterns. They can only be compiled once
+    // VLD's internal heap exists.
+    wcsncpy_s(m_crtStartupFunctions, MAXMODULELISTLENGTH, config.crtStartupFunctions, _TRUNCATE);
+    wcsncpy_s(m_internalSourceFiles, MAXMODULELISTLENGTH, config.internalSourceFiles, _TRUNCATE);
+    wcsncpy_s(m_captureRules, MAXMODULELISTLENGTH, config.captureRules, _TRUNCATE);
+
     // Read the report destination (debugger, file, or both).
     WCHAR filename [MAX_PATH] = {0};
-    LoadStringOption(L"ReportFile", filename, MAX_PATH, inipath);
+    wcsncpy_s(filename, MAX_PATH, config.reportFile, _TRUNCATE);
     if (filename[0] == '\0') {
         wcsncpy_s(filename, MAX_PATH, VLD_DEFAULT_REPORT_FILE_NAME, _TRUNCATE);
     }
     WCHAR* path = _wfullpath(m_reportFilePath, filename, MAX_PATH);
     assert(path);
 
-    LoadStringOption(L"ReportTo", buffer, buffersize, inipath);
-    if (_wcsicmp(buffer, L"both") == 0) {
+    if (_wcsicmp(config.reportTo, L"both") == 0) {
         m_options |= (VLD_OPT_REPORT_TO_DEBUGGER | VLD_OPT_REPORT_TO_FILE);
     }
-    else if (_wcsicmp(buffer, L"file") == 0) {
+    else if (_wcsicmp(config.reportTo, L"file") == 0) {
         m_options |= VLD_OPT_REPORT_TO_FILE;
     }
-    else if (_wcsicmp(buffer, L"stdout") == 0) {
+    else if (_wcsicmp(config.reportTo, L"stdout") == 0) {
         m_options |= VLD_OPT_REPORT_TO_STDOUT;
     }
     else {
@@ -1186,8 +1514,7 @@ VOID VisualLeakDetector::configure ()
     }
 
     // Read the report file encoding (ascii or unicode).
-    LoadStringOption(L"ReportEncoding", buffer, buffersize, inipath);
-    if (_wcsicmp(buffer, L"unicode") == 0) {
+    if (_wcsicmp(config.reportEncoding, L"unicode") == 0) {
         m_options |= VLD_OPT_UNICODE_REPORT;
     }
     if ((m_options & VLD_OPT_UNICODE_REPORT) && !(m_options & VLD_OPT_REPORT_TO_FILE)) {
@@ -1199,12 +1526,11 @@ VOID VisualLeakDetector::configure ()
     }
 
     // Read the stack walking method.
-    LoadStringOption(L"StackWalkMethod", buffer, buffersize, inipath);
-    if (_wcsicmp(buffer, L"safe") == 0) {
+    if (_wcsicmp(config.stackWalkMethod, L"safe") == 0) {
         m_options |= VLD_OPT_SAFE_STACK_WALK;
     }
 
-    if (LoadBoolOption(L"ValidateHeapAllocs", L"", inipath)) {
+    if (config.validateHeapAllocs) {
         m_options |= VLD_OPT_VALIDATE_HEAPFREE;
     }
 }
@@ -1240,50 +1566,71 @@ BOOL VisualLeakDetector::enabled ()
     return ((tls->flags & VLD_TLS_ENABLED) != 0);
 }
 
-// eraseduplicates - Erases, from the block maps, blocks that appear to be
-//   duplicate leaks of an already identified leak.
+// classifyleaks - Finds which leaks of a snapshot are still reachable from the
+//   writable sections of the loaded modules (VLD's own excepted), and from the
+//   stack and registers of the calling thread. The scan runs on the calling
+//   thread only: threads started while the loader lock is held couldn't run.
+//   See BlockTracker::classifyLeaks.
 //
-//  - element (IN): BlockMap Iterator referencing the block of which to search
-//      for duplicates.
+//  - snapshot (IN/OUT): The leaks to classify.
+//
+//  - reachablebytes (OUT): Receives the total size of the still reachable
+//      leaks.
 //
 //  Return Value:
 //
-//    Returns the number of duplicate blocks erased from the block map.
+//    Returns the number of still reachable leaks.
 //
-SIZE_T VisualLeakDetector::eraseDuplicates (const BlockMap::Iterator &element, Set<blockinfo_t*> &aggregatedLeaks)
+SIZE_T VisualLeakDetector::classifyLeaks (LeakSnapshot &snapshot, SIZE_T &reachablebytes)
 {
-    blockinfo_t *elementinfo = (*element).second;
-
-    if (elementinfo->callStack == NULL)
-        return 0;
-
-    SIZE_T       erased = 0;
-    // Iterate through all block maps, looking for blocks with the same size
-    // and callstack as the specified element.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        BlockMap *blockmap = &(*heapit).second->blockMap;
-        for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-            if (blockit == element) {
-                // Don't delete the element of which we are searching for
-                // duplicates.
+    ReachabilityScan scan;
+    {
+        CriticalSectionLocker<> cs(m_modulesLock);
+        for (ModuleSet::Iterator moduleit = m_loadedModules->begin(); moduleit != m_loadedModules->end(); ++moduleit) {
+            if ((*moduleit).addrLow == (UINT_PTR)m_vldBase)
                 continue;
-            }
-            blockinfo_t *info = (*blockit).second;
-            if (info->callStack == NULL)
+            PIMAGE_DOS_HEADER dosheader = (PIMAGE_DOS_HEADER)(*moduleit).addrLow;
+            if (dosheader->e_magic != IMAGE_DOS_SIGNATURE)
                 continue;
-            Set<blockinfo_t*>::Iterator it = aggregatedLeaks.find(info);
-            if (it != aggregatedLeaks.end())
+            PIMAGE_NT_HEADERS ntheaders = (PIMAGE_NT_HEADERS)R2VA(dosheader, dosheader->e_lfanew);
+            if (ntheaders->Signature != IMAGE_NT_SIGNATURE)
                 continue;
-            if ((info->size == elementinfo->size) && (*(info->callStack) == *(elementinfo->callStack))) {
-                // Found a duplicate. Mark it.
-                aggregatedLeaks.insert(info);
-                erased++;
+            PIMAGE_SECTION_HEADER section = IMAGE_FIRST_SECTION(ntheaders);
+            for (WORD index = 0; index < ntheaders->FileHeader.NumberOfSections; index++, section++) {
+                if ((section->Characteristics & IMAGE_SCN_MEM_WRITE) &&
+                    !(section->Characteristics & IMAGE_SCN_MEM_DISCARDABLE))
+                    scan.addRoot(R2VA(dosheader, section->VirtualAddress), section->Misc.VirtualSize);
             }
         }
     }
 
-    return erased;
+    // The registers are saved on the stack, at the bottom of the range scanned.
+    CONTEXT context;
+    RtlCaptureContext(&context);
+    NT_TIB* tib = (NT_TIB*)NtCurrentTeb();
+    if (((UINT_PTR)&context >= (UINT_PTR)tib->StackLimit) && ((UINT_PTR)&context < (UINT_PTR)tib->StackBase))
+        scan.addRoot(&context, (UINT_PTR)tib->StackBase - (UINT_PTR)&context);
+
+    return m_tracker->classifyLeaks(snapshot, scan, 1, snapshotBlock, NULL, reachablebytes);
+}
+
+// countleaks - Counts the leaks of a snapshot, dropping those which shouldn't
+//   be reported.
+//
+//   Note: Resolving symbols for the CRT startup check may need the loader lock.
+//
+//  - snapshot (IN/OUT): The leaks to count. On return, the count of each leak
+//      is the number of leaks to report under its heading.
+//
+//  - aggregate (IN): If true, duplicate leaks are folded into the first one.
+//
+//  Return Value:
+//
+//    Returns the number of leaks.
+//
+SIZE_T VisualLeakDetector::countLeaks (LeakSnapshot &snapshot, bool aggregate)
+{
+    return BlockTracker::countLeaks(snapshot, aggregate, (m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS) != 0);
 }
 
 // gettls - Obtains the thread local storage structure for the calling thread.
@@ -1295,6 +1642,8 @@ SIZE_T VisualLeakDetector::eraseDuplicates (const BlockMap::Iterator &element, S
 //
 tls_t* VisualLeakDetector::getTls ()
 {
+    StatTimer timer(STATS_GET_TLS);
+
 #if defined(PRESERVE_WSAERROR)
     // save winsock last error because TlsGetValue resets it
     // perhaps we should do the same wit lasterror ?
@@ -1312,32 +1661,71 @@ tls_t* VisualLeakDetector::getTls ()
     if (tls == NULL) {
         DWORD threadId = GetCurrentThreadId();
 
-        CriticalSectionLocker<> cs(m_tlsLock);
-        TlsMap::Iterator it = m_tlsMap->find(threadId);
-        if (it == m_tlsMap->end()) {
-            // This thread's thread local storage structure has not been allocated.
-            tls = new tls_t;
+        {
+            CriticalSectionLocker<> cs(m_tlsLock);
+            TlsMap::Iterator it = m_tlsMap->find(threadId);
+            if (it == m_tlsMap->end()) {
+                // This thread's thread local storage structure has not been allocated.
+                tls = new tls_t;
+#if defined(_M_X64)
+                tls->unwindCache = NULL;
+#endif
 
-            // Add this thread's TLS to the TlsSet.
-            m_tlsMap->insert(threadId, tls);
-        } else {
-            // Already had a thread with this ID
-            tls = (*it).second;
-        }
+                // Add this thread's TLS to the TlsSet.
+                m_tlsMap->insert(threadId, tls);
+            } else {
+                // Already had a thread with this ID
+                tls = (*it).second;
+            }
 
-        ZeroMemory(&tls->context, sizeof(tls->context));
-        tls->flags = 0x0;
-        tls->oldFlags = 0x0;
-        tls->threadId = threadId;
-        tls->blockWithoutGuard = NULL;
-        TlsSetValue(m_tlsIndex, tls);
+            ZeroMemory(&tls->context, sizeof(tls->context));
+            ZeroMemory(&tls->capture, sizeof(tls->capture));
+            tls->flags = 0x0;
+            tls->oldFlags = 0x0;
+            tls->threadId = threadId;
+            tls->blockWithoutGuard = NULL;
+            tls->detached.address = NULL;
+            TlsSetValue(m_tlsIndex, tls);
+        }
     }
 
     return tls;
 }
 
+// readThreadName - Passes the current name of the calling thread to the
+//   capture rules. The name is allocated from the process heap: leak detection
+//   is disabled for the thread meanwhile, so that the hooks leave the name, and
+//   the allocation being tracked by the thread, alone.
+//
+//  - tls (IN/OUT): The calling thread's thread local storage structure.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::readThreadName (tls_t* tls)
+{
+    PWSTR name = NULL;
+    if (m_capturePolicy->usesThreadNames() && (g_GetThreadDescription != NULL)) {
+        UINT32 state = tls->flags & (VLD_TLS_DISABLED | VLD_TLS_ENABLED);
+        tls->flags &= ~VLD_TLS_ENABLED;
+        tls->flags |= VLD_TLS_DISABLED;
+        if (FAILED(g_GetThreadDescription(GetCurrentThread(), &name)))
+            name = NULL;
+        tls->flags &= ~(VLD_TLS_DISABLED | VLD_TLS_ENABLED);
+        tls->flags |= state;
+    }
+
+    m_capturePolicy->setThreadName(tls->capture, name, (name != NULL) ? wcslen(name) : 0);
+    if (name != NULL)
+        LocalFree(name);
+}
+
 // mapblock - Tracks memory allocations. Information about allocated blocks is
-//   collected and then the block is mapped to this information.
+//   collected and then the block is mapped to this information (see
+//   BlockTracker::mapBlock).
+//
+//   Caller must hold g_heapMapLock.
 //
 //  - heap (IN): Handle to the heap from which the block has been allocated.
 //
@@ -1345,12 +1733,14 @@ tls_t* VisualLeakDetector::getTls ()
 //
 //  - size (IN): Size, in bytes, of the memory block being allocated.
 //
-//  - addrOfRetAddr (IN): Address of return address at the time this allocation
-//      first entered VLD's code. This is used from determining the starting
-//      point for the stack trace.
+//  - debugcrtalloc (IN): Should be set to TRUE if this allocation is a CRT
+//      memory block. Otherwise should be FALSE.
 //
-//  - crtalloc (IN): Should be set to TRUE if this allocation is a CRT memory
-//      block. Otherwise should be FALSE.
+//  - ucrt (IN): Should be set to TRUE if the CRT memory block is the UCRT's.
+//
+//  - threadId (IN): ID of the thread allocating the block.
+//
+//  - pblockInfo (OUT): Receives the block's record.
 //
 //  Return Value:
 //
@@ -1358,48 +1748,12 @@ tls_t* VisualLeakDetector::getTls ()
 //
 VOID VisualLeakDetector::mapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, bool debugcrtalloc, bool ucrt, DWORD threadId, blockinfo_t* &pblockInfo)
 {
-    // Record the block's information.
-    blockinfo_t* blockinfo = new blockinfo_t();
-    blockinfo->callStack = NULL;
-    pblockInfo = blockinfo;
-    blockinfo->threadId = threadId;
-    blockinfo->serialNumber = m_requestCurr++;
-    blockinfo->size = size;
-    blockinfo->reported = false;
-    blockinfo->debugCrtAlloc = debugcrtalloc;
-    blockinfo->ucrt = ucrt;
-
-    if (SIZE_MAX - m_totalAlloc > size)
-        m_totalAlloc += size;
-    else
-        m_totalAlloc = SIZE_MAX;
-    m_curAlloc += size;
-
-    if (m_curAlloc > m_maxAlloc)
-        m_maxAlloc = m_curAlloc;
-
-    // Insert the block's information into the block map.
-    HeapMap::Iterator heapit = m_heapMap->find(heap);
-    if (heapit == m_heapMap->end()) {
-        // We haven't mapped this heap to a block map yet. Do it now.
-        mapHeap(heap);
-        heapit = m_heapMap->find(heap);
-        assert(heapit != m_heapMap->end());
-    }
-    BlockMap* blockmap = &(*heapit).second->blockMap;
-    BlockMap::Iterator blockit = blockmap->insert(mem, blockinfo);
-    if (blockit == blockmap->end()) {
-        // A block with this address has already been allocated. The
-        // previously allocated block must have been freed (probably by some
-        // mechanism unknown to VLD), or the heap wouldn't have allocated it
-        // again. Replace the previously allocated info with the new info.
-        blockit = blockmap->find(mem);
-        blockinfo_t* info = (*blockit).second;
-        m_curAlloc -= info->size;
-        Report(L"VLD: New allocation at already allocated address: 0x%p with size: %u and new size: %u\n", mem, info->size, size);
-        delete info;
-        blockmap->erase(blockit);
-        blockmap->insert(mem, blockinfo);
+    UINT32 flags = (debugcrtalloc ? VLD_BLOCK_DEBUGCRTALLOC : 0) | (ucrt ? VLD_BLOCK_UCRT : 0);
+    SIZE_T oldsize;
+    if (!m_tracker->mapBlock(heap, mem, size, flags, threadId, pblockInfo, oldsize)) {
+        // The previously allocated block must have been freed by some
+        // mechanism unknown to VLD.
+        Report(L"VLD: New allocation at already allocated address: 0x%p with size: %u and new size: %u\n", mem, oldsize, size);
     }
 }
 
@@ -1415,22 +1769,10 @@ VOID VisualLeakDetector::mapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, bool d
 //
 VOID VisualLeakDetector::mapHeap (HANDLE heap)
 {
-    CriticalSectionLocker<> cs(g_heapMapLock);
-
-    // Create a new block map for this heap and insert it into the heap map.
-    heapinfo_t* heapinfo = new heapinfo_t;
-    heapinfo->blockMap.reserve(BLOCK_MAP_RESERVE);
-    heapinfo->flags = 0x0;
-
-    HeapMap::Iterator heapit = m_heapMap->insert(heap, heapinfo);
-    if (heapit == m_heapMap->end()) {
+    if (!m_tracker->mapHeap(heap)) {
         // Somehow this heap has been created twice without being destroyed,
-        // or at least it was destroyed without VLD's knowledge. Unmap the heap
-        // from the existing heapinfo, and remap it to the new one.
+        // or at least it was destroyed without VLD's knowledge.
         Report(L"WARNING: Visual Leak Detector detected a duplicate heap (" ADDRESSFORMAT L").\n", heap);
-        heapit = m_heapMap->find(heap);
-        unmapHeap((*heapit).first);
-        m_heapMap->insert(heap, heapinfo);
     }
 }
 
@@ -1441,76 +1783,55 @@ VOID VisualLeakDetector::mapHeap (HANDLE heap)
 //
 //  - mem (IN): Pointer to the memory block being freed.
 //
+//  - context (IN): Where the free entered VLD's code. Used for the call stack
+//      reported if the block was allocated from another heap.
+//
 //  Return Value:
 //
 //    None.
 //
 VOID VisualLeakDetector::unmapBlock (HANDLE heap, LPCVOID mem, const context_t &context)
 {
-    if (NULL == mem)
+    if (m_tracker->unmapBlock(heap, mem) || !(m_options & VLD_OPT_VALIDATE_HEAPFREE))
         return;
 
-    // Find this heap's block map.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    HeapMap::Iterator heapit = m_heapMap->find(heap);
-    if (heapit == m_heapMap->end()) {
-        // We don't have a block map for this heap. We must not have monitored
-        // this allocation (probably happened before VLD was initialized).
-        return;
-    }
+    // This memory block is not in the block map. We must not have monitored this
+    // allocation (probably happened before VLD was initialized).
 
-    // Find this block in the block map.
-    BlockMap           *blockmap = &(*heapit).second->blockMap;
-    BlockMap::Iterator  blockit = blockmap->find(mem);
-    if (blockit == blockmap->end())
+    // This can also result from allocating on one heap, and freeing on another heap.
+    // This is an especially bad way to corrupt the application.
+    // Now we have to search through every heap and every single block in each to make
+    // sure that this is indeed the case.
+    CriticalSectionLocker<> cs(g_heapMapLock);
+    HANDLE other_heap = NULL;
+    blockinfo_t* alloc_block = m_tracker->findBlock(mem, other_heap); // other_heap is an out parameter
+    bool diff = other_heap != heap; // Check indeed if the other heap is different
+    CallStack* alloc_stack = alloc_block ? m_tracker->stackTable()->get(alloc_block->stackId) : NULL;
+    if (alloc_stack && diff)
     {
-        // This memory block is not in the block map. We must not have monitored this
-        // allocation (probably happened before VLD was initialized).
-
-        // This can also result from allocating on one heap, and freeing on another heap.
-        // This is an especially bad way to corrupt the application.
-        // Now we have to search through every heap and every single block in each to make
-        // sure that this is indeed the case.
-        if (m_options & VLD_OPT_VALIDATE_HEAPFREE)
-        {
-            HANDLE other_heap = NULL;
-            blockinfo_t* alloc_block = findAllocedBlock(mem, other_heap); // other_heap is an out parameter
-            bool diff = other_heap != heap; // Check indeed if the other heap is different
-            if (alloc_block && alloc_block->callStack && diff)
-            {
-                Report(L"CRITICAL ERROR!: VLD reports that memory was allocated in one heap and freed in another.\nThis will result in a corrupted heap.\nAllocation Call stack.\n");
-                Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", alloc_block->serialNumber, mem, alloc_block->size);
-                Report(L"  TID: %u\n", alloc_block->threadId);
-                Report(L"  Call Stack:\n");
-                alloc_block->callStack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
+        Report(L"CRITICAL ERROR!: VLD reports that memory was allocated in one heap and freed in another.\nThis will result in a corrupted heap.\nAllocation Call stack.\n");
+        Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", (SIZE_T)alloc_block->serialNumber, mem, alloc_block->size);
+        Report(L"  TID: %u\n", alloc_block->threadId);
+        Report(L"  Call Stack:\n");
+        alloc_stack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
 
-                // Now we need a way to print the current callstack at this point:
-                CallStack* stack_here = CallStack::Create(m_options & VLD_OPT_SAFE_STACK_WALK);
-                stack_here->getStackTrace(m_maxTraceFrames, context);
-                Report(L"Deallocation Call stack.\n");
-                Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", alloc_block->serialNumber, mem, alloc_block->size);
-                Report(L"  Call Stack:\n");
-                stack_here->dump(FALSE, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
-                // Now it should be safe to delete our temporary callstack
-                delete stack_here;
-                stack_here = NULL;
-                if (IsDebuggerPresent())
-                    DebugBreak();
-            }
-        }
-        return;
+        // Now we need a way to print the current callstack at this point:
+        CallStack* stack_here = CallStack::Create(m_options & VLD_OPT_SAFE_STACK_WALK);
+        stack_here->getStackTrace(m_maxTraceFrames, context);
+        Report(L"Deallocation Call stack.\n");
+        Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", (SIZE_T)alloc_block->serialNumber, mem, alloc_block->size);
+        Report(L"  Call Stack:\n");
+        stack_here->dump(FALSE, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
+        // Now it should be safe to delete our temporary callstack
+        delete stack_here;
+        stack_here = NULL;
+        if (IsDebuggerPresent())
+            DebugBreak();
     }
-
-    // Free the blockinfo_t structure and erase it from the block map.
-    blockinfo_t *info = (*blockit).second;
-    m_curAlloc -= info->size;
-    delete info;
-    blockmap->erase(blockit);
 }
 
 // unmapheap - Tracks heap destruction. Unmaps the specified heap from its block
-//   map. The block map is cleared and deleted, relinquishing internally
-//   allocated resources.
+//   map, relinquishing internally allocated resources.
 //
 //  - heap (IN): Handle to the heap which is being destroyed.
 //
@@ -1520,34 +1841,16 @@ VOID VisualLeakDetector::unmapBlock (HANDLE heap, LPCVOID mem, const context_t &
 //
 VOID VisualLeakDetector::unmapHeap (HANDLE heap)
 {
-    // Find this heap's block map.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    HeapMap::Iterator heapit = m_heapMap->find(heap);
-    if (heapit == m_heapMap->end()) {
-        // This heap hasn't been mapped. We must not have monitored this heap's
-        // creation (probably happened before VLD was initialized).
-        return;
-    }
-
-    // Free all of the blockinfo_t structures stored in the block map.
-    heapinfo_t *heapinfo = (*heapit).second;
-    BlockMap   *blockmap = &heapinfo->blockMap;
-    for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-        m_curAlloc -= (*blockit).second->size;
-        delete (*blockit).second;
-    }
-    delete heapinfo;
-
-    // Remove this heap's block map from the heap map.
-    m_heapMap->erase(heapit);
+    m_tracker->unmapHeap(heap);
 }
 
-// remapblock - Tracks reallocations. Unmaps a block from its previously
-//   collected information and remaps it to updated information.
+// remapblock - Tracks reallocations. The record of the block, detached
+//   before the block was reallocated, is mapped to the updated information.
 //
 //  Note: If the block itself remains at the same address, then the block's
-//   information can simply be updated rather than having to actually erase and
-//   reinsert the block.
+//   record can simply be attached again, rather than a new one being mapped.
+//
+//   Caller must hold g_heapMapLock.
 //
 //  - heap (IN): Handle to the heap from which the memory is being reallocated.
 //
@@ -1559,76 +1862,35 @@ VOID VisualLeakDetector::unmapHeap (HANDLE heap)
 //
 //  - size (IN): Size, in bytes, of the new memory block.
 //
-//  - framepointer (IN): The frame pointer at which this reallocation entered
-//      VLD's code. Used for determining the starting point of the stack trace.
+//  - debugcrtalloc (IN): Should be set to TRUE if this reallocation is for a
+//      CRT memory block. Otherwise should be set to FALSE.
+//
+//  - ucrt (IN): Should be set to TRUE if the CRT memory block is the UCRT's.
+//
+//  - threadId (IN): ID of the thread reallocating the block.
+//
+//  - detached (IN/OUT): The record detached by CaptureContext::Detach, or an
+//      empty one if the block wasn't tracked. It is left empty.
 //
-//  - crtalloc (IN): Should be set to TRUE if this reallocation is for a CRT
-//      memory block. Otherwise should be set to FALSE.
+//  - pblockInfo (OUT): Receives the block's record.
 //
 //  Return Value:
 //
 //    None.
 //
 VOID VisualLeakDetector::remapBlock (HANDLE heap, LPCVOID mem, LPCVOID newmem, SIZE_T size,
-    bool debugcrtalloc, bool ucrt, DWORD threadId, blockinfo_t* &pblockInfo, const context_t &context)
+    bool debugcrtalloc, bool ucrt, DWORD threadId, detachedblock_t &detached, blockinfo_t* &pblockInfo)
 {
-    if (newmem != mem) {
-        // The block was not reallocated in-place. Instead the old block was
-        // freed and a new block allocated to satisfy the new size.
-        unmapBlock(heap, mem, context);
-        mapBlock(heap, newmem, size, debugcrtalloc, ucrt, threadId, pblockInfo);
-        return;
-    }
-
-    // The block was reallocated in-place. Find the existing blockinfo_t
-    // entry in the block map and update it with the new callstack and size.
-    HeapMap::Iterator heapit = m_heapMap->find(heap);
-    if (heapit == m_heapMap->end()) {
-        // We haven't mapped this heap to a block map yet. Obviously the
-        // block has also not been mapped to a blockinfo_t entry yet either,
-        // so treat this reallocation as a brand-new allocation (this will
-        // also map the heap to a new block map).
-        mapBlock(heap, newmem, size, debugcrtalloc, ucrt, threadId, pblockInfo);
+    if ((newmem == mem) && (detached.address != NULL)) {
+        pblockInfo = m_tracker->attachBlock(detached, size, threadId, false);
         return;
     }
 
-    // Find the block's blockinfo_t structure so that we can update it.
-    BlockMap           *blockmap = &(*heapit).second->blockMap;
-    BlockMap::Iterator  blockit = blockmap->find(mem);
-    if (blockit == blockmap->end()) {
-        // The block hasn't been mapped to a blockinfo_t entry yet.
-        // Treat this reallocation as a new allocation.
-        mapBlock(heap, newmem, size, debugcrtalloc, ucrt, threadId, pblockInfo);
-        return;
-    }
-
-    // Found the blockinfo_t entry for this block. Update it with
-    // a new callstack and new size.
-    blockinfo_t* info = (*blockit).second;
-    if (info->callStack)
-    {
-        info->callStack.reset();
-    }
-
-    if (m_totalAlloc < SIZE_MAX)
-    {
-        m_totalAlloc -= info->size;
-        if (SIZE_MAX - m_totalAlloc > size)
-            m_totalAlloc += size;
-        else
-            m_totalAlloc = SIZE_MAX;
-    }
-
-    m_curAlloc -= info->size;
-    m_curAlloc += size;
-
-    if (m_curAlloc > m_maxAlloc)
-        m_maxAlloc = m_curAlloc;
-
-    info->threadId = threadId;
-    // Update the block's size.
-    info->size = size;
-    pblockInfo = info;
+    // The block was not reallocated in-place. Instead the old block was
+    // freed and a new block allocated to satisfy the new size. A block VLD
+    // didn't track is tracked from now on.
+    m_tracker->releaseDetached(detached);
+    mapBlock(heap, newmem, size, debugcrtalloc, ucrt, threadId, pblockInfo);
 }
 
 // reportconfig - Generates a brief report summarizing Visual Leak Detector's
@@ -1658,6 +1920,21 @@ VOID VisualLeakDetector::reportConfig ()
     if (m_maxTraceFrames != VLD_DEFAULT_MAX_TRACE_FRAMES) {
         Report(L"    Limiting stack traces to %u frames.\n", m_maxTraceFrames);
     }
+    if (m_suspectWindow != 0) {
+        Report(L"    Looking for suspected leaks every %Iu allocations.\n", m_suspectWindow);
+    }
+    if (m_options & VLD_OPT_LIFETIME_HISTOGRAMS) {
+        Report(L"    Counting the lifetimes of the blocks freed from each call site.\n");
+    }
+    if (m_options & VLD_OPT_REACHABILITY_SCAN) {
+        Report(L"    Leaving leaks still reachable from the program's data out of the report.\n");
+    }
+    if (m_options & VLD_OPT_INTERNAL_STATS) {
+        Report(L"    Measuring Visual Leak Detector's own operations.\n");
+    }
+    if (m_capturePolicy != NULL) {
+        Report(L"    Tracking allocations following %Iu capture rule(s): %s\n", m_capturePolicy->ruleCount(), m_captureRules);
+    }
     if (m_options & VLD_OPT_UNICODE_REPORT) {
         Report(L"    Generating a Unicode (UTF-16) encoded report.\n");
     }
@@ -1689,109 +1966,50 @@ VOID VisualLeakDetector::reportConfig ()
 bool VisualLeakDetector::isDebugCrtAlloc( LPCVOID block, blockinfo_t* info )
 {
     // Autodetection allocations from statically linked CRT
-    if (!info->debugCrtAlloc) {
+    if (!(info->flags & VLD_BLOCK_DEBUGCRTALLOC)) {
         crtdbgblockheader_t* crtheader = (crtdbgblockheader_t*)block;
         SIZE_T nSize = sizeof(crtdbgblockheader_t) + crtheader->size + GAPSIZE;
         int nValid = _CrtIsValidPointer(block, (unsigned int)info->size, TRUE);
         if (_BLOCK_TYPE_IS_VALID(crtheader->use) && nValid && (nSize == info->size)) {
-            info->debugCrtAlloc = true;
-            info->ucrt = false;
+            info->flags |= VLD_BLOCK_DEBUGCRTALLOC;
+            info->flags &= ~VLD_BLOCK_UCRT;
         }
     }
 
-    if (!info->debugCrtAlloc) {
+    if (!(info->flags & VLD_BLOCK_DEBUGCRTALLOC)) {
         crtdbgblockheaderucrt_t* crtheader = (crtdbgblockheaderucrt_t*)block;
         SIZE_T nSize = sizeof(crtdbgblockheaderucrt_t) + crtheader->size + GAPSIZE;
         int nValid = _CrtIsValidPointer(block, (unsigned int)info->size, TRUE);
         if (_BLOCK_TYPE_IS_VALID(crtheader->use) && nValid && (nSize == info->size)) {
-            info->debugCrtAlloc = true;
-            info->ucrt = true;
-        }
-    }
-
-    return info->debugCrtAlloc;
-}
-
-// getleakscount - Calculate number of memory leaks.
-//
-//  - heap (IN): Handle to the heap for which to generate a memory leak
-//      report.
-//
-//  Return Value:
-//
-//    None.
-//
-SIZE_T VisualLeakDetector::getLeaksCount (heapinfo_t* heapinfo, DWORD threadId)
-{
-    BlockMap* blockmap   = &heapinfo->blockMap;
-    SIZE_T memoryleaks = 0;
-
-    for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit)
-    {
-        // Found a block which is still in the BlockMap. We've identified a
-        // potential memory leak.
-        LPCVOID block = (*blockit).first;
-        blockinfo_t* info = (*blockit).second;
-        if (info->reported)
-            continue;
-
-        if (threadId != ((DWORD)-1) && info->threadId != threadId)
-            continue;
-
-        if (isDebugCrtAlloc(block, info)) {
-            // This block is allocated to a CRT heap, so the block has a CRT
-            // memory block header pretended to it.
-            int blockUse = getCrtBlockUse(block, info->ucrt);
-            // Leaks identified as CRT_USE_IGNORE should not be ignored here otherwise
-            // DynamicLoader/Thread test will randomly fail with less leaks being reported.
-            if (CRT_USE_TYPE(blockUse) == CRT_USE_FREE ||
-                CRT_USE_TYPE(blockUse) == CRT_USE_INTERNAL) {
-                // This block is marked as being used internally by the CRT.
-                // The CRT will free the block after VLD is destroyed.
-                continue;
-            }
-        }
-
-        if (m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS) {
-            // Check for crt startup allocations
-            if (info->callStack && info->callStack->isCrtStartupAlloc()) {
-                info->reported = true;
-                continue;
-            }
+            info->flags |= VLD_BLOCK_DEBUGCRTALLOC | VLD_BLOCK_UCRT;
         }
-
-        memoryleaks ++;
     }
 
-    return memoryleaks;
+    return (info->flags & VLD_BLOCK_DEBUGCRTALLOC) != 0;
 }
 
-// reportleaks - Generates a memory leak report for the specified heap.
+// reportheapleaks - Generates a memory leak report for the specified heap.
 //
 //  - heap (IN): Handle to the heap for which to generate a memory leak
 //      report.
 //
 //  Return Value:
 //
-//    None.
+//    Returns the number of leaks found in the heap.
 //
 SIZE_T VisualLeakDetector::reportHeapLeaks (HANDLE heap)
 {
     assert(heap != NULL);
 
-    // Find the heap's information (blockmap, etc).
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    HeapMap::Iterator heapit = m_heapMap->find(heap);
-    if (heapit == m_heapMap->end()) {
-        // Nothing is allocated from this heap. No leaks.
-        return 0;
-    }
+    LoaderLock ll;  // resolving symbols may need the loader lock
+    CriticalSectionLocker<> cs(m_reportLock);
 
-    Set<blockinfo_t*> aggregatedLeaks;
-    heapinfo_t* heapinfo = (*heapit).second;
     // Generate a memory leak report for heap.
+    LeakSnapshot snapshot;
+    takeSnapshot(snapshot, heap, (DWORD)-1, true);
     bool firstLeak = true;
-    SIZE_T leaks_count = reportLeaks(heapinfo, firstLeak, aggregatedLeaks);
+    SIZE_T leaks_count = reportLeaks(snapshot, firstLeak, false);
+    m_tracker->releaseSnapshot(snapshot);
 
     // Show a summary.
     if (leaks_count != 0) {
@@ -1829,58 +2047,39 @@ size_t VisualLeakDetector::getCrtBlockSize(LPCVOID block, bool ucrt)
     }
 }
 
-SIZE_T VisualLeakDetector::reportLeaks (heapinfo_t* heapinfo, bool &firstLeak, Set<blockinfo_t*> &aggregatedLeaks, DWORD threadId)
+// reportleaks - Generates a memory leak report for the leaks of a snapshot.
+//   The heap maps are not locked while doing so.
+//
+//  - snapshot (IN/OUT): The leaks to report. Their data must have been copied
+//      when the snapshot was taken.
+//
+//  - firstLeak (IN/OUT): If true, the report's heading is printed before the
+//      first leak, and set to false.
+//
+//  - classify (IN): If true, and ReachabilityScan is enabled, still reachable
+//      leaks are left out of the report, and the others are classified.
+//
+//  Return Value:
+//
+//    Returns the number of leaks reported.
+//
+SIZE_T VisualLeakDetector::reportLeaks (LeakSnapshot &snapshot, bool &firstLeak, bool classify)
 {
-    BlockMap* blockmap   = &heapinfo->blockMap;
-    SIZE_T leaksFound = 0;
+    SIZE_T reachable = 0;
+    m_reachableBytes = 0;
+    classify = classify && ((m_options & VLD_OPT_REACHABILITY_SCAN) != 0);
+    if (classify) {
+        reachable = classifyLeaks(snapshot, m_reachableBytes);
+    }
+    SIZE_T leaksFound = countLeaks(snapshot, (m_options & VLD_OPT_AGGREGATE_DUPLICATES) != 0);
+    SIZE_T lost [REACHABILITY_REACHABLE] = { 0 };
 
-    for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit)
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit)
     {
-        // Found a block which is still in the BlockMap. We've identified a
-        // potential memory leak.
-        LPCVOID block = (*blockit).first;
-        blockinfo_t* info = (*blockit).second;
-        if (info->reported)
-            continue;
-
-        if (threadId != ((DWORD)-1) && info->threadId != threadId)
+        const leakentry_t *leak = &(*leakit);
+        if (leak->count == 0) {
+            // Skipped, or aggregated under the heading of another leak.
             continue;
-
-        Set<blockinfo_t*>::Iterator it = aggregatedLeaks.find(info);
-        if (it != aggregatedLeaks.end())
-            continue;
-
-        LPCVOID address = block;
-        SIZE_T size = info->size;
-
-        if (isDebugCrtAlloc( block, info )) {
-            // This block is allocated to a CRT heap, so the block has a CRT
-            // memory block header pretended to it.
-            int blockUse = getCrtBlockUse( block, info->ucrt );
-            // Leaks identified as CRT_USE_IGNORE should not be ignored here otherwise
-            // DynamicLoader/Thread test will randomly fail with less leaks being reported.
-            if (CRT_USE_TYPE(blockUse) == CRT_USE_FREE ||
-                CRT_USE_TYPE(blockUse) == CRT_USE_INTERNAL)
-            {
-                // This block is marked as being used internally by the CRT.
-                // The CRT will free the block after VLD is destroyed.
-                continue;
-            }
-
-            // The CRT header is more or less transparent to the user, so
-            // the information about the contained block will probably be
-            // more useful to the user. Accordingly, that's the information
-            // we'll include in the report.
-            address = CRTDBGBLOCKDATA(block);
-            size = getCrtBlockSize(block, info->ucrt);
-        }
-
-        if (m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS) {
-            // Check for crt startup allocations
-            if (info->callStack && info->callStack->isCrtStartupAlloc()) {
-                info->reported = true;
-                continue;
-            }
         }
 
         // It looks like a real memory leak.
@@ -1888,117 +2087,143 @@ SIZE_T VisualLeakDetector::reportLeaks (heapinfo_t* heapinfo, bool &firstLeak, S
             Report(L"WARNING: Visual Leak Detector detected memory leaks!\n");
             firstLeak = false;
         }
-        SIZE_T blockLeaksCount = 1;
-        Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", info->serialNumber, address, size);
+        SIZE_T blockLeaksCount = leak->count;
+        Report(L"---------- Block %Iu at " ADDRESSFORMAT L": %Iu bytes ----------\n", leak->serialNumber, leak->address, leak->size);
 #ifdef _DEBUG
-        if (info->debugCrtAlloc)
+        if (leak->crtRequest != 0)
         {
-            crtdbgblockheader_t* crtheader = (crtdbgblockheader_t*)block;
-            Report(L"  CRT Alloc ID: %Iu\n", crtheader->request);
-            assert(size == getCrtBlockSize(block, info->ucrt));
+            Report(L"  CRT Alloc ID: %Iu\n", leak->crtRequest);
         }
 #endif
-        assert(info->callStack);
-        if (m_options & VLD_OPT_AGGREGATE_DUPLICATES) {
-            // Aggregate all other leaks which are duplicates of this one
-            // under this same heading, to cut down on clutter.
-            SIZE_T erased = eraseDuplicates(blockit, aggregatedLeaks);
+        assert(leak->callStack);
 
-            // add only the number that were erased, since the 'one left over'
-            // is already recorded as a leak
-            blockLeaksCount += erased;
+        Report(L"  Leak Hash: 0x%08X, Count: %Iu, Total %Iu bytes\n", leak->leakHash, blockLeaksCount, leak->size * blockLeaksCount);
+        if (leak->reachability != REACHABILITY_UNKNOWN) {
+            Report(L"  Reachability: %s\n", (leak->reachability == REACHABILITY_DIRECT) ?
+                L"definitely lost" : L"indirectly lost (only referenced by other leaks)");
+            lost[leak->reachability] += blockLeaksCount;
         }
 
-        DWORD callstackCRC = 0;
-        if (info->callStack)
-            callstackCRC = CalculateCRC32(info->size, info->callStack->getHashValue());
-        Report(L"  Leak Hash: 0x%08X, Count: %Iu, Total %Iu bytes\n", callstackCRC, blockLeaksCount, size * blockLeaksCount);
-        leaksFound += blockLeaksCount;
-
         // Dump the call stack.
         if (blockLeaksCount == 1)
-            Report(L"  Call Stack (TID %u):\n", info->threadId);
+            Report(L"  Call Stack (TID %u):\n", leak->threadId);
         else
             Report(L"  Call Stack:\n");
-        if (info->callStack)
-            info->callStack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
+        if (leak->callStack)
+            leak->callStack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
 
-        // Dump the data in the user data section of the memory block.
+        // Dump the data in the user data section of the memory block, as
+        // copied when the snapshot was taken.
         if (m_maxDataDump != 0) {
             Report(L"  Data:\n");
+            SIZE_T dumpSize = (leak->data != NULL) ? leak->dataSize : 0;
             if (m_options & VLD_OPT_UNICODE_REPORT) {
-                DumpMemoryW(address, (m_maxDataDump < size) ? m_maxDataDump : size);
+                DumpMemoryW(leak->data, dumpSize);
             }
             else {
-                DumpMemoryA(address, (m_maxDataDump < size) ? m_maxDataDump : size);
+                DumpMemoryA(leak->data, dumpSize);
             }
         }
         Report(L"\n\n");
     }
 
+    if (classify) {
+        Report(L"Reachability: %Iu leaks definitely lost, %Iu indirectly lost, %Iu blocks still reachable"
+            L" (%Iu bytes, not reported).\n", lost[REACHABILITY_DIRECT], lost[REACHABILITY_INDIRECT],
+            reachable, m_reachableBytes);
+    }
     return leaksFound;
 }
 
-VOID VisualLeakDetector::markAllLeaksAsReported (heapinfo_t* heapinfo, DWORD threadId)
+// checkleaksuspects - Samples the live bytes of every call site, at most once
+//   per window of m_suspectWindow allocations, and reports the sites whose live
+//   bytes keep growing while the program runs. The report goes through the
+//   usual channels, including the report hooks. Called by the leak suspect
+//   detector thread.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::checkLeakSuspects ()
 {
-    BlockMap* blockmap   = &heapinfo->blockMap;
-
-    for (BlockMap::Iterator blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit)
+    StackTable::suspect_t suspects [MAX_SUSPECTS];
+    CallStack*            stacks [MAX_SUSPECTS];
+    UINT32                count;
     {
-        blockinfo_t* info = (*blockit).second;
-        if (threadId == ((DWORD)-1) || info->threadId == threadId)
-            info->reported = true;
+        CriticalSectionLocker<> cs(g_heapMapLock);
+        SIZE_T window = m_tracker->requestCurr() / m_suspectWindow;
+        if (window == m_suspectSampled) {
+            // Not enough allocations since the last sample.
+            return;
+        }
+        m_suspectSampled = window;
+        count = m_tracker->stackTable()->sampleTrends(suspects, MAX_SUSPECTS);
+        for (UINT32 index = 0; index < count; index++) {
+            stacks[index] = m_tracker->stackTable()->get(suspects[index].id);
+        }
+    }
+    if (count == 0)
+        return;
+
+    // Resolving symbols needs the loader lock. Never wait for it: a thread
+    // unloading VLD holds it until this thread exits.
+    for (;;) {
+        LoaderLock ll(true);
+        if (ll.IsLocked()) {
+            CriticalSectionLocker<> cs(m_reportLock);
+            for (UINT32 index = 0; index < count; index++) {
+                Report(L"WARNING: Visual Leak Detector: Suspected leak: %Iu bytes in %Iu blocks allocated from here are"
+                    L" still in use, and growing.\n", suspects[index].liveBytes, suspects[index].liveBlocks);
+                Report(L"  Call Stack:\n");
+                stacks[index]->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, FALSE);
+                Report(L"\n");
+            }
+            break;
+        }
+        if (WaitForSingleObject(m_suspectStop, SUSPECT_RETRY_TIME) != WAIT_TIMEOUT)
+            break;
+    }
+
+    CriticalSectionLocker<> cs(g_heapMapLock);
+    for (UINT32 index = 0; index < count; index++) {
+        m_tracker->stackTable()->release(suspects[index].id);
     }
 }
 
-// FindAllocedBlock - Find if a particular memory allocation is tracked inside of VLD.
-//     This is a really good example of how to iterate through the data structures
-//     that represent heaps and their associated memory blocks.
-// Pre Condition: Be VERY sure that this is only called within a block that already has
-// acquired a critical section for m_maplock.
+// reportlifetimes - Reports one of the lifetime histograms of a call site: its
+//   median and 90th percentile, followed by the non-empty buckets.
 //
-// mem - The particular memory address to search for.
+//   Caller must hold m_reportLock.
+//
+//  - unit (IN): Unit the lifetimes are measured in.
+//
+//  - buckets (IN): Counters of the histogram, LIFETIME_BUCKETS of them.
+//
+//  - frees (IN): Sum of the counters.
 //
 //  Return Value:
-//   If mem is found, it will return the blockinfo_t pointer, otherwise NULL
 //
-blockinfo_t* VisualLeakDetector::findAllocedBlock(LPCVOID mem, __out HANDLE& heap)
+//    None.
+//
+VOID VisualLeakDetector::reportLifetimes (LPCWSTR unit, const UINT64* buckets, UINT64 frees)
 {
-    heap = NULL;
-    blockinfo_t* result = NULL;
-    // Iterate through all heaps
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator it = m_heapMap->begin();
-        it != m_heapMap->end();
-        ++it)
-    {
-        HANDLE heap_handle  = (*it).first;
-        (heap_handle); // unused
-        heapinfo_t* heapPtr = (*it).second;
-
-        // Iterate through all memory blocks in each heap
-        BlockMap& p_block_map = heapPtr->blockMap;
-        for (BlockMap::Iterator iter = p_block_map.begin();
-            iter != p_block_map.end();
-            ++iter)
-        {
-            if ((*iter).first == mem)
-            {
-                // Found the block.
-                blockinfo_t* alloc_block = (*iter).second;
-                heap = heap_handle;
-                result = alloc_block;
-                break;
-            }
+    const UINT64 longest = LifetimeBucketLimit(LIFETIME_BUCKETS - 2);
+    UINT32 median = LifetimeQuantile(buckets, frees, 50);
+    UINT32 tail = LifetimeQuantile(buckets, frees, 90);
+    Report(L"  Lifetime in %s: half under %I64u, 90%% under %I64u.\n  Blocks by lifetime:", unit,
+        LifetimeBucketLimit(median), LifetimeBucketLimit(tail));
+    for (UINT32 bucket = 0; bucket < LIFETIME_BUCKETS; bucket++) {
+        if (buckets[bucket] == 0)
+            continue;
+        if (bucket < LIFETIME_BUCKETS - 1) {
+            Report(L" <%I64u: %I64u", LifetimeBucketLimit(bucket), buckets[bucket]);
         }
-
-        if (result)
-        {
-            break;
+        else {
+            Report(L" >=%I64u: %I64u", longest, buckets[bucket]);
         }
     }
-
-    return result;
+    Report(L"\n");
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2072,6 +2297,11 @@ BOOL VisualLeakDetector::addLoadedModule (PCWSTR modulepath, DWORD64 modulebase,
     moduleinfo.flags    = 0x0;
     moduleinfo.name     = modulename;
     moduleinfo.path     = modulepathw;
+    // The modules are enumerated under the loader lock, which serializes
+    // building the rows of the decision table.
+    moduleinfo.policyRow = CAPTURE_ROW_ANY;
+    if (g_vld.m_capturePolicy != NULL)
+        moduleinfo.policyRow = g_vld.m_capturePolicy->moduleRow(modulename.c_str(), modulename.length());
 
     ModuleSet*    newmodules = (ModuleSet*)context;
     newmodules->insert(moduleinfo);
@@ -2107,6 +2337,27 @@ BOOL VisualLeakDetector::detachFromModule (PCWSTR /*modulepath*/, DWORD64 module
     return TRUE;
 }
 
+// suspectthreadproc - Thread procedure of the leak suspect detector. Checks for
+//   suspected leaks at regular intervals until m_suspectStop is signaled.
+//
+//  - param (IN): The VisualLeakDetector.
+//
+//  Return Value:
+//
+//    Always returns 0.
+//
+DWORD VisualLeakDetector::suspectThreadProc (LPVOID param)
+{
+    VisualLeakDetector* vld = (VisualLeakDetector*)param;
+
+    // What this thread allocates while reporting is not the program's doing.
+    vld->DisableLeakDetection();
+    while (WaitForSingleObject(vld->m_suspectStop, SUSPECT_POLL_TIME) == WAIT_TIMEOUT) {
+        vld->checkLeakSuspects();
+    }
+    return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Win32 IAT Replacement Functions
@@ -2334,6 +2585,8 @@ VOID VisualLeakDetector::RefreshModules()
 
         // Attach to all modules included in the set.
         attachToLoadedModules(newmodules);
+        if (m_options & VLD_OPT_SAFE_STACK_WALK)
+            loadSymbols();
     }
 
     // Start using the new set of loaded modules.
@@ -2341,12 +2594,18 @@ VOID VisualLeakDetector::RefreshModules()
     ModuleSet* oldmodules = m_loadedModules;
     m_loadedModules = newmodules;
 
+    // Cached function table entries may point into modules that are gone.
+    InterlockedIncrement(&g_modulesGeneration);
+
     // Free resources used by the old module list.
     delete oldmodules;
 }
 
-// Find the information for the module that initiated this reallocation.
-bool VisualLeakDetector::isModuleExcluded(UINT_PTR address)
+// Find the information for the module that initiated this allocation, and
+// the row of the capture rules' decision table for it from the same lookup.
+// Code outside of any module is only subject to the rules without module
+// patterns.
+bool VisualLeakDetector::isModuleExcluded(UINT_PTR address, UINT32 &policyrow)
 {
     moduleinfo_t         moduleinfo;
     ModuleSet::Iterator  moduleit;
@@ -2354,10 +2613,13 @@ bool VisualLeakDetector::isModuleExcluded(UINT_PTR address)
     moduleinfo.addrHigh = address + 1024;
     moduleinfo.flags = 0;
 
+    policyrow = CAPTURE_ROW_ANY;
     CriticalSectionLocker<> cs(g_vld.m_modulesLock);
     moduleit = g_vld.m_loadedModules->find(moduleinfo);
-    if (moduleit != g_vld.m_loadedModules->end())
+    if (moduleit != g_vld.m_loadedModules->end()) {
+        policyrow = (*moduleit).policyRow;
         return (*moduleit).flags & VLD_MODULE_EXCLUDED ? true : false;
+    }
     return false;
 }
 
@@ -2368,15 +2630,13 @@ SIZE_T VisualLeakDetector::GetLeaksCount()
         return 0;
     }
 
-    SIZE_T leaksCount = 0;
-    // Generate a memory leak report for each heap in the process.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        HANDLE heap = (*heapit).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapit).second;
-        leaksCount += getLeaksCount(heapinfo);
-    }
+    LoaderLock ll;  // resolving symbols for the CRT startup check may need the loader lock
+
+    // Count the leaks of each heap in the process.
+    LeakSnapshot snapshot;
+    takeSnapshot(snapshot, NULL, (DWORD)-1, false);
+    SIZE_T leaksCount = countLeaks(snapshot, false);
+    m_tracker->releaseSnapshot(snapshot);
     return leaksCount;
 }
 
@@ -2387,15 +2647,13 @@ SIZE_T VisualLeakDetector::GetThreadLeaksCount(DWORD threadId)
         return 0;
     }
 
-    SIZE_T leaksCount = 0;
-    // Generate a memory leak report for each heap in the process.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        HANDLE heap = (*heapit).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapit).second;
-        leaksCount += getLeaksCount(heapinfo, threadId);
-    }
+    LoaderLock ll;  // resolving symbols for the CRT startup check may need the loader lock
+
+    // Count the leaks of each heap in the process.
+    LeakSnapshot snapshot;
+    takeSnapshot(snapshot, NULL, threadId, false);
+    SIZE_T leaksCount = countLeaks(snapshot, false);
+    m_tracker->releaseSnapshot(snapshot);
     return leaksCount;
 }
 
@@ -2407,18 +2665,14 @@ SIZE_T VisualLeakDetector::ReportLeaks( )
     }
 
     LoaderLock ll;  // scanning for module names needs ldrloc - getting it proactively to avoid deadlocks later
+    CriticalSectionLocker<> cs(m_reportLock);
 
     // Generate a memory leak report for each heap in the process.
-    SIZE_T leaksCount = 0;
-    CriticalSectionLocker<> cs(g_heapMapLock);
+    LeakSnapshot snapshot;
+    takeSnapshot(snapshot, NULL, (DWORD)-1, true);
     bool firstLeak = true;
-    Set<blockinfo_t*> aggregatedLeaks;
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        HANDLE heap = (*heapit).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapit).second;
-        leaksCount += reportLeaks(heapinfo, firstLeak, aggregatedLeaks);
-    }
+    SIZE_T leaksCount = reportLeaks(snapshot, firstLeak, true);
+    m_tracker->releaseSnapshot(snapshot);
     return leaksCount;
 }
 
@@ -2429,17 +2683,15 @@ SIZE_T VisualLeakDetector::ReportThreadLeaks( DWORD threadId )
         return 0;
     }
 
+    LoaderLock ll;  // resolving symbols may need the loader lock
+    CriticalSectionLocker<> cs(m_reportLock);
+
     // Generate a memory leak report for each heap in the process.
-    SIZE_T leaksCount = 0;
-    CriticalSectionLocker<> cs(g_heapMapLock);
+    LeakSnapshot snapshot;
+    takeSnapshot(snapshot, NULL, threadId, true);
     bool firstLeak = true;
-    Set<blockinfo_t*> aggregatedLeaks;
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        HANDLE heap = (*heapit).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapit).second;
-        leaksCount += reportLeaks(heapinfo, firstLeak, aggregatedLeaks, threadId);
-    }
+    SIZE_T leaksCount = reportLeaks(snapshot, firstLeak, true);
+    m_tracker->releaseSnapshot(snapshot);
     return leaksCount;
 }
 
@@ -2450,14 +2702,7 @@ VOID VisualLeakDetector::MarkAllLeaksAsReported( )
         return;
     }
 
-    // Generate a memory leak report for each heap in the process.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        HANDLE heap = (*heapit).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapit).second;
-        markAllLeaksAsReported(heapinfo);
-    }
+    m_tracker->markAllReported();
 }
 
 VOID VisualLeakDetector::MarkThreadLeaksAsReported( DWORD threadId )
@@ -2467,14 +2712,7 @@ VOID VisualLeakDetector::MarkThreadLeaksAsReported( DWORD threadId )
         return;
     }
 
-    // Generate a memory leak report for each heap in the process.
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator heapit = m_heapMap->begin(); heapit != m_heapMap->end(); ++heapit) {
-        HANDLE heap = (*heapit).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapit).second;
-        markAllLeaksAsReported(heapinfo, threadId);
-    }
+    m_tracker->markThreadReported(threadId);
 }
 
 void VisualLeakDetector::ChangeModuleState(HMODULE module, bool on)
@@ -2614,7 +2852,7 @@ void VisualLeakDetector::GlobalEnableLeakDetection ()
 CONST UINT32 OptionsMask = VLD_OPT_AGGREGATE_DUPLICATES | VLD_OPT_MODULE_LIST_INCLUDE |
     VLD_OPT_SAFE_STACK_WALK | VLD_OPT_SLOW_DEBUGGER_DUMP | VLD_OPT_START_DISABLED |
     VLD_OPT_TRACE_INTERNAL_FRAMES | VLD_OPT_SKIP_HEAPFREE_LEAKS | VLD_OPT_VALIDATE_HEAPFREE |
-    VLD_OPT_SKIP_CRTSTARTUP_LEAKS;
+    VLD_OPT_SKIP_CRTSTARTUP_LEAKS | VLD_OPT_REACHABILITY_SCAN;
 
 UINT32 VisualLeakDetector::GetOptions()
 {
@@ -2784,7 +3022,8 @@ void VisualLeakDetector::setupReporting()
 blockinfo_t* VisualLeakDetector::getAllocationBlockInfo(void* alloc)
 {
     // should be called under g_heapMapLock
-    for (HeapMap::Iterator heapiter = m_heapMap->begin(); heapiter != m_heapMap->end(); ++heapiter)
+    HeapMap* heapmap = m_tracker->heapMap();
+    for (HeapMap::Iterator heapiter = heapmap->begin(); heapiter != heapmap->end(); ++heapiter)
     {
         HANDLE heap = (*heapiter).first;
         UNREFERENCED_PARAMETER(heap);
@@ -2795,7 +3034,7 @@ blockinfo_t* VisualLeakDetector::getAllocationBlockInfo(void* alloc)
             // Found a block which is still in the BlockMap. We've identified a
             // potential memory leak.
             LPCVOID block = (*blockit).first;
-            blockinfo_t* info = (*blockit).second;
+            blockinfo_t* info = &blockmap.entry(blockit).second;
             if (block == alloc)
                 return info;
 
@@ -2821,88 +3060,236 @@ const wchar_t* VisualLeakDetector::GetAllocationResolveResults(void* alloc, BOOL
 
     CriticalSectionLocker<> cs(g_heapMapLock);
     blockinfo_t* info = getAllocationBlockInfo(alloc);
-    if (info != NULL)
+    CallStack* callStack = (info != NULL) ? m_tracker->stackTable()->get(info->stackId) : NULL;
+    if (callStack != NULL)
     {
-        int unresolvedFunctionsCount = info->callStack->resolve(showInternalFrames, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
+        int unresolvedFunctionsCount = callStack->resolve(showInternalFrames, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
         _ASSERT(unresolvedFunctionsCount == 0);
-        return info->callStack->getResolvedCallstack(showInternalFrames, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
+        return callStack->getResolvedCallstack(showInternalFrames, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
     }
     return NULL;
 }
 
-int VisualLeakDetector::resolveStacks(heapinfo_t* heapinfo)
+int VisualLeakDetector::resolveStacks(LeakSnapshot &snapshot)
 {
     int unresolvedFunctionsCount = 0;
-    BlockMap& blockmap = heapinfo->blockMap;
-
-    for (BlockMap::Iterator blockit = blockmap.begin(); blockit != blockmap.end(); ++blockit) {
-        // Found a block which is still in the BlockMap. We've identified a
-        // potential memory leak.
-        const void* block   = (*blockit).first;
-        blockinfo_t* info   = (*blockit).second;
-        assert(info);
-        if (info == NULL)
+
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit) {
+        // Resolve the call stack.
+        CallStack* callStack = leakit->callStack;
+        if (callStack)
         {
-            continue;
+            unresolvedFunctionsCount += callStack->resolve(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
         }
+    }
+    return unresolvedFunctionsCount;
+}
 
-        if (info->reported) {
-            continue;
-        }
+int VisualLeakDetector::ResolveCallstacks()
+{
+    LoaderLock ll;
 
-        // The actual memory address
-        const void* address = block;
-        assert(address != NULL);
+    if (m_options & VLD_OPT_VLDOFF)
+        return 0;
 
-        if (isDebugCrtAlloc(block, info)) {
-            // This block is allocated to a CRT heap, so the block has a CRT
-            // memory block header prepended to it.
-            crtdbgblockheader_t* crtheader = (crtdbgblockheader_t*)block;
-            if (!crtheader)
-                continue;
+    // Generate the Callstacks early
+    LeakSnapshot snapshot;
+    takeSnapshot(snapshot, NULL, (DWORD)-1, false);
+    int unresolvedFunctionsCount = resolveStacks(snapshot);
+    m_tracker->releaseSnapshot(snapshot);
+    return unresolvedFunctionsCount;
+}
 
-            // Leaks identified as CRT_USE_IGNORE should not be ignored here otherwise
-            // DynamicLoader/Thread test will randomly fail with less leaks being reported.
-            if (CRT_USE_TYPE(crtheader->use) == CRT_USE_FREE ||
-                CRT_USE_TYPE(crtheader->use) == CRT_USE_INTERNAL)
-            {
-                // This block is marked as being used internally by the CRT.
-                // The CRT will free the block after VLD is destroyed.
-                continue;
-            }
+// The lifetime histograms are returned by the API as they are counted.
+static char lifetime_buckets_assert[(VLD_LIFETIME_BUCKETS == LIFETIME_BUCKETS) ? 1 : -1];
+
+UINT32 VisualLeakDetector::GetLifetimeHistograms(VLD_LIFETIME_HISTOGRAM *histograms, UINT32 count)
+{
+    if ((m_options & VLD_OPT_VLDOFF) || !(m_options & VLD_OPT_LIFETIME_HISTOGRAMS))
+        return 0;
+
+    // No lock is needed: histograms are only ever added to the list, and their
+    // counters are updated atomically.
+    UINT32 sites = 0;
+    for (lifetimehist_t* hist = m_tracker->stackTable()->lifetimes(); hist != NULL; hist = hist->next) {
+        if (sites < count) {
+            lifetimecounts_t counts;
+            ReadLifetimeHistogram(*hist, counts);
+            histograms[sites].stackHash = hist->hash;
+            histograms[sites].frees = counts.frees;
+            memcpy(histograms[sites].allocations, counts.serials, sizeof(counts.serials));
+            memcpy(histograms[sites].cycles, counts.ticks, sizeof(counts.ticks));
         }
+        sites++;
+    }
+    return sites;
+}
 
-        // Dump the call stack.
-        if (info->callStack)
-        {
-            unresolvedFunctionsCount += info->callStack->resolve(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS);
-            if ((m_options & VLD_OPT_SKIP_CRTSTARTUP_LEAKS) && info->callStack->isCrtStartupAlloc()) {
-                info->reported = true;
-                continue;
-            }
+UINT32 VisualLeakDetector::ReportLifetimeHistograms()
+{
+    if ((m_options & VLD_OPT_VLDOFF) || !(m_options & VLD_OPT_LIFETIME_HISTOGRAMS))
+        return 0;
+
+    // Find the call sites which freed the most blocks, busiest first.
+    lifetimehist_t* busiest [MAX_LIFETIME_SITES];
+    UINT64          frees [MAX_LIFETIME_SITES];
+    UINT32          count = 0;
+    for (lifetimehist_t* hist = m_tracker->stackTable()->lifetimes(); hist != NULL; hist = hist->next) {
+        lifetimecounts_t counts;
+        ReadLifetimeHistogram(*hist, counts);
+        if ((counts.frees == 0) || ((count == MAX_LIFETIME_SITES) && (counts.frees <= frees[count - 1])))
+            continue;
+
+        UINT32 index = (count < MAX_LIFETIME_SITES) ? count++ : count - 1;
+        for (; (index > 0) && (frees[index - 1] < counts.frees); index--) {
+            busiest[index] = busiest[index - 1];
+            frees[index] = frees[index - 1];
         }
+        busiest[index] = hist;
+        frees[index] = counts.frees;
     }
-    return unresolvedFunctionsCount;
+    if (count == 0)
+        return 0;
+
+    LoaderLock ll;  // resolving symbols may need the loader lock
+    CriticalSectionLocker<> cs(m_reportLock);
+    Report(L"Visual Leak Detector block lifetimes of the %u call sites which freed the most blocks:\n", count);
+    for (UINT32 index = 0; index < count; index++) {
+        // Histograms never free their call stack.
+        lifetimecounts_t counts;
+        ReadLifetimeHistogram(*busiest[index], counts);
+        Report(L"---------- Call site 0x%08X: %I64u blocks freed ----------\n", busiest[index]->hash, counts.frees);
+        reportLifetimes(L"allocations", counts.serials, counts.frees);
+        reportLifetimes(L"cycles", counts.ticks, counts.frees);
+        Report(L"  Call Stack:\n");
+        ((CallStack*)busiest[index]->site)->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES, FALSE);
+        Report(L"\n");
+    }
+    return count;
 }
 
-int VisualLeakDetector::ResolveCallstacks()
+// The internal statistics are returned by the API as they are counted.
+static char stat_count_assert[(VLD_STAT_COUNT == STATS_COUNT) ? 1 : -1];
+static char stat_buckets_assert[(VLD_STAT_BUCKETS == STATS_BUCKETS) ? 1 : -1];
+
+UINT32 VisualLeakDetector::GetInternalStats(VLD_INTERNAL_STAT *stats, UINT32 count)
 {
-    LoaderLock ll;
+    if ((m_options & VLD_OPT_VLDOFF) || !(m_options & VLD_OPT_INTERNAL_STATS))
+        return 0;
 
-    if (m_options & VLD_OPT_VLDOFF)
+    // No lock is needed: each thread's counters are only ever added to the
+    // list, and are read atomically.
+    statcounts_t counts [STATS_COUNT];
+    ReadInternalStats(counts);
+    for (UINT32 stat = 0; (stat < count) && (stat < STATS_COUNT); stat++) {
+        stats[stat].calls = counts[stat].calls;
+        stats[stat].cycles = counts[stat].cycles;
+        stats[stat].maxCycles = counts[stat].maxCycles;
+        memcpy(stats[stat].histogram, counts[stat].buckets, sizeof(counts[stat].buckets));
+    }
+    return STATS_COUNT;
+}
+
+UINT32 VisualLeakDetector::ReportInternalStats()
+{
+    if ((m_options & VLD_OPT_VLDOFF) || !(m_options & VLD_OPT_INTERNAL_STATS))
         return 0;
 
-    int unresolvedFunctionsCount = 0;
-    // Generate the Callstacks early
-    CriticalSectionLocker<> cs(g_heapMapLock);
-    for (HeapMap::Iterator heapiter = m_heapMap->begin(); heapiter != m_heapMap->end(); ++heapiter)
-    {
-        HANDLE heap = (*heapiter).first;
-        UNREFERENCED_PARAMETER(heap);
-        heapinfo_t* heapinfo = (*heapiter).second;
-        unresolvedFunctionsCount += resolveStacks(heapinfo);
+    statcounts_t counts [STATS_COUNT];
+    ReadInternalStats(counts);
+
+    CriticalSectionLocker<> cs(m_reportLock);
+    Report(L"Visual Leak Detector internal statistics, in cycles:\n");
+    Report(L"  %-18s %12s %10s %10s %10s %12s\n", L"Operation", L"Calls", L"Mean", L"Median", L"99%", L"Max");
+    UINT32 reported = 0;
+    for (UINT32 stat = 0; stat < STATS_COUNT; stat++) {
+        if (counts[stat].calls == 0)
+            continue;
+        // The quantiles are the upper limits of their buckets, which no call
+        // may have reached.
+        UINT64 median = StatBucketLimit(StatQuantile(counts[stat].buckets, counts[stat].calls, 50));
+        UINT64 tail = StatBucketLimit(StatQuantile(counts[stat].buckets, counts[stat].calls, 99));
+        if (median > counts[stat].maxCycles)
+            median = counts[stat].maxCycles;
+        if (tail > counts[stat].maxCycles)
+            tail = counts[stat].maxCycles;
+        Report(L"  %-18s %12I64u %10I64u %10I64u %10I64u %12I64u\n", StatName(stat), counts[stat].calls,
+            counts[stat].cycles / counts[stat].calls, median, tail, counts[stat].maxCycles);
+        reported++;
     }
-    return unresolvedFunctionsCount;
+    return reported;
+}
+
+// takesnapshot - Records the potential leaks currently in the block maps, so
+//   that they can be counted, resolved and reported without keeping the heap
+//   maps locked (see BlockTracker::takeSnapshot). Every snapshot must be
+//   released with BlockTracker::releaseSnapshot.
+//
+//  - snapshot (OUT): Receives the potential leaks.
+//
+//  - heap (IN): If not NULL, only the blocks allocated from this heap are
+//      recorded.
+//
+//  - threadId (IN): If not (DWORD)-1, only the blocks allocated by this
+//      thread are recorded.
+//
+//  - copydata (IN): If true, up to MaxDataDump bytes of each block are copied
+//      for the data dump of the report.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::takeSnapshot (LeakSnapshot &snapshot, HANDLE heap, DWORD threadId, bool copydata)
+{
+    m_tracker->takeSnapshot(snapshot, heap, threadId, copydata ? m_maxDataDump : 0, snapshotBlock, NULL);
+}
+
+// snapshotblock - Called by BlockTracker::takeSnapshot for each block. Leaves
+//   out the blocks used internally by the CRT, and reports the user data of
+//   debug CRT blocks rather than the blocks themselves.
+//
+//   Caller must hold g_heapMapLock.
+//
+//  - leak (IN/OUT): The leak, as recorded from the block's information.
+//
+//  - info (IN): Information about the block.
+//
+//  - context (IN): Unused.
+//
+//  Return Value:
+//
+//    Returns false if the block should be left out of the snapshot.
+//
+bool VisualLeakDetector::snapshotBlock (leakentry_t &leak, blockinfo_t* info, void* /*context*/)
+{
+    LPCVOID block = leak.address;
+    if (isDebugCrtAlloc(block, info)) {
+        // This block is allocated to a CRT heap, so the block has a CRT
+        // memory block header prepended to it.
+        int blockUse = getCrtBlockUse(block, (info->flags & VLD_BLOCK_UCRT) != 0);
+        // Leaks identified as CRT_USE_IGNORE should not be ignored here otherwise
+        // DynamicLoader/Thread test will randomly fail with less leaks being reported.
+        if (CRT_USE_TYPE(blockUse) == CRT_USE_FREE ||
+            CRT_USE_TYPE(blockUse) == CRT_USE_INTERNAL)
+        {
+            // This block is marked as being used internally by the CRT.
+            // The CRT will free the block after VLD is destroyed.
+            return false;
+        }
+
+        // The CRT header is more or less transparent to the user, so
+        // the information about the contained block will probably be
+        // more useful to the user. Accordingly, that's the information
+        // we'll include in the report.
+        leak.address = CRTDBGBLOCKDATA(block);
+        leak.size = getCrtBlockSize(block, (info->flags & VLD_BLOCK_UCRT) != 0);
+#ifdef _DEBUG
+        crtdbgblockheader_t* crtheader = (crtdbgblockheader_t*)block;
+        leak.crtRequest = crtheader->request;
+#endif
+    }
+    return true;
 }
 
 CaptureContext::CaptureContext(void* func, context_t& context, BOOL debug, BOOL ucrt) : m_context(context) {
@@ -2929,40 +3316,79 @@ CaptureContext::~CaptureContext() {
     if (!m_bFirst)
         return;
 
-    if ((m_tls->blockWithoutGuard) && (!IsExcludedModule())) {
-        CallStack* callstack = CallStack::Create(g_vld.m_options & VLD_OPT_SAFE_STACK_WALK);
-        callstack->getStackTrace(g_vld.m_maxTraceFrames, m_tls->context);
+    UINT32 row, maxframes;
+    if ((m_tls->blockWithoutGuard) && (!IsExcludedModule(row))) {
+        if (IsCaptured(row, maxframes)) {
+            CallStack* callstack = CallStack::Create(g_vld.m_options & VLD_OPT_SAFE_STACK_WALK);
+            callstack->getStackTrace(maxframes, m_tls->context);
 
-        CriticalSectionLocker<> cs(g_heapMapLock);
+            CriticalSectionLocker<> cs(g_heapMapLock);
 
-        blockinfo_t* pblockInfo = NULL;
-        if (m_tls->newBlockWithoutGuard == NULL) {
-            g_vld.mapBlock(m_tls->heap,
-                m_tls->blockWithoutGuard,
-                m_tls->size,
-                (m_tls->flags & VLD_TLS_DEBUGCRTALLOC) != 0,
-                (m_tls->flags & VLD_TLS_UCRT) != 0,
-                m_tls->threadId,
-                pblockInfo);
+            blockinfo_t* pblockInfo = NULL;
+            if (m_tls->newBlockWithoutGuard == NULL) {
+                g_vld.mapBlock(m_tls->heap,
+                    m_tls->blockWithoutGuard,
+                    m_tls->size,
+                    (m_tls->flags & VLD_TLS_DEBUGCRTALLOC) != 0,
+                    (m_tls->flags & VLD_TLS_UCRT) != 0,
+                    m_tls->threadId,
+                    pblockInfo);
+            }
+            else {
+                g_vld.remapBlock(m_tls->heap,
+                    m_tls->blockWithoutGuard,
+                    m_tls->newBlockWithoutGuard,
+                    m_tls->size,
+                    (m_tls->flags & VLD_TLS_DEBUGCRTALLOC) != 0,
+                    (m_tls->flags & VLD_TLS_UCRT) != 0,
+                    m_tls->threadId,
+                    m_tls->detached, pblockInfo);
+            }
+
+            g_vld.m_tracker->setStack(pblockInfo, callstack);
+        }
+    }
+    if (m_tls->detached.address != NULL) {
+        CriticalSectionLocker<> cs(g_heapMapLock);
+        if (m_tls->blockWithoutGuard == NULL) {
+            // The reallocation failed: the block is left as it was.
+            g_vld.m_tracker->attachBlock(m_tls->detached, m_tls->detached.info.size, m_tls->detached.info.threadId, true);
         }
         else {
-            g_vld.remapBlock(m_tls->heap,
-                m_tls->blockWithoutGuard,
-                m_tls->newBlockWithoutGuard,
-                m_tls->size,
-                (m_tls->flags & VLD_TLS_DEBUGCRTALLOC) != 0,
-                (m_tls->flags & VLD_TLS_UCRT) != 0,
-                m_tls->threadId,
-                pblockInfo, m_tls->context);
+            // Reallocated by an excluded module, or left out by the capture
+            // rules: not tracked anymore, even if reallocated in-place.
+            g_vld.m_tracker->releaseDetached(m_tls->detached);
         }
-
-        pblockInfo->callStack.reset(callstack);
     }
 
     // Reset thread local flags and variables for the next allocation.
     Reset();
 }
 
+// Detach - Takes the record of a block about to be reallocated out of the
+//   block maps, before the heap is called (see BlockTracker::detachBlock). A
+//   reallocation nested in another one leaves the record detached by the
+//   outer one alone.
+//
+//  - heap (IN): Handle to the heap the block is reallocated from.
+//
+//  - mem (IN): The block about to be reallocated.
+//
+//  Return Value:
+//
+//    None.
+//
+void CaptureContext::Detach(HANDLE heap, LPVOID mem) {
+    if (m_tls->detached.address != NULL)
+        return;
+
+    if (!g_vld.m_tracker->detachBlock(heap, mem, m_tls->detached) && (g_vld.m_options & VLD_OPT_VALIDATE_HEAPFREE)) {
+        // The block is still allocated: this only reports a block allocated
+        // from another heap.
+        g_vld.unmapBlock(heap, mem, m_context);
+    }
+}
+
 void CaptureContext::Set(HANDLE heap, LPVOID mem, LPVOID newmem, SIZE_T size) {
     m_tls->heap = heap;
     m_tls->blockWithoutGuard = mem;
@@ -2988,7 +3414,51 @@ void CaptureContext::Reset() {
     Set(NULL, NULL, NULL, NULL);
 }
 
-BOOL CaptureContext::IsExcludedModule() {
+// IsCaptured - Determines whether the capture rules track the allocation (see
+//   CapturePolicy). Called once the module is known not to be excluded. The
+//   thread's name is read again whenever the rules ask for it: there is no
+//   hook telling when a thread is renamed (see
+//   VisualLeakDetector::readThreadName).
+//
+//  - row (IN): The row of the calling module, as found by IsExcludedModule.
+//
+//  - maxframes (OUT): Receives the most frames to capture for the block.
+//
+//  Return Value:
+//
+//    Returns TRUE if the allocation should be tracked.
+//
+BOOL CaptureContext::IsCaptured(UINT32 row, UINT32 &maxframes) {
+    maxframes = g_vld.m_maxTraceFrames;
+    CapturePolicy *policy = g_vld.m_capturePolicy;
+    if (policy == NULL)
+        return TRUE;
+
+    capturethread_t &thread = m_tls->capture;
+    if (policy->threadNameStale(thread))
+        g_vld.readThreadName(m_tls);
+
+    UINT32 depth;
+    if (!policy->capture(row, m_tls->size, thread, depth))
+        return FALSE;
+    if ((depth != 0) && (depth < maxframes))
+        maxframes = depth;
+    return TRUE;
+}
+
+// IsExcludedModule - Determines whether the module making the allocation is
+//   excluded from leak detection, and finds its row of the capture rules'
+//   decision table with the same lookup.
+//
+//  - policyrow (OUT): Receives the row of the module, or CAPTURE_ROW_ANY.
+//
+//  Return Value:
+//
+//    Returns TRUE if the allocation is not tracked.
+//
+BOOL CaptureContext::IsExcludedModule(UINT32 &policyrow) {
+    StatTimer timer(STATS_EXCLUDED_MODULE);
+    policyrow = CAPTURE_ROW_ANY;
     HMODULE hModule = GetCallingModule(m_context.fp);
     if (hModule == g_vld.m_dbghlpBase)
         return TRUE;
@@ -2996,9 +3466,14 @@ BOOL CaptureContext::IsExcludedModule() {
     UINT tablesize = _countof(g_vld.m_patchTable);
     for (UINT index = 0; index < tablesize; index++) {
         if (((HMODULE)g_vld.m_patchTable[index].moduleBase == hModule)) {
-            return !g_vld.m_patchTable[index].reportLeaks;
+            if (!g_vld.m_patchTable[index].reportLeaks)
+                return TRUE;
+            // Tracked whatever its flags: only its row is needed.
+            if (g_vld.m_capturePolicy != NULL)
+                g_vld.isModuleExcluded((UINT_PTR)hModule, policyrow);
+            return FALSE;
         }
     }
 
-    return g_vld.isModuleExcluded((UINT_PTR)hModule);
+    return g_vld.isModuleExcluded((UINT_PTR)hModule, policyrow);
 }
\ No newline at end of file
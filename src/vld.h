@@ -305,6 +305,59 @@ __declspec(dllimport) void VLDSetReportOptions(VLD_UINT option_mask, const wchar
 //
 __declspec(dllimport) int VLDSetReportHook(int mode,  VLD_REPORT_HOOK pfnNewHook);
 
+// VLDGetLifetimeHistograms - Return the lifetime histograms of every call site
+// blocks were allocated from. Only available if LifetimeHistograms is enabled in
+// vld.ini. The histograms are read without stopping other threads, so frees
+// made meanwhile may or may not be counted.
+//
+// histograms: array receiving the histograms, can be NULL if count is 0.
+//
+// count: size of the array.
+//
+//  Return Value:
+//
+//    VLD_UINT: number of call sites with a histogram, which can be more than
+//    count, in which case only the first count ones are returned.
+//
+__declspec(dllimport) VLD_UINT VLDGetLifetimeHistograms(VLD_LIFETIME_HISTOGRAM *histograms, VLD_UINT count);
+
+// VLDReportLifetimeHistograms - Report the lifetimes of the blocks freed from
+// the call sites that freed the most blocks, as is done after the leak report
+// when LifetimeHistograms is enabled in vld.ini.
+//
+//  Return Value:
+//
+//    VLD_UINT: number of call sites reported.
+//
+__declspec(dllimport) VLD_UINT VLDReportLifetimeHistograms();
+
+// VLDGetInternalStats - Return how many times each operation of Visual Leak
+// Detector was called, and how long the calls took. Only available if
+// InternalStats is enabled in vld.ini. The counters are read without stopping
+// other threads, so calls made meanwhile may or may not be counted.
+//
+// stats: array receiving the statistics, indexed by VLD_STAT_* operation, can
+//   be NULL if count is 0.
+//
+// count: size of the array.
+//
+//  Return Value:
+//
+//    VLD_UINT: number of operations measured, VLD_STAT_COUNT, or 0 if
+//    InternalStats is disabled. Only the first count ones are returned.
+//
+__declspec(dllimport) VLD_UINT VLDGetInternalStats(VLD_INTERNAL_STAT *stats, VLD_UINT count);
+
+// VLDReportInternalStats - Report the table of the calls made to each operation
+// of Visual Leak Detector, as is done after the leak report when InternalStats
+// is enabled in vld.ini.
+//
+//  Return Value:
+//
+//    VLD_UINT: number of operations reported.
+//
+__declspec(dllimport) VLD_UINT VLDReportInternalStats();
+
 // VLDResolveCallstacks - Performs symbol resolution for all saved extent CallStack's that have
 // been tracked by Visual Leak Detector. This function is necessary for applications that
 // dynamically load and unload modules, and through which memory leaks might be included.
@@ -346,5 +399,9 @@ __declspec(dllexport) int VLDResolveCallstacks();
 #define VLDGetModulesList(a, b) (FALSE)
 #define VLDSetReportOptions(a, b)
 #define VLDResolveCallstacks() (0)
+#define VLDGetLifetimeHistograms(a, b) (0)
+#define VLDReportLifetimeHistograms() (0)
+#define VLDGetInternalStats(a, b) (0)
+#define VLDReportInternalStats() (0)
 
 #endif // _DEBUG
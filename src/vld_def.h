@@ -42,8 +42,54 @@
 #define VLD_OPT_SKIP_HEAPFREE_LEAKS     0x1000 //   If set, VLD skip HeapFree memory leaks.
 #define VLD_OPT_VALIDATE_HEAPFREE       0x2000 //   If set, VLD verifies and reports heap consistency for HeapFree calls.
 #define VLD_OPT_SKIP_CRTSTARTUP_LEAKS   0x4000 //   If set, VLD skip crt srtartup memory leaks.
+#define VLD_OPT_LIFETIME_HISTOGRAMS     0x8000 //   If set, VLD counts the lifetimes of the blocks freed from each call site.
+#define VLD_OPT_REACHABILITY_SCAN       0x10000 //  If set, leaks still reachable from the program's data are left out of the report.
+#define VLD_OPT_INTERNAL_STATS          0x20000 //  If set, VLD measures the latency of its own hot paths.
 
 #define VLD_RPTHOOK_INSTALL  0
 #define VLD_RPTHOOK_REMOVE   1
 
 typedef int (__cdecl * VLD_REPORT_HOOK)(int reportType, wchar_t *message, int *returnValue);
+
+#define VLD_LIFETIME_BUCKETS 48
+
+// The lifetimes of the blocks allocated from one call site and freed since,
+// as returned by VLDGetLifetimeHistograms. Both histograms have a logarithmic
+// scale: bucket 0 counts lifetimes of 0, bucket n those from 2^(n-1) up to
+// 2^n - 1, and the last bucket every longer lifetime too.
+typedef struct VLD_LIFETIME_HISTOGRAM
+{
+    unsigned int       stackHash;   // Hash of the call stack of the call site.
+    unsigned long long frees;       // Number of blocks freed.
+    unsigned long long allocations [VLD_LIFETIME_BUCKETS]; // Lifetimes, in allocations made while the block was alive.
+    unsigned long long cycles [VLD_LIFETIME_BUCKETS];      // Lifetimes, in processor time stamp counter ticks.
+} VLD_LIFETIME_HISTOGRAM;
+
+// The operations of VLD measured when InternalStats is enabled, as indexes of
+// the array filled by VLDGetInternalStats.
+#define VLD_STAT_GET_TLS            0   // Finding the thread local storage of a hook.
+#define VLD_STAT_EXCLUDED_MODULE    1   // Finding whether the module calling a hook is excluded.
+#define VLD_STAT_STACK_CAPTURE      2   // Capturing the call stack of an allocation.
+#define VLD_STAT_MAP_BLOCK          3   // Recording an allocated block.
+#define VLD_STAT_UNMAP_BLOCK        4   // Forgetting a freed block.
+#define VLD_STAT_REMAP_BLOCK        5   // Updating a reallocated block.
+#define VLD_STAT_HEAPMAP_LOCK       6   // Waiting for the lock protecting the block maps.
+#define VLD_STAT_VLDHEAP_LOCK       7   // Waiting for the locks of VLD's own blocks.
+#define VLD_STAT_MODULES_LOCK       8   // Waiting for the lock protecting the loaded modules.
+#define VLD_STAT_SYMBOLS            9   // Resolving the symbols of a call stack.
+#define VLD_STAT_COUNT              10
+
+#define VLD_STAT_BUCKETS 32
+
+// The calls made to one operation of VLD by every thread, as returned by
+// VLDGetInternalStats. Durations are in processor time stamp counter ticks.
+// The histogram has a logarithmic scale: bucket 0 counts calls of 0 ticks,
+// bucket n those from 2^(n-1) up to 2^n - 1, and the last bucket every longer
+// call too.
+typedef struct VLD_INTERNAL_STAT
+{
+    unsigned long long calls;       // Number of calls.
+    unsigned long long cycles;      // Ticks spent in all the calls.
+    unsigned long long maxCycles;   // Ticks spent in the longest call.
+    unsigned long long histogram [VLD_STAT_BUCKETS]; // Calls by duration.
+} VLD_INTERNAL_STAT;
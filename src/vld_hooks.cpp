@@ -66,11 +66,11 @@ HANDLE VisualLeakDetector::_GetProcessHeap()
     HANDLE heap = m_GetProcessHeap();
 
     CriticalSectionLocker<> cs(g_heapMapLock);
-    HeapMap::Iterator heapit = g_vld.m_heapMap->find(heap);
-    if (heapit == g_vld.m_heapMap->end())
+    HeapMap* heapmap = g_vld.m_tracker->heapMap();
+    HeapMap::Iterator heapit = heapmap->find(heap);
+    if (heapit == heapmap->end())
     {
         g_vld.mapHeap(heap);
-        heapit = g_vld.m_heapMap->find(heap);
     }
 
     return heap;
@@ -101,8 +101,9 @@ HANDLE VisualLeakDetector::_HeapCreate (DWORD options, SIZE_T initsize, SIZE_T m
     // Map the created heap handle to a new block map.
     g_vld.mapHeap(heap);
 
-    HeapMap::Iterator heapit = g_vld.m_heapMap->find(heap);
-    assert(heapit != g_vld.m_heapMap->end());
+    HeapMap* heapmap = g_vld.m_tracker->heapMap();
+    assert(heapmap->find(heap) != heapmap->end());
+    UNREFERENCED_PARAMETER(heapmap);
 
     return heap;
 }
@@ -265,16 +266,22 @@ LPVOID VisualLeakDetector::_RtlReAllocateHeap (HANDLE heap, DWORD flags, LPVOID
 {
     PRINT_HOOKED_FUNCTION();
 
+    if (g_DbgHelp.IsLockedByCurrentThread()) // skip dbghelp.dll calls
+        return RtlReAllocateHeap(heap, flags, mem, size);
+
+    // Another thread may get the old address back from the heap as soon as
+    // the block is moved, so its record must not be in the maps anymore. The
+    // record is put back if the reallocation fails.
+    CAPTURE_CONTEXT();
+    CaptureContext cc(RtlReAllocateHeap, context_);
+    BOOL enabled = g_vld.enabled();
+    if (enabled)
+        cc.Detach(heap, mem);
+
     // Reallocate the block.
     LPVOID newmem = RtlReAllocateHeap(heap, flags, mem, size);
-    if ((newmem == NULL) || !g_vld.enabled())
-        return newmem;
-
-    if (!g_DbgHelp.IsLockedByCurrentThread()) { // skip dbghelp.dll calls
-        CAPTURE_CONTEXT();
-        CaptureContext cc(RtlReAllocateHeap, context_);
+    if ((newmem != NULL) && enabled)
         cc.Set(heap, mem, newmem, size);
-    }
 
     return newmem;
 }
@@ -284,16 +291,22 @@ LPVOID VisualLeakDetector::_HeapReAlloc (HANDLE heap, DWORD flags, LPVOID mem, S
 {
     PRINT_HOOKED_FUNCTION();
 
+    if (g_DbgHelp.IsLockedByCurrentThread()) // skip dbghelp.dll calls
+        return HeapReAlloc(heap, flags, mem, size);
+
+    // Another thread may get the old address back from the heap as soon as
+    // the block is moved, so its record must not be in the maps anymore. The
+    // record is put back if the reallocation fails.
+    CAPTURE_CONTEXT();
+    CaptureContext cc(HeapReAlloc, context_);
+    BOOL enabled = g_vld.enabled();
+    if (enabled)
+        cc.Detach(heap, mem);
+
     // Reallocate the block.
     LPVOID newmem = HeapReAlloc(heap, flags, mem, size);
-    if ((newmem == NULL) || !g_vld.enabled())
-        return newmem;
-
-    if (!g_DbgHelp.IsLockedByCurrentThread()) { // skip dbghelp.dll calls
-        CAPTURE_CONTEXT();
-        CaptureContext cc(HeapReAlloc, context_);
+    if ((newmem != NULL) && enabled)
         cc.Set(heap, mem, newmem, size);
-    }
 
     return newmem;
 }
@@ -0,0 +1,1243 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Preload Library for Linux
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// The Linux counterpart of the hooks of vld.dll: built as libvld_preload.so,
+// and loaded into a program with LD_PRELOAD, it replaces the C library's heap
+// functions and the global new and delete operators with functions feeding the
+// same tracking engine (vld_core), and reports the leaks when the program
+// exits. Options are read from the Vld<Option> environment variables only.
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <dlfcn.h>
+#if !defined(__x86_64__)
+#include <execinfo.h>
+#endif
+#include <link.h>
+#include <malloc.h>
+#include <new>
+#include <pthread.h>
+#include <sys/auxv.h>
+#include <ucontext.h>
+
+#define VLDBUILD
+#include "blocktracker.h"       // Provides the tracking engine.
+#include "callstack.h"          // Provides a class for handling call stacks.
+#include "capturepolicy.h"      // Provides the capture rules.
+#include "criticalsection.h"    // Provides the lock protecting the tracker.
+#include "internalstats.h"      // Provides the counters of VLD's own operations.
+#include "moduletable.h"        // Provides the table of the loaded modules.
+#include "stacktable.h"         // Provides the table of the call stacks.
+#include "symbolizer.h"         // Provides the symbols of unloaded modules.
+#include "utility.h"            // Provides the report functions.
+#include "vldconfig.h"          // Provides the configuration loader.
+#include "vldheap.h"            // Provides internal new and delete operators.
+#include "version.h"            // Provides the version of VLD.
+
+// The real heap functions. These are glibc's own names for them, so they are
+// available without dlsym, which itself allocates, even while the dynamic
+// loader is still starting the program.
+extern "C" {
+void* __libc_malloc (size_t size);
+void* __libc_calloc (size_t count, size_t size);
+void* __libc_realloc (void *mem, size_t size);
+void  __libc_free (void *mem);
+void* __libc_memalign (size_t alignment, size_t size);
+}
+
+#define VLD_EXPORT __attribute__((visibility("default")))
+
+#define VLD_DEFAULT_MAX_DATA_DUMP    256    // Same defaults as vld.dll.
+#define VLD_DEFAULT_MAX_TRACE_FRAMES 64
+#define VLD_DEFAULT_REPORT_FILE_NAME L"memory_leak_report.txt"
+
+#define VLD_PRELOAD_HEAP        ((HANDLE)1) // The C library's heap, the only heap there is here.
+
+// The hooks forward every call to the C library until the tracker is running,
+// and again once the leaks have been reported.
+#define PRELOAD_STARTING        0x0 // The library isn't initialized yet.
+#define PRELOAD_RUNNING         0x1 // Allocations are being tracked.
+#define PRELOAD_STOPPED         0x2 // Leak detection is turned off, or the leaks have been reported.
+
+#define MODULE_CHECK_INTERVAL   256 // Allocations of a thread between two checks for modules loaded or unloaded.
+
+// The C library's functions, found with dlsym.
+typedef int (*dlclose_t)(void *handle);
+typedef int (*pthread_setname_np_t)(pthread_t thread, const char *name);
+
+// Global variables.
+static BlockTracker    *g_tracker = NULL;   // The tracking engine. Never deleted: threads may still be using it at exit.
+static CriticalSection  g_heapMapLock;      // Protects the tracker.
+static vldconfig_t      g_config;           // The options, as loaded from the environment.
+static FILE            *g_reportFile = NULL;
+static BOOL             g_safeStackWalk = FALSE;    // If set, stacks are unwound instead of following the frame pointers.
+static int              g_state = PRELOAD_STARTING;
+static ModuleTable     *g_modules = NULL;   // The loaded modules. Never deleted, like the tracker.
+static CriticalSection  g_modulesLock;      // Serializes RefreshModules.
+static CapturePolicy   *g_policy = NULL;    // The capture rules, or NULL if there are none. Never deleted, like the tracker.
+static UINT32           g_unloading = 0;    // Number of calls to dlclose in progress.
+
+// Number of VLD's functions the current thread is in. Only the outermost hook
+// tracks the allocation; the heap functions called by VLD itself, by the C++
+// runtime's own new operator or while capturing a stack go straight to the C
+// library. The initial-exec model keeps accesses to it from allocating.
+static __thread UINT32 t_hookDepth __attribute__((tls_model("initial-exec")));
+
+// The state of the capture rules kept by the current thread.
+static __thread capturethread_t t_capture __attribute__((tls_model("initial-exec")));
+
+// Number of allocations made by the current thread since it last checked for
+// modules loaded or unloaded.
+static __thread UINT32 t_moduleCheck __attribute__((tls_model("initial-exec")));
+
+static bool CheckModules ();
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The HookContext Class
+//
+//   One instance is created by each hook, playing the part of CaptureContext
+//   in vld.dll: it detects the first entry into VLD's code, and maps the block
+//   set by the hook when it goes out of scope, once the real heap function has
+//   returned. The record of a block being reallocated is detached by the hook
+//   beforehand, and attached again or released then.
+//
+class HookContext
+{
+public:
+    HookContext (void* func, context_t& context);
+    ~HookContext ();
+    bool IsFirst () const { return m_bFirst; }
+    void Detach (LPCVOID mem);
+    void Set (LPCVOID mem, LPCVOID newmem, SIZE_T size);
+private:
+    // Disallow certain operations
+    HookContext ();
+    HookContext (const HookContext&);
+    HookContext& operator = (const HookContext&);
+private:
+    bool IsCaptured (UINT32 &maxframes) const;
+private:
+    const context_t& m_context;
+    bool             m_bFirst;
+    LPCVOID          m_block;       // The allocated block, or the block before reallocation.
+    LPCVOID          m_newBlock;    // The block after reallocation, or NULL.
+    SIZE_T           m_size;
+    detachedblock_t  m_detached;    // The record of the block being reallocated, if it is tracked.
+};
+
+// Constructor - Enters VLD's code.
+//
+//  - func (IN): The hook, which is shown as the first frame of the call stack.
+//
+//  - context (IN): Where the hook was called from. See CAPTURE_CONTEXT.
+//
+HookContext::HookContext (void* func, context_t& context)
+    : m_context(context), m_block(NULL), m_newBlock(NULL), m_size(0)
+{
+    m_detached.address = NULL;
+    context.func = reinterpret_cast<UINT_PTR>(func);
+    m_bFirst = (t_hookDepth++ == 0) && (__atomic_load_n(&g_state, __ATOMIC_ACQUIRE) == PRELOAD_RUNNING);
+}
+
+// Destructor - Maps the block set by the hook, if any, with the call stack of
+//   the allocation, and leaves VLD's code. A detached record is attached
+//   again if the block was reallocated in-place and is still tracked, or if
+//   the reallocation failed, and is released otherwise.
+//
+HookContext::~HookContext ()
+{
+    UINT32 maxframes;
+    if (m_bFirst && (m_block != NULL)) {
+        if (!IsCaptured(maxframes)) {
+            // Not tracked anymore, even if the block was reallocated in-place.
+            if (m_detached.address != NULL) {
+                CriticalSectionLocker<> cs(g_heapMapLock);
+                g_tracker->releaseDetached(m_detached);
+            }
+        }
+        else {
+            CallStack* callstack = CallStack::Create(g_safeStackWalk);
+            callstack->getStackTrace(maxframes, m_context);
+
+            CriticalSectionLocker<> cs(g_heapMapLock);
+            blockinfo_t* pblockInfo = NULL;
+            SIZE_T oldsize = 0;
+            if (m_newBlock == NULL) {
+                if (!g_tracker->mapBlock(VLD_PRELOAD_HEAP, m_block, m_size, 0, GetCurrentThreadId(), pblockInfo, oldsize)) {
+                    // The previously allocated block must have been freed by some
+                    // mechanism unknown to VLD.
+                    Report(L"VLD: New allocation at already allocated address: " ADDRESSFORMAT L" with size: %zu and new size: %zu\n",
+                        (UINT_PTR)m_block, oldsize, m_size);
+                }
+            }
+            else if ((m_newBlock == m_block) && (m_detached.address != NULL)) {
+                pblockInfo = g_tracker->attachBlock(m_detached, m_size, GetCurrentThreadId(), false);
+            }
+            else {
+                // The block was not reallocated in-place. Instead the old block
+                // was freed and a new block allocated to satisfy the new size.
+                // A block VLD didn't track is tracked from now on.
+                g_tracker->releaseDetached(m_detached);
+                g_tracker->mapBlock(VLD_PRELOAD_HEAP, m_newBlock, m_size, 0, GetCurrentThreadId(), pblockInfo, oldsize);
+            }
+            g_tracker->setStack(pblockInfo, callstack);
+        }
+    }
+    else if (m_detached.address != NULL) {
+        // The reallocation failed: the block is left as it was.
+        CriticalSectionLocker<> cs(g_heapMapLock);
+        g_tracker->attachBlock(m_detached, m_detached.info.size, m_detached.info.threadId, true);
+    }
+    t_hookDepth--;
+}
+
+// Detach - Takes the record of a block about to be reallocated out of the
+//   block maps, before the C library is called (see
+//   BlockTracker::detachBlock).
+//
+//  - mem (IN): The block about to be reallocated.
+//
+//  Return Value:
+//
+//    None.
+//
+void HookContext::Detach (LPCVOID mem)
+{
+    g_tracker->detachBlock(VLD_PRELOAD_HEAP, mem, m_detached);
+}
+
+// Set - Records the block to map once the real heap function has returned.
+//
+//  - mem (IN): The allocated block, or the block before reallocation.
+//
+//  - newmem (IN): The block after reallocation, or NULL for an allocation.
+//
+//  - size (IN): The size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    None.
+//
+void HookContext::Set (LPCVOID mem, LPCVOID newmem, SIZE_T size)
+{
+    m_block = mem;
+    m_newBlock = newmem;
+    m_size = size;
+}
+
+// IsCaptured - Determines whether the allocation is tracked. It isn't if the
+//   hook was called by a module whose allocations are not tracked: the C
+//   library, the dynamic loader, and the modules left out by
+//   ForceIncludeModules (see ModuleTable), or if the capture rules leave it
+//   out (see CapturePolicy). Neither lookup takes any lock. Modules loaded
+//   or unloaded are looked for when the return address isn't in any module,
+//   every MODULE_CHECK_INTERVAL allocations of the thread, and on every
+//   allocation while a module is being unloaded, so that a module loaded at
+//   the addresses of an unloaded one is never taken for it.
+//
+//  - maxframes (OUT): Receives the most frames to capture for the block.
+//
+//  Return Value:
+//
+//    Returns true if the allocation should be tracked.
+//
+bool HookContext::IsCaptured (UINT32 &maxframes) const
+{
+    const loadedmodule_t *module;
+    {
+        StatTimer timer(STATS_EXCLUDED_MODULE);
+        // Read before the lookup: once dlclose has returned, the table no
+        // longer holds the modules it unloaded.
+        bool unloading = (__atomic_load_n(&g_unloading, __ATOMIC_ACQUIRE) != 0);
+        module = g_modules->find(GET_RETURN_ADDRESS(m_context));
+        if (((module == NULL) || unloading || (++t_moduleCheck >= MODULE_CHECK_INTERVAL)) && CheckModules())
+            module = g_modules->find(GET_RETURN_ADDRESS(m_context));
+        if ((module != NULL) && (module->flags & MODULE_EXCLUDED))
+            return false;
+    }
+
+    maxframes = g_config.maxTraceFrames;
+    if (g_policy == NULL)
+        return true;
+
+    if (g_policy->threadNameStale(t_capture)) {
+        // Reading the name of the calling thread doesn't allocate.
+        char name [16];
+        wchar_t wname [16];
+        size_t length = 0;
+        if (g_policy->usesThreadNames() && (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)) {
+            for (; (name[length] != '\0') && (length < sizeof(name) - 1); length++)
+                wname[length] = (wchar_t)(unsigned char)name[length];
+        }
+        g_policy->setThreadName(t_capture, wname, length);
+    }
+
+    // Code outside of any module, such as code generated at run time, is only
+    // subject to the rules without module patterns.
+    UINT32 depth;
+    if (!g_policy->capture((module != NULL) ? module->policyRow : CAPTURE_ROW_ANY, m_size, t_capture, depth))
+        return false;
+    if ((depth != 0) && (depth < maxframes))
+        maxframes = depth;
+    return true;
+}
+
+// UnmapBlock - Stops tracking a block about to be freed. Must be called before
+//   the block is freed, or its address could be allocated again, and mapped,
+//   by another thread in the meantime.
+//
+//  - hook (IN): The context of the hook freeing the block.
+//
+//  - mem (IN): The block being freed.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID UnmapBlock (const HookContext &hook, LPCVOID mem)
+{
+    if (hook.IsFirst() && (mem != NULL)) {
+        // Blocks VLD doesn't know about are rejected by the tracker's address
+        // filter, without taking the lock.
+        g_tracker->unmapBlock(VLD_PRELOAD_HEAP, mem);
+    }
+}
+
+// HasFrameInModules - Determines whether a call stack went through any of the
+//   specified modules.
+//
+//  - callstack (IN): The call stack.
+//
+//  - modules (IN): The modules.
+//
+//  Return Value:
+//
+//    Returns true if a frame of the call stack is in the code of one of the
+//    modules.
+//
+static bool HasFrameInModules (const CallStack &callstack, const LoadedModuleList &modules)
+{
+    for (UINT32 frame = 0; frame < callstack.size(); frame++) {
+        UINT_PTR programcounter = callstack[frame];
+        for (LoadedModuleList::const_iterator moduleit = modules.begin(); moduleit != modules.end(); ++moduleit) {
+            for (UINT32 index = 0; index < (*moduleit)->segmentCount; index++) {
+                if ((programcounter >= (*moduleit)->segments[index].low) && (programcounter < (*moduleit)->segments[index].high))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+// RefreshModules - Publishes a new snapshot of the loaded modules, after a
+//   module was loaded or unloaded. The call stacks going through the modules
+//   which were unloaded are resolved right away, from the modules' files,
+//   while their addresses still mean what they meant when the stacks were
+//   captured: another module may be loaded at the same addresses later on.
+//   This is what VLDResolveCallstacks leaves to the program on Windows.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID RefreshModules ()
+{
+    CriticalSectionLocker<> cs(g_modulesLock);
+    LoadedModuleList unloaded;
+    g_modules->refresh(&unloaded);
+    if (unloaded.empty())
+        return;
+
+    // The stacks are referenced, so that they stay alive while they are
+    // resolved without holding the heap map lock.
+    struct pendingstack_t {
+        UINT32     id;
+        CallStack *callstack;
+    };
+    typedef std::vector<pendingstack_t, vldallocator<pendingstack_t> > PendingStackList;
+    PendingStackList pending;
+    {
+        CriticalSectionLocker<> heap(g_heapMapLock);
+        StackTable *stacks = g_tracker->stackTable();
+        for (UINT32 id = 1; id < stacks->capacity(); id++) {
+            pendingstack_t stack = { id, stacks->get(id) };
+            if ((stack.callstack != NULL) && HasFrameInModules(*stack.callstack, unloaded)) {
+                // A stack captured from a module loaded at the same addresses
+                // later on is not the same stack.
+                stacks->retire(id);
+                stacks->addRef(id);
+                pending.push_back(stack);
+            }
+        }
+    }
+    if (pending.empty())
+        return;
+
+    // Whatever the symbolizer knows about the addresses of the unloaded
+    // modules is forgotten, and forgotten again once the stacks are resolved.
+    Symbolizer *symbolizer = Symbolizer::Get();
+    symbolizer->flush();
+    for (LoadedModuleList::iterator moduleit = unloaded.begin(); moduleit != unloaded.end(); ++moduleit)
+        symbolizer->addModule(**moduleit);
+    for (PendingStackList::iterator stackit = pending.begin(); stackit != pending.end(); ++stackit)
+        stackit->callstack->resolve(FALSE, FALSE);
+    symbolizer->flush();
+
+    CriticalSectionLocker<> heap(g_heapMapLock);
+    for (PendingStackList::iterator stackit = pending.begin(); stackit != pending.end(); ++stackit)
+        g_tracker->stackTable()->release(stackit->id);
+}
+
+// CheckModules - Refreshes the module table if modules were loaded or
+//   unloaded since it was last refreshed, as told by the dynamic loader. dlopen
+//   isn't hooked: the module calling it is found from its return address,
+//   which must stay in the caller for the caller's run path and $ORIGIN to
+//   apply. dlclose is, and checks the modules before returning (see dlclose).
+//
+//  Return Value:
+//
+//    Returns true if the module table was refreshed.
+//
+static bool CheckModules ()
+{
+    t_moduleCheck = 0;
+    if (!g_modules->changed())
+        return false;
+    RefreshModules();
+    return true;
+}
+
+// SetupReporting - Selects the destinations of the report, as set by the
+//   ReportTo and ReportFile options. The debugger is the standard error
+//   stream.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID SetupReporting ()
+{
+    BOOL toDebugger = TRUE;
+    BOOL toFile = FALSE;
+    BOOL toStdOut = FALSE;
+    if (wcscasecmp(g_config.reportTo, L"both") == 0) {
+        toFile = TRUE;
+    }
+    else if (wcscasecmp(g_config.reportTo, L"file") == 0) {
+        toDebugger = FALSE;
+        toFile = TRUE;
+    }
+    else if (wcscasecmp(g_config.reportTo, L"stdout") == 0) {
+        toDebugger = FALSE;
+        toStdOut = TRUE;
+    }
+
+    if (toFile) {
+        const WCHAR* path = (g_config.reportFile[0] != L'\0') ? g_config.reportFile : VLD_DEFAULT_REPORT_FILE_NAME;
+        char patha [VLD_CONFIG_MAX_PATH * 4];
+        if (wcstombs(patha, path, sizeof(patha)) < sizeof(patha))
+            g_reportFile = fopen(patha, "w");
+        if (g_reportFile == NULL) {
+            Report(L"WARNING: Visual Leak Detector: Couldn't open report file for writing: %ls\n"
+                L"  The report will be sent to the debugger instead.\n", path);
+            return;
+        }
+    }
+    SetReportFile(g_reportFile, toDebugger, toStdOut);
+}
+
+// AddModuleRoots - Called by dl_iterate_phdr for each loaded module. Adds the
+//   writable segments of the module, and its thread local storage for the
+//   calling thread, to the roots of a reachability scan. This library's own
+//   data only points to the tracker's records, and is left out.
+//
+//  - info (IN): The module's program headers.
+//
+//  - size (IN): Size of the structure pointed to by info.
+//
+//  - context (IN): The scan.
+//
+//  Return Value:
+//
+//    Always returns 0, to go on with the next module.
+//
+static int AddModuleRoots (struct dl_phdr_info *info, size_t /*size*/, void *context)
+{
+    ReachabilityScan *scan = (ReachabilityScan*)context;
+    for (ElfW(Half) index = 0; index < info->dlpi_phnum; index++) {
+        const ElfW(Phdr) *segment = &info->dlpi_phdr[index];
+        if ((segment->p_type == PT_LOAD) &&
+            ((UINT_PTR)&g_tracker - (info->dlpi_addr + segment->p_vaddr) < segment->p_memsz))
+            return 0;
+    }
+
+    for (ElfW(Half) index = 0; index < info->dlpi_phnum; index++) {
+        const ElfW(Phdr) *segment = &info->dlpi_phdr[index];
+        if ((segment->p_type == PT_LOAD) && (segment->p_flags & PF_W)) {
+            scan->addRoot((LPCVOID)(info->dlpi_addr + segment->p_vaddr), segment->p_memsz);
+        }
+        else if ((segment->p_type == PT_TLS) && (info->dlpi_tls_data != NULL)) {
+            scan->addRoot(info->dlpi_tls_data, segment->p_memsz);
+        }
+    }
+    return 0;
+}
+
+// AddThreadRoots - Adds the registers and the stack of the calling thread, from
+//   this function's frame up, to the roots of a reachability scan. The stacks
+//   of the other threads are not scanned: they keep running.
+//
+//  - scan (IN/OUT): The scan.
+//
+//  Return Value:
+//
+//    None.
+//
+__attribute__((noinline))
+static VOID AddThreadRoots (ReachabilityScan &scan)
+{
+    // Only the general purpose registers are scanned: the vector registers
+    // would mostly hold stale words, left by VLD's own copies of the blocks.
+    ucontext_t registers;
+    getcontext(&registers);
+    scan.addRoot(&registers.uc_mcontext.gregs, sizeof(registers.uc_mcontext.gregs));
+
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+        return;
+    void *stack = NULL;
+    size_t stacksize = 0;
+    if (pthread_attr_getstack(&attributes, &stack, &stacksize) == 0) {
+        UINT_PTR low = (UINT_PTR)(&registers + 1);
+        UINT_PTR high = (UINT_PTR)stack + stacksize;
+        if ((low >= (UINT_PTR)stack) && (low < high))
+            scan.addRoot((LPCVOID)low, high - low);
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+// ClassifyLeaks - Runs a reachability scan of the blocks, from the data of the
+//   loaded modules and the calling thread, on one thread per processor. See
+//   BlockTracker::classifyLeaks.
+//
+//  - snapshot (IN/OUT): The leaks to classify.
+//
+//  - reachablebytes (OUT): Receives the total size of the still reachable
+//      leaks.
+//
+//  Return Value:
+//
+//    Returns the number of still reachable leaks.
+//
+static SIZE_T ClassifyLeaks (LeakSnapshot &snapshot, SIZE_T &reachablebytes)
+{
+    ReachabilityScan scan;
+    dl_iterate_phdr(AddModuleRoots, &scan);
+    AddThreadRoots(scan);
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return g_tracker->classifyLeaks(snapshot, scan, (processors > 0) ? (UINT32)processors : 1,
+        NULL, NULL, reachablebytes);
+}
+
+// ReportLeaks - Generates a memory leak report for the blocks still allocated.
+//   Follows the format of vld.dll's report.
+//
+//  - reachableBytes (OUT): Receives the total size of the blocks left out of
+//      the report because they are still reachable.
+//
+//  Return Value:
+//
+//    Returns the number of leaks found.
+//
+static SIZE_T ReportLeaks (SIZE_T &reachableBytes)
+{
+    LeakSnapshot snapshot;
+    g_tracker->takeSnapshot(snapshot, NULL, (DWORD)-1, g_config.maxDataDump, NULL, NULL);
+    SIZE_T reachable = 0;
+    reachableBytes = 0;
+    if (g_config.reachabilityScan) {
+        reachable = ClassifyLeaks(snapshot, reachableBytes);
+    }
+    SIZE_T leaksFound = BlockTracker::countLeaks(snapshot, g_config.aggregateDuplicates, false);
+    SIZE_T lost [REACHABILITY_REACHABLE] = { 0 };
+
+    bool firstLeak = true;
+    for (LeakSnapshot::iterator leakit = snapshot.begin(); leakit != snapshot.end(); ++leakit)
+    {
+        const leakentry_t *leak = &(*leakit);
+        if (leak->count == 0) {
+            // Aggregated under the heading of another leak.
+            continue;
+        }
+
+        if (firstLeak) {
+            Report(L"WARNING: Visual Leak Detector detected memory leaks!\n");
+            firstLeak = false;
+        }
+        SIZE_T blockLeaksCount = leak->count;
+        Report(L"---------- Block %zu at " ADDRESSFORMAT L": %zu bytes ----------\n", leak->serialNumber,
+            (UINT_PTR)leak->address, leak->size);
+        Report(L"  Leak Hash: 0x%08X, Count: %zu, Total %zu bytes\n", leak->leakHash, blockLeaksCount,
+            leak->size * blockLeaksCount);
+        if (leak->reachability != REACHABILITY_UNKNOWN) {
+            Report(L"  Reachability: %ls\n", (leak->reachability == REACHABILITY_DIRECT) ?
+                L"definitely lost" : L"indirectly lost (only referenced by other leaks)");
+            lost[leak->reachability] += blockLeaksCount;
+        }
+
+        // Dump the call stack.
+        if (blockLeaksCount == 1)
+            Report(L"  Call Stack (TID %u):\n", leak->threadId);
+        else
+            Report(L"  Call Stack:\n");
+        if (leak->callStack)
+            leak->callStack->dump(FALSE, FALSE);
+
+        // Dump the data in the user data section of the memory block, as
+        // copied when the snapshot was taken.
+        if (g_config.maxDataDump != 0) {
+            Report(L"  Data:\n");
+            DumpMemoryA(leak->data, (leak->data != NULL) ? leak->dataSize : 0);
+        }
+        Report(L"\n\n");
+    }
+
+    if (g_config.reachabilityScan) {
+        Report(L"Reachability: %zu leaks definitely lost, %zu indirectly lost, %zu blocks still reachable"
+            L" (%zu bytes, not reported).\n", lost[REACHABILITY_DIRECT], lost[REACHABILITY_INDIRECT],
+            reachable, reachableBytes);
+    }
+    g_tracker->releaseSnapshot(snapshot);
+    return leaksFound;
+}
+
+// ReportInternalStats - Reports the table of the calls made to each of VLD's
+//   operations, with their latencies in time stamp counter ticks. The counters
+//   keep running: the table only shows the calls made so far.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID ReportInternalStats ()
+{
+    statcounts_t counts [STATS_COUNT];
+    ReadInternalStats(counts);
+
+    Report(L"Visual Leak Detector internal statistics, in cycles:\n");
+    Report(L"  %-18ls %12ls %10ls %10ls %10ls %12ls\n", L"Operation", L"Calls", L"Mean", L"Median", L"99%", L"Max");
+    for (UINT stat = 0; stat < STATS_COUNT; stat++) {
+        if (counts[stat].calls == 0)
+            continue;
+        // The quantiles are the upper limits of their buckets, which no call
+        // may have reached.
+        UINT64 median = StatBucketLimit(StatQuantile(counts[stat].buckets, counts[stat].calls, 50));
+        UINT64 tail = StatBucketLimit(StatQuantile(counts[stat].buckets, counts[stat].calls, 99));
+        if (median > counts[stat].maxCycles)
+            median = counts[stat].maxCycles;
+        if (tail > counts[stat].maxCycles)
+            tail = counts[stat].maxCycles;
+        Report(L"  %-18ls %12llu %10llu %10llu %10llu %12llu\n", StatName(stat),
+            (unsigned long long)counts[stat].calls, (unsigned long long)(counts[stat].cycles / counts[stat].calls),
+            (unsigned long long)median, (unsigned long long)tail, (unsigned long long)counts[stat].maxCycles);
+    }
+}
+
+// The tracker and the module table must not be in the middle of an update when
+// the process forks. The child's only thread isn't the owner of the locks
+// anymore, as far as the mutexes can tell, so it gets new locks instead of
+// releasing them.
+static void ForkPrepare () { g_modulesLock.Enter(); g_heapMapLock.Enter(); }
+static void ForkParent ()  { g_heapMapLock.Leave(); g_modulesLock.Leave(); }
+static void ForkChild ()   { g_heapMapLock.Initialize(STATS_HEAPMAP_LOCK); g_modulesLock.Initialize(STATS_MODULES_LOCK); }
+
+// VldPreloadInit - Starts tracking allocations. Called by the dynamic loader
+//   once the C library and the C++ runtime are initialized, before the
+//   program's own constructors run.
+//
+//  Return Value:
+//
+//    None.
+//
+__attribute__((constructor))
+static void VldPreloadInit ()
+{
+    t_hookDepth++;
+    InitConfig(g_config, VLD_DEFAULT_MAX_DATA_DUMP, VLD_DEFAULT_MAX_TRACE_FRAMES);
+    LoadConfigEnvironment(g_config);
+    if (!g_config.vld) {
+        Report(L"Visual Leak Detector is turned off.\n");
+        __atomic_store_n(&g_state, PRELOAD_STOPPED, __ATOMIC_RELEASE);
+        t_hookDepth--;
+        return;
+    }
+    SetupReporting();
+    if (g_config.captureRules[0] != L'\0') {
+        size_t invalid;
+        g_policy = new CapturePolicy;
+        if (g_policy->compile(g_config.captureRules, invalid) == 0) {
+            delete g_policy;
+            g_policy = NULL;
+        }
+        if (invalid > 0) {
+            Report(L"VLD: Ignoring %zu capture rule(s) which could not be parsed: %ls\n", invalid, g_config.captureRules);
+        }
+    }
+    UINT_PTR runtime [] = { (UINT_PTR)&__libc_malloc, (UINT_PTR)getauxval(AT_BASE) };
+    g_modules = new ModuleTable(g_config.forceIncludeModules, runtime, sizeof(runtime) / sizeof(runtime[0]), g_policy);
+    g_modules->refresh(NULL);
+    g_safeStackWalk = (wcscasecmp(g_config.stackWalkMethod, L"safe") == 0);
+
+#if !defined(__x86_64__)
+    // The unwinder used by backtrace is loaded the first time a stack is
+    // captured. Load it now, instead of under the lock.
+    void* frame;
+    backtrace(&frame, 1);
+#endif
+
+    g_modulesLock.Initialize(STATS_MODULES_LOCK);
+    g_heapMapLock.Initialize(STATS_HEAPMAP_LOCK);
+    g_tracker = new BlockTracker(g_heapMapLock, false);
+    pthread_atfork(ForkPrepare, ForkParent, ForkChild);
+
+    Report(L"Visual Leak Detector Version " VLDVERSION L" installed.\n");
+    if (g_config.aggregateDuplicates) {
+        Report(L"    Aggregating duplicate leaks.\n");
+    }
+    if (g_config.maxDataDump != VLD_DEFAULT_MAX_DATA_DUMP) {
+        if (g_config.maxDataDump == 0) {
+            Report(L"    Suppressing data dumps.\n");
+        }
+        else {
+            Report(L"    Limiting data dumps to %u bytes.\n", g_config.maxDataDump);
+        }
+    }
+    if (g_config.maxTraceFrames != VLD_DEFAULT_MAX_TRACE_FRAMES) {
+        Report(L"    Limiting stack traces to %u frames.\n", g_config.maxTraceFrames);
+    }
+    if (g_modules->isIncludeList()) {
+        Report(L"    Forcing inclusion of these modules in leak detection: %ls\n", g_config.forceIncludeModules);
+    }
+    if (g_safeStackWalk) {
+        Report(L"    Using the \"safe\" (but slow) stack walking method.\n");
+    }
+    if (g_policy != NULL) {
+        Report(L"    Tracking allocations following %zu capture rule(s): %ls\n", g_policy->ruleCount(), g_config.captureRules);
+    }
+    if (g_config.reachabilityScan) {
+        Report(L"    Leaving leaks still reachable from the program's data out of the report.\n");
+    }
+    if (g_config.internalStats) {
+        Report(L"    Measuring Visual Leak Detector's own operations.\n");
+        EnableInternalStats(true);
+    }
+    __atomic_store_n(&g_state, PRELOAD_RUNNING, __ATOMIC_RELEASE);
+    t_hookDepth--;
+}
+
+// VldPreloadFini - Reports the leaks and stops tracking allocations. Called
+//   when the program exits, after the program's own destructors and the
+//   functions registered with atexit.
+//
+//  Return Value:
+//
+//    None.
+//
+__attribute__((destructor))
+static void VldPreloadFini ()
+{
+    if (__atomic_load_n(&g_state, __ATOMIC_ACQUIRE) != PRELOAD_RUNNING)
+        return;
+
+    t_hookDepth++;
+    // The stacks going through the modules unloaded since the last check are
+    // resolved before the report.
+    CheckModules();
+    SIZE_T reachableBytes = 0;
+    SIZE_T leaks_count = ReportLeaks(reachableBytes);
+
+    // Show a summary.
+    if (leaks_count == 0) {
+        Report(L"No memory leaks detected.\n");
+    }
+    else {
+        CriticalSectionLocker<> cs(g_heapMapLock);
+        Report(L"Visual Leak Detector detected %zu memory leak", leaks_count);
+        Report((leaks_count > 1) ? L"s (%zu bytes).\n" : L" (%zu bytes).\n", g_tracker->curAlloc() - reachableBytes);
+        Report(L"Largest number used: %zu bytes.\n", g_tracker->maxAlloc());
+        Report(L"Total allocations: %zu bytes.\n", g_tracker->totalAlloc());
+    }
+    if (g_config.internalStats) {
+        ReportInternalStats();
+    }
+    Report(L"Visual Leak Detector is now exiting.\n");
+
+    // Blocks freed from now on, by the destructors of the libraries loaded
+    // before this one, are not tracked anymore.
+    __atomic_store_n(&g_state, PRELOAD_STOPPED, __ATOMIC_RELEASE);
+    if (g_reportFile != NULL) {
+        SetReportFile(NULL, TRUE, FALSE);
+        fclose(g_reportFile);
+        g_reportFile = NULL;
+    }
+    t_hookDepth--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The C Library's Heap Functions
+//
+//   These replace the functions of the C library for the whole process, as
+//   libvld_preload.so is searched for symbols before any other library.
+//
+
+// malloc - Calls to malloc are patched through to this function. This
+//   function invokes the real malloc and then calls VLD's allocation tracking
+//   function.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns the value returned by the C library's malloc.
+//
+extern "C" VLD_EXPORT void* malloc (size_t size) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)malloc, context_);
+    void* block = __libc_malloc(size);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// calloc - Calls to calloc are patched through to this function. This
+//   function invokes the real calloc and then calls VLD's allocation tracking
+//   function.
+//
+//  - count (IN): The number of elements to allocate.
+//
+//  - size (IN): The size, in bytes, of each element.
+//
+//  Return Value:
+//
+//    Returns the value returned by the C library's calloc.
+//
+extern "C" VLD_EXPORT void* calloc (size_t count, size_t size) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)calloc, context_);
+    void* block = __libc_calloc(count, size);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, count * size);
+    return block;
+}
+
+// realloc - Calls to realloc are patched through to this function. This
+//   function invokes the real realloc and then calls VLD's reallocation
+//   tracking function. A NULL block is allocated, and a zero size frees the
+//   block, as the C library does.
+//
+//  - mem (IN): Pointer to the memory block to be reallocated.
+//
+//  - size (IN): The size, in bytes, of the memory block to reallocate.
+//
+//  Return Value:
+//
+//    Returns the value returned by the C library's realloc.
+//
+extern "C" VLD_EXPORT void* realloc (void *mem, size_t size) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)realloc, context_);
+    if (!hc.IsFirst())
+        return __libc_realloc(mem, size);
+
+    if (mem == NULL) {
+        void* block = __libc_malloc(size);
+        hc.Set(block, NULL, size);
+        return block;
+    }
+    if (size == 0) {
+        UnmapBlock(hc, mem);
+        return __libc_realloc(mem, size);
+    }
+
+    // Another thread may get the old address back from malloc as soon as
+    // the block is moved, so its record must not be in the maps anymore.
+    hc.Detach(mem);
+    void* block = __libc_realloc(mem, size);
+    if (block != NULL)
+        hc.Set(mem, block, size);
+    return block;
+}
+
+// free - Calls to free are patched through to this function. This function
+//   calls VLD's free tracking function and then invokes the real free.
+//
+//  - mem (IN): Pointer to the memory block to be freed.
+//
+//  Return Value:
+//
+//    None.
+//
+extern "C" VLD_EXPORT void free (void *mem) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)free, context_);
+    UnmapBlock(hc, mem);
+    __libc_free(mem);
+}
+
+// memalign - Calls to memalign are patched through to this function. This
+//   function invokes the real memalign and then calls VLD's allocation
+//   tracking function.
+//
+//  - alignment (IN): The alignment of the block, a power of two.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns the value returned by the C library's memalign.
+//
+extern "C" VLD_EXPORT void* memalign (size_t alignment, size_t size) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)memalign, context_);
+    void* block = __libc_memalign(alignment, size);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// aligned_alloc - Calls to aligned_alloc are patched through to this
+//   function. This function invokes the real memalign and then calls VLD's
+//   allocation tracking function.
+//
+//  - alignment (IN): The alignment of the block, which must be a power of
+//      two.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL with errno set.
+//
+extern "C" VLD_EXPORT void* aligned_alloc (size_t alignment, size_t size) noexcept
+{
+    if ((alignment == 0) || ((alignment & (alignment - 1)) != 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)aligned_alloc, context_);
+    void* block = __libc_memalign(alignment, size);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// posix_memalign - Calls to posix_memalign are patched through to this
+//   function. This function invokes the real memalign and then calls VLD's
+//   allocation tracking function.
+//
+//  - memptr (OUT): Receives the pointer to the allocated block.
+//
+//  - alignment (IN): The alignment of the block, which must be a power of
+//      two and a multiple of the size of a pointer.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns 0 on success, or an error number.
+//
+extern "C" VLD_EXPORT int posix_memalign (void **memptr, size_t alignment, size_t size) noexcept
+{
+    if ((alignment % sizeof(void*) != 0) || ((alignment & (alignment - 1)) != 0) || (alignment == 0))
+        return EINVAL;
+
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)posix_memalign, context_);
+    void* block = __libc_memalign(alignment, size);
+    if (block == NULL)
+        return ENOMEM;
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    *memptr = block;
+    return 0;
+}
+
+// strdup - Calls to strdup are patched through to this function, so that the
+//   copy is attributed to its caller instead of to the C library. This
+//   function allocates the copy with the real malloc and then calls VLD's
+//   allocation tracking function.
+//
+//  - src (IN): The string to duplicate.
+//
+//  Return Value:
+//
+//    Returns a pointer to the copy, or NULL if it couldn't be allocated.
+//
+extern "C" VLD_EXPORT char* strdup (const char *src) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)strdup, context_);
+    size_t size = strlen(src) + 1;
+    char* block = (char*)__libc_malloc(size);
+    if (block == NULL)
+        return NULL;
+    memcpy(block, src, size);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The Global New and Delete Operators
+//
+//   These replace the operators of the C++ runtime. The new operators allocate
+//   from the C library's heap, like the C++ runtime's operators do, so blocks
+//   can be freed with either.
+//
+#undef new  // The operators are defined below.
+
+// AllocateNew - Allocates a block for the new operators, calling the new
+//   handler until the block can be allocated.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  - nothrow (IN): If true, NULL is returned when the block can't be
+//      allocated. Otherwise std::bad_alloc is thrown.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block.
+//
+static void* AllocateNew (size_t size, bool nothrow)
+{
+    for (;;) {
+        void* block = __libc_malloc((size != 0) ? size : 1);
+        if (block != NULL)
+            return block;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL) {
+            if (nothrow)
+                return NULL;
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+// scalar new operator - Calls to the new operator are patched through to this
+//   function. This function allocates the block and then calls VLD's
+//   allocation tracking function.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block.
+//
+VLD_EXPORT void* operator new (size_t size)
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)static_cast<void* (*)(size_t)>(&operator new), context_);
+    void* block = AllocateNew(size, false);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// vector new operator - Calls to the vector new operator are patched through
+//   to this function. This function allocates the block and then calls VLD's
+//   allocation tracking function.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block.
+//
+VLD_EXPORT void* operator new [] (size_t size)
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)static_cast<void* (*)(size_t)>(&operator new []), context_);
+    void* block = AllocateNew(size, false);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// nothrow scalar new operator - Same as the scalar new operator, returning NULL
+//   instead of throwing if the block can't be allocated.
+//
+VLD_EXPORT void* operator new (size_t size, const std::nothrow_t&) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)static_cast<void* (*)(size_t, const std::nothrow_t&)>(&operator new), context_);
+    void* block = AllocateNew(size, true);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// nothrow vector new operator - Same as the vector new operator, returning
+//   NULL instead of throwing if the block can't be allocated.
+//
+VLD_EXPORT void* operator new [] (size_t size, const std::nothrow_t&) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)static_cast<void* (*)(size_t, const std::nothrow_t&)>(&operator new []), context_);
+    void* block = AllocateNew(size, true);
+    if (hc.IsFirst())
+        hc.Set(block, NULL, size);
+    return block;
+}
+
+// scalar delete operator - Calls to the delete operator are patched through
+//   to this function. This function calls VLD's free tracking function and
+//   then frees the block.
+//
+//  - mem (IN): Pointer to the memory block to be freed.
+//
+//  Return Value:
+//
+//    None.
+//
+VLD_EXPORT void operator delete (void *mem) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)static_cast<void (*)(void*)>(&operator delete), context_);
+    UnmapBlock(hc, mem);
+    __libc_free(mem);
+}
+
+// vector delete operator - Calls to the vector delete operator are patched
+//   through to this function. This function calls VLD's free tracking
+//   function and then frees the block.
+//
+//  - mem (IN): Pointer to the memory block to be freed.
+//
+//  Return Value:
+//
+//    None.
+//
+VLD_EXPORT void operator delete [] (void *mem) noexcept
+{
+    CAPTURE_CONTEXT();
+    HookContext hc((void*)static_cast<void (*)(void*)>(&operator delete []), context_);
+    UnmapBlock(hc, mem);
+    __libc_free(mem);
+}
+
+// The other delete operators only differ from these by arguments not needed
+// to free the block.
+VLD_EXPORT void operator delete (void *mem, const std::nothrow_t&) noexcept      { operator delete(mem); }
+VLD_EXPORT void operator delete [] (void *mem, const std::nothrow_t&) noexcept   { operator delete [] (mem); }
+VLD_EXPORT void operator delete (void *mem, size_t) noexcept                     { operator delete(mem); }
+VLD_EXPORT void operator delete [] (void *mem, size_t) noexcept                  { operator delete [] (mem); }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The Dynamic Loader's Functions
+//
+//   Unloading modules is followed by a refresh of the module table, like
+//   LdrUnloadDll is in vld.dll. Loading them isn't hooked (see CheckModules).
+//
+
+// dlclose - Calls to dlclose are patched through to this function. This
+//   function invokes the real dlclose and then refreshes the module table,
+//   resolving the call stacks going through the modules unloaded. Until the
+//   table is refreshed, every hook checks the modules itself: another thread
+//   may load a module at the addresses of an unloaded one in the meantime.
+//
+//  - handle (IN): The module to unload.
+//
+//  Return Value:
+//
+//    Returns the value returned by the real dlclose.
+//
+extern "C" VLD_EXPORT int dlclose (void *handle) noexcept
+{
+    static dlclose_t realDlclose = NULL;
+    if (realDlclose == NULL) {
+        // dlsym allocates.
+        t_hookDepth++;
+        realDlclose = (dlclose_t)dlsym(RTLD_NEXT, "dlclose");
+        t_hookDepth--;
+    }
+
+    __atomic_add_fetch(&g_unloading, 1, __ATOMIC_ACQ_REL);
+    int result = realDlclose(handle);
+    if (__atomic_load_n(&g_state, __ATOMIC_ACQUIRE) == PRELOAD_RUNNING) {
+        t_hookDepth++;
+        CheckModules();
+        t_hookDepth--;
+    }
+    __atomic_sub_fetch(&g_unloading, 1, __ATOMIC_RELEASE);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The Thread Functions
+//
+//   Renaming a thread makes every thread match its name against the capture
+//   rules again, as the thread renamed may be another one.
+//
+
+// pthread_setname_np - Calls to pthread_setname_np are patched through to
+//   this function. This function invokes the real pthread_setname_np and then
+//   invalidates the thread names the capture rules were matched against.
+//
+//  - thread (IN): The thread to rename.
+//
+//  - name (IN): The new name of the thread.
+//
+//  Return Value:
+//
+//    Returns the value returned by the real pthread_setname_np.
+//
+extern "C" VLD_EXPORT int pthread_setname_np (pthread_t thread, const char *name) noexcept
+{
+    static pthread_setname_np_t realSetname = NULL;
+    if (realSetname == NULL) {
+        t_hookDepth++;
+        realSetname = (pthread_setname_np_t)dlsym(RTLD_NEXT, "pthread_setname_np");
+        t_hookDepth--;
+    }
+
+    int result = realSetname(thread, name);
+    if ((result == 0) && (g_policy != NULL)) {
+        g_policy->threadNamesChanged();
+    }
+    return result;
+}
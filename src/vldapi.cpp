@@ -147,6 +147,26 @@ __declspec(dllexport) int VLDResolveCallstacks()
     return g_vld.ResolveCallstacks();
 }
 
+__declspec(dllexport) UINT VLDGetLifetimeHistograms(VLD_LIFETIME_HISTOGRAM *histograms, UINT count)
+{
+    return g_vld.GetLifetimeHistograms(histograms, count);
+}
+
+__declspec(dllexport) UINT VLDReportLifetimeHistograms()
+{
+    return g_vld.ReportLifetimeHistograms();
+}
+
+__declspec(dllexport) UINT VLDGetInternalStats(VLD_INTERNAL_STAT *stats, UINT count)
+{
+    return g_vld.GetInternalStats(stats, count);
+}
+
+__declspec(dllexport) UINT VLDReportInternalStats()
+{
+    return g_vld.ReportInternalStats();
+}
+
 /// Internal function for tests. Not safe to use because Vld own returned string
 __declspec(dllexport) const wchar_t* VldInternalGetAllocationCallstack(void* alloc, BOOL showInternalFrames)
 {
@@ -0,0 +1,382 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Configuration Loader
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define VLDBUILD         // Declares that we are building Visual Leak Detector.
+#include "vldconfig.h"   // Provides the configuration structure and parser.
+#include <cstddef>
+#include <cstdlib>
+#include <cwchar>
+#include <cwctype>
+
+namespace {
+
+enum optiontype_e {
+    option_bool,
+    option_uint,
+    option_string
+};
+
+struct optiondesc_t
+{
+    const wchar_t *name;    // Option name, as written in vld.ini.
+    optiontype_e   type;    // How the value is converted.
+    size_t         offset;  // Offset of the field within vldconfig_t.
+    size_t         size;    // Size of string fields, in characters.
+};
+
+#define BOOL_OPTION(name, field)   { name, option_bool,   offsetof(vldconfig_t, field), 0 }
+#define UINT_OPTION(name, field)   { name, option_uint,   offsetof(vldconfig_t, field), 0 }
+#define STRING_OPTION(name, field) { name, option_string, offsetof(vldconfig_t, field), \
+                                     sizeof(((vldconfig_t*)0)->field) / sizeof(wchar_t) }
+
+const optiondesc_t s_options [] = {
+    BOOL_OPTION(L"VLD",                     vld),
+    BOOL_OPTION(L"AggregateDuplicates",     aggregateDuplicates),
+    BOOL_OPTION(L"SelfTest",                selfTest),
+    BOOL_OPTION(L"SlowDebuggerDump",        slowDebuggerDump),
+    BOOL_OPTION(L"StartDisabled",           startDisabled),
+    BOOL_OPTION(L"TraceInternalFrames",     traceInternalFrames),
+    BOOL_OPTION(L"SkipHeapFreeLeaks",       skipHeapFreeLeaks),
+    BOOL_OPTION(L"SkipCrtStartupLeaks",     skipCrtStartupLeaks),
+    BOOL_OPTION(L"ValidateHeapAllocs",      validateHeapAllocs),
+    BOOL_OPTION(L"LifetimeHistograms",      lifetimeHistograms),
+    BOOL_OPTION(L"ReachabilityScan",        reachabilityScan),
+    BOOL_OPTION(L"InternalStats",           internalStats),
+    UINT_OPTION(L"MaxDataDump",             maxDataDump),
+    UINT_OPTION(L"MaxTraceFrames",          maxTraceFrames),
+    UINT_OPTION(L"LeakSuspectWindow",       leakSuspectWindow),
+    STRING_OPTION(L"ForceIncludeModules",   forceIncludeModules),
+    STRING_OPTION(L"ReportFile",            reportFile),
+    STRING_OPTION(L"ReportTo",              reportTo),
+    STRING_OPTION(L"ReportEncoding",        reportEncoding),
+    STRING_OPTION(L"StackWalkMethod",       stackWalkMethod),
+    STRING_OPTION(L"OverrideFile",          overrideFile),
+    STRING_OPTION(L"CrtStartupFunctions",   crtStartupFunctions),
+    STRING_OPTION(L"InternalSourceFiles",   internalSourceFiles),
+    STRING_OPTION(L"CaptureRules",          captureRules),
+};
+
+// Case-insensitively compares a counted string with a null-terminated one.
+bool equalsNoCase (const wchar_t *s, size_t length, const wchar_t *literal)
+{
+    size_t i = 0;
+    for (; i < length; i++) {
+        if ((literal[i] == L'\0') || (towlower(s[i]) != towlower(literal[i])))
+            return false;
+    }
+    return (literal[i] == L'\0');
+}
+
+bool isBlank (wchar_t c)
+{
+    return (c == L' ') || (c == L'\t');
+}
+
+// Removes leading and trailing blanks from the range [*begin, *end).
+void trim (const wchar_t **begin, const wchar_t **end)
+{
+    while ((*begin < *end) && isBlank(**begin))
+        (*begin)++;
+    while ((*end > *begin) && isBlank(*(*end - 1)))
+        (*end)--;
+}
+
+void applyCallback (const wchar_t *name, size_t namelength, const wchar_t *value, size_t valuelength, void *context)
+{
+    SetConfigOption(*static_cast<vldconfig_t*>(context), name, namelength, value, valuelength);
+}
+
+} // namespace
+
+// ConfigStrToBool - Converts string values (e.g. "yes", "no", "on", "off") to
+//   boolean values. Same rules as StrToBool, but for counted strings.
+//
+//  - s (IN): String value to convert. Need not be null-terminated.
+//
+//  - length (IN): Length of the string, in characters.
+//
+//  Return Value:
+//
+//    Returns true if the string is recognized as a "true" string. Otherwise
+//    returns false.
+//
+bool ConfigStrToBool (const wchar_t *s, size_t length)
+{
+    if (equalsNoCase(s, length, L"true") ||
+        equalsNoCase(s, length, L"yes") ||
+        equalsNoCase(s, length, L"on")) {
+        return true;
+    }
+
+    // Anything that parses as the integer 1 (e.g. "1", "01", "1 ") is true.
+    wchar_t number [16] = {0};
+    if (length >= sizeof(number) / sizeof(wchar_t))
+        return false;
+    wmemcpy(number, s, length);
+    wchar_t *end;
+    return (wcstol(number, &end, 10) == 1);
+}
+
+// InitConfig - Resets the configuration to VLD's built-in defaults.
+//
+//  - config (OUT): Configuration to initialize.
+//
+//  - maxdatadump (IN): Default value for MaxDataDump.
+//
+//  - maxtraceframes (IN): Default value for MaxTraceFrames.
+//
+//  Return Value:
+//
+//    None.
+//
+void InitConfig (vldconfig_t &config, unsigned maxdatadump, unsigned maxtraceframes)
+{
+    config.vld                 = true;
+    config.aggregateDuplicates = false;
+    config.selfTest            = false;
+    config.slowDebuggerDump    = false;
+    config.startDisabled       = false;
+    config.traceInternalFrames = false;
+    config.skipHeapFreeLeaks   = false;
+    config.skipCrtStartupLeaks = true;
+    config.validateHeapAllocs  = false;
+    config.lifetimeHistograms  = false;
+    config.reachabilityScan    = false;
+    config.internalStats       = false;
+    config.maxDataDump         = maxdatadump;
+    config.maxTraceFrames      = maxtraceframes;
+    config.leakSuspectWindow   = 0;
+    config.forceIncludeModules[0] = L'\0';
+    config.reportFile[0]       = L'\0';
+    config.reportTo[0]         = L'\0';
+    config.reportEncoding[0]   = L'\0';
+    config.stackWalkMethod[0]  = L'\0';
+    config.overrideFile[0]     = L'\0';
+    config.crtStartupFunctions[0] = L'\0';
+    config.internalSourceFiles[0] = L'\0';
+    config.captureRules[0]     = L'\0';
+}
+
+// ParseIniText - Parses the text of an ini file in a single pass, invoking the
+//   callback for every "name = value" pair found in the given section. Section
+//   and option names are case-insensitive. Leading and trailing blanks are
+//   removed from names and values, and values enclosed in matching quotes are
+//   unquoted, as GetPrivateProfileString does. Lines starting with ';' are
+//   comments.
+//
+//  - text (IN): The ini file contents. Need not be null-terminated.
+//
+//  - length (IN): Length of the text, in characters.
+//
+//  - section (IN): Name of the section whose values are wanted.
+//
+//  - callback (IN): Function invoked for each value in the section.
+//
+//  - context (IN): Passed through to the callback.
+//
+//  Return Value:
+//
+//    Returns the number of values passed to the callback.
+//
+size_t ParseIniText (const wchar_t *text, size_t length, const wchar_t *section,
+    IniValueCallback callback, void *context)
+{
+    const wchar_t *end = text + length;
+    const wchar_t *line = text;
+    bool insection = false;
+    size_t count = 0;
+
+    while (line < end) {
+        const wchar_t *lineend = line;
+        while ((lineend < end) && (*lineend != L'\r') && (*lineend != L'\n') && (*lineend != L'\0'))
+            lineend++;
+
+        const wchar_t *begin = line;
+        const wchar_t *finish = lineend;
+        trim(&begin, &finish);
+
+        if ((begin < finish) && (*begin == L'[')) {
+            // Section header.
+            const wchar_t *name = begin + 1;
+            const wchar_t *nameend = name;
+            while ((nameend < finish) && (*nameend != L']'))
+                nameend++;
+            trim(&name, &nameend);
+            insection = equalsNoCase(name, nameend - name, section);
+        }
+        else if (insection && (begin < finish) && (*begin != L';')) {
+            const wchar_t *equals = begin;
+            while ((equals < finish) && (*equals != L'='))
+                equals++;
+            if (equals < finish) {
+                const wchar_t *name = begin;
+                const wchar_t *nameend = equals;
+                const wchar_t *value = equals + 1;
+                const wchar_t *valueend = finish;
+                trim(&name, &nameend);
+                trim(&value, &valueend);
+                if ((valueend - value >= 2) && ((*value == L'"') || (*value == L'\'')) &&
+                    (*(valueend - 1) == *value)) {
+                    value++;
+                    valueend--;
+                }
+                if (nameend > name) {
+                    callback(name, nameend - name, value, valueend - value, context);
+                    count++;
+                }
+            }
+        }
+
+        // Skip the line terminator; "\r\n" counts as one.
+        line = lineend;
+        if ((line < end) && (*line == L'\r'))
+            line++;
+        if ((line < end) && (*line == L'\n'))
+            line++;
+        if ((line < end) && (*line == L'\0'))
+            break;
+    }
+
+    return count;
+}
+
+// SetConfigOption - Stores a single option value into the configuration,
+//   converting it to the option's type. An empty value leaves numeric options
+//   at their current value, like GetPrivateProfileInt does.
+//
+//  - config (IN/OUT): Configuration to update.
+//
+//  - name (IN): Option name (case-insensitive). Need not be null-terminated.
+//
+//  - namelength (IN): Length of the option name, in characters.
+//
+//  - value (IN): Option value. Need not be null-terminated.
+//
+//  - valuelength (IN): Length of the value, in characters.
+//
+//  Return Value:
+//
+//    Returns true if the option name is recognized. Otherwise returns false.
+//
+bool SetConfigOption (vldconfig_t &config, const wchar_t *name, size_t namelength,
+    const wchar_t *value, size_t valuelength)
+{
+    for (size_t i = 0; i < sizeof(s_options) / sizeof(s_options[0]); i++) {
+        const optiondesc_t &option = s_options[i];
+        if (!equalsNoCase(name, namelength, option.name))
+            continue;
+
+        char *field = reinterpret_cast<char*>(&config) + option.offset;
+        switch (option.type) {
+        case option_bool:
+            *reinterpret_cast<bool*>(field) = ConfigStrToBool(value, valuelength);
+            break;
+
+        case option_uint:
+            if (valuelength > 0) {
+                wchar_t number [16] = {0};
+                size_t copy = (valuelength < 15) ? valuelength : 15;
+                wmemcpy(number, value, copy);
+                wchar_t *end;
+                *reinterpret_cast<unsigned*>(field) = static_cast<unsigned>(wcstol(number, &end, 10));
+            }
+            break;
+
+        case option_string: {
+            wchar_t *string = reinterpret_cast<wchar_t*>(field);
+            size_t copy = (valuelength < option.size - 1) ? valuelength : option.size - 1;
+            wmemcpy(string, value, copy);
+            string[copy] = L'\0';
+            break;
+        }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// ApplyConfigText - Layers the [Options] section of an ini file on top of the
+//   current configuration. Options not mentioned in the text keep their value.
+//
+//  - config (IN/OUT): Configuration to update.
+//
+//  - text (IN): The ini file contents. Need not be null-terminated.
+//
+//  - length (IN): Length of the text, in characters.
+//
+//  Return Value:
+//
+//    Returns the number of values found in the [Options] section.
+//
+size_t ApplyConfigText (vldconfig_t &config, const wchar_t *text, size_t length)
+{
+    return ParseIniText(text, length, VLD_CONFIG_SECTION, applyCallback, &config);
+}
+
+// ApplyConfigEnvironment - Layers the Vld<Option> environment variables on top
+//   of the current configuration. The master switch is read from the "VLD"
+//   variable. Empty variables are ignored, as GetEnvironmentVariable reports
+//   them as missing.
+//
+//  - config (IN/OUT): Configuration to update.
+//
+//  - environment (IN): Environment block, as returned by
+//      GetEnvironmentStrings: "name=value" strings, each null-terminated,
+//      followed by an extra null terminator.
+//
+//  Return Value:
+//
+//    Returns the number of options taken from the environment.
+//
+size_t ApplyConfigEnvironment (vldconfig_t &config, const wchar_t *environment)
+{
+    const size_t prefixlength = wcslen(VLD_CONFIG_ENV_PREFIX);
+    size_t count = 0;
+
+    if (environment == NULL)
+        return 0;
+
+    for (const wchar_t *entry = environment; *entry != L'\0'; entry += wcslen(entry) + 1) {
+        // Entries such as "=C:=C:\" describe per-drive directories; skip them.
+        const wchar_t *equals = (*entry == L'=') ? NULL : wcschr(entry, L'=');
+        if ((equals == NULL) || (equals[1] == L'\0'))
+            continue;
+        size_t namelength = equals - entry;
+        if ((namelength < prefixlength) || !equalsNoCase(entry, prefixlength, VLD_CONFIG_ENV_PREFIX))
+            continue;
+
+        const wchar_t *value = equals + 1;
+        const wchar_t *name = entry + prefixlength;
+        namelength -= prefixlength;
+        if (namelength == 0) {
+            // The bare "VLD" variable is the master switch.
+            name = L"VLD";
+            namelength = 3;
+        }
+        if (SetConfigOption(config, name, namelength, value, wcslen(value)))
+            count++;
+    }
+
+    return count;
+}
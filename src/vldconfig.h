@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Configuration Loader Definitions
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+    "This header should only be included by Visual Leak Detector when building it from source. \
+    Applications should never include this header."
+#endif
+
+// This header and vldconfig.cpp deliberately depend on nothing but the C/C++
+// standard library, so that the parser can be unit tested on any platform.
+// Reading files and the environment block is left to the caller.
+#include <cstddef>
+
+#define VLD_CONFIG_SECTION          L"Options"  // The only ini section VLD reads options from.
+#define VLD_CONFIG_ENV_PREFIX       L"Vld"      // Environment variables overriding options are named Vld<Option>.
+#define VLD_CONFIG_MAX_VALUE        64          // Maximum length, in characters, of short string options.
+#define VLD_CONFIG_MAX_MODULE_LIST  512         // Must match MAXMODULELISTLENGTH.
+#define VLD_CONFIG_MAX_PATH         260         // Must match MAX_PATH.
+#define VLD_CONFIG_MAX_LAYERS       4           // Maximum number of chained override files.
+#define VLD_CONFIG_MAX_FILE_SIZE    0x100000    // Configuration files larger than this (1 MB) are ignored.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The vldconfig_t Structure
+//
+//    Holds every option VLD understands, already converted to its final type.
+//    The structure is filled once by layering the sources on top of the
+//    defaults set by InitConfig: the main vld.ini, then any override files, and
+//    finally the Vld<Option> environment variables. VisualLeakDetector::configure
+//    translates it into the option flags used at runtime.
+//
+struct vldconfig_t
+{
+    bool     vld;                   // VLD: Master switch. If false, VLD is turned off.
+    bool     aggregateDuplicates;   // AggregateDuplicates
+    bool     selfTest;              // SelfTest
+    bool     slowDebuggerDump;      // SlowDebuggerDump
+    bool     startDisabled;         // StartDisabled
+    bool     traceInternalFrames;   // TraceInternalFrames
+    bool     skipHeapFreeLeaks;     // SkipHeapFreeLeaks
+    bool     skipCrtStartupLeaks;   // SkipCrtStartupLeaks
+    bool     validateHeapAllocs;    // ValidateHeapAllocs
+    bool     lifetimeHistograms;    // LifetimeHistograms
+    bool     reachabilityScan;      // ReachabilityScan
+    bool     internalStats;         // InternalStats
+    unsigned maxDataDump;           // MaxDataDump
+    unsigned maxTraceFrames;        // MaxTraceFrames
+    unsigned leakSuspectWindow;     // LeakSuspectWindow
+    wchar_t  forceIncludeModules [VLD_CONFIG_MAX_MODULE_LIST]; // ForceIncludeModules
+    wchar_t  reportFile [VLD_CONFIG_MAX_PATH];                 // ReportFile
+    wchar_t  reportTo [VLD_CONFIG_MAX_VALUE];                  // ReportTo
+    wchar_t  reportEncoding [VLD_CONFIG_MAX_VALUE];            // ReportEncoding
+    wchar_t  stackWalkMethod [VLD_CONFIG_MAX_VALUE];           // StackWalkMethod
+    wchar_t  overrideFile [VLD_CONFIG_MAX_PATH];               // OverrideFile: Next configuration layer, if any.
+    wchar_t  crtStartupFunctions [VLD_CONFIG_MAX_MODULE_LIST]; // CrtStartupFunctions: Patterns added to the built-in ones.
+    wchar_t  internalSourceFiles [VLD_CONFIG_MAX_MODULE_LIST]; // InternalSourceFiles: Patterns added to the built-in ones.
+    wchar_t  captureRules [VLD_CONFIG_MAX_MODULE_LIST];        // CaptureRules: See CapturePolicy::compile.
+};
+
+// Called by ParseIniText for every "name = value" pair found in the requested
+// section. Neither string is null-terminated.
+typedef void (*IniValueCallback)(const wchar_t *name, size_t namelength,
+    const wchar_t *value, size_t valuelength, void *context);
+
+// Configuration functions. See function definitions for details.
+bool   ConfigStrToBool (const wchar_t *s, size_t length);
+void   InitConfig (vldconfig_t &config, unsigned maxdatadump, unsigned maxtraceframes);
+size_t ParseIniText (const wchar_t *text, size_t length, const wchar_t *section,
+    IniValueCallback callback, void *context);
+bool   SetConfigOption (vldconfig_t &config, const wchar_t *name, size_t namelength,
+    const wchar_t *value, size_t valuelength);
+size_t ApplyConfigText (vldconfig_t &config, const wchar_t *text, size_t length);
+size_t ApplyConfigEnvironment (vldconfig_t &config, const wchar_t *environment);
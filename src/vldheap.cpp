@@ -30,14 +30,32 @@
 #undef new           // Do not map "new" to VLD's new operator in this file
 
 // Global variables.
-vldblockheader_t *g_vldBlockList = NULL; // List of internally allocated blocks on VLD's private heap.
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+vldblocklist_t    g_vldBlockLists [VLD_BLOCK_LISTS]; // Lists of internally allocated blocks on VLD's private heap.
+#endif
+volatile LONG     g_vldBlockCount = 0;   // Number of internally allocated blocks on VLD's private heap.
 HANDLE            g_vldHeap;             // VLD's private heap.
-CriticalSection   g_vldHeapLock;         // Serializes access to VLD's private heap.
 
 // Local helper functions.
 static inline void* vldnew (size_t size, const char *file, int line);
 static inline void vlddelete (void *block);
 
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+// getblocklist - Selects the list an internally allocated block is linked into.
+//
+//  - header (IN): Header of the block.
+//
+//  Return Value:
+//
+//    Returns the block's list.
+//
+static inline vldblocklist_t* getBlockList (const vldblockheader_t *header)
+{
+    // Skip the low bits, which alignment makes the same for most blocks.
+    return &g_vldBlockLists[((UINT_PTR)header >> 4) % VLD_BLOCK_LISTS];
+}
+#endif // VLD_TRACK_INTERNAL_BLOCKS
+
 // scalar new operator - New operator used to allocate a scalar memory block
 //   from VLD's private heap.
 //
@@ -133,11 +151,12 @@ void operator delete [] (void *block, const char *, int)
 }
 
 // vldnew - Local helper function that actually allocates memory from VLD's
-//   private heap. Prepends a header, which is used for bookkeeping information
-//   that allows VLD to detect and report internal memory leaks, to the returned
-//   block, but the header is transparent to the caller because the returned
-//   pointer points to the usable section of memory requested by the caller, it
-//   does not point to the block header.
+//   private heap. In builds tracking internal blocks, prepends a header, which
+//   is used for bookkeeping information that allows VLD to detect and report
+//   internal memory leaks, to the returned block, but the header is
+//   transparent to the caller because the returned pointer points to the
+//   usable section of memory requested by the caller, it does not point to the
+//   block header. Other builds only count the block.
 //
 //  - size (IN): Size of the memory block to be allocated.
 //
@@ -152,31 +171,44 @@ void operator delete [] (void *block, const char *, int)
 //
 void* vldnew (size_t size, const char *file, int line)
 {
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
     vldblockheader_t *header = (vldblockheader_t*)RtlAllocateHeap(g_vldHeap, 0x0, size + sizeof(vldblockheader_t));
-    static SIZE_T     serialnumber = 0;
+    static volatile LONG serialnumber = 0;
 
     if (header == NULL) {
         // Out of memory.
         return NULL;
     }
+    InterlockedIncrement(&g_vldBlockCount);
 
     // Fill in the block's header information.
     header->file         = file;
     header->line         = line;
-    header->serialNumber = serialnumber++;
+    header->serialNumber = (SIZE_T)(InterlockedIncrement(&serialnumber) - 1);
     header->size         = size;
 
-    // Link the block into the block list.
-    CriticalSectionLocker<> cs(g_vldHeapLock);
-    header->next         = g_vldBlockList;
+    // Link the block into its block list.
+    vldblocklist_t   *list = getBlockList(header);
+    CriticalSectionLocker<> cs(list->lock);
+    header->next         = list->head;
     if (header->next != NULL) {
         header->next->prev = header;
     }
     header->prev         = NULL;
-    g_vldBlockList       = header;
+    list->head           = header;
 
     // Return a pointer to the beginning of the data section of the block.
     return (void*)VLDBLOCKDATA(header);
+#else
+    UNREFERENCED_PARAMETER(file);
+    UNREFERENCED_PARAMETER(line);
+
+    LPVOID block = RtlAllocateHeap(g_vldHeap, 0x0, size);
+    if (block != NULL) {
+        InterlockedIncrement(&g_vldBlockCount);
+    }
+    return block;
+#endif // VLD_TRACK_INTERNAL_BLOCKS
 }
 
 // vlddelete - Local helper function that actually frees memory back to VLD's
@@ -194,22 +226,29 @@ void vlddelete (void *block)
         return;
 
     BOOL              freed;
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
     vldblockheader_t *header = VLDBLOCKHEADER((LPVOID)block);
 
-    // Unlink the block from the block list.
-    CriticalSectionLocker<> cs(g_vldHeapLock);
-    if (header->prev) {
-        header->prev->next = header->next;
-    }
-    else {
-        g_vldBlockList = header->next;
-    }
-
-    if (header->next) {
-        header->next->prev = header->prev;
+    // Unlink the block from its block list.
+    vldblocklist_t   *list = getBlockList(header);
+    {
+        CriticalSectionLocker<> cs(list->lock);
+        if (header->prev) {
+            header->prev->next = header->next;
+        }
+        else {
+            list->head = header->next;
+        }
+
+        if (header->next) {
+            header->next->prev = header->prev;
+        }
     }
+    block = header;
+#endif // VLD_TRACK_INTERNAL_BLOCKS
 
     // Free the block.
-    freed = RtlFreeHeap(g_vldHeap, 0x0, header);
+    InterlockedDecrement(&g_vldBlockCount);
+    freed = RtlFreeHeap(g_vldHeap, 0x0, block);
     assert(freed);
 }
@@ -29,10 +29,20 @@
 Applications should never include this header."
 #endif
 
-#include <windows.h>
+#include "platform.h"
+#include "criticalsection.h"
 
 #define GAPSIZE 4
 
+#if defined(_WIN32)
+// Only debug builds of VLD give internally allocated blocks a header and link
+// them into lists, so that checkInternalMemoryLeaks can tell where a leaked
+// block was allocated. Release builds allocate blocks as they are and only
+// count them, so that internal allocations take no lock of VLD's own.
+#if defined(_DEBUG) && !defined(VLD_TRACK_INTERNAL_BLOCKS)
+#define VLD_TRACK_INTERNAL_BLOCKS
+#endif
+
 // Memory block header structure used internally by the debug CRT. All blocks
 // allocated by the CRT are allocated from the CRT heap and, in debug mode, they
 // have this header pretended to them (there's also a trailer appended at the
@@ -85,6 +95,9 @@ typedef char checkDebugHeapBlockSize[
 #define CRT_USE_TYPE(use) (use & 0xFFFF)
 #define _BLOCK_TYPE_IS_VALID(use) (_BLOCK_TYPE(use) == _CLIENT_BLOCK || (use) == _NORMAL_BLOCK || _BLOCK_TYPE(use) == _CRT_BLOCK || (use) == _IGNORE_BLOCK)
 
+#ifdef VLD_TRACK_INTERNAL_BLOCKS
+#define VLD_BLOCK_LISTS 16 // Number of lists internally allocated blocks are spread over.
+
 // Memory block header structure used internally by VLD. All internally
 // allocated blocks are allocated from VLD's private heap and have this header
 // pretended to them.
@@ -98,15 +111,30 @@ struct vldblockheader_t
     size_t                   serialNumber;  // Each block is assigned a unique serial number, starting from zero.
 };
 
+// Internally allocated blocks are spread over several lists, chosen by the
+// address of the block, so that threads allocating at the same time rarely
+// wait for each other.
+struct vldblocklist_t
+{
+    CriticalSection          lock;          // Serializes access to the list.
+    struct vldblockheader_t *head;          // Most recently allocated block of the list.
+};
+
 // Data-to-Header and Header-to-Data conversion
 #define VLDBLOCKHEADER(d) (vldblockheader_t*)(((PBYTE)d) - sizeof(vldblockheader_t))
 #define VLDBLOCKDATA(h) (LPVOID)(((PBYTE)h) + sizeof(vldblockheader_t))
+#endif // VLD_TRACK_INTERNAL_BLOCKS
 #define CRTDBGBLOCKHEADER(d) (crtdbgblockheader_t*)(((PBYTE)d) - sizeof(crtdbgblockheader_t))
 #define CRTDBGBLOCKDATA(h) (LPVOID)(((PBYTE)h) + sizeof(crtdbgblockheader_t))
+#endif // _WIN32
 
-// new and delete operators for allocating from VLD's private heap.
+// new and delete operators for allocating from VLD's private heap. Elsewhere
+// than on Windows, the private heap is the C runtime's heap (see
+// vldheap_posix.cpp), and blocks are freed by the standard delete operators.
+#if defined(_WIN32)
 void operator delete (void *block);
 void operator delete [] (void *block);
+#endif // _WIN32
 void operator delete (void *block, const char *file, int line);
 void operator delete [] (void *block, const char *file, int line);
 void* operator new (size_t size, const char *file, int line);
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Internal Heap (POSIX)
+//  Copyright (c) 2005-2014 VLD Team
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// The internal heap on platforms other than Windows, where the Windows version
+// in vldheap.cpp can't be built.
+#include <cstdlib>
+
+#if defined(__GLIBC__)
+// The internal heap is the C library's heap, reached without going through
+// malloc and free: those are replaced by VLD's own when it is preloaded (see
+// vld_preload.cpp), and VLD's blocks must never be tracked.
+extern "C" void* __libc_malloc (size_t size);
+extern "C" void  __libc_free (void *block);
+#define vld_malloc  __libc_malloc
+#define vld_free    __libc_free
+#else
+#define vld_malloc  malloc
+#define vld_free    free
+#endif
+
+#define VLDBUILD     // Declares that we are building Visual Leak Detector.
+#include "vldheap.h" // Provides access to VLD's internal heap data structures.
+#undef new           // Do not map "new" to VLD's new operator in this file
+
+// scalar new operator - New operator used to allocate a scalar memory block
+//   from VLD's private heap. The C runtime's heap serves as the private heap,
+//   so that the blocks can be freed by the standard delete operator, which
+//   the preload library forwards straight to the C runtime for VLD's blocks.
+//
+//  - size (IN): Size of the memory block to be allocated.
+//
+//  - file (IN): The name of the file from which this function is being
+//      called (ignored).
+//
+//  - line (IN): The line number, in the above file, at which this function is
+//      being called (ignored).
+//
+//  Return Value:
+//
+//    If the allocation succeeds, a pointer to the allocated memory block is
+//    returned. If the allocation fails, NULL is returned.
+//
+void* operator new (size_t size, const char *, int)
+{
+    return vld_malloc((size != 0) ? size : 1);
+}
+
+// vector new operator - New operator used to allocate a vector memory block
+//   from VLD's private heap.
+//
+//  - size (IN): Size of the memory block to be allocated.
+//
+//  - file (IN): The name of the file from which this function is being
+//      called (ignored).
+//
+//  - line (IN): The line number, in the above file, at which this function is
+//      being called (ignored).
+//
+//  Return Value:
+//
+//    If the allocation succeeds, a pointer to the allocated memory block is
+//    returned. If the allocation fails, NULL is returned.
+//
+void* operator new [] (size_t size, const char *, int)
+{
+    return vld_malloc((size != 0) ? size : 1);
+}
+
+// scalar delete operator - Delete operator used to free memory partially
+//   allocated by new in the event that the corresponding new operator throws
+//   an exception.
+//
+//  Note: This version of the delete operator should never be called directly.
+//    The compiler automatically generates calls to this function as needed.
+//
+void operator delete (void *block, const char *, int)
+{
+    vld_free(block);
+}
+
+// vector delete operator - Delete operator used to free memory partially
+//   allocated by new in the event that the corresponding new operator throws
+//   an exception.
+//
+//  Note: This version of the delete operator should never be called directly.
+//    The compiler automatically generates calls to this function as needed.
+//
+void operator delete [] (void *block, const char *, int)
+{
+    vld_free(block);
+}
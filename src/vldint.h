@@ -34,11 +34,14 @@
 #undef new
 #include <string>
 #include <memory>
+#include <vector>
 #pragma pop_macro("new")
 #include <windows.h>
 #include "vld_def.h"
 #include "version.h"
+#include "blocktracker.h" // Provides the records of the live blocks.
 #include "callstack.h"  // Provides a custom class for handling call stacks.
+#include "capturepolicy.h"   // Provides the capture rules.
 #include "map.h"        // Provides a custom STL-like map template.
 #include "ntapi.h"      // Provides access to NT APIs.
 #include "set.h"        // Provides a custom STL-like set template.
@@ -67,6 +70,7 @@ typedef HANDLE(__stdcall *HeapCreate_t) (DWORD, SIZE_T, SIZE_T);
 typedef BOOL(__stdcall *HeapFree_t) (HANDLE, DWORD, LPVOID);
 typedef FARPROC(__stdcall *GetProcAddress_t) (HMODULE, LPCSTR);
 typedef FARPROC(__stdcall *GetProcAddressForCaller_t) (HMODULE, LPCSTR, LPVOID);
+typedef HRESULT(__stdcall *GetThreadDescription_t) (HANDLE, PWSTR *);
 
 typedef void* (__cdecl *_calloc_dbg_t) (size_t, size_t, int, const char*, int);
 typedef void* (__cdecl *_malloc_dbg_t) (size_t, int, const char *, int);
@@ -99,33 +103,6 @@ typedef void* (__cdecl *_aligned_offset_realloc_dbg_t) (void *, size_t, size_t,
 typedef void* (__cdecl *_aligned_recalloc_dbg_t) (void *, size_t, size_t, size_t, int, const char *, int);
 typedef void* (__cdecl *_aligned_offset_recalloc_dbg_t) (void *, size_t, size_t, size_t, size_t, int, const char *, int);
 
-// Data is collected for every block allocated from any heap in the process.
-// The data is stored in this structure and these structures are stored in
-// a BlockMap which maps each of these structures to its corresponding memory
-// block.
-struct blockinfo_t {
-    std::unique_ptr<CallStack> callStack;
-    DWORD      threadId;
-    SIZE_T     serialNumber;
-    SIZE_T     size;
-    bool       reported;
-    bool       debugCrtAlloc;
-    bool       ucrt;
-};
-
-// BlockMaps map memory blocks (via their addresses) to blockinfo_t structures.
-typedef Map<LPCVOID, blockinfo_t*> BlockMap;
-
-// Information about each heap in the process is kept in this map. Primarily
-// this is used for mapping heaps to all of the blocks allocated from those
-// heaps.
-struct heapinfo_t {
-    BlockMap blockMap;   // Map of all blocks allocated from this heap.
-    UINT32   flags;      // Heap status flags
-};
-
-// HeapMaps map heaps (via their handles) to BlockMaps.
-typedef Map<HANDLE, heapinfo_t*> HeapMap;
 typedef std::basic_string<wchar_t, std::char_traits<wchar_t>, vldallocator<wchar_t> > vldstring;
 
 // This structure stores information, primarily the virtual address range, about
@@ -146,7 +123,7 @@ struct moduleinfo_t {
     SIZE_T addrHigh;                 // Highest address within the module's virtual address space (i.e. base + size).
     UINT32 flags;                    // Module flags:
 #define VLD_MODULE_EXCLUDED      0x1 //   If set, this module is excluded from leak detection.
-#define VLD_MODULE_SYMBOLSLOADED 0x2 //   If set, this module's debug symbols have been loaded.
+    UINT32 policyRow;                // Row of the module in the decision table of the capture rules.
     vldstring name;                  // The module's name (e.g. "kernel32.dll").
     vldstring path;                  // The fully qualified path from where the module was loaded.
 };
@@ -154,6 +131,24 @@ struct moduleinfo_t {
 // ModuleSets store information about modules loaded in the process.
 typedef Set<moduleinfo_t> ModuleSet;
 
+// Identity of a module whose symbols may be needed for a leak report. This is
+// all VLD records when a module is loaded; the symbols themselves are only
+// loaded, by loadSymbols, once a call stack actually needs to be resolved. The
+// identity is kept after the module is unloaded, so that the symbols can still
+// be loaded from the module's file for leaks allocated while it was loaded.
+struct symbolmodule_t {
+    vldstring path;                  // The fully qualified path from where the module was loaded.
+    DWORD64   base;                  // The base address at which the module was loaded.
+    DWORD     size;                  // The size, in bytes, of the loaded module image.
+    DWORD     timestamp;             // The link time stamp of the loaded image, to detect a changed file.
+    bool      excluded;              // If true, the module is excluded from leak detection.
+    bool      pending;               // If true, the module's symbols haven't been loaded yet.
+};
+
+// SymbolModuleMaps map module base addresses to the identity of the module most
+// recently loaded at that address.
+typedef Map<UINT_PTR, symbolmodule_t*> SymbolModuleMap;
+
 typedef Set<VLD_REPORT_HOOK> ReportHookSet;
 
 // Thread local storage structure. Every thread in the process gets its own copy
@@ -173,11 +168,27 @@ struct tls_t {
     LPVOID      blockWithoutGuard; // Store pointer to block.
     LPVOID      newBlockWithoutGuard;
     SIZE_T      size;
+    detachedblock_t detached;     // Record of the block being reallocated, if it is tracked (see BlockTracker::detachBlock).
+    capturethread_t capture;      // State of the capture rules kept by the thread.
+#if defined(_M_X64)
+    unwindcache_t* unwindCache;   // Function table cache used by the safe stack walk. Allocated on first use.
+#endif
+};
+
+// Startup profile. Records, in microseconds, how long each phase of the
+// VisualLeakDetector constructor took. Every process loading VLD pays this cost
+// while blocked in DLL initialization, so it is worth keeping an eye on.
+struct startupprofile_t {
+    ULONGLONG   configure;        // Locating and reading vld.ini, override files and the environment.
+    ULONGLONG   symbols;          // Initializing the symbol handler, if it is needed right away.
+    ULONGLONG   attach;           // Enumerating and patching the loaded modules.
+    ULONGLONG   total;            // The whole constructor.
 };
 
 // Allocation state:
 // 1. Allocation function set tls->context and tls->blockWithoutGuard = NULL
 // 2. HeapAlloc set tls->heap, tls->blockWithoutGuard, tls->newBlockWithoutGuard and tls->size
+//    (HeapReAlloc first detaches the record of the block into tls->detached)
 // 3. Allocation function reset tls data, map block and capture callstack to tls->blockWithoutGuard
 
 // The TlsSet allows VLD to keep track of all thread local storage structures
@@ -188,6 +199,7 @@ class CaptureContext {
 public:
     CaptureContext(void* func, context_t& context, BOOL debug = FALSE, BOOL ucrt = FALSE);
     ~CaptureContext();
+    void Detach(HANDLE heap, LPVOID mem);
     void Set(HANDLE heap, LPVOID mem, LPVOID newmem, SIZE_T size);
 private:
     // Disallow certain operations
@@ -195,7 +207,8 @@ private:
     CaptureContext(const CaptureContext&);
     CaptureContext& operator=(const CaptureContext&);
 private:
-    BOOL IsExcludedModule();
+    BOOL IsCaptured(UINT32 row, UINT32 &maxframes);
+    BOOL IsExcludedModule(UINT32 &policyrow);
     void Reset();
 private:
     tls_t *m_tls;
@@ -275,6 +288,10 @@ public:
     VOID SetModulesList(CONST WCHAR *modules, BOOL includeModules);
     bool GetModulesList(WCHAR *modules, UINT size);
     int ResolveCallstacks();
+    UINT32 GetLifetimeHistograms(VLD_LIFETIME_HISTOGRAM *histograms, UINT32 count);
+    UINT32 ReportLifetimeHistograms();
+    UINT32 GetInternalStats(VLD_INTERNAL_STAT *stats, UINT32 count);
+    UINT32 ReportInternalStats();
     const wchar_t* GetAllocationResolveResults(void* alloc, BOOL showInternalFrames);
 
     static NTSTATUS __stdcall _LdrLoadDll (LPWSTR searchpath, PULONG flags, unicodestring_t *modulename,
@@ -295,36 +312,44 @@ private:
     // Private leak detection functions - see each function definition for details.
     ////////////////////////////////////////////////////////////////////////////////
     VOID   attachToLoadedModules (ModuleSet *newmodules);
+    VOID   checkLeakSuspects ();
     UINT32 getModuleState(ModuleSet::Iterator& it, UINT32 &moduleFlags);
     LPWSTR buildSymbolSearchPath();
+    symbolmodule_t* recordSymbolModule (const moduleinfo_t &moduleinfo, CriticalSectionLocker<DbgHelp>& locker);
+    VOID   loadSymbols ();
+    VOID   loadSymbols (CriticalSectionLocker<DbgHelp>& locker);
+    VOID   loadModuleSymbols (const symbolmodule_t &module, CriticalSectionLocker<DbgHelp>& locker);
     BOOL GetIniFilePath(LPTSTR lpPath, SIZE_T cchPath);
     VOID   configure ();
     BOOL   enabled ();
-    SIZE_T eraseDuplicates (const BlockMap::Iterator &element, Set<blockinfo_t*> &aggregatedLeak);
+    SIZE_T classifyLeaks (LeakSnapshot &snapshot, SIZE_T &reachablebytes);
+    SIZE_T countLeaks (LeakSnapshot &snapshot, bool aggregate);
     tls_t* getTls ();
+    VOID   readThreadName (tls_t* tls);
     VOID   mapBlock (HANDLE heap, LPCVOID mem, SIZE_T size, bool crtalloc, bool ucrt, DWORD threadId, blockinfo_t* &pblockInfo);
     VOID   mapHeap (HANDLE heap);
     VOID   remapBlock (HANDLE heap, LPCVOID mem, LPCVOID newmem, SIZE_T size,
-        bool crtalloc, bool ucrt, DWORD threadId, blockinfo_t* &pblockInfo, const context_t &context);
+        bool crtalloc, bool ucrt, DWORD threadId, detachedblock_t &detached, blockinfo_t* &pblockInfo);
     VOID   reportConfig ();
     static bool   isDebugCrtAlloc(LPCVOID block, blockinfo_t* info);
     SIZE_T reportHeapLeaks (HANDLE heap);
     static int    getCrtBlockUse (LPCVOID block, bool ucrt);
     static size_t getCrtBlockSize(LPCVOID block, bool ucrt);
-    SIZE_T getLeaksCount (heapinfo_t* heapinfo, DWORD threadId = (DWORD)-1);
-    SIZE_T reportLeaks(heapinfo_t* heapinfo, bool &firstLeak, Set<blockinfo_t*> &aggregatedLeaks, DWORD threadId = (DWORD)-1);
-    VOID   markAllLeaksAsReported (heapinfo_t* heapinfo, DWORD threadId = (DWORD)-1);
+    SIZE_T reportLeaks (LeakSnapshot &snapshot, bool &firstLeak, bool classify);
+    VOID   reportLifetimes (LPCWSTR unit, const UINT64* buckets, UINT64 frees);
     VOID   unmapBlock (HANDLE heap, LPCVOID mem, const context_t &context);
     VOID   unmapHeap (HANDLE heap);
-    int    resolveStacks(heapinfo_t* heapinfo);
+    int    resolveStacks (LeakSnapshot &snapshot);
+    VOID   takeSnapshot (LeakSnapshot &snapshot, HANDLE heap, DWORD threadId, bool copydata);
 
     // Static functions (callbacks)
     static BOOL __stdcall addLoadedModule (PCWSTR modulepath, DWORD64 modulebase, ULONG modulesize, PVOID context);
+    static bool snapshotBlock (leakentry_t &leak, blockinfo_t* info, void *context);
     static BOOL __stdcall detachFromModule (PCWSTR modulepath, DWORD64 modulebase, ULONG modulesize, PVOID context);
+    static DWORD __stdcall suspectThreadProc (LPVOID param);
 
     // Utils
-    static bool isModuleExcluded (UINT_PTR returnaddress);
-    blockinfo_t* findAllocedBlock(LPCVOID, __out HANDLE& heap);
+    static bool isModuleExcluded (UINT_PTR returnaddress, UINT32 &policyrow);
     blockinfo_t* getAllocationBlockInfo(void* alloc);
     void setupReporting();
     void checkInternalMemoryLeaks();
@@ -362,16 +387,28 @@ private:
     // Private data
     ////////////////////////////////////////////////////////////////////////////////
     WCHAR                m_forcedModuleList [MAXMODULELISTLENGTH]; // List of modules to be forcefully included in leak detection.
-    HeapMap             *m_heapMap;           // Map of all active heaps in the process.
+    WCHAR                m_crtStartupFunctions [MAXMODULELISTLENGTH]; // Patterns of CRT startup functions read from vld.ini.
+    WCHAR                m_internalSourceFiles [MAXMODULELISTLENGTH]; // Patterns of internal source files read from vld.ini.
+    WCHAR                m_captureRules [MAXMODULELISTLENGTH]; // Capture rules read from vld.ini.
+    CapturePolicy       *m_capturePolicy;     // The compiled capture rules, or NULL if there are none.
+    FramePatternSet     *m_crtStartupPatterns;   // Classifies function names as CRT startup code.
+    FramePatternSet     *m_internalFilePatterns; // Classifies source files as internal to the heap.
+    BlockTracker        *m_tracker;           // Records of every live block in the process. Protected by g_heapMapLock.
+    CriticalSection      m_reportLock;        // Keeps concurrent leak reports from interleaving.
     IMalloc             *m_iMalloc;           // Pointer to the system implementation of IMalloc.
 
-    SIZE_T               m_requestCurr;       // Current request number.
-    SIZE_T               m_totalAlloc;        // Grand total - sum of all allocations.
-    SIZE_T               m_curAlloc;          // Total amount currently allocated.
-    SIZE_T               m_maxAlloc;          // Largest ever allocated at once.
     ModuleSet           *m_loadedModules;     // Contains information about all modules loaded in the process.
+    SymbolModuleMap     *m_symbolModules;     // Identity of every module whose symbols may be needed. Protected by the DbgHelp lock.
+    bool                 m_symbolsPending;    // If true, some modules in m_symbolModules haven't had their symbols loaded yet.
+    bool                 m_symbolsInitialized; // If true, the symbol handler has been initialized.
+    FrameTable          *m_frameTable;        // Interned descriptions of every frame of every resolved call stack.
     SIZE_T               m_maxDataDump;       // Maximum number of user-data bytes to dump for each leaked block.
     UINT32               m_maxTraceFrames;    // Maximum number of frames per stack trace for each leaked block.
+    SIZE_T               m_suspectWindow;     // Allocations between two samples of the leak suspect detector, or 0.
+    SIZE_T               m_suspectSampled;    // Last window sampled by the leak suspect detector. Protected by g_heapMapLock.
+    SIZE_T               m_reachableBytes;    // Bytes left out of the last report by the reachability scan. Protected by m_reportLock.
+    HANDLE               m_suspectThread;     // The leak suspect detector thread, or NULL.
+    HANDLE               m_suspectStop;       // Event signaled to stop the leak suspect detector thread.
     CriticalSection      m_modulesLock;       // Protects accesses to the "loaded modules" ModuleSet.
     CriticalSection      m_optionsLock;       // Serializes access to the heap and block maps.
     UINT32               m_options;           // Configuration options.
@@ -395,6 +432,7 @@ private:
     TlsMap              *m_tlsMap;            // Set of all thread-local storage structures for the process.
     HMODULE              m_vldBase;           // Visual Leak Detector's own module handle (base address).
     HMODULE              m_dbghlpBase;
+    startupprofile_t     m_startupProfile;    // Time spent in each phase of the constructor.
 
     VOID __stdcall ChangeModuleState(HMODULE module, bool on);
     static GetProcAddress_t m_GetProcAddress;